@@ -100,6 +100,10 @@ sqlite_freemem
 sqlite_libversion
 sqlite_libencoding
 sqlite_changes
+sqlite_open_vfs
+sqlite_vfs_register
+sqlite_vfs_unregister
+sqlite_vfs_find
 sqliteMalloc
 sqliteFree
 sqliteRealloc
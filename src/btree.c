@@ -52,6 +52,7 @@
 #include "sqliteInt.h"
 #include "pager.h"
 #include "btree.h"
+#include "os.h"
 #include <assert.h>
 
 /*
@@ -65,6 +66,7 @@ typedef struct CellHdr CellHdr;
 typedef struct FreeBlk FreeBlk;
 typedef struct OverflowPage OverflowPage;
 typedef struct FreelistInfo FreelistInfo;
+typedef struct BtShared BtShared;
 
 /*
 ** All structures on a database page are aligned to 4-byte boundries.
@@ -106,6 +108,11 @@ static const char zMagicHeader[] =
 ** The first page also contains SQLITE_N_BTREE_META integers that
 ** can be used by higher-level routines.
 **
+** PageOne.iChange is incremented by every transaction that changes the
+** database.  An online backup uses it to find out whether the database
+** has changed since it started copying.  (See sqliteBtreeBackupStep().)
+** Files written by older versions of the library have a 0 here.
+**
 ** Remember that pages are numbered beginning with 1.  (See pager.c
 ** for additional information.)  Page 0 does not exist and a page
 ** number of 0 is used to mean "no such page".
@@ -116,6 +123,7 @@ struct PageOne {
   Pgno freeList;           /* First free page in a list of all free pages */
   int nFree;               /* Number of pages on the free list */
   int aMeta[SQLITE_N_BTREE_META-1];  /* User defined integers */
+  int iChange;             /* Incremented by each change to the database */
 };
 
 /*
@@ -309,9 +317,36 @@ struct MemPage {
 #define EXTRA_SIZE (sizeof(MemPage)-SQLITE_PAGE_SIZE)
 
 /*
-** Everything we need to know about an open database
+** Everything we need to know about an open database file.
+**
+** When the shared cache is enabled (see sqliteBtreeSharedCache()) all
+** connections in this process that open the same file use a single
+** BtShared and so a single page cache.  Each connection has its own
+** Btree handle that points to the BtShared.  Only one of the handles
+** may hold a write transaction at a time.  That handle is pWriter.
+**
+** A cursor holds a lock on its table in the locks hash for as long as
+** it is open.  The tables that pWriter has changed are also recorded in
+** wrTables until its transaction ends, so that other connections cannot
+** see the uncommitted changes.  A connection that cannot get one of
+** these table locks gets SQLITE_LOCKED.
+**
+** A handle with snapshot reads turned on (see sqliteBtreeReadSnapshot())
+** takes no table locks for its read-only cursors.  They read the pages
+** through a pager snapshot of the last commit instead, so they are not
+** blocked by the writer, and the writer is not blocked by them.
+**
+** The connections that share a BtShared may be used by different
+** threads.  Every sqliteBtree...() entry point that is given a handle or
+** a cursor holds pMutex while it runs, so the page cache, the cursor
+** list and the lock tables are only ever used by one thread at a time.
+** A BtShared that is not shared has no mutex.
+**
+** The statements of connections that share a BtShared may also commit
+** together, as one transaction on disk.  See sqliteBtreeBeginGroup().
+** The statements of the group in progress are listed on pGroup.
 */
-struct Btree {
+struct BtShared {
   Pager *pPager;        /* The page cache */
   BtCursor *pCursor;    /* A list of all open cursors */
   PageOne *page1;       /* First page of the database */
@@ -319,6 +354,37 @@ struct Btree {
   u8 inCkpt;            /* True if there is a checkpoint on the transaction */
   u8 readOnly;          /* True if the underlying file is readonly */
   Hash locks;           /* Key: root page number.  Data: lock count */
+  Btree *pWriter;       /* The handle that holds the transaction, if any */
+  Hash wrTables;        /* Root pages of tables changed by pWriter */
+  int nRef;             /* Number of Btree handles using this object */
+  OsFileKey key;        /* Identifies the file when shared */
+  BtShared *pNext;      /* Next object on the list of shared caches */
+  BtBackup *pBackup;    /* Online backups reading this database */
+  u8 changeCounted;     /* Change counter already incremented */
+  void *pMutex;         /* Serializes the threads that share this object */
+  sqlite_vfs *pVfs;     /* VFS used to sleep while waiting on a group */
+  int msLockTimeout;    /* Longest wait to join a group commit */
+  int nGroupMax;        /* Most statements in a group commit.  <=1 for off */
+  u8 inGroup;           /* The transaction in progress is a group commit */
+  Btree *pGroup;        /* Statements of the group commit in progress */
+  int nGroup;           /* Statements of pGroup waiting for the sync */
+  int nGroupWait;       /* Statements waiting to join the group */
+  int nLastGroup;       /* Statements in the last group that was synced */
+  Btree *pSyncer;       /* Handle that is committing the group, if any */
+};
+
+/*
+** A connection's handle on a database file.
+*/
+struct Btree {
+  BtShared *pBt;        /* The file and its page cache */
+  u8 inTrans;           /* True if this handle holds the transaction */
+  u8 readSnapshot;      /* Read-only cursors read the last commit */
+  PgSnapshot *pSnap;    /* Snapshot read by the open cursors, if any */
+  int nSnapCursor;      /* Number of open cursors that read pSnap */
+  u8 inGroup;           /* A statement of this handle is in a group commit */
+  int rcGroup;          /* How the group commit ended */
+  Btree *pGroupNext;    /* Next statement of the same group commit */
 };
 typedef Btree Bt;
 
@@ -328,7 +394,8 @@ typedef Btree Bt;
 ** MemPage.apCell[] of the entry.
 */
 struct BtCursor {
-  Btree *pBt;               /* The Btree to which this cursor belongs */
+  Btree *pBtree;            /* The handle that opened this cursor */
+  BtShared *pBt;            /* The BtShared to which this cursor belongs */
   BtCursor *pNext, *pPrev;  /* Forms a linked list of all cursors */
   Pgno pgnoRoot;            /* The root page of this tree */
   MemPage *pPage;           /* Page that contains the entry */
@@ -336,6 +403,7 @@ struct BtCursor {
   u8 wrFlag;                /* True if writable */
   u8 bSkipNext;             /* sqliteBtreeNext() is no-op if true */
   u8 iMatch;                /* compare result from last sqliteBtreeMoveto() */
+  PgSnapshot *pSnap;        /* Read pages through this snapshot if not NULL */
 };
 
 /*
@@ -595,6 +663,65 @@ static void pageDestructor(void *pData){
   }
 }
 
+/*
+** When this is true, sqliteBtreeOpen() shares a single BtShared, and so
+** a single page cache, among all connections in this process that open
+** the same file.
+*/
+static int sharedCacheEnabled = 0;
+
+/*
+** A list of all BtShared objects that may be shared.  Use of the list
+** is serialized by sqliteOsEnterMutex().
+*/
+static BtShared *pSharedList = 0;
+
+/*
+** Take and release the mutex of a BtShared.  The mutex is recursive,
+** so an entry point may call another.
+*/
+static void btreeEnter(BtShared *pBt){
+  if( pBt->pMutex ) sqliteOsMutexEnter(pBt->pMutex);
+}
+static void btreeLeave(BtShared *pBt){
+  if( pBt->pMutex ) sqliteOsMutexLeave(pBt->pMutex);
+}
+
+/*
+** Turn the shared cache on or off.  Only databases that are opened
+** afterwards are affected.
+*/
+void sqliteBtreeSharedCache(int enable){
+  sharedCacheEnabled = enable;
+}
+
+/*
+** Look for a BtShared on the shared list whose file has the key given.
+** If there is one, take a reference to it and return it.  Otherwise
+** return NULL.  The caller must hold sqliteOsEnterMutex().
+*/
+static BtShared *findSharedBtree(OsFileKey *pKey){
+  BtShared *pBt;
+  for(pBt=pSharedList; pBt; pBt=pBt->pNext){
+    if( memcmp(&pBt->key, pKey, sizeof(*pKey))==0 ){
+      pBt->nRef++;
+      break;
+    }
+  }
+  return pBt;
+}
+
+/*
+** Free a BtShared that no handle uses any more.
+*/
+static void freeBtShared(BtShared *pBt){
+  sqlitepager_close(pBt->pPager);
+  sqliteHashClear(&pBt->locks);
+  sqliteHashClear(&pBt->wrTables);
+  sqliteOsMutexFree(pBt->pMutex);
+  sqliteFree(pBt);
+}
+
 /*
 ** Open a new database.
 **
@@ -605,48 +732,129 @@ static void pageDestructor(void *pData){
 ** zFilename is the name of the database file.  If zFilename is NULL
 ** a new database with a random name is created.  This randomly named
 ** database file will be deleted when sqliteBtreeClose() is called.
+** If zFilename is ":memory:" the database is kept in memory only and
+** is never shared.
+**
+** If the shared cache is on and another connection in this process
+** already has the same file open through the same VFS, the new handle
+** uses the BtShared of that connection.  Files are matched by the
+** device and inode numbers that the OS layer uses for locking, not by
+** name.  nCache is ignored in that case.  The two connections may then
+** be used by different threads.
 */
 int sqliteBtreeOpen(
   const char *zFilename,    /* Name of the file containing the BTree database */
   int mode,                 /* Not currently used */
   int nCache,               /* How many pages in the page cache */
+  sqlite_vfs *pVfs,         /* Do all I/O through this VFS.  NULL for default */
   Btree **ppBtree           /* Pointer to new Btree object written here */
 ){
-  Btree *pBt;
+  Btree *p;
+  BtShared *pBt = 0;
+  OsFileKey key;
+  int isShared;
   int rc;
 
-  pBt = sqliteMalloc( sizeof(*pBt) );
-  if( pBt==0 ){
-    *ppBtree = 0;
+  *ppBtree = 0;
+  p = sqliteMalloc( sizeof(*p) );
+  if( p==0 ){
     return SQLITE_NOMEM;
   }
-  if( nCache<10 ) nCache = 10;
-  rc = sqlitepager_open(&pBt->pPager, zFilename, nCache, EXTRA_SIZE);
-  if( rc!=SQLITE_OK ){
-    if( pBt->pPager ) sqlitepager_close(pBt->pPager);
-    sqliteFree(pBt);
-    *ppBtree = 0;
-    return rc;
+  if( pVfs==0 ) pVfs = sqlite_vfs_find(0);
+  isShared = sharedCacheEnabled && zFilename!=0
+                && strcmp(zFilename, ":memory:")!=0;
+  if( isShared && sqliteOsFileKey(pVfs, zFilename, &key)==SQLITE_OK ){
+    sqliteOsEnterMutex();
+    pBt = findSharedBtree(&key);
+    sqliteOsLeaveMutex();
   }
-  sqlitepager_set_destructor(pBt->pPager, pageDestructor);
-  pBt->pCursor = 0;
-  pBt->page1 = 0;
-  pBt->readOnly = sqlitepager_isreadonly(pBt->pPager);
-  sqliteHashInit(&pBt->locks, SQLITE_HASH_INT, 0);
-  *ppBtree = pBt;
+  if( pBt==0 ){
+    pBt = sqliteMalloc( sizeof(*pBt) );
+    if( pBt==0 ){
+      sqliteFree(p);
+      return SQLITE_NOMEM;
+    }
+    if( nCache<10 ) nCache = 10;
+    rc = sqlitepager_open(&pBt->pPager, zFilename, nCache, EXTRA_SIZE, pVfs);
+    if( rc!=SQLITE_OK ){
+      if( pBt->pPager ) sqlitepager_close(pBt->pPager);
+      sqliteFree(pBt);
+      sqliteFree(p);
+      return rc;
+    }
+    sqlitepager_set_destructor(pBt->pPager, pageDestructor);
+    pBt->pCursor = 0;
+    pBt->page1 = 0;
+    pBt->readOnly = sqlitepager_isreadonly(pBt->pPager);
+    pBt->pVfs = pVfs;
+    sqliteHashInit(&pBt->locks, SQLITE_HASH_INT, 0);
+    sqliteHashInit(&pBt->wrTables, SQLITE_HASH_INT, 0);
+    pBt->nRef = 1;
+
+    /* The file may not have existed until the pager opened it, so the
+    ** key is looked up again before the new BtShared is published.  If
+    ** another thread has published one for the same file in the meantime,
+    ** that one is used and the new one is thrown away.
+    */
+    if( isShared && sqliteOsFileKey(pVfs, zFilename, &pBt->key)==SQLITE_OK ){
+      BtShared *pOther;
+      rc = sqliteOsMutexAlloc(&pBt->pMutex);
+      if( rc!=SQLITE_OK ){
+        freeBtShared(pBt);
+        sqliteFree(p);
+        return rc;
+      }
+      sqliteOsEnterMutex();
+      pOther = findSharedBtree(&pBt->key);
+      if( pOther==0 ){
+        pBt->pNext = pSharedList;
+        pSharedList = pBt;
+      }
+      sqliteOsLeaveMutex();
+      if( pOther ){
+        freeBtShared(pBt);
+        pBt = pOther;
+      }
+    }
+  }
+  p->pBt = pBt;
+  *ppBtree = p;
   return SQLITE_OK;
 }
 
 /*
-** Close an open database and invalidate all cursors.
+** Close an open database and invalidate all cursors.  The file and
+** its page cache are closed when the last handle on them is closed.
 */
-int sqliteBtreeClose(Btree *pBt){
-  while( pBt->pCursor ){
-    sqliteBtreeCloseCursor(pBt->pCursor);
+int sqliteBtreeClose(Btree *p){
+  BtShared *pBt = p->pBt;
+  BtCursor *pCur, *pNext;
+  BtShared **pp;
+  int nRef;
+
+  btreeEnter(pBt);
+  for(pCur=pBt->pCursor; pCur; pCur=pNext){
+    pNext = pCur->pNext;
+    if( pCur->pBtree==p ) sqliteBtreeCloseCursor(pCur);
+  }
+  sqliteBtreeRollback(p);
+  sqliteBtreeReadSnapshot(p, 0);
+  btreeLeave(pBt);
+  sqliteOsEnterMutex();
+  nRef = --pBt->nRef;
+  if( nRef==0 ){
+    for(pp=&pSharedList; *pp; pp=&(*pp)->pNext){
+      if( *pp==pBt ){
+        *pp = pBt->pNext;
+        break;
+      }
+    }
   }
-  sqlitepager_close(pBt->pPager);
-  sqliteHashClear(&pBt->locks);
-  sqliteFree(pBt);
+  sqliteOsLeaveMutex();
+  if( nRef==0 ){
+    freeBtShared(pBt);
+  }
+  sqliteFree(p);
   return SQLITE_OK;
 }
 
@@ -665,11 +873,139 @@ int sqliteBtreeClose(Btree *pBt){
 ** Synchronous is on by default so database corruption is not
 ** normally a worry.
 */
-int sqliteBtreeSetCacheSize(Btree *pBt, int mxPage){
-  sqlitepager_set_cachesize(pBt->pPager, mxPage);
+static int btreeSetCacheSize(Btree *p, int mxPage){
+  sqlitepager_set_cachesize(p->pBt->pPager, mxPage);
   return SQLITE_OK;
 }
 
+int sqliteBtreeSetCacheSize(Btree *p, int mxPage){
+  BtShared *pBt = p->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeSetCacheSize(p, mxPage);
+  btreeLeave(pBt);
+  return rc;
+}
+
+/*
+** Change the way the rollback journal of the database is managed.
+** eMode is one of the PAGER_JOURNALMODE_* values, or negative to leave
+** the mode unchanged.  The journal mode in effect is returned.
+*/
+static int btreeJournalMode(Btree *p, int eMode){
+  return sqlitepager_journal_mode(p->pBt->pPager, eMode);
+}
+
+int sqliteBtreeJournalMode(Btree *p, int eMode){
+  BtShared *pBt = p->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeJournalMode(p, eMode);
+  btreeLeave(pBt);
+  return rc;
+}
+
+/*
+** Change whether the lock on the database file and the page cache are
+** kept from one statement to the next.  eMode is one of the
+** PAGER_LOCKINGMODE_* values, or negative to leave the mode unchanged.
+** The locking mode in effect is returned.
+*/
+static int btreeLockingMode(Btree *p, int eMode){
+  return sqlitepager_locking_mode(p->pBt->pPager, eMode);
+}
+
+int sqliteBtreeLockingMode(Btree *p, int eMode){
+  BtShared *pBt = p->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeLockingMode(p, eMode);
+  btreeLeave(pBt);
+  return rc;
+}
+
+/*
+** Turn snapshot reads on or off for handle p, or leave the setting
+** unchanged if eMode is negative.  Return the setting in effect.
+**
+** While snapshot reads are on, the read-only cursors of this handle
+** see the database as of the last commit, even while another handle
+** on a shared cache is changing it.  All cursors of the handle that
+** are open at the same time see the same commit.  Each transaction on
+** the cache then pays for saving the original content of the pages it
+** changes.
+*/
+static int btreeReadSnapshot(Btree *p, int eMode){
+  if( eMode>=0 && (eMode!=0)!=p->readSnapshot ){
+    p->readSnapshot = eMode!=0;
+    sqlitepager_snapshot_readers(p->pBt->pPager, p->readSnapshot ? 1 : -1);
+  }
+  return p->readSnapshot;
+}
+
+int sqliteBtreeReadSnapshot(Btree *p, int eMode){
+  BtShared *pBt = p->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeReadSnapshot(p, eMode);
+  btreeLeave(pBt);
+  return rc;
+}
+
+/*
+** Change how carefully the database is flushed to disk.  eLevel is one
+** of the PAGER_SYNC_* values, or negative to leave the level unchanged.
+** The safety level in effect is returned.
+*/
+static int btreeSafetyLevel(Btree *p, int eLevel){
+  return sqlitepager_safety_level(p->pBt->pPager, eLevel);
+}
+
+int sqliteBtreeSafetyLevel(Btree *p, int eLevel){
+  BtShared *pBt = p->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeSafetyLevel(p, eLevel);
+  btreeLeave(pBt);
+  return rc;
+}
+
+/*
+** Set how many milliseconds to wait for a lock on the database file
+** before reporting SQLITE_BUSY.
+*/
+static void btreeLockTimeout(Btree *p, int ms){
+  sqlitepager_lock_timeout(p->pBt->pPager, ms);
+  p->pBt->msLockTimeout = ms;
+}
+
+void sqliteBtreeLockTimeout(Btree *p, int ms){
+  BtShared *pBt = p->pBt;
+  btreeEnter(pBt);
+  btreeLockTimeout(p, ms);
+  btreeLeave(pBt);
+}
+
+/*
+** Write into *pnFetch the number of page requests that have been made
+** through this BTree and into *pnMiss the number of those requests
+** that had to go to the disk because the page was not in the cache.
+** This information is used by EXPLAIN ANALYZE.
+*/
+static void btreePageCounts(Btree *p, int *pnFetch, int *pnMiss){
+  int nHit, nMiss;
+  sqlitepager_hitmiss(p->pBt->pPager, &nHit, &nMiss);
+  *pnFetch = nHit + nMiss;
+  *pnMiss = nMiss;
+}
+
+void sqliteBtreePageCounts(Btree *p, int *pnFetch, int *pnMiss){
+  BtShared *pBt = p->pBt;
+  btreeEnter(pBt);
+  btreePageCounts(p, pnFetch, pnMiss);
+  btreeLeave(pBt);
+}
+
 /*
 ** Get a reference to page1 of the database file.  This will
 ** also acquire a readlock on that file.
@@ -680,7 +1016,7 @@ int sqliteBtreeSetCacheSize(Btree *pBt, int mxPage){
 ** is returned if we run out of memory.  SQLITE_PROTOCOL is returned
 ** if there is a locking protocol violation.
 */
-static int lockBtree(Btree *pBt){
+static int lockBtree(BtShared *pBt){
   int rc;
   if( pBt->page1 ) return SQLITE_OK;
   rc = sqlitepager_get(pBt->pPager, 1, (void**)&pBt->page1);
@@ -714,7 +1050,7 @@ page1_init_failed:
 **
 ** If there is a transaction in progress, this routine is a no-op.
 */
-static void unlockBtreeIfUnused(Btree *pBt){
+static void unlockBtreeIfUnused(BtShared *pBt){
   if( pBt->inTrans==0 && pBt->pCursor==0 && pBt->page1!=0 ){
     sqlitepager_unref(pBt->page1);
     pBt->page1 = 0;
@@ -727,7 +1063,7 @@ static void unlockBtreeIfUnused(Btree *pBt){
 ** Create a new database by initializing the first two pages of the
 ** file.
 */
-static int newDatabase(Btree *pBt){
+static int newDatabase(BtShared *pBt){
   MemPage *pRoot;
   PageOne *pP1;
   int rc;
@@ -763,10 +1099,15 @@ static int newDatabase(Btree *pBt){
 **      sqliteBtreeInsert()
 **      sqliteBtreeDelete()
 **      sqliteBtreeUpdateMeta()
+**
+** Only one connection may have a transaction on a shared cache at a
+** time.  SQLITE_LOCKED is returned if another one already has it.
 */
-int sqliteBtreeBeginTrans(Btree *pBt){
+static int btreeBeginTrans(Btree *p){
+  BtShared *pBt = p->pBt;
   int rc;
-  if( pBt->inTrans ) return SQLITE_ERROR;
+  if( p->inTrans ) return SQLITE_ERROR;
+  if( pBt->inTrans ) return SQLITE_LOCKED;
   if( pBt->page1==0 ){
     rc = lockBtree(pBt);
     if( rc!=SQLITE_OK ){
@@ -782,47 +1123,355 @@ int sqliteBtreeBeginTrans(Btree *pBt){
     }
   }
   if( rc==SQLITE_OK ){
+    p->inTrans = 1;
     pBt->inTrans = 1;
     pBt->inCkpt = 0;
+    pBt->pWriter = p;
   }else{
     unlockBtreeIfUnused(pBt);
   }
   return rc;
 }
 
+int sqliteBtreeBeginTrans(Btree *p){
+  BtShared *pBt = p->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeBeginTrans(p);
+  btreeLeave(pBt);
+  return rc;
+}
+
+/*
+** Record that the transaction held by handle p has ended.  The table
+** locks that were held on behalf of the transaction are released.
+*/
+static void endTrans(Btree *p){
+  BtShared *pBt = p->pBt;
+  p->inTrans = 0;
+  pBt->inTrans = 0;
+  pBt->inCkpt = 0;
+  pBt->changeCounted = 0;
+  pBt->pWriter = 0;
+  sqliteHashClear(&pBt->wrTables);
+}
+
+/*
+** Write the transaction in progress to disk.  If the transaction changed
+** the database, the change counter on page 1 is incremented as part of
+** it, once however many times the commit is tried.  Online backups of
+** the database are told which of the pages they have copied were
+** changed.
+**
+** If SQLITE_BUSY is returned, because other connections are still
+** reading the database, the transaction is still open and the commit
+** can be tried again.  On any other error it has been rolled back.
+*/
+static void backupMarkChanges(BtShared*);
+static void backupCommitted(BtShared*, int);
+static int commitTrans(BtShared *pBt){
+  int rc = SQLITE_OK;
+  if( !pBt->readOnly ){
+    int iOld = pBt->page1->iChange;
+    if( sqlitepager_isdirty(pBt->pPager) && !pBt->changeCounted ){
+      rc = sqlitepager_write(pBt->page1);
+      if( rc==SQLITE_OK ){
+        pBt->page1->iChange++;
+        pBt->changeCounted = 1;
+      }
+    }
+    if( pBt->changeCounted ){
+      iOld = pBt->page1->iChange - 1;
+      if( pBt->pBackup ) backupMarkChanges(pBt);
+    }
+    if( rc==SQLITE_OK ){
+      rc = sqlitepager_commit(pBt->pPager);
+      if( rc==SQLITE_BUSY ) return rc;
+      if( rc==SQLITE_OK && pBt->changeCounted && pBt->pBackup ){
+        backupCommitted(pBt, iOld);
+      }
+    }else{
+      sqlitepager_rollback(pBt->pPager);
+    }
+  }
+  return rc;
+}
+
+/*
+** Group commit.  When the "group_commit" pragma sets nGroupMax to more
+** than 1 on a shared cache, the statements that connections sharing the
+** cache run outside of BEGIN...COMMIT are gathered into groups.  The
+** statements of a group make up one transaction on disk, so the journal
+** and the database file are synced once for the whole group instead of
+** once for each statement.
+**
+** The first statement of a group starts the transaction.  The others
+** join it one at a time, once the statement before them is done.  Each
+** statement runs under a checkpoint, so a statement that fails is undone
+** without disturbing the rest of the group.  A statement that is done
+** waits in sqliteBtreeCommit() until the group has been synced, and only
+** then returns, with the result of the sync.  A statement is therefore
+** never reported as committed before it is on disk.
+**
+** The group is synced by one of its waiting statements as soon as no
+** statement of the group is running and either the group is full, or
+** it is as large as the last group and no other statement is waiting to
+** join it, or the statement has waited for GROUP_COMMIT_WINDOW
+** milliseconds.  So a connection that is used alone never waits, and
+** the lock on the file is never held while the group is idle.
+**
+** Statements can only join a group when the cache is shared, because
+** a write lock on the database file is held by only one pager at a time.
+** Connections that do not share a cache, in this process or another,
+** commit alone as before.
+*/
+#ifndef GROUP_COMMIT_WINDOW
+# define GROUP_COMMIT_WINDOW 10
+#endif
+
+/*
+** Set the largest number of statements in a group commit, or leave it
+** unchanged if nMax is negative.  Return the setting in effect.
+*/
+static int btreeGroupCommit(Btree *p, int nMax){
+  if( nMax>=0 ) p->pBt->nGroupMax = nMax;
+  return p->pBt->nGroupMax;
+}
+
+int sqliteBtreeGroupCommit(Btree *p, int nMax){
+  BtShared *pBt = p->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeGroupCommit(p, nMax);
+  btreeLeave(pBt);
+  return rc;
+}
+
+/*
+** Let the other threads sharing pBt run for a millisecond or so.  Return
+** the number of milliseconds slept.
+*/
+static int groupSleep(BtShared *pBt){
+  int ms;
+  btreeLeave(pBt);
+  ms = sqliteOsSleep(pBt->pVfs, 1);
+  btreeEnter(pBt);
+  return ms>0 ? ms : 1;
+}
+
+/*
+** Start the transaction of a statement that runs outside of
+** BEGIN...COMMIT.  If group commit is on, the statement joins the group
+** in progress, or starts a new one, and runs under a checkpoint.  It
+** waits while another statement of the group is running, but for no
+** longer than the lock timeout.  SQLITE_LOCKED is returned if it cannot
+** join in that time, or if a transaction that is not a group is in
+** progress.
+**
+** If group commit is off this is the same as sqliteBtreeBeginTrans().
+*/
+static int btreeRollback(Btree*);
+static int btreeBeginGroup(Btree *p){
+  BtShared *pBt = p->pBt;
+  int nWait = 0;
+  int rc;
+  if( pBt->pMutex==0 || pBt->nGroupMax<=1 || p->inTrans ){
+    return btreeBeginTrans(p);
+  }
+  while( pBt->inGroup && (pBt->pWriter || pBt->pSyncer
+                           || pBt->nGroup>=pBt->nGroupMax) ){
+    if( nWait>=pBt->msLockTimeout ) return SQLITE_LOCKED;
+    pBt->nGroupWait++;
+    nWait += groupSleep(pBt);
+    pBt->nGroupWait--;
+  }
+  if( pBt->inGroup ){
+    p->inTrans = 1;
+    pBt->pWriter = p;
+  }else{
+    rc = btreeBeginTrans(p);
+    if( rc!=SQLITE_OK ) return rc;
+    pBt->inGroup = 1;
+  }
+  p->inGroup = 1;
+  p->pGroupNext = pBt->pGroup;
+  pBt->pGroup = p;
+  rc = pBt->readOnly ? SQLITE_OK : sqlitepager_ckpt_begin(pBt->pPager);
+  if( rc!=SQLITE_OK ){
+    btreeRollback(p);
+    return rc;
+  }
+  pBt->inCkpt = 1;
+  return SQLITE_OK;
+}
+
+int sqliteBtreeBeginGroup(Btree *p){
+  BtShared *pBt = p->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeBeginGroup(p);
+  btreeLeave(pBt);
+  return rc;
+}
+
+/*
+** End the group commit in progress.  Every statement of the group is
+** told that the group ended with result rc.  p is the handle that ends
+** it.
+*/
+static void endGroup(Btree *p, int rc){
+  BtShared *pBt = p->pBt;
+  Btree *pMember;
+  for(pMember=pBt->pGroup; pMember; pMember=pMember->pGroupNext){
+    pMember->inGroup = 0;
+    pMember->inTrans = 0;
+    pMember->rcGroup = rc;
+  }
+  if( rc==SQLITE_OK ) pBt->nLastGroup = pBt->nGroup;
+  pBt->inGroup = 0;
+  pBt->pGroup = 0;
+  pBt->nGroup = 0;
+  pBt->pSyncer = 0;
+  endTrans(p);
+  unlockBtreeIfUnused(pBt);
+}
+
+/*
+** Commit the statement of handle p, which is part of a group commit.
+** The checkpoint of the statement is committed, and then the statement
+** waits until the group is synced, by this statement or another one.
+**
+** If the sync fails with SQLITE_BUSY the group is still open, this
+** statement is the one to sync it, and the commit can be tried again.
+** It can also be rolled back, which rolls back the whole group.
+*/
+static int groupCommit(Btree *p){
+  BtShared *pBt = p->pBt;
+  int nWait = 0;
+  int rc;
+  if( p->inTrans ){
+    if( pBt->inCkpt && !pBt->readOnly ){
+      rc = sqlitepager_ckpt_commit(pBt->pPager);
+      if( rc!=SQLITE_OK ) return rc;
+    }
+    pBt->inCkpt = 0;
+    p->inTrans = 0;
+    pBt->pWriter = 0;
+    pBt->nGroup++;
+  }
+  while( p->inGroup && pBt->pSyncer!=p ){
+    if( pBt->pSyncer==0 && pBt->pWriter==0
+     && (pBt->nGroup>=pBt->nGroupMax || nWait>=GROUP_COMMIT_WINDOW
+          || (pBt->nGroupWait==0 && pBt->nGroup>=pBt->nLastGroup)) ){
+      pBt->pSyncer = p;
+      break;
+    }
+    nWait += groupSleep(pBt);
+  }
+  if( !p->inGroup ) return p->rcGroup;
+  rc = commitTrans(pBt);
+  if( rc!=SQLITE_BUSY ) endGroup(p, rc);
+  return rc;
+}
+
+/*
+** Roll back the statement of handle p, which is part of a group commit.
+** Only the checkpoint of the statement is rolled back, unless it is the
+** last statement of the group or the group could not be synced.  Then
+** the whole transaction is rolled back.
+*/
+static int groupRollback(Btree *p){
+  BtShared *pBt = p->pBt;
+  Btree **pp;
+  BtCursor *pCur;
+  int rc = SQLITE_OK;
+  if( pBt->pSyncer!=p && !p->inTrans ) return SQLITE_OK;
+  for(pCur=pBt->pCursor; pCur; pCur=pCur->pNext){
+    if( pCur->pPage && (pCur->pBtree==p
+                          || (pBt->pSyncer==p && pCur->pBtree->inGroup)) ){
+      sqlitepager_unref(pCur->pPage);
+      pCur->pPage = 0;
+    }
+  }
+  if( pBt->pSyncer==p ){
+    if( !pBt->readOnly ) rc = sqlitepager_rollback(pBt->pPager);
+    endGroup(p, SQLITE_BUSY);
+    return rc;
+  }
+  if( pBt->inCkpt && !pBt->readOnly ){
+    rc = sqlitepager_ckpt_rollback(pBt->pPager);
+  }
+  pBt->inCkpt = 0;
+  for(pp=&pBt->pGroup; *pp!=p; pp=&(*pp)->pGroupNext){}
+  *pp = p->pGroupNext;
+  p->inGroup = 0;
+  p->inTrans = 0;
+  pBt->pWriter = 0;
+  if( pBt->pGroup==0 ){
+    if( !pBt->readOnly ) rc = sqlitepager_rollback(pBt->pPager);
+    pBt->inGroup = 0;
+    endTrans(p);
+    unlockBtreeIfUnused(pBt);
+  }
+  return rc;
+}
+
 /*
 ** Commit the transaction currently in progress.
 **
 ** This will release the write lock on the database file.  If there
 ** are no active cursors, it also releases the read lock.
+**
+** If SQLITE_BUSY is returned, because other connections are still
+** reading the database, the transaction is still open and the commit
+** can be tried again.  It can also be rolled back.
+**
+** A statement that is part of a group commit returns once the whole
+** group has been synced.
 */
-int sqliteBtreeCommit(Btree *pBt){
+static int btreeCommit(Btree *p){
+  BtShared *pBt = p->pBt;
   int rc;
-  if( pBt->inTrans==0 ) return SQLITE_ERROR;
-  rc = pBt->readOnly ? SQLITE_OK : sqlitepager_commit(pBt->pPager);
-  pBt->inTrans = 0;
-  pBt->inCkpt = 0;
+  if( p->inGroup ) return groupCommit(p);
+  if( p->inTrans==0 ) return SQLITE_ERROR;
+  rc = commitTrans(pBt);
+  if( rc==SQLITE_BUSY ) return rc;
+  endTrans(p);
   unlockBtreeIfUnused(pBt);
   return rc;
 }
 
+int sqliteBtreeCommit(Btree *p){
+  BtShared *pBt = p->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeCommit(p);
+  btreeLeave(pBt);
+  return rc;
+}
+
 /*
-** Rollback the transaction in progress.  All cursors will be
-** invalided by this operation.  Any attempt to use a cursor
+** Rollback the transaction in progress.  All cursors of this handle
+** will be invalided by this operation.  Any attempt to use a cursor
 ** that was open at the beginning of this operation will result
-** in an error.
+** in an error.  Cursors of other handles on a shared cache are left
+** alone, since they cannot be open on a table that was changed.
 **
 ** This will release the write lock on the database file.  If there
 ** are no active cursors, it also releases the read lock.
+**
+** A statement that is part of a group commit only rolls back its own
+** changes.  See groupRollback().
 */
-int sqliteBtreeRollback(Btree *pBt){
+static int btreeRollback(Btree *p){
+  BtShared *pBt = p->pBt;
   int rc;
   BtCursor *pCur;
-  if( pBt->inTrans==0 ) return SQLITE_OK;
-  pBt->inTrans = 0;
-  pBt->inCkpt = 0;
+  if( p->inGroup ) return groupRollback(p);
+  if( p->inTrans==0 ) return SQLITE_OK;
+  endTrans(p);
   for(pCur=pBt->pCursor; pCur; pCur=pCur->pNext){
-    if( pCur->pPage ){
+    if( pCur->pPage && pCur->pBtree==p ){
       sqlitepager_unref(pCur->pPage);
       pCur->pPage = 0;
     }
@@ -832,6 +1481,15 @@ int sqliteBtreeRollback(Btree *pBt){
   return rc;
 }
 
+int sqliteBtreeRollback(Btree *p){
+  BtShared *pBt = p->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeRollback(p);
+  btreeLeave(pBt);
+  return rc;
+}
+
 /*
 ** Set the checkpoint for the current transaction.  The checkpoint serves
 ** as a sub-transaction that can be rolled back independently of the
@@ -842,9 +1500,10 @@ int sqliteBtreeRollback(Btree *pBt){
 ** Only one checkpoint may be active at a time.  It is an error to try
 ** to start a new checkpoint if another checkpoint is already active.
 */
-int sqliteBtreeBeginCkpt(Btree *pBt){
+static int btreeBeginCkpt(Btree *p){
+  BtShared *pBt = p->pBt;
   int rc;
-  if( !pBt->inTrans || pBt->inCkpt ){
+  if( !p->inTrans || pBt->inCkpt ){
     return SQLITE_ERROR;
   }
   rc = pBt->readOnly ? SQLITE_OK : sqlitepager_ckpt_begin(pBt->pPager);
@@ -852,13 +1511,24 @@ int sqliteBtreeBeginCkpt(Btree *pBt){
   return rc;
 }
 
+int sqliteBtreeBeginCkpt(Btree *p){
+  BtShared *pBt = p->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeBeginCkpt(p);
+  btreeLeave(pBt);
+  return rc;
+}
+
 
 /*
 ** Commit a checkpoint to transaction currently in progress.  If no
 ** checkpoint is active, this is a no-op.
 */
-int sqliteBtreeCommitCkpt(Btree *pBt){
+static int btreeCommitCkpt(Btree *p){
+  BtShared *pBt = p->pBt;
   int rc;
+  if( !p->inTrans ) return SQLITE_OK;
   if( pBt->inCkpt && !pBt->readOnly ){
     rc = sqlitepager_ckpt_commit(pBt->pPager);
   }else{
@@ -868,6 +1538,15 @@ int sqliteBtreeCommitCkpt(Btree *pBt){
   return rc;
 }
 
+int sqliteBtreeCommitCkpt(Btree *p){
+  BtShared *pBt = p->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeCommitCkpt(p);
+  btreeLeave(pBt);
+  return rc;
+}
+
 /*
 ** Rollback the checkpoint to the current transaction.  If there
 ** is no active checkpoint or transaction, this routine is a no-op.
@@ -876,12 +1555,13 @@ int sqliteBtreeCommitCkpt(Btree *pBt){
 ** to use a cursor that was open at the beginning of this operation
 ** will result in an error.
 */
-int sqliteBtreeRollbackCkpt(Btree *pBt){
+static int btreeRollbackCkpt(Btree *p){
+  BtShared *pBt = p->pBt;
   int rc;
   BtCursor *pCur;
-  if( pBt->inCkpt==0 || pBt->readOnly ) return SQLITE_OK;
+  if( !p->inTrans || pBt->inCkpt==0 || pBt->readOnly ) return SQLITE_OK;
   for(pCur=pBt->pCursor; pCur; pCur=pCur->pNext){
-    if( pCur->pPage ){
+    if( pCur->pPage && pCur->pBtree==p ){
       sqlitepager_unref(pCur->pPage);
       pCur->pPage = 0;
     }
@@ -891,6 +1571,61 @@ int sqliteBtreeRollbackCkpt(Btree *pBt){
   return rc;
 }
 
+int sqliteBtreeRollbackCkpt(Btree *p){
+  BtShared *pBt = p->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeRollbackCkpt(p);
+  btreeLeave(pBt);
+  return rc;
+}
+
+/*
+** Make cursor pCur read through the snapshot of its handle, taking a new
+** snapshot if the handle has none.  The cursor reads the database
+** normally if no snapshot can be had for the transaction in progress.
+*/
+static int openSnapshot(BtCursor *pCur){
+  Btree *p = pCur->pBtree;
+  int rc;
+  if( p->pSnap==0 ){
+    rc = sqlitepager_snapshot_open(p->pBt->pPager, &p->pSnap);
+    if( rc==SQLITE_LOCKED ) return SQLITE_OK;
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  pCur->pSnap = p->pSnap;
+  p->nSnapCursor++;
+  return SQLITE_OK;
+}
+
+/*
+** Stop cursor pCur from reading through its snapshot.  The snapshot is
+** released when the last cursor of the handle that reads it is done.
+** This must happen before the cursor releases its page, so that the
+** pager does not unlock the database while the snapshot is held.
+*/
+static void closeSnapshot(BtCursor *pCur){
+  Btree *p = pCur->pBtree;
+  if( pCur->pSnap==0 ) return;
+  pCur->pSnap = 0;
+  p->nSnapCursor--;
+  if( p->nSnapCursor==0 ){
+    sqlitepager_snapshot_close(p->pSnap);
+    p->pSnap = 0;
+  }
+}
+
+/*
+** Get page pgno for cursor pCur.  Cursors that read a snapshot get the
+** version of the page in the snapshot.
+*/
+static int getCursorPage(BtCursor *pCur, Pgno pgno, void **ppPage){
+  if( pCur->pSnap ){
+    return sqlitepager_snapshot_get(pCur->pSnap, pgno, ppPage);
+  }
+  return sqlitepager_get(pCur->pBt->pPager, pgno, ppPage);
+}
+
 /*
 ** Create a new cursor for the BTree whose root is on the page
 ** iTable.  The act of acquiring a cursor gets a read lock on 
@@ -903,11 +1638,16 @@ int sqliteBtreeRollbackCkpt(Btree *pBt){
 ** cursors is a read/write cursor.  But there can be two or more
 ** read-only cursors open on the same table.
 **
+** On a shared cache a table that has been changed by the transaction
+** of another connection cannot be read until that transaction ends.
+** SQLITE_LOCKED is returned for such a table.
+**
 ** No checking is done to make sure that page iTable really is the
 ** root page of a b-tree.  If it is not, then the cursor acquired
 ** will not work correctly.
 */
-int sqliteBtreeCursor(Btree *pBt, int iTable, int wrFlag, BtCursor **ppCur){
+static int btreeCursor(Btree *p, int iTable, int wrFlag, BtCursor **ppCur){
+  BtShared *pBt = p->pBt;
   int rc;
   BtCursor *pCur;
   ptr nLock;
@@ -929,7 +1669,15 @@ int sqliteBtreeCursor(Btree *pBt, int iTable, int wrFlag, BtCursor **ppCur){
     goto create_cursor_exception;
   }
   pCur->pgnoRoot = (Pgno)iTable;
-  rc = sqlitepager_get(pBt->pPager, pCur->pgnoRoot, (void**)&pCur->pPage);
+  pCur->pBtree = p;
+  pCur->pBt = pBt;
+  if( !wrFlag && p->readSnapshot && pBt->pWriter!=p ){
+    rc = openSnapshot(pCur);
+    if( rc!=SQLITE_OK ){
+      goto create_cursor_exception;
+    }
+  }
+  rc = getCursorPage(pCur, pCur->pgnoRoot, (void**)&pCur->pPage);
   if( rc!=SQLITE_OK ){
     goto create_cursor_exception;
   }
@@ -937,14 +1685,22 @@ int sqliteBtreeCursor(Btree *pBt, int iTable, int wrFlag, BtCursor **ppCur){
   if( rc!=SQLITE_OK ){
     goto create_cursor_exception;
   }
-  nLock = (ptr)sqliteHashFind(&pBt->locks, 0, iTable);
-  if( nLock<0 || (nLock>0 && wrFlag) ){
-    rc = SQLITE_LOCKED;
-    goto create_cursor_exception;
+  if( pCur->pSnap==0 ){
+    nLock = (ptr)sqliteHashFind(&pBt->locks, 0, iTable);
+    if( nLock<0 || (nLock>0 && wrFlag) ){
+      rc = SQLITE_LOCKED;
+      goto create_cursor_exception;
+    }
+    if( pBt->pWriter!=p && sqliteHashFind(&pBt->wrTables, 0, iTable) ){
+      rc = SQLITE_LOCKED;
+      goto create_cursor_exception;
+    }
+    nLock = wrFlag ? -1 : nLock+1;
+    sqliteHashInsert(&pBt->locks, 0, iTable, (void*)nLock);
+    if( wrFlag && p->inTrans ){
+      sqliteHashInsert(&pBt->wrTables, 0, iTable, (void*)1);
+    }
   }
-  nLock = wrFlag ? -1 : nLock+1;
-  sqliteHashInsert(&pBt->locks, 0, iTable, (void*)nLock);
-  pCur->pBt = pBt;
   pCur->wrFlag = wrFlag;
   pCur->idx = 0;
   pCur->pNext = pBt->pCursor;
@@ -959,6 +1715,7 @@ int sqliteBtreeCursor(Btree *pBt, int iTable, int wrFlag, BtCursor **ppCur){
 create_cursor_exception:
   *ppCur = 0;
   if( pCur ){
+    closeSnapshot(pCur);
     if( pCur->pPage ) sqlitepager_unref(pCur->pPage);
     sqliteFree(pCur);
   }
@@ -966,13 +1723,22 @@ create_cursor_exception:
   return rc;
 }
 
+int sqliteBtreeCursor(Btree *p, int iTable, int wrFlag, BtCursor **ppCur){
+  BtShared *pBt = p->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeCursor(p, iTable, wrFlag, ppCur);
+  btreeLeave(pBt);
+  return rc;
+}
+
 /*
 ** Close a cursor.  The read lock on the database file is released
 ** when the last cursor is closed.
 */
-int sqliteBtreeCloseCursor(BtCursor *pCur){
+static int btreeCloseCursor(BtCursor *pCur){
   ptr nLock;
-  Btree *pBt = pCur->pBt;
+  BtShared *pBt = pCur->pBt;
   if( pCur->pPrev ){
     pCur->pPrev->pNext = pCur->pNext;
   }else{
@@ -981,18 +1747,31 @@ int sqliteBtreeCloseCursor(BtCursor *pCur){
   if( pCur->pNext ){
     pCur->pNext->pPrev = pCur->pPrev;
   }
+  if( pCur->pSnap ){
+    closeSnapshot(pCur);
+  }else{
+    nLock = (ptr)sqliteHashFind(&pBt->locks, 0, pCur->pgnoRoot);
+    assert( nLock!=0 || sqlite_malloc_failed );
+    nLock = nLock<0 ? 0 : nLock-1;
+    sqliteHashInsert(&pBt->locks, 0, pCur->pgnoRoot, (void*)nLock);
+  }
   if( pCur->pPage ){
     sqlitepager_unref(pCur->pPage);
   }
   unlockBtreeIfUnused(pBt);
-  nLock = (ptr)sqliteHashFind(&pBt->locks, 0, pCur->pgnoRoot);
-  assert( nLock!=0 || sqlite_malloc_failed );
-  nLock = nLock<0 ? 0 : nLock-1;
-  sqliteHashInsert(&pBt->locks, 0, pCur->pgnoRoot, (void*)nLock);
   sqliteFree(pCur);
   return SQLITE_OK;
 }
 
+int sqliteBtreeCloseCursor(BtCursor *pCur){
+  BtShared *pBt = pCur->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeCloseCursor(pCur);
+  btreeLeave(pBt);
+  return rc;
+}
+
 /*
 ** Make a temporary cursor by filling in the fields of pTempCur.
 ** The temporary cursor is not on the cursor list for the Btree.
@@ -1023,7 +1802,7 @@ static void releaseTempCursor(BtCursor *pCur){
 ** pointing to an entry (which can happen, for example, if
 ** the database is empty) then *pSize is set to 0.
 */
-int sqliteBtreeKeySize(BtCursor *pCur, int *pSize){
+static int btreeKeySize(BtCursor *pCur, int *pSize){
   Cell *pCell;
   MemPage *pPage;
 
@@ -1037,6 +1816,15 @@ int sqliteBtreeKeySize(BtCursor *pCur, int *pSize){
   return SQLITE_OK;
 }
 
+int sqliteBtreeKeySize(BtCursor *pCur, int *pSize){
+  BtShared *pBt = pCur->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeKeySize(pCur, pSize);
+  btreeLeave(pBt);
+  return rc;
+}
+
 /*
 ** Read payload information from the entry that the pCur cursor is
 ** pointing to.  Begin reading the payload at "offset" and read
@@ -1072,7 +1860,7 @@ static int getPayload(BtCursor *pCur, int offset, int amt, char *zBuf){
   }
   while( amt>0 && nextPage ){
     OverflowPage *pOvfl;
-    rc = sqlitepager_get(pCur->pBt->pPager, nextPage, (void**)&pOvfl);
+    rc = getCursorPage(pCur, nextPage, (void**)&pOvfl);
     if( rc!=0 ){
       return rc;
     }
@@ -1105,7 +1893,7 @@ static int getPayload(BtCursor *pCur, int offset, int amt, char *zBuf){
 ** amount requested if there are not enough bytes in the key
 ** to satisfy the request.
 */
-int sqliteBtreeKey(BtCursor *pCur, int offset, int amt, char *zBuf){
+static int btreeKey(BtCursor *pCur, int offset, int amt, char *zBuf){
   Cell *pCell;
   MemPage *pPage;
 
@@ -1128,6 +1916,15 @@ int sqliteBtreeKey(BtCursor *pCur, int offset, int amt, char *zBuf){
   return amt;
 }
 
+int sqliteBtreeKey(BtCursor *pCur, int offset, int amt, char *zBuf){
+  BtShared *pBt = pCur->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeKey(pCur, offset, amt, zBuf);
+  btreeLeave(pBt);
+  return rc;
+}
+
 /*
 ** Set *pSize to the number of bytes of data in the entry the
 ** cursor currently points to.  Always return SQLITE_OK.
@@ -1135,7 +1932,7 @@ int sqliteBtreeKey(BtCursor *pCur, int offset, int amt, char *zBuf){
 ** pointing to an entry (which can happen, for example, if
 ** the database is empty) then *pSize is set to 0.
 */
-int sqliteBtreeDataSize(BtCursor *pCur, int *pSize){
+static int btreeDataSize(BtCursor *pCur, int *pSize){
   Cell *pCell;
   MemPage *pPage;
 
@@ -1149,6 +1946,15 @@ int sqliteBtreeDataSize(BtCursor *pCur, int *pSize){
   return SQLITE_OK;
 }
 
+int sqliteBtreeDataSize(BtCursor *pCur, int *pSize){
+  BtShared *pBt = pCur->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeDataSize(pCur, pSize);
+  btreeLeave(pBt);
+  return rc;
+}
+
 /*
 ** Read part of the data associated with cursor pCur.  A maximum
 ** of "amt" bytes will be transfered into zBuf[].  The transfer
@@ -1157,7 +1963,7 @@ int sqliteBtreeDataSize(BtCursor *pCur, int *pSize){
 ** amount requested if there are not enough bytes in the data
 ** to satisfy the request.
 */
-int sqliteBtreeData(BtCursor *pCur, int offset, int amt, char *zBuf){
+static int btreeData(BtCursor *pCur, int offset, int amt, char *zBuf){
   Cell *pCell;
   MemPage *pPage;
 
@@ -1179,6 +1985,15 @@ int sqliteBtreeData(BtCursor *pCur, int offset, int amt, char *zBuf){
   return amt;
 }
 
+int sqliteBtreeData(BtCursor *pCur, int offset, int amt, char *zBuf){
+  BtShared *pBt = pCur->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeData(pCur, offset, amt, zBuf);
+  btreeLeave(pBt);
+  return rc;
+}
+
 /*
 ** Compare an external key against the key on the entry that pCur points to.
 **
@@ -1200,7 +2015,7 @@ int sqliteBtreeData(BtCursor *pCur, int offset, int amt, char *zBuf){
 ** keys must be exactly the same length. (The length of the pCur key
 ** is the actual key length minus nIgnore bytes.)
 */
-int sqliteBtreeKeyCompare(
+static int btreeKeyCompare(
   BtCursor *pCur,       /* Pointer to entry to compare against */
   const void *pKey,     /* Key to compare against entry that pCur points to */
   int nKey,             /* Number of bytes in pKey */
@@ -1235,7 +2050,7 @@ int sqliteBtreeKeyCompare(
     if( nextPage==0 ){
       return SQLITE_CORRUPT;
     }
-    rc = sqlitepager_get(pCur->pBt->pPager, nextPage, (void**)&pOvfl);
+    rc = getCursorPage(pCur, nextPage, (void**)&pOvfl);
     if( rc ){
       return rc;
     }
@@ -1261,6 +2076,16 @@ int sqliteBtreeKeyCompare(
   return SQLITE_OK;
 }
 
+int sqliteBtreeKeyCompare(BtCursor *pCur, const void *pKey, int nKey,
+  int nIgnore, int *pResult){
+  BtShared *pBt = pCur->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeKeyCompare(pCur, pKey, nKey, nIgnore, pResult);
+  btreeLeave(pBt);
+  return rc;
+}
+
 /*
 ** Move the cursor down to a new child page.
 */
@@ -1268,7 +2093,7 @@ static int moveToChild(BtCursor *pCur, int newPgno){
   int rc;
   MemPage *pNewPage;
 
-  rc = sqlitepager_get(pCur->pBt->pPager, newPgno, (void**)&pNewPage);
+  rc = getCursorPage(pCur, newPgno, (void**)&pNewPage);
   if( rc ) return rc;
   rc = initPage(pNewPage, newPgno, pCur->pPage);
   if( rc ) return rc;
@@ -1313,7 +2138,7 @@ static int moveToRoot(BtCursor *pCur){
   MemPage *pNew;
   int rc;
 
-  rc = sqlitepager_get(pCur->pBt->pPager, pCur->pgnoRoot, (void**)&pNew);
+  rc = getCursorPage(pCur, pCur->pgnoRoot, (void**)&pNew);
   if( rc ) return rc;
   rc = initPage(pNew, pCur->pgnoRoot, 0);
   if( rc ) return rc;
@@ -1342,7 +2167,7 @@ static int moveToLeftmost(BtCursor *pCur){
 ** on success.  Set *pRes to 0 if the cursor actually points to something
 ** or set *pRes to 1 if the table is empty.
 */
-int sqliteBtreeFirst(BtCursor *pCur, int *pRes){
+static int btreeFirst(BtCursor *pCur, int *pRes){
   int rc;
   if( pCur->pPage==0 ) return SQLITE_ABORT;
   rc = moveToRoot(pCur);
@@ -1357,11 +2182,20 @@ int sqliteBtreeFirst(BtCursor *pCur, int *pRes){
   return rc;
 }
 
+int sqliteBtreeFirst(BtCursor *pCur, int *pRes){
+  BtShared *pBt = pCur->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeFirst(pCur, pRes);
+  btreeLeave(pBt);
+  return rc;
+}
+
 /* Move the cursor to the last entry in the table.  Return SQLITE_OK
 ** on success.  Set *pRes to 0 if the cursor actually points to something
 ** or set *pRes to 1 if the table is empty.
 */
-int sqliteBtreeLast(BtCursor *pCur, int *pRes){
+static int btreeLast(BtCursor *pCur, int *pRes){
   int rc;
   Pgno pgno;
   if( pCur->pPage==0 ) return SQLITE_ABORT;
@@ -1381,6 +2215,15 @@ int sqliteBtreeLast(BtCursor *pCur, int *pRes){
   return rc;
 }
 
+int sqliteBtreeLast(BtCursor *pCur, int *pRes){
+  BtShared *pBt = pCur->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeLast(pCur, pRes);
+  btreeLeave(pBt);
+  return rc;
+}
+
 /* Move the cursor so that it points to an entry near pKey.
 ** Return a success code.
 **
@@ -1403,7 +2246,7 @@ int sqliteBtreeLast(BtCursor *pCur, int *pRes){
 **     *pRes>0      The cursor is left pointing at an entry that
 **                  is larger than pKey.
 */
-int sqliteBtreeMoveto(BtCursor *pCur, const void *pKey, int nKey, int *pRes){
+static int btreeMoveto(BtCursor *pCur, const void *pKey, int nKey, int *pRes){
   int rc;
   if( pCur->pPage==0 ) return SQLITE_ABORT;
   pCur->bSkipNext = 0;
@@ -1448,13 +2291,22 @@ int sqliteBtreeMoveto(BtCursor *pCur, const void *pKey, int nKey, int *pRes){
   /* NOT REACHED */
 }
 
+int sqliteBtreeMoveto(BtCursor *pCur, const void *pKey, int nKey, int *pRes){
+  BtShared *pBt = pCur->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeMoveto(pCur, pKey, nKey, pRes);
+  btreeLeave(pBt);
+  return rc;
+}
+
 /*
 ** Advance the cursor to the next entry in the database.  If
 ** successful and pRes!=NULL then set *pRes=0.  If the cursor
 ** was already pointing to the last entry in the database before
 ** this routine was called, then set *pRes=1 if pRes!=NULL.
 */
-int sqliteBtreeNext(BtCursor *pCur, int *pRes){
+static int btreeNext(BtCursor *pCur, int *pRes){
   int rc;
   if( pCur->pPage==0 ){
     if( pRes ) *pRes = 1;
@@ -1492,6 +2344,15 @@ int sqliteBtreeNext(BtCursor *pCur, int *pRes){
   return SQLITE_OK;
 }
 
+int sqliteBtreeNext(BtCursor *pCur, int *pRes){
+  BtShared *pBt = pCur->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeNext(pCur, pRes);
+  btreeLeave(pBt);
+  return rc;
+}
+
 /*
 ** Allocate a new page from the database file.
 **
@@ -1504,7 +2365,7 @@ int sqliteBtreeNext(BtCursor *pCur, int *pRes){
 ** an error.  *ppPage and *pPgno are undefined in the event of an error.
 ** Do not invoke sqlitepager_unref() on *ppPage if an error is returned.
 */
-static int allocatePage(Btree *pBt, MemPage **ppPage, Pgno *pPgno){
+static int allocatePage(BtShared *pBt, MemPage **ppPage, Pgno *pPgno){
   PageOne *pPage1 = pBt->page1;
   int rc;
   if( pPage1->freeList ){
@@ -1551,7 +2412,7 @@ static int allocatePage(Btree *pBt, MemPage **ppPage, Pgno *pPgno){
 **
 ** sqlitepager_unref() is NOT called for pPage.
 */
-static int freePage(Btree *pBt, void *pPage, Pgno pgno){
+static int freePage(BtShared *pBt, void *pPage, Pgno pgno){
   PageOne *pPage1 = pBt->page1;
   OverflowPage *pOvfl = (OverflowPage*)pPage;
   int rc;
@@ -1614,7 +2475,7 @@ static int freePage(Btree *pBt, void *pPage, Pgno pgno){
 ** Erase all the data out of a cell.  This involves returning overflow
 ** pages back the freelist.
 */
-static int clearCell(Btree *pBt, Cell *pCell){
+static int clearCell(BtShared *pBt, Cell *pCell){
   Pager *pPager = pBt->pPager;
   OverflowPage *pOvfl;
   Pgno ovfl, nextOvfl;
@@ -1642,7 +2503,7 @@ static int clearCell(Btree *pBt, Cell *pCell){
 ** necessary and linked to this cell.  
 */
 static int fillInCell(
-  Btree *pBt,              /* The whole Btree.  Needed to allocate pages */
+  BtShared *pBt,           /* The whole Btree.  Needed to allocate pages */
   Cell *pCell,             /* Populate this Cell structure */
   const void *pKey, int nKey,    /* The key */
   const void *pData,int nData    /* The data */
@@ -1717,8 +2578,8 @@ static void reparentPage(Pager *pPager, Pgno pgno, MemPage *pNewParent){
   if( pgno==0 ) return;
   assert( pPager!=0 );
   pThis = sqlitepager_lookup(pPager, pgno);
-  if( pThis && pThis->isInit ){
-    if( pThis->pParent!=pNewParent ){
+  if( pThis ){
+    if( pThis->isInit && pThis->pParent!=pNewParent ){
       if( pThis->pParent ) sqlitepager_unref(pThis->pParent);
       pThis->pParent = pNewParent;
       if( pNewParent ) sqlitepager_ref(pNewParent);
@@ -1887,7 +2748,7 @@ static void copyPage(MemPage *pTo, MemPage *pFrom){
 ** in a corrupted state.  So if this routine fails, the database should
 ** be rolled back.
 */
-static int balance(Btree *pBt, MemPage *pPage, BtCursor *pCur){
+static int balance(BtShared *pBt, MemPage *pPage, BtCursor *pCur){
   MemPage *pParent;            /* The parent of pPage */
   MemPage *apOld[3];           /* pPage and up to two siblings */
   Pgno pgnoOld[3];             /* Page numbers for each page in apOld[] */
@@ -2286,7 +3147,7 @@ balance_cleanup:
 ** define what database the record should be inserted into.  The cursor
 ** is left pointing at the new record.
 */
-int sqliteBtreeInsert(
+static int btreeInsert(
   BtCursor *pCur,                /* Insert data into the table of this cursor */
   const void *pKey, int nKey,    /* The key of the new record */
   const void *pData, int nData   /* The data of the new record */
@@ -2296,12 +3157,12 @@ int sqliteBtreeInsert(
   int loc;
   int szNew;
   MemPage *pPage;
-  Btree *pBt = pCur->pBt;
+  BtShared *pBt = pCur->pBt;
 
   if( pCur->pPage==0 ){
     return SQLITE_ABORT;  /* A rollback destroyed this cursor */
   }
-  if( !pCur->pBt->inTrans || nKey+nData==0 ){
+  if( !pCur->pBtree->inTrans || nKey+nData==0 ){
     return SQLITE_ERROR;  /* Must start a transaction first */
   }
   if( !pCur->wrFlag ){
@@ -2333,6 +3194,16 @@ int sqliteBtreeInsert(
   return rc;
 }
 
+int sqliteBtreeInsert(BtCursor *pCur, const void *pKey, int nKey,
+  const void *pData, int nData){
+  BtShared *pBt = pCur->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeInsert(pCur, pKey, nKey, pData, nData);
+  btreeLeave(pBt);
+  return rc;
+}
+
 /*
 ** Delete the entry that the cursor is pointing to.
 **
@@ -2343,7 +3214,7 @@ int sqliteBtreeInsert(
 ** sqliteBtreeNext() after a delete and the cursor will be left
 ** pointing to the first entry after the deleted entry.
 */
-int sqliteBtreeDelete(BtCursor *pCur){
+static int btreeDelete(BtCursor *pCur){
   MemPage *pPage = pCur->pPage;
   Cell *pCell;
   int rc;
@@ -2352,7 +3223,7 @@ int sqliteBtreeDelete(BtCursor *pCur){
   if( pCur->pPage==0 ){
     return SQLITE_ABORT;  /* A rollback destroyed this cursor */
   }
-  if( !pCur->pBt->inTrans ){
+  if( !pCur->pBtree->inTrans ){
     return SQLITE_ERROR;  /* Must start a transaction first */
   }
   if( pCur->idx >= pPage->nCell ){
@@ -2413,6 +3284,15 @@ int sqliteBtreeDelete(BtCursor *pCur){
   return rc;
 }
 
+int sqliteBtreeDelete(BtCursor *pCur){
+  BtShared *pBt = pCur->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeDelete(pCur);
+  btreeLeave(pBt);
+  return rc;
+}
+
 /*
 ** Create a new BTree table.  Write into *piTable the page
 ** number for the root page of the new table.
@@ -2422,11 +3302,12 @@ int sqliteBtreeDelete(BtCursor *pCur){
 ** are restricted to having a 4-byte integer key and arbitrary data and
 ** BTree indices are restricted to having an arbitrary key and no data.
 */
-int sqliteBtreeCreateTable(Btree *pBt, int *piTable){
+static int btreeCreateTable(Btree *p, int *piTable){
+  BtShared *pBt = p->pBt;
   MemPage *pRoot;
   Pgno pgnoRoot;
   int rc;
-  if( !pBt->inTrans ){
+  if( !p->inTrans ){
     return SQLITE_ERROR;  /* Must start a transaction first */
   }
   if( pBt->readOnly ){
@@ -2441,6 +3322,15 @@ int sqliteBtreeCreateTable(Btree *pBt, int *piTable){
   return SQLITE_OK;
 }
 
+int sqliteBtreeCreateTable(Btree *p, int *piTable){
+  BtShared *pBt = p->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeCreateTable(p, piTable);
+  btreeLeave(pBt);
+  return rc;
+}
+
 /*
 ** Create a new BTree index.  Write into *piTable the page
 ** number for the root page of the new index.
@@ -2450,15 +3340,24 @@ int sqliteBtreeCreateTable(Btree *pBt, int *piTable){
 ** are restricted to having a 4-byte integer key and arbitrary data and
 ** BTree indices are restricted to having an arbitrary key and no data.
 */
-int sqliteBtreeCreateIndex(Btree *pBt, int *piIndex){
-  return sqliteBtreeCreateTable(pBt, piIndex);
+static int btreeCreateIndex(Btree *p, int *piIndex){
+  return sqliteBtreeCreateTable(p, piIndex);
+}
+
+int sqliteBtreeCreateIndex(Btree *p, int *piIndex){
+  BtShared *pBt = p->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeCreateIndex(p, piIndex);
+  btreeLeave(pBt);
+  return rc;
 }
 
 /*
 ** Erase the given database page and all its children.  Return
 ** the page to the freelist.
 */
-static int clearDatabasePage(Btree *pBt, Pgno pgno, int freePageFlag){
+static int clearDatabasePage(BtShared *pBt, Pgno pgno, int freePageFlag){
   MemPage *pPage;
   int rc;
   Cell *pCell;
@@ -2495,10 +3394,11 @@ static int clearDatabasePage(Btree *pBt, Pgno pgno, int freePageFlag){
 /*
 ** Delete all information from a single table in the database.
 */
-int sqliteBtreeClearTable(Btree *pBt, int iTable){
+static int btreeClearTable(Btree *p, int iTable){
+  BtShared *pBt = p->pBt;
   int rc;
   ptr nLock;
-  if( !pBt->inTrans ){
+  if( !p->inTrans ){
     return SQLITE_ERROR;  /* Must start a transaction first */
   }
   if( pBt->readOnly ){
@@ -2508,22 +3408,33 @@ int sqliteBtreeClearTable(Btree *pBt, int iTable){
   if( nLock ){
     return SQLITE_LOCKED;
   }
+  sqliteHashInsert(&pBt->wrTables, 0, iTable, (void*)1);
   rc = clearDatabasePage(pBt, (Pgno)iTable, 0);
   if( rc ){
-    sqliteBtreeRollback(pBt);
+    sqliteBtreeRollback(p);
   }
   return rc;
 }
 
+int sqliteBtreeClearTable(Btree *p, int iTable){
+  BtShared *pBt = p->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeClearTable(p, iTable);
+  btreeLeave(pBt);
+  return rc;
+}
+
 /*
 ** Erase all information in a table and add the root of the table to
 ** the freelist.  Except, the root of the principle table (the one on
 ** page 2) is never added to the freelist.
 */
-int sqliteBtreeDropTable(Btree *pBt, int iTable){
+static int btreeDropTable(Btree *p, int iTable){
+  BtShared *pBt = p->pBt;
   int rc;
   MemPage *pPage;
-  if( !pBt->inTrans ){
+  if( !p->inTrans ){
     return SQLITE_ERROR;  /* Must start a transaction first */
   }
   if( pBt->readOnly ){
@@ -2531,7 +3442,7 @@ int sqliteBtreeDropTable(Btree *pBt, int iTable){
   }
   rc = sqlitepager_get(pBt->pPager, (Pgno)iTable, (void**)&pPage);
   if( rc ) return rc;
-  rc = sqliteBtreeClearTable(pBt, iTable);
+  rc = sqliteBtreeClearTable(p, iTable);
   if( rc ) return rc;
   if( iTable>2 ){
     rc = freePage(pBt, pPage, iTable);
@@ -2542,28 +3453,78 @@ int sqliteBtreeDropTable(Btree *pBt, int iTable){
   return rc;  
 }
 
+int sqliteBtreeDropTable(Btree *p, int iTable){
+  BtShared *pBt = p->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeDropTable(p, iTable);
+  btreeLeave(pBt);
+  return rc;
+}
+
 /*
 ** Read the meta-information out of a database file.
+**
+** The meta-information is locked like a table whose root is page 1.
+** If another connection on a shared cache has changed it in a
+** transaction that is still open, SQLITE_LOCKED is returned.  A handle
+** with snapshot reads turned on reads it from its snapshot instead.
 */
-int sqliteBtreeGetMeta(Btree *pBt, int *aMeta){
+static int btreeGetMeta(Btree *p, int *aMeta){
+  BtShared *pBt = p->pBt;
   PageOne *pP1;
+  PageOne *pSnap1 = 0;
+  PgSnapshot *pSnap;
   int rc;
 
   rc = sqlitepager_get(pBt->pPager, 1, (void**)&pP1);
   if( rc ) return rc;
-  aMeta[0] = pP1->nFree;
-  memcpy(&aMeta[1], pP1->aMeta, sizeof(pP1->aMeta));
+  if( p->readSnapshot && pBt->pWriter!=p ){
+    pSnap = p->pSnap;
+    if( pSnap==0 ){
+      rc = sqlitepager_snapshot_open(pBt->pPager, &pSnap);
+    }
+    if( pSnap ){
+      rc = sqlitepager_snapshot_get(pSnap, 1, (void**)&pSnap1);
+      if( pSnap!=p->pSnap ) sqlitepager_snapshot_close(pSnap);
+    }
+    if( rc!=SQLITE_OK && rc!=SQLITE_LOCKED ){
+      sqlitepager_unref(pP1);
+      return rc;
+    }
+  }
+  if( pSnap1 ){
+    aMeta[0] = pSnap1->nFree;
+    memcpy(&aMeta[1], pSnap1->aMeta, sizeof(pSnap1->aMeta));
+    sqlitepager_unref(pSnap1);
+  }else if( pBt->pWriter!=p && sqliteHashFind(&pBt->wrTables, 0, 1) ){
+    rc = SQLITE_LOCKED;
+  }else{
+    aMeta[0] = pP1->nFree;
+    memcpy(&aMeta[1], pP1->aMeta, sizeof(pP1->aMeta));
+    rc = SQLITE_OK;
+  }
   sqlitepager_unref(pP1);
-  return SQLITE_OK;
+  return rc;
+}
+
+int sqliteBtreeGetMeta(Btree *p, int *aMeta){
+  BtShared *pBt = p->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeGetMeta(p, aMeta);
+  btreeLeave(pBt);
+  return rc;
 }
 
 /*
 ** Write meta-information back into the database.
 */
-int sqliteBtreeUpdateMeta(Btree *pBt, int *aMeta){
+static int btreeUpdateMeta(Btree *p, int *aMeta){
+  BtShared *pBt = p->pBt;
   PageOne *pP1;
   int rc;
-  if( !pBt->inTrans ){
+  if( !p->inTrans ){
     return SQLITE_ERROR;  /* Must start a transaction first */
   }
   if( pBt->readOnly ){
@@ -2573,9 +3534,355 @@ int sqliteBtreeUpdateMeta(Btree *pBt, int *aMeta){
   rc = sqlitepager_write(pP1);
   if( rc ) return rc;   
   memcpy(pP1->aMeta, &aMeta[1], sizeof(pP1->aMeta));
+  sqliteHashInsert(&pBt->wrTables, 0, 1, (void*)1);
+  return SQLITE_OK;
+}
+
+int sqliteBtreeUpdateMeta(Btree *p, int *aMeta){
+  BtShared *pBt = p->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeUpdateMeta(p, aMeta);
+  btreeLeave(pBt);
+  return rc;
+}
+
+/*
+** Number of pages in the page cache of the file that a backup is
+** written to.  Dirty pages are written out in batches of this size.
+*/
+#define BACKUP_CACHE_SIZE 100
+
+/*
+** The number of times a backup starts over, because some other
+** process changed the database, before it gives up with SQLITE_CHANGED.
+*/
+#ifndef BACKUP_MAX_RESTART
+# define BACKUP_MAX_RESTART 100
+#endif
+
+/*
+** An online backup of a database into another file.  The pages of the
+** database are copied one batch at a time by sqliteBtreeBackupStep().
+** The database is only read-locked while a batch is being copied, so
+** other connections can change it in between.
+**
+** A commit through the page cache of pFrom, by this connection or one
+** that shares its cache, marks the pages it changed that have already
+** been copied in aRecopy, and they are copied again by a later step.
+** Any other change to the database is found from the change counter
+** on page 1, and then the copy starts over from the first page.
+**
+** The destination file is written through a pager of its own, inside
+** a single transaction that lasts from the first batch to the last.
+** Nobody else can see the half-finished copy, and if the backup is
+** abandoned the file is left as it was before.
+*/
+struct BtBackup {
+  Btree *pFrom;           /* The database being copied */
+  Pager *pTo;             /* The file the copy is written to */
+  void *pTo1;             /* Page 1 of pTo while its transaction is open */
+  Pgno iNext;             /* The next page of pFrom to copy */
+  int nPage;              /* Pages in pFrom at the last step */
+  int iChange;            /* Change counter of pFrom that the copy matches */
+  int nRestart;           /* Number of times the copy has started over */
+  u8 *aRecopy;            /* One bit for each page to be copied again */
+  int nRecopyAlloc;       /* Number of bytes allocated for aRecopy */
+  int nRecopy;            /* Number of bits set in aRecopy */
+  int rc;                 /* The first error, or SQLITE_DONE when finished */
+  BtBackup *pNext;        /* Next backup of the same database */
+};
+
+/*
+** Start the copy over from the first page.
+*/
+static void backupRestart(BtBackup *p, int iChange){
+  p->iNext = 1;
+  p->iChange = iChange;
+  if( p->nRecopy ){
+    memset(p->aRecopy, 0, p->nRecopyAlloc);
+    p->nRecopy = 0;
+  }
+}
+
+/*
+** Note that page pgno, which the backup p has already copied, has been
+** changed and must be copied again.  This is an xPage callback for
+** sqlitepager_changed_pages().
+*/
+static void backupPageChanged(void *pArg, Pgno pgno){
+  BtBackup *p = (BtBackup*)pArg;
+  int i = pgno/8;
+  if( i>=p->nRecopyAlloc ){
+    int nNew = (p->iNext/8 + 1)*2;
+    u8 *aNew = sqliteRealloc(p->aRecopy, nNew);
+    if( aNew==0 ){
+      /* Without room to remember the page, copy everything again */
+      backupRestart(p, p->iChange);
+      return;
+    }
+    memset(&aNew[p->nRecopyAlloc], 0, nNew - p->nRecopyAlloc);
+    p->aRecopy = aNew;
+    p->nRecopyAlloc = nNew;
+  }
+  if( (p->aRecopy[i] & (1<<(pgno&7)))==0 ){
+    p->aRecopy[i] |= 1<<(pgno&7);
+    p->nRecopy++;
+  }
+}
+
+/*
+** The write transaction on pBt is about to commit.  Mark the pages it
+** changed in every backup of the database.  This is done before the
+** commit, while the pager still knows which pages changed.
+*/
+static void backupMarkChanges(BtShared *pBt){
+  BtBackup *p;
+  for(p=pBt->pBackup; p; p=p->pNext){
+    if( p->pTo1 && p->rc==SQLITE_OK ){
+      sqlitepager_changed_pages(pBt->pPager, p->iNext, backupPageChanged, p);
+    }
+  }
+}
+
+/*
+** The write transaction on pBt has committed and moved the change
+** counter on from iOld.  Backups that were up to date with iOld have
+** marked the changed pages and are up to date again.
+*/
+static void backupCommitted(BtShared *pBt, int iOld){
+  BtBackup *p;
+  for(p=pBt->pBackup; p; p=p->pNext){
+    if( p->pTo1 && p->iChange==iOld ){
+      p->iChange = pBt->page1->iChange;
+    }
+  }
+}
+
+/*
+** Copy page pgno of the database into the destination file.
+*/
+static int backupCopyPage(BtBackup *p, Pgno pgno){
+  void *pFrom, *pTo;
+  int rc;
+  rc = sqlitepager_get(p->pFrom->pBt->pPager, pgno, &pFrom);
+  if( rc!=SQLITE_OK ) return rc;
+  rc = sqlitepager_get(p->pTo, pgno, &pTo);
+  if( rc==SQLITE_OK ){
+    rc = sqlitepager_write(pTo);
+    if( rc==SQLITE_OK ){
+      memcpy(pTo, pFrom, SQLITE_PAGE_SIZE);
+    }
+    sqlitepager_unref(pTo);
+  }
+  sqlitepager_unref(pFrom);
+  return rc;
+}
+
+/*
+** Start an online backup of pFrom into the file zFilename.  The file
+** is created if it does not exist and any database in it is replaced.
+** Nothing is read or written until the first call to
+** sqliteBtreeBackupStep().
+*/
+static int btreeBackupOpen(
+  Btree *pFrom,             /* The database to copy */
+  const char *zFilename,    /* Name of the file to copy it into */
+  sqlite_vfs *pVfs,         /* Open zFilename through this VFS */
+  BtBackup **ppBackup       /* Write the new backup here */
+){
+  BtBackup *p;
+  int rc;
+
+  *ppBackup = 0;
+  p = sqliteMalloc( sizeof(*p) );
+  if( p==0 ) return SQLITE_NOMEM;
+  rc = sqlitepager_open(&p->pTo, zFilename, BACKUP_CACHE_SIZE, 0, pVfs);
+  if( rc!=SQLITE_OK ){
+    if( p->pTo ) sqlitepager_close(p->pTo);
+    sqliteFree(p);
+    return rc;
+  }
+  if( sqlitepager_isreadonly(p->pTo) ){
+    sqlitepager_close(p->pTo);
+    sqliteFree(p);
+    return SQLITE_READONLY;
+  }
+  p->pFrom = pFrom;
+  p->iNext = 1;
+  p->pNext = pFrom->pBt->pBackup;
+  pFrom->pBt->pBackup = p;
+  *ppBackup = p;
   return SQLITE_OK;
 }
 
+int sqliteBtreeBackupOpen(Btree *pFrom, const char *zFilename, sqlite_vfs *pVfs,
+  BtBackup **ppBackup){
+  BtShared *pBt = pFrom->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeBackupOpen(pFrom, zFilename, pVfs, ppBackup);
+  btreeLeave(pBt);
+  return rc;
+}
+
+/*
+** Copy up to nPage more pages of the database, or all that are left
+** if nPage is negative.  Pages that were changed after they were copied
+** are copied again first, in addition to the nPage.  Return SQLITE_OK if there are more pages to
+** copy and SQLITE_DONE once the copy is complete and committed.
+**
+** SQLITE_BUSY is returned if either file is locked or a transaction is
+** open on the database being copied.  The step can be tried again
+** later.  If the final commit of the destination is busy, the copy is
+** kept and only the commit is tried again.  SQLITE_CHANGED is returned
+** once other processes have changed the database BACKUP_MAX_RESTART
+** times during the backup.  That and any other error ends the backup
+** and is returned again by every later step.
+*/
+static int btreeBackupStep(BtBackup *p, int nPage){
+  BtShared *pBt = p->pFrom->pBt;
+  PageOne *pP1;
+  Pgno pgno;
+  int nFrom;
+  int i;
+  int rc;
+
+  if( p->rc!=SQLITE_OK ) return p->rc;
+  if( pBt->inTrans ) return SQLITE_BUSY;
+
+  /* Holding page 1 keeps the database read-locked until the end of the
+  ** step.  If some other process has changed the database since the
+  ** last step, start again from the beginning.
+  */
+  rc = sqlitepager_get(pBt->pPager, 1, (void**)&pP1);
+  if( rc!=SQLITE_OK ) return rc;
+  if( p->pTo1==0 ){
+    rc = sqlitepager_get(p->pTo, 1, &p->pTo1);
+    if( rc==SQLITE_OK ){
+      rc = sqlitepager_begin(p->pTo1);
+      if( rc!=SQLITE_OK ){
+        sqlitepager_unref(p->pTo1);
+        p->pTo1 = 0;
+      }
+    }
+    if( rc!=SQLITE_OK ){
+      sqlitepager_unref(pP1);
+      if( rc!=SQLITE_BUSY ) p->rc = rc;
+      return rc;
+    }
+    backupRestart(p, pP1->iChange);
+  }else if( pP1->iChange!=p->iChange ){
+    if( p->nRestart>=BACKUP_MAX_RESTART ){
+      sqlitepager_unref(pP1);
+      p->rc = SQLITE_CHANGED;
+      return p->rc;
+    }
+    p->nRestart++;
+    backupRestart(p, pP1->iChange);
+  }
+  nFrom = sqlitepager_pagecount(pBt->pPager);
+  p->nPage = nFrom;
+
+  /* Copy the pages that changed after they were copied, and then the
+  ** next batch of pages.  The pages copied again do not count against
+  ** nPage, so that a connection which changes a page before every step
+  ** cannot keep the backup from getting any further.
+  */
+  for(pgno=1; p->nRecopy>0; pgno++){
+    assert( (int)pgno<p->nRecopyAlloc*8 );
+    if( (p->aRecopy[pgno/8] & (1<<(pgno&7)))==0 ) continue;
+    if( (int)pgno<=nFrom ){
+      rc = backupCopyPage(p, pgno);
+      if( rc!=SQLITE_OK ) break;
+    }
+    p->aRecopy[pgno/8] &= ~(1<<(pgno&7));
+    p->nRecopy--;
+  }
+  for(i=0; rc==SQLITE_OK && (nPage<0 || i<nPage) && (int)p->iNext<=nFrom; i++){
+    rc = backupCopyPage(p, p->iNext);
+    if( rc!=SQLITE_OK ) break;
+    p->iNext++;
+  }
+
+  /* After the last page, cut the copy to the size of the database and
+  ** commit it.  If the commit is busy, the destination transaction is
+  ** still open and the next step tries again.
+  */
+  if( rc==SQLITE_OK && (int)p->iNext>nFrom && p->nRecopy==0 ){
+    rc = sqlitepager_truncate(p->pTo, nFrom);
+    if( rc==SQLITE_OK ){
+      rc = sqlitepager_commit(p->pTo);
+    }
+    if( rc==SQLITE_OK ){
+      sqlitepager_unref(p->pTo1);
+      p->pTo1 = 0;
+      rc = SQLITE_DONE;
+    }
+  }
+  sqlitepager_unref(pP1);
+  if( rc!=SQLITE_OK && rc!=SQLITE_BUSY ){
+    p->rc = rc;
+  }
+  return rc;
+}
+
+int sqliteBtreeBackupStep(BtBackup *p, int nPage){
+  BtShared *pBt = p->pFrom->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeBackupStep(p, nPage);
+  btreeLeave(pBt);
+  return rc;
+}
+
+/*
+** Write into *pnRemaining the number of pages that are still to be
+** copied and into *pnPage the number of pages in the database, both as
+** of the last step.
+*/
+static void btreeBackupCounts(BtBackup *p, int *pnRemaining, int *pnPage){
+  *pnPage = p->nPage;
+  *pnRemaining = p->nPage - (int)p->iNext + 1;
+  if( *pnRemaining<0 ) *pnRemaining = 0;
+  *pnRemaining += p->nRecopy;
+}
+
+void sqliteBtreeBackupCounts(BtBackup *p, int *pnRemaining, int *pnPage){
+  BtShared *pBt = p->pFrom->pBt;
+  btreeEnter(pBt);
+  btreeBackupCounts(p, pnRemaining, pnPage);
+  btreeLeave(pBt);
+}
+
+/*
+** End a backup.  If it is not complete, the destination file is left
+** as it was.  Return the error that ended the backup, if any.
+*/
+static int btreeBackupClose(BtBackup *p){
+  BtBackup **pp;
+  int rc = p->rc;
+  for(pp=&p->pFrom->pBt->pBackup; *pp!=p; pp=&(*pp)->pNext){}
+  *pp = p->pNext;
+  if( p->pTo1 ){
+    sqlitepager_rollback(p->pTo);
+    sqlitepager_unref(p->pTo1);
+  }
+  sqlitepager_close(p->pTo);
+  sqliteFree(p->aRecopy);
+  sqliteFree(p);
+  return rc==SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+int sqliteBtreeBackupClose(BtBackup *p){
+  BtShared *pBt = p->pFrom->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeBackupClose(p);
+  btreeLeave(pBt);
+  return rc;
+}
+
 /******************************************************************************
 ** The complete implementation of the BTree subsystem is above this line.
 ** All the code the follows is for testing and troubleshooting the BTree
@@ -2587,7 +3894,8 @@ int sqliteBtreeUpdateMeta(Btree *pBt, int *aMeta){
 ** is used for debugging and testing only.
 */
 #ifdef SQLITE_TEST
-int sqliteBtreePageDump(Btree *pBt, int pgno, int recursive){
+static int btreePageDump(Btree *p, int pgno, int recursive){
+  BtShared *pBt = p->pBt;
   int rc;
   MemPage *pPage;
   int i, j;
@@ -2647,14 +3955,23 @@ int sqliteBtreePageDump(Btree *pBt, int pgno, int recursive){
     idx = pPage->u.hdr.firstCell;
     while( idx>0 && idx<SQLITE_PAGE_SIZE-MIN_CELL_SIZE ){
       Cell *pCell = (Cell*)&pPage->u.aDisk[idx];
-      sqliteBtreePageDump(pBt, pCell->h.leftChild, 1);
+      sqliteBtreePageDump(p, pCell->h.leftChild, 1);
       idx = pCell->h.iNext;
     }
-    sqliteBtreePageDump(pBt, pPage->u.hdr.rightChild, 1);
+    sqliteBtreePageDump(p, pPage->u.hdr.rightChild, 1);
   }
   sqlitepager_unref(pPage);
   return SQLITE_OK;
 }
+
+int sqliteBtreePageDump(Btree *p, int pgno, int recursive){
+  BtShared *pBt = p->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreePageDump(p, pgno, recursive);
+  btreeLeave(pBt);
+  return rc;
+}
 #endif
 
 #ifdef SQLITE_TEST
@@ -2673,7 +3990,7 @@ int sqliteBtreePageDump(Btree *pBt, int pgno, int recursive){
 **
 ** This routine is used for testing and debugging only.
 */
-int sqliteBtreeCursorDump(BtCursor *pCur, int *aResult){
+static int btreeCursorDump(BtCursor *pCur, int *aResult){
   int cnt, idx;
   MemPage *pPage = pCur->pPage;
   aResult[0] = sqlitepager_pagenumber(pPage);
@@ -2697,6 +4014,15 @@ int sqliteBtreeCursorDump(BtCursor *pCur, int *aResult){
   aResult[7] = pPage->u.hdr.rightChild;
   return SQLITE_OK;
 }
+
+int sqliteBtreeCursorDump(BtCursor *pCur, int *aResult){
+  BtShared *pBt = pCur->pBt;
+  int rc;
+  btreeEnter(pBt);
+  rc = btreeCursorDump(pCur, aResult);
+  btreeLeave(pBt);
+  return rc;
+}
 #endif
 
 #ifdef SQLITE_TEST
@@ -2704,8 +4030,8 @@ int sqliteBtreeCursorDump(BtCursor *pCur, int *aResult){
 ** Return the pager associated with a BTree.  This routine is used for
 ** testing and debugging only.
 */
-Pager *sqliteBtreePager(Btree *pBt){
-  return pBt->pPager;
+Pager *sqliteBtreePager(Btree *p){
+  return p->pBt->pPager;
 }
 #endif
 
@@ -2715,7 +4041,7 @@ Pager *sqliteBtreePager(Btree *pBt){
 */
 typedef struct IntegrityCk IntegrityCk;
 struct IntegrityCk {
-  Btree *pBt;    /* The tree being checked out */
+  BtShared *pBt; /* The tree being checked out */
   Pager *pPager; /* The associated pager.  Also accessible by pBt->pPager */
   int nPage;     /* Number of pages in the database */
   int *anRef;    /* Number of times each page is referenced */
@@ -2885,6 +4211,7 @@ static int checkTreePage(
   nKey1 = nLower;
   cur.pPage = pPage;
   cur.pBt = pCheck->pBt;
+  cur.pSnap = 0;
   for(i=0; i<pPage->nCell; i++){
     Cell *pCell = pPage->apCell[i];
     int sz;
@@ -2982,7 +4309,8 @@ static int checkTreePage(
 ** and a pointer to that error message is returned.  The calling function
 ** is responsible for freeing the error message when it is done.
 */
-char *sqliteBtreeIntegrityCheck(Btree *pBt, int *aRoot, int nRoot){
+static char *btreeIntegrityCheck(Btree *p, int *aRoot, int nRoot){
+  BtShared *pBt = p->pBt;
   int i;
   int nRef;
   IntegrityCk sCheck;
@@ -3038,3 +4366,12 @@ char *sqliteBtreeIntegrityCheck(Btree *pBt, int *aRoot, int nRoot){
   sqliteFree(sCheck.anRef);
   return sCheck.zErrMsg;
 }
+
+char *sqliteBtreeIntegrityCheck(Btree *p, int *aRoot, int nRoot){
+  BtShared *pBt = p->pBt;
+  char *zErr;
+  btreeEnter(pBt);
+  zErr = btreeIntegrityCheck(p, aRoot, nRoot);
+  btreeLeave(pBt);
+  return zErr;
+}
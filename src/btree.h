@@ -20,12 +20,22 @@
 
 typedef struct Btree Btree;
 typedef struct BtCursor BtCursor;
+typedef struct BtBackup BtBackup;
 
-int sqliteBtreeOpen(const char *zFilename, int mode, int nPg, Btree **ppBtree);
+int sqliteBtreeOpen(const char *zFilename, int mode, int nPg, sqlite_vfs*,
+                    Btree **ppBtree);
 int sqliteBtreeClose(Btree*);
 int sqliteBtreeSetCacheSize(Btree*, int);
+int sqliteBtreeJournalMode(Btree*, int);
+int sqliteBtreeLockingMode(Btree*, int);
+int sqliteBtreeReadSnapshot(Btree*, int);
+int sqliteBtreeSafetyLevel(Btree*, int);
+void sqliteBtreeLockTimeout(Btree*, int);
+int sqliteBtreeGroupCommit(Btree*, int);
+void sqliteBtreeSharedCache(int);
 
 int sqliteBtreeBeginTrans(Btree*);
+int sqliteBtreeBeginGroup(Btree*);
 int sqliteBtreeCommit(Btree*);
 int sqliteBtreeRollback(Btree*);
 int sqliteBtreeBeginCkpt(Btree*);
@@ -58,6 +68,13 @@ int sqliteBtreeGetMeta(Btree*, int*);
 int sqliteBtreeUpdateMeta(Btree*, int*);
 
 char *sqliteBtreeIntegrityCheck(Btree*, int*, int);
+void sqliteBtreePageCounts(Btree*, int*, int*);
+
+int sqliteBtreeBackupOpen(Btree*, const char *zFilename, sqlite_vfs*,
+                          BtBackup**);
+int sqliteBtreeBackupStep(BtBackup*, int nPage);
+void sqliteBtreeBackupCounts(BtBackup*, int*, int*);
+int sqliteBtreeBackupClose(BtBackup*);
 
 #ifdef SQLITE_TEST
 int sqliteBtreePageDump(Btree*, int, int);
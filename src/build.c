@@ -45,9 +45,15 @@ void sqliteExec(Parse *pParse){
   sqlite *db = pParse->db;
   if( sqlite_malloc_failed ) return;
   if( pParse->pVdbe && pParse->nErr==0 ){
+    sqliteVdbeOptimize(pParse->pVdbe);
     if( pParse->explain ){
       rc = sqliteVdbeList(pParse->pVdbe, pParse->xCallback, pParse->pArg, 
                           &pParse->zErrMsg);
+    }else if( pParse->explainAnalyze ){
+      rc = sqliteVdbeAnalyze(pParse->pVdbe, pParse->xCallback, pParse->pArg,
+                             &pParse->zErrMsg, db->pBusyArg,
+                             db->xBusyCallback);
+      if( rc ) pParse->nErr++;
     }else{
       FILE *trace = (db->flags & SQLITE_VdbeTrace)!=0 ? stdout : 0;
       sqliteVdbeTrace(pParse->pVdbe, trace);
@@ -59,6 +65,7 @@ void sqliteExec(Parse *pParse){
     sqliteVdbeDelete(pParse->pVdbe);
     pParse->pVdbe = 0;
     pParse->colNamesSet = 0;
+    pParse->explainAnalyze = 0;
     pParse->rc = rc;
     pParse->schemaVerified = 0;
   }
@@ -406,7 +413,7 @@ void sqliteStartTable(Parse *pParse, Token *pStart, Token *pName, int isTemp){
   ** holding temporary tables is open.
   */
   if( isTemp && db->pBeTemp==0 ){
-    int rc = sqliteBtreeOpen(0, 0, MAX_PAGES, &db->pBeTemp);
+    int rc = sqliteBtreeOpen(0, 0, MAX_PAGES, db->pVfs, &db->pBeTemp);
     if( rc!=SQLITE_OK ){
       sqliteSetNString(&pParse->zErrMsg, "unable to open a temporary database "
         "file for storing temporary tables", 0);
@@ -920,7 +927,8 @@ void sqliteCreateView(
   Token sEnd;
   Table *p;
   const char *z;
-  int n, offset;
+  int n;
+  ptr offset;
 
   sqliteStartTable(pParse, pBegin, pName, 0);
   p = pParse->pNewTable;
@@ -944,14 +952,14 @@ void sqliteCreateView(
     sEnd.z += sEnd.n;
   }
   sEnd.n = 0;
-  n = ((int)sEnd.z) - (int)pBegin->z;
+  n = (int)(Addr(sEnd.z) - Addr(pBegin->z));
   z = pBegin->z;
   while( n>0 && (z[n-1]==';' || isspace(z[n-1])) ){ n--; }
   sEnd.z = &z[n-1];
   sEnd.n = 1;
   z = p->pSelect->zSelect = sqliteStrNDup(z, n);
   if( z ){
-    offset = ((int)z) - (int)pBegin->z;
+    offset = Addr(z) - Addr(pBegin->z);
     sqliteSelectMoveStrings(p->pSelect, offset);
     sqliteEndTable(pParse, &sEnd, 0);
   }
@@ -1784,12 +1792,18 @@ void sqliteBeginTransaction(Parse *pParse, int onError){
 */
 void sqliteCommitTransaction(Parse *pParse){
   sqlite *db;
+  Vdbe *v;
 
   if( pParse==0 || (db=pParse->db)==0 || db->pBe==0 ) return;
   if( pParse->nErr || sqlite_malloc_failed ) return;
   if( (db->flags & SQLITE_InTrans)==0 ) return;
   db->flags &= ~SQLITE_InTrans;
-  sqliteEndWriteOperation(pParse);
+  v = sqliteGetVdbe(pParse);
+  if( v ){
+    /* P1 lets a COMMIT that finds the database busy leave the
+    ** transaction open so that the COMMIT can be tried again. */
+    sqliteVdbeAddOp(v, OP_Commit, 1, db->onError);
+  }
   db->onError = OE_Default;
 }
 
@@ -1873,6 +1887,24 @@ static int getBoolean(char *z){
   return 0;
 }
 
+/*
+** Interpret the given string as a safety level for the "synchronous"
+** pragmas.  OFF, NORMAL, FULL and DATA name the PAGER_SYNC_* levels.
+** Anything else is read as a boolean, where "on" means NORMAL for
+** compatibility with the older on/off form.
+*/
+static int getSafetyLevel(char *z){
+  /* The order of these names must match the PAGER_SYNC_* values */
+  static char *azLevel[] = { "off", "normal", "full", "data" };
+  int i;
+  for(i=0; i<sizeof(azLevel)/sizeof(azLevel[0]); i++){
+    if( sqliteStrICmp(z,azLevel[i])==0 ) return i;
+  }
+  i = getBoolean(z);
+  if( i<0 || i>=sizeof(azLevel)/sizeof(azLevel[0]) ) i = 1;
+  return i;
+}
+
 /*
 ** Process a pragma statement.  
 **
@@ -2006,6 +2038,11 @@ void sqlitePragma(Parse *pParse, Token *pLeft, Token *pRight, int minusFlag){
   ** even with synchronous off, but an operating system crash or power loss
   ** could potentially corrupt data.  On the other hand, synchronous off is
   ** faster than synchronous on.
+  **
+  ** Only on or off is stored in the database file.  Any of the levels
+  ** accepted by the "synchronous" pragma may be given here; it takes
+  ** effect locally, and every level but OFF is stored as on, which means
+  ** NORMAL the next time the database is opened.
   */
   if( sqliteStrICmp(zLeft,"default_synchronous")==0 ){
     static VdbeOp getSync[] = {
@@ -2025,6 +2062,7 @@ void sqlitePragma(Parse *pParse, Token *pLeft, Token *pRight, int minusFlag){
     }else{
       int addr;
       int size = db->cache_size;
+      int level = getSafetyLevel(zRight);
       if( size<0 ) size = -size;
       sqliteBeginWriteOperation(pParse, 0);
       sqliteVdbeAddOp(v, OP_ReadCookie, 0, 2);
@@ -2033,7 +2071,7 @@ void sqlitePragma(Parse *pParse, Token *pLeft, Token *pRight, int minusFlag){
       sqliteVdbeAddOp(v, OP_Ne, 0, addr+3);
       sqliteVdbeAddOp(v, OP_AddImm, MAX_PAGES, 0);
       sqliteVdbeAddOp(v, OP_AbsValue, 0, 0);
-      if( !getBoolean(zRight) ){
+      if( level==0 ){
         sqliteVdbeAddOp(v, OP_Negative, 0, 0);
         size = -size;
       }
@@ -2041,17 +2079,25 @@ void sqlitePragma(Parse *pParse, Token *pLeft, Token *pRight, int minusFlag){
       sqliteEndWriteOperation(pParse);
       db->cache_size = size;
       sqliteBtreeSetCacheSize(db->pBe, db->cache_size);
+      sqliteBtreeSafetyLevel(db->pBe, level);
     }
   }else
 
   /*
   **   PRAGMA synchronous
-  **   PRAGMA synchronous=BOOLEAN
+  **   PRAGMA synchronous=OFF|NORMAL|FULL|DATA
   **
   ** Return or set the local value of the synchronous flag.  Changing
   ** the local value does not make changes to the disk file and the
   ** default value will be restored the next time the database is
   ** opened.
+  **
+  ** The value is one of the PAGER_SYNC_* safety levels, reported as the
+  ** numbers 0 through 3.  NORMAL syncs at the points needed to keep a
+  ** transaction atomic, FULL also syncs the directory holding the journal
+  ** so that committed transactions survive a power failure, and DATA is
+  ** NORMAL using fdatasync().  ON and OFF are still accepted, and ON
+  ** means NORMAL.  See sqlitepager_safety_level() for the details.
   */
   if( sqliteStrICmp(zLeft,"synchronous")==0 ){
     static VdbeOp getSync[] = {
@@ -2062,14 +2108,153 @@ void sqlitePragma(Parse *pParse, Token *pLeft, Token *pRight, int minusFlag){
     Vdbe *v = sqliteGetVdbe(pParse);
     if( v==0 ) return;
     if( pRight->z==pLeft->z ){
-      sqliteVdbeAddOp(v, OP_Integer, db->cache_size>=0, 0);
+      sqliteVdbeAddOp(v, OP_Integer, sqliteBtreeSafetyLevel(db->pBe, -1), 0);
       sqliteVdbeAddOpList(v, ArraySize(getSync), getSync);
     }else{
       int size = db->cache_size;
+      int level = getSafetyLevel(zRight);
       if( size<0 ) size = -size;
-      if( !getBoolean(zRight) ) size = -size;
+      if( level==0 ) size = -size;
       db->cache_size = size;
       sqliteBtreeSetCacheSize(db->pBe, db->cache_size);
+      sqliteBtreeSafetyLevel(db->pBe, level);
+    }
+  }else
+
+  /*
+  **   PRAGMA journal_mode
+  **   PRAGMA journal_mode=DELETE|PERSIST|TRUNCATE|MEMORY
+  **
+  ** Return or set the way the rollback journal of the main database is
+  ** managed.  DELETE, the default, creates a new journal file for each
+  ** transaction and deletes it afterwards.  PERSIST and TRUNCATE keep the
+  ** journal file around and only zero its header or truncate it.  MEMORY
+  ** does not write a journal file at all, so a crash during a COMMIT can
+  ** corrupt the database.  Like "synchronous", this setting is not stored
+  ** in the database file.  It cannot be changed inside a transaction.
+  ** Only the main database is affected.  The temporary database keeps
+  ** its journal in memory until it grows too big for its cache, and it is
+  ** deleted when the connection closes, so there is nothing for a crash
+  ** to corrupt.
+  */
+  if( sqliteStrICmp(zLeft,"journal_mode")==0 ){
+    /* The order of these names must match the PAGER_JOURNALMODE_* values */
+    static char *azMode[] = { "delete", "persist", "truncate", "memory" };
+    static VdbeOp getMode[] = {
+      { OP_ColumnCount, 1, 0,        0},
+      { OP_ColumnName,  0, 0,        "journal_mode"},
+      { OP_Callback,    1, 0,        0},
+    };
+    Vdbe *v = sqliteGetVdbe(pParse);
+    int i;
+    if( v==0 ) return;
+    if( pRight->z==pLeft->z ){
+      i = sqliteBtreeJournalMode(db->pBe, -1);
+      sqliteVdbeAddOp(v, OP_String, 0, 0);
+      sqliteVdbeChangeP3(v, -1, azMode[i], P3_STATIC);
+      sqliteVdbeAddOpList(v, ArraySize(getMode), getMode);
+    }else{
+      for(i=0; i<ArraySize(azMode); i++){
+        if( sqliteStrICmp(zRight, azMode[i])==0 ){
+          sqliteBtreeJournalMode(db->pBe, i);
+          break;
+        }
+      }
+    }
+  }else
+
+  /*
+  **   PRAGMA locking_mode
+  **   PRAGMA locking_mode=NORMAL|EXCLUSIVE
+  **
+  ** Return or set whether the main database is locked for one statement
+  ** at a time or for as long as the connection is open.  In EXCLUSIVE
+  ** mode the lock is never released once it is taken, so the page cache
+  ** is kept from one statement to the next, and other connections cannot
+  ** write the database and, after the first change, cannot read it.
+  ** Setting NORMAL again releases the lock.  This setting is not stored
+  ** in the database file.
+  */
+  if( sqliteStrICmp(zLeft,"locking_mode")==0 ){
+    /* The order of these names must match the PAGER_LOCKINGMODE_* values */
+    static char *azMode[] = { "normal", "exclusive" };
+    static VdbeOp getMode[] = {
+      { OP_ColumnCount, 1, 0,        0},
+      { OP_ColumnName,  0, 0,        "locking_mode"},
+      { OP_Callback,    1, 0,        0},
+    };
+    Vdbe *v = sqliteGetVdbe(pParse);
+    int i;
+    if( v==0 ) return;
+    if( pRight->z==pLeft->z ){
+      i = sqliteBtreeLockingMode(db->pBe, -1);
+      sqliteVdbeAddOp(v, OP_String, 0, 0);
+      sqliteVdbeChangeP3(v, -1, azMode[i], P3_STATIC);
+      sqliteVdbeAddOpList(v, ArraySize(getMode), getMode);
+    }else{
+      for(i=0; i<ArraySize(azMode); i++){
+        if( sqliteStrICmp(zRight, azMode[i])==0 ){
+          sqliteBtreeLockingMode(db->pBe, i);
+          break;
+        }
+      }
+    }
+  }else
+
+  /*
+  **   PRAGMA read_snapshot
+  **   PRAGMA read_snapshot=ON|OFF
+  **
+  ** Return or set whether queries on the main database read the last
+  ** committed version of the tables.  This only matters when the page
+  ** cache is shared with other connections (see the
+  ** sqlite_enable_shared_cache() API).  With read_snapshot on, a query
+  ** can read a table that another connection is changing, and that
+  ** connection can change a table this one is reading.  The query sees
+  ** the table as it was when the statement started.  This setting is
+  ** not stored in the database file.
+  */
+  if( sqliteStrICmp(zLeft,"read_snapshot")==0 ){
+    static VdbeOp getSnap[] = {
+      { OP_ColumnCount, 1, 0,        0},
+      { OP_ColumnName,  0, 0,        "read_snapshot"},
+      { OP_Callback,    1, 0,        0},
+    };
+    Vdbe *v = sqliteGetVdbe(pParse);
+    if( v==0 ) return;
+    if( pRight->z==pLeft->z ){
+      sqliteVdbeAddOp(v, OP_Integer, sqliteBtreeReadSnapshot(db->pBe, -1), 0);
+      sqliteVdbeAddOpList(v, ArraySize(getSnap), getSnap);
+    }else{
+      sqliteBtreeReadSnapshot(db->pBe, getBoolean(zRight));
+    }
+  }else
+
+  /*
+  **   PRAGMA group_commit
+  **   PRAGMA group_commit=N
+  **
+  ** Return or set the largest number of autocommit statements that are
+  ** synced to disk together on a shared cache.  0 or 1, the default,
+  ** turns group commit off.  See sqliteBtreeBeginGroup() for how a group
+  ** is formed.  Like the other settings of a shared cache, this applies
+  ** to every connection that shares it.  It is not stored in the
+  ** database file.
+  */
+  if( sqliteStrICmp(zLeft,"group_commit")==0 ){
+    static VdbeOp getGroup[] = {
+      { OP_ColumnCount, 1, 0,        0},
+      { OP_ColumnName,  0, 0,        "group_commit"},
+      { OP_Callback,    1, 0,        0},
+    };
+    Vdbe *v = sqliteGetVdbe(pParse);
+    if( v==0 ) return;
+    if( pRight->z==pLeft->z ){
+      sqliteVdbeAddOp(v, OP_Integer, sqliteBtreeGroupCommit(db->pBe, -1), 0);
+      sqliteVdbeAddOpList(v, ArraySize(getGroup), getGroup);
+    }else{
+      int n = atoi(zRight);
+      sqliteBtreeGroupCommit(db->pBe, n<0 ? 0 : n);
     }
   }else
 
@@ -188,6 +188,10 @@ void sqliteDeleteFrom(
   ** the table an pick which records to delete.
   */
   else{
+    /* Compute the invariant parts of the WHERE clause once, up front
+    */
+    sqliteExprHoistConstants(pParse, pWhere);
+
     /* Begin the database scan
     */
     pWInfo = sqliteWhereBegin(pParse, base, pTabList, pWhere, 1);
@@ -119,7 +119,7 @@ void sqliteExprDelete(Expr *p){
 ** The work of figuring out the appropriate "offset" and making the
 ** presistent copy of the input buffer is done by the calling routine.
 */
-void sqliteExprMoveStrings(Expr *p, int offset){
+void sqliteExprMoveStrings(Expr *p, ptr offset){
   if( p==0 ) return;
   if( p->token.z ) p->token.z += offset;
   if( p->span.z ) p->span.z += offset;
@@ -128,14 +128,14 @@ void sqliteExprMoveStrings(Expr *p, int offset){
   if( p->pList ) sqliteExprListMoveStrings(p->pList, offset);
   if( p->pSelect ) sqliteSelectMoveStrings(p->pSelect, offset);
 }
-void sqliteExprListMoveStrings(ExprList *pList, int offset){
+void sqliteExprListMoveStrings(ExprList *pList, ptr offset){
   int i;
   if( pList==0 ) return;
   for(i=0; i<pList->nExpr; i++){
     sqliteExprMoveStrings(pList->a[i].pExpr, offset);
   }
 }
-void sqliteSelectMoveStrings(Select *pSelect, int offset){
+void sqliteSelectMoveStrings(Select *pSelect, ptr offset){
   if( pSelect==0 ) return;
   sqliteExprListMoveStrings(pSelect->pEList, offset);
   sqliteExprMoveStrings(pSelect->pWhere, offset);
@@ -248,6 +248,8 @@ Select *sqliteSelectDup(Select *p){
   pNew->pPrior = sqliteSelectDup(p->pPrior);
   pNew->nLimit = p->nLimit;
   pNew->nOffset = p->nOffset;
+  pNew->iLimit = -1;
+  pNew->iOffset = -1;
   pNew->zSelect = 0;
   return pNew;
 }
@@ -320,6 +322,7 @@ int sqliteExprIsConstant(Expr *p){
       return p->token.z[0]=='\'';
     case TK_INTEGER:
     case TK_FLOAT:
+    case TK_REGISTER:
       return 1;
     default: {
       if( p->pLeft && !sqliteExprIsConstant(p->pLeft) ) return 0;
@@ -941,7 +944,8 @@ void sqliteExprCode(Parse *pParse, Expr *pExpr){
       sqliteVdbeChangeP3(v, -1, (char*)pDef, P3_POINTER);
       break;
     }
-    case TK_SELECT: {
+    case TK_SELECT:
+    case TK_REGISTER: {
       sqliteVdbeAddOp(v, OP_MemLoad, pExpr->iColumn, 0);
       break;
     }
@@ -1042,6 +1046,136 @@ void sqliteExprCode(Parse *pParse, Expr *pExpr){
   }
 }
 
+/*
+** Return TRUE if the value of the expression pExpr is the same for
+** every row of the query.  This is stricter than sqliteExprIsConstant()
+** in that a function call is only invariant if the function has been
+** marked as deterministic.  The random() function, for example, is
+** not.  Scalar subqueries and the left operand of IN are allowed since
+** the subquery result or the set of IN values are computed before the
+** loop starts.
+**
+** This routine must only be called after sqliteExprResolveIds() and
+** sqliteExprCheck() have been run on the expression.
+*/
+static int exprIsInvariant(Parse *pParse, Expr *p){
+  switch( p->op ){
+    case TK_INTEGER:
+    case TK_FLOAT:
+    case TK_STRING:
+    case TK_NULL:
+    case TK_SELECT:
+    case TK_REGISTER: {
+      return 1;
+    }
+    case TK_IN: {
+      return exprIsInvariant(pParse, p->pLeft);
+    }
+    case TK_FUNCTION: {
+      int n = p->pList ? p->pList->nExpr : 0;
+      FuncDef *pDef;
+      pDef = sqliteFindFunction(pParse->db, p->token.z, p->token.n, n, 0);
+      if( pDef==0 || !pDef->isDeterministic ) return 0;
+      /* Fall thru into the checks of the arguments */
+    }
+    case TK_AND:
+    case TK_OR:
+    case TK_PLUS:
+    case TK_STAR:
+    case TK_MINUS:
+    case TK_REM:
+    case TK_BITAND:
+    case TK_BITOR:
+    case TK_SLASH:
+    case TK_LT:
+    case TK_LE:
+    case TK_GT:
+    case TK_GE:
+    case TK_NE:
+    case TK_EQ:
+    case TK_LSHIFT:
+    case TK_RSHIFT:
+    case TK_CONCAT:
+    case TK_UMINUS:
+    case TK_BITNOT:
+    case TK_NOT:
+    case TK_ISNULL:
+    case TK_NOTNULL:
+    case TK_BETWEEN:
+    case TK_CASE:
+    case TK_AS: {
+      if( p->pLeft && !exprIsInvariant(pParse, p->pLeft) ) return 0;
+      if( p->pRight && !exprIsInvariant(pParse, p->pRight) ) return 0;
+      if( p->pList ){
+        int i;
+        for(i=0; i<p->pList->nExpr; i++){
+          if( !exprIsInvariant(pParse, p->pList->a[i].pExpr) ) return 0;
+        }
+      }
+      return 1;
+    }
+    default: {
+      break;
+    }
+  }
+  return 0;
+}
+
+/*
+** Search the expression pExpr for subexpressions whose value does not
+** change from one row to the next.  Generate code that computes each
+** such subexpression once and saves the result in a memory cell, then
+** change the subexpression into a TK_REGISTER node so that later calls
+** to sqliteExprCode() just load the saved value.
+**
+** The caller must invoke this routine while the VDBE is positioned
+** before the start of the loop, so that the computations are done
+** only once.  Literal values are left alone since loading them from
+** a memory cell is no cheaper than pushing them directly.
+**
+** Since the program is rebuilt each time the statement is run,
+** evaluating a deterministic function once in front of the loop is
+** equivalent to folding it into a constant at compile-time.
+*/
+void sqliteExprHoistConstants(Parse *pParse, Expr *pExpr){
+  Vdbe *v = pParse->pVdbe;
+  if( v==0 || pExpr==0 ) return;
+  if( exprIsInvariant(pParse, pExpr) ){
+    switch( pExpr->op ){
+      case TK_INTEGER:
+      case TK_FLOAT:
+      case TK_STRING:
+      case TK_NULL:
+      case TK_SELECT:
+      case TK_REGISTER: {
+        return;
+      }
+      case TK_UMINUS: {
+        if( pExpr->pLeft->op==TK_INTEGER || pExpr->pLeft->op==TK_FLOAT ){
+          return;
+        }
+        break;
+      }
+      default: {
+        break;
+      }
+    }
+    sqliteExprCode(pParse, pExpr);
+    pExpr->iColumn = pParse->nMem++;
+    sqliteVdbeAddOp(v, OP_MemStore, pExpr->iColumn, 1);
+    pExpr->op = TK_REGISTER;
+    return;
+  }
+  sqliteExprHoistConstants(pParse, pExpr->pLeft);
+  sqliteExprHoistConstants(pParse, pExpr->pRight);
+  if( pExpr->pList && pExpr->op!=TK_IN ){
+    int i;
+    for(i=0; i<pExpr->pList->nExpr; i++){
+      sqliteExprHoistConstants(pParse, pExpr->pList->a[i].pExpr);
+    }
+  }
+}
+
 /*
 ** Generate code for a boolean expression such that a jump is made
 ** to the label "dest" if the expression is true but execution
@@ -416,27 +416,28 @@ void sqliteRegisterBuiltinFunctions(sqlite *db){
   static struct {
      char *zName;
      int nArg;
+     int isDeterministic;
      void (*xFunc)(sqlite_func*,int,const char**);
   } aFuncs[] = {
-    { "min",       -1, minFunc    },
-    { "min",        0, 0          },
-    { "max",       -1, maxFunc    },
-    { "max",        0, 0          },
-    { "length",     1, lengthFunc },
-    { "substr",     3, substrFunc },
-    { "abs",        1, absFunc    },
-    { "round",      1, roundFunc  },
-    { "round",      2, roundFunc  },
-    { "upper",      1, upperFunc  },
-    { "lower",      1, lowerFunc  },
-    { "coalesce",  -1, ifnullFunc },
-    { "coalesce",   0, 0          },
-    { "coalesce",   1, 0          },
-    { "ifnull",     2, ifnullFunc },
-    { "random",    -1, randomFunc },
-    { "like",       2, likeFunc   },
-    { "glob",       2, globFunc   },
-    { "nullif",     2, nullifFunc },
+    { "min",       -1, 1, minFunc    },
+    { "min",        0, 1, 0          },
+    { "max",       -1, 1, maxFunc    },
+    { "max",        0, 1, 0          },
+    { "length",     1, 1, lengthFunc },
+    { "substr",     3, 1, substrFunc },
+    { "abs",        1, 1, absFunc    },
+    { "round",      1, 1, roundFunc  },
+    { "round",      2, 1, roundFunc  },
+    { "upper",      1, 1, upperFunc  },
+    { "lower",      1, 1, lowerFunc  },
+    { "coalesce",  -1, 1, ifnullFunc },
+    { "coalesce",   0, 1, 0          },
+    { "coalesce",   1, 1, 0          },
+    { "ifnull",     2, 1, ifnullFunc },
+    { "random",    -1, 0, randomFunc },
+    { "like",       2, 1, likeFunc   },
+    { "glob",       2, 1, globFunc   },
+    { "nullif",     2, 1, nullifFunc },
   };
   static struct {
     char *zName;
@@ -457,8 +458,12 @@ void sqliteRegisterBuiltinFunctions(sqlite *db){
   int i;
 
   for(i=0; i<sizeof(aFuncs)/sizeof(aFuncs[0]); i++){
+    FuncDef *p;
     sqlite_create_function(db, aFuncs[i].zName,
            aFuncs[i].nArg, aFuncs[i].xFunc, 0);
+    p = sqliteFindFunction(db, aFuncs[i].zName, strlen(aFuncs[i].zName),
+                           aFuncs[i].nArg, 0);
+    if( p ) p->isDeterministic = aFuncs[i].isDeterministic;
   }
   sqlite_create_function(db, "last_insert_rowid", 0, 
            last_insert_rowid, db);
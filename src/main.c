@@ -310,13 +310,36 @@ const char sqlite_encoding[] = "iso8859";
 ** sqlite_exec().
 */
 sqlite *sqlite_open(const char *zFilename, int mode, char **pzErrMsg){
+  return sqlite_open_vfs(zFilename, mode, 0, pzErrMsg);
+}
+
+/*
+** Open a new SQLite database that does all of its I/O through the
+** registered VFS named zVfs, or through the default VFS if zVfs is NULL.
+*/
+sqlite *sqlite_open_vfs(
+  const char *zFilename,    /* Name of the database file */
+  int mode,                 /* Not currently used */
+  const char *zVfs,         /* Name of the VFS to use.  NULL for default */
+  char **pzErrMsg           /* Write error messages here */
+){
   sqlite *db;
+  sqlite_vfs *pVfs;
   int rc;
 
+  /* Locate the VFS */
+  if( pzErrMsg ) *pzErrMsg = 0;
+  pVfs = sqlite_vfs_find(zVfs);
+  if( pVfs==0 ){
+    sqliteSetString(pzErrMsg, "no such vfs: ", zVfs, 0);
+    sqliteStrRealloc(pzErrMsg);
+    return 0;
+  }
+
   /* Allocate the sqlite data structure */
   db = sqliteMalloc( sizeof(sqlite) );
-  if( pzErrMsg ) *pzErrMsg = 0;
   if( db==0 ) goto no_mem_on_open;
+  db->pVfs = pVfs;
   sqliteHashInit(&db->tblHash, SQLITE_HASH_STRING, 0);
   sqliteHashInit(&db->idxHash, SQLITE_HASH_STRING, 0);
   sqliteHashInit(&db->trigHash, SQLITE_HASH_STRING, 0);
@@ -330,7 +353,7 @@ sqlite *sqlite_open(const char *zFilename, int mode, char **pzErrMsg){
   db->magic = SQLITE_MAGIC_BUSY;
   
   /* Open the backend database driver */
-  rc = sqliteBtreeOpen(zFilename, mode, MAX_PAGES, &db->pBe);
+  rc = sqliteBtreeOpen(zFilename, mode, MAX_PAGES, pVfs, &db->pBe);
   if( rc!=SQLITE_OK ){
     switch( rc ){
       default: {
@@ -672,6 +695,8 @@ const char *sqlite_error_string(int rc){
     case SQLITE_CONSTRAINT: z = "constraint failed";                     break;
     case SQLITE_MISMATCH:   z = "datatype mismatch";                     break;
     case SQLITE_MISUSE:     z = "library routine called out of sequence";break;
+    case SQLITE_CHANGED:    z = "database changed too often to back up"; break;
+    case SQLITE_DONE:       z = "no more pages to copy";                 break;
     default:                z = "unknown error";                         break;
   }
   return z;
@@ -679,21 +704,28 @@ const char *sqlite_error_string(int rc){
 
 /*
 ** This routine implements a busy callback that sleeps and tries
-** again until a timeout value is reached.  The timeout value is
-** an integer number of milliseconds passed in as the first
-** argument.
+** again until a timeout value is reached.  The first argument is
+** the database connection.  Its busyTimeout field holds the timeout
+** as an integer number of milliseconds and its VFS does the sleeping.
+**
+** If the VFS can wait for locks, the pager has already waited for the
+** whole timeout before reporting that the database is busy, so there
+** is no point in sleeping and trying again.
 */
 static int sqliteDefaultBusyCallback(
- void *Timeout,           /* Maximum amount of time to wait */
+ void *pDb,               /* The database connection */
  const char *NotUsed,     /* The name of the table that is busy */
  int count                /* Number of times table has been busy */
 ){
 #if SQLITE_MIN_SLEEP_MS==1
+  sqlite *db = (sqlite*)pDb;
   int delay = 10;
   int prior_delay = 0;
-  int timeout = (int)Timeout;
+  int timeout = db->busyTimeout;
   int i;
 
+  if( db->pVfs->xLockWait ) return 0;
+
   for(i=1; i<count; i++){ 
     prior_delay += delay;
     delay = delay*2;
@@ -707,14 +739,15 @@ static int sqliteDefaultBusyCallback(
     delay = timeout - prior_delay;
     if( delay<=0 ) return 0;
   }
-  sqliteOsSleep(delay);
+  sqliteOsSleep(db->pVfs, delay);
   return 1;
 #else
-  int timeout = (int)Timeout;
-  if( (count+1)*1000 > timeout ){
+  sqlite *db = (sqlite*)pDb;
+  if( db->pVfs->xLockWait ) return 0;
+  if( (count+1)*1000 > db->busyTimeout ){
     return 0;
   }
-  sqliteOsSleep(1000);
+  sqliteOsSleep(db->pVfs, 1000);
   return 1;
 #endif
 }
@@ -730,15 +763,21 @@ void sqlite_busy_handler(
 ){
   db->xBusyCallback = xBusy;
   db->pBusyArg = pArg;
+  db->busyTimeout = 0;
+  sqliteBtreeLockTimeout(db->pBe, 0);
 }
 
 /*
 ** This routine installs a default busy handler that waits for the
-** specified number of milliseconds before returning 0.
+** specified number of milliseconds before returning 0.  Where the
+** VFS allows it, the wait is done inside the pager by blocking on
+** the lock itself, so that it ends as soon as the lock is released.
 */
 void sqlite_busy_timeout(sqlite *db, int ms){
   if( ms>0 ){
-    sqlite_busy_handler(db, sqliteDefaultBusyCallback, (void*)ms);
+    sqlite_busy_handler(db, sqliteDefaultBusyCallback, db);
+    db->busyTimeout = ms;
+    sqliteBtreeLockTimeout(db->pBe, ms);
   }else{
     sqlite_busy_handler(db, 0, 0);
   }
@@ -751,6 +790,100 @@ void sqlite_interrupt(sqlite *db){
   db->flags |= SQLITE_Interrupt;
 }
 
+/*
+** Turn the shared page cache on or off for databases that are opened
+** from now on.
+*/
+int sqlite_enable_shared_cache(int enable){
+  sqliteBtreeSharedCache(enable);
+  return SQLITE_OK;
+}
+
+/*
+** An online backup of a database.  The work is done by the BTree layer.
+** See sqliteBtreeBackupStep().
+*/
+struct sqlite_backup {
+  sqlite *db;            /* The database being copied */
+  BtBackup *pBackup;     /* The backup in progress */
+};
+
+/*
+** Start an online backup of database db into the file zFilename.
+*/
+sqlite_backup *sqlite_backup_init(
+  sqlite *db,               /* The database to copy */
+  const char *zFilename,    /* Name of the file to copy it into */
+  char **pzErrMsg           /* Write error messages here */
+){
+  sqlite_backup *p;
+  int rc;
+
+  if( pzErrMsg ) *pzErrMsg = 0;
+  if( sqliteSafetyCheck(db) ){
+    sqliteSetString(pzErrMsg, sqlite_error_string(SQLITE_MISUSE), 0);
+    sqliteStrRealloc(pzErrMsg);
+    return 0;
+  }
+  p = sqliteMalloc( sizeof(*p) );
+  if( p==0 ){
+    sqliteSetString(pzErrMsg, "out of memory", 0);
+    sqliteStrRealloc(pzErrMsg);
+    return 0;
+  }
+  rc = sqliteBtreeBackupOpen(db->pBe, zFilename, db->pVfs, &p->pBackup);
+  if( rc!=SQLITE_OK ){
+    if( rc==SQLITE_READONLY ){
+      sqliteSetString(pzErrMsg, "backup file is read-only: ", zFilename, 0);
+    }else{
+      sqliteSetString(pzErrMsg, "unable to open backup file: ", zFilename, 0);
+    }
+    sqliteFree(p);
+    sqliteStrRealloc(pzErrMsg);
+    return 0;
+  }
+  p->db = db;
+  return p;
+}
+
+/*
+** Copy up to nPage more pages of the database into the backup file.
+*/
+int sqlite_backup_step(sqlite_backup *p, int nPage){
+  if( sqliteSafetyCheck(p->db) ) return SQLITE_MISUSE;
+  return sqliteBtreeBackupStep(p->pBackup, nPage);
+}
+
+/*
+** Return the number of pages that are still to be copied, as of the
+** last call to sqlite_backup_step().
+*/
+int sqlite_backup_remaining(sqlite_backup *p){
+  int nRemaining, nPage;
+  sqliteBtreeBackupCounts(p->pBackup, &nRemaining, &nPage);
+  return nRemaining;
+}
+
+/*
+** Return the number of pages in the database, as of the last call to
+** sqlite_backup_step().
+*/
+int sqlite_backup_pagecount(sqlite_backup *p){
+  int nRemaining, nPage;
+  sqliteBtreeBackupCounts(p->pBackup, &nRemaining, &nPage);
+  return nPage;
+}
+
+/*
+** End a backup and free the sqlite_backup object.
+*/
+int sqlite_backup_finish(sqlite_backup *p){
+  int rc;
+  rc = sqliteBtreeBackupClose(p->pBackup);
+  sqliteFree(p);
+  return rc;
+}
+
 /*
 ** Windows systems should call this routine to free memory that
 ** is returned in the in the errmsg parameter of sqlite_open() when
@@ -783,6 +916,10 @@ const char *sqlite_libencoding(void){ return sqlite_encoding; }
 **
 ** If nArg is -1 it means that this function will accept any number
 ** of arguments, including 0.
+**
+** User-defined functions are never assumed to be deterministic, so a
+** call to one is evaluated separately for every row even when all of
+** its arguments are constant.
 */
 int sqlite_create_function(
   sqlite *db,          /* Add the function to this database connection */
@@ -798,6 +935,7 @@ int sqlite_create_function(
   p->xFunc = xFunc;
   p->xStep = 0;
   p->xFinalize = 0;
+  p->isDeterministic = 0;
   p->pUserData = pUserData;
   return 0;
 }
@@ -816,6 +954,7 @@ int sqlite_create_aggregate(
   p->xFunc = 0;
   p->xStep = xStep;
   p->xFinalize = xFinalize;
+  p->isDeterministic = 0;
   p->pUserData = pUserData;
   return 0;
 }
@@ -14,6 +14,21 @@
 ** systems.  The purpose of this file is to provide a uniform abstraction
 ** on which the rest of SQLite can operate.
 */
+
+/*
+** Ask for 64-bit file offsets on 32-bit Unix systems so that database
+** files can grow beyond 2 GB.  These must be defined before any system
+** header is included.  Compile with -DSQLITE_DISABLE_LFS on systems
+** where this does not work.
+*/
+#ifndef SQLITE_DISABLE_LFS
+# define _LARGE_FILE       1
+# ifndef _FILE_OFFSET_BITS
+#   define _FILE_OFFSET_BITS 64
+# endif
+# define _LARGEFILE_SOURCE 1
+#endif
+
 #include "sqliteInt.h"
 #include "os.h"
 
@@ -22,6 +37,8 @@
 # include <fcntl.h>
 # include <sys/stat.h>
 # include <time.h>
+# include <sys/uio.h>
+# include <sys/time.h>
 #endif
 #if OS_WIN
 # include <winbase.h>
@@ -35,10 +52,67 @@ static int last_page = 0;
 #define SEEK(X)     last_page=(X)
 #define TRACE1(X)   fprintf(stderr,X)
 #define TRACE2(X,Y) fprintf(stderr,X,Y)
+#define TRACE3(X,Y,Z) fprintf(stderr,X,Y,Z)
 #else
 #define SEEK(X)
 #define TRACE1(X)
 #define TRACE2(X,Y)
+#define TRACE3(X,Y,Z)
+#endif
+
+/*
+** Macros used to determine whether or not to use threads.  The
+** SQLITE_UNIX_THREADS macro is defined if we are synchronizing for
+** Posix threads and SQLITE_W32_THREADS is defined if we are
+** synchronizing using Win32 threads.
+*/
+#if OS_UNIX && defined(THREADSAFE) && THREADSAFE
+# include <pthread.h>
+# define SQLITE_UNIX_THREADS 1
+#endif
+#if OS_WIN && defined(THREADSAFE) && THREADSAFE
+# define SQLITE_W32_THREADS 1
+#endif
+
+/*
+** Static variables used for thread synchronization.
+**
+** The mutex used by sqliteOsEnterMutex() is only taken on paths that
+** are not run for every statement: opening databases, registering a
+** VFS, the random number generator and one-time initialization.  The
+** locking of database files does not use it.  lockHashMutex guards the
+** lockHash table, which is changed only when a file is opened or
+** closed, and each lockInfo has a mutex of its own for the locks on its
+** inode.  So threads that use different database files never wait for
+** one another.
+*/
+static int inMutex = 0;
+#ifdef SQLITE_UNIX_THREADS
+  static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  static pthread_mutex_t lockHashMutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+#ifdef SQLITE_W32_THREADS
+  static CRITICAL_SECTION cs;
+#endif
+
+/*
+** The built-in VFS keeps the following information about each open file.
+** A pointer to one of these is the handle that the built-in VFS gives
+** back when it opens a file.
+*/
+typedef struct NativeFile NativeFile;
+#if OS_UNIX
+struct NativeFile {
+  struct lockInfo *pLock;  /* Information about locks on this inode */
+  int fd;                  /* The file descriptor */
+  int locktype;            /* The SQLITE_LOCK_* level this user holds */
+};
+#endif
+#if OS_WIN
+struct NativeFile {
+  HANDLE h;                /* Handle for the open file */
+  int locktype;            /* The SQLITE_LOCK_* level this user holds */
+};
 #endif
 
 
@@ -78,21 +152,24 @@ static int last_page = 0;
 ** locks to see if another thread has previously set a lock on that same
 ** inode.
 **
-** The OsFile structure for POSIX is no longer just an integer file
+** The NativeFile structure for POSIX is no longer just an integer file
 ** descriptor.  It is now a structure that holds the integer file
 ** descriptor and a pointer to a structure that describes the internal
 ** locks on the corresponding inode.  There is one locking structure
-** per inode, so if the same inode is opened twice, both OsFile structures
+** per inode, so if the same inode is opened twice, both NativeFile structures
 ** point to the same locking structure.  The locking structure keeps
-** a reference count (so we will know when to delete it) and a "cnt"
-** field that tells us its internal lock status.  cnt==0 means the
-** file is unlocked.  cnt==-1 means the file has an exclusive lock.
-** cnt>0 means there are cnt shared locks on the file.
+** a reference count (so we will know when to delete it), the strongest
+** lock held on the file by any NativeFile of this process, and a "cnt"
+** field that counts how many of those NativeFiles hold at least a
+** SHARED lock.
 **
 ** Any attempt to lock or unlock a file first checks the locking
 ** structure.  The fcntl() system call is only invoked to set a 
-** POSIX lock if the internal lock structure transitions between
-** a locked and an unlocked state.
+** POSIX lock if the lock held by the process as a whole changes.
+** The check and the fcntl() call are made while holding the mutex of
+** the locking structure, so they are atomic with respect to other
+** threads using the same inode but do not hold up threads using
+** other files.
 */
 
 /*
@@ -106,16 +183,33 @@ struct inodeKey {
 
 /*
 ** An instance of the following structure is allocated for each inode.
-** A single inode can have multiple file descriptors, so each OsFile
+** A single inode can have multiple file descriptors, so each NativeFile
 ** structure contains a pointer to an instance of this object and this
-** object keeps a count of the number of OsFiles pointing to it.
+** object keeps a count of the number of NativeFiles pointing to it.
 */
 struct lockInfo {
   struct inodeKey key;  /* The lookup key */
-  int cnt;              /* 0: unlocked.  -1: write lock.  1...: read lock. */
+  int cnt;              /* Number of NativeFiles holding a SHARED lock */
+  int locktype;         /* Strongest SQLITE_LOCK_* level held */
   int nRef;             /* Number of pointers to this structure */
+  int nRelease;         /* Incremented whenever a lock is dropped or weakened */
+#ifdef SQLITE_UNIX_THREADS
+  pthread_mutex_t mutex;  /* Held while the fields above are used */
+  pthread_cond_t cond;    /* Signalled when a lock is dropped or weakened */
+#endif
 };
 
+/*
+** Enter and leave the mutex of a lockInfo structure.
+*/
+#ifdef SQLITE_UNIX_THREADS
+# define lockInfoEnter(P)  pthread_mutex_lock(&(P)->mutex)
+# define lockInfoLeave(P)  pthread_mutex_unlock(&(P)->mutex)
+#else
+# define lockInfoEnter(P)
+# define lockInfoLeave(P)
+#endif
+
 /* 
 ** This hash table maps inodes (in the form of inodeKey structures) into
 ** pointers to lockInfo structures.
@@ -137,23 +231,37 @@ static struct lockInfo *findLockInfo(int fd){
   memset(&key, 0, sizeof(key));
   key.dev = statbuf.st_dev;
   key.ino = statbuf.st_ino;
+#ifdef SQLITE_UNIX_THREADS
+  pthread_mutex_lock(&lockHashMutex);
+#endif
   pInfo = (struct lockInfo*)sqliteHashFind(&lockHash, &key, sizeof(key));
   if( pInfo==0 ){
     struct lockInfo *pOld;
     pInfo = sqliteMalloc( sizeof(*pInfo) );
-    if( pInfo==0 ) return 0;
-    pInfo->key = key;
-    pInfo->nRef = 1;
-    pInfo->cnt = 0;
-    pOld = sqliteHashInsert(&lockHash, &pInfo->key, sizeof(key), pInfo);
-    if( pOld!=0 ){
-      assert( pOld==pInfo );
-      sqliteFree(pInfo);
-      pInfo = 0;
+    if( pInfo!=0 ){
+      pInfo->key = key;
+      pInfo->nRef = 1;
+      pInfo->cnt = 0;
+      pInfo->locktype = SQLITE_LOCK_NONE;
+      pOld = sqliteHashInsert(&lockHash, &pInfo->key, sizeof(key), pInfo);
+      if( pOld!=0 ){
+        assert( pOld==pInfo );
+        sqliteFree(pInfo);
+        pInfo = 0;
+      }
     }
+#ifdef SQLITE_UNIX_THREADS
+    if( pInfo!=0 ){
+      pthread_mutex_init(&pInfo->mutex, 0);
+      pthread_cond_init(&pInfo->cond, 0);
+    }
+#endif
   }else{
     pInfo->nRef++;
   }
+#ifdef SQLITE_UNIX_THREADS
+  pthread_mutex_unlock(&lockHashMutex);
+#endif
   return pInfo;
 }
 
@@ -161,11 +269,67 @@ static struct lockInfo *findLockInfo(int fd){
 ** Release a lockInfo structure previously allocated by findLockInfo().
 */
 static void releaseLockInfo(struct lockInfo *pInfo){
+#ifdef SQLITE_UNIX_THREADS
+  pthread_mutex_lock(&lockHashMutex);
+#endif
   pInfo->nRef--;
   if( pInfo->nRef==0 ){
     sqliteHashInsert(&lockHash, &pInfo->key, sizeof(pInfo->key), 0);
+#ifdef SQLITE_UNIX_THREADS
+    pthread_mutex_destroy(&pInfo->mutex);
+    pthread_cond_destroy(&pInfo->cond);
+#endif
     sqliteFree(pInfo);
   }
+#ifdef SQLITE_UNIX_THREADS
+  pthread_mutex_unlock(&lockHashMutex);
+#endif
+}
+
+/*
+** Record that a lock on the inode described by pInfo has been dropped
+** or weakened and wake up any threads waiting for a lock on it.  The
+** caller must hold the mutex of pInfo.
+*/
+static void lockReleased(struct lockInfo *pInfo){
+  pInfo->nRelease++;
+#ifdef SQLITE_UNIX_THREADS
+  pthread_cond_broadcast(&pInfo->cond);
+#endif
+}
+
+/*
+** Wait for up to ms milliseconds for a lock on the inode described by
+** pInfo to be dropped or weakened.  nRelease is the value of
+** pInfo->nRelease seen before the last attempt to take the lock.  If it
+** has changed since, there is no need to wait at all.
+**
+** Only locks held within this process are noticed here.  POSIX has no
+** way to wait for a lock held by another process with a timeout, since
+** F_SETLKW waits forever unless a signal interrupts it, so the caller
+** just retries after ms milliseconds in that case.
+*/
+static void lockInfoWait(struct lockInfo *pInfo, int nRelease, int ms){
+#ifdef SQLITE_UNIX_THREADS
+  struct timeval now;
+  struct timespec until;
+  gettimeofday(&now, 0);
+  until.tv_sec = now.tv_sec + ms/1000;
+  until.tv_nsec = (now.tv_usec + (ms%1000)*1000)*1000;
+  if( until.tv_nsec>=1000000000 ){
+    until.tv_sec++;
+    until.tv_nsec -= 1000000000;
+  }
+  lockInfoEnter(pInfo);
+  if( pInfo->nRelease==nRelease ){
+    pthread_cond_timedwait(&pInfo->cond, &pInfo->mutex, &until);
+  }
+  lockInfoLeave(pInfo);
+#elif defined(HAVE_USLEEP) && HAVE_USLEEP
+  usleep(ms*1000);
+#else
+  sleep((ms+999)/1000);
+#endif
 }
 #endif  /** POSIX advisory lock work-around **/
 
@@ -186,11 +350,10 @@ static void local_ioerr(){
 #define SimulateIOError(A)
 #endif
 
-
 /*
 ** Delete the named file
 */
-int sqliteOsDelete(const char *zFilename){
+static int nativeDelete(sqlite_vfs *pVfs, const char *zFilename){
 #if OS_UNIX
   unlink(zFilename);
 #endif
@@ -203,7 +366,7 @@ int sqliteOsDelete(const char *zFilename){
 /*
 ** Return TRUE if the named file exists.
 */
-int sqliteOsFileExists(const char *zFilename){
+static int nativeFileExists(sqlite_vfs *pVfs, const char *zFilename){
 #if OS_UNIX
   return access(zFilename, 0)==0;
 #endif
@@ -212,47 +375,77 @@ int sqliteOsFileExists(const char *zFilename){
 #endif
 }
 
+/*
+** Release the operating system resources held by a NativeFile.  The
+** NativeFile structure itself is not freed.
+*/
+static void nativeRelease(NativeFile *id){
+#if OS_UNIX
+  close(id->fd);
+  releaseLockInfo(id->pLock);
+#endif
+#if OS_WIN
+  CloseHandle(id->h);
+#endif
+}
+
+/*
+** Make a copy of the newly opened file *id in memory obtained from
+** sqliteMalloc() and write a pointer to the copy into *ppFile.  The
+** file is closed again if the memory cannot be had.
+*/
+static int nativeSave(NativeFile *id, void **ppFile){
+  NativeFile *pNew = sqliteMalloc( sizeof(*pNew) );
+  if( pNew==0 ){
+    nativeRelease(id);
+    return SQLITE_NOMEM;
+  }
+  *pNew = *id;
+  *ppFile = pNew;
+  return SQLITE_OK;
+}
 
 /*
 ** Attempt to open a file for both reading and writing.  If that
 ** fails, try opening it read-only.  If the file does not exist,
 ** try to create it.
 **
-** On success, a handle for the open file is written to *id
+** On success, a handle for the open file is written to *ppFile
 ** and *pReadonly is set to 0 if the file was opened for reading and
 ** writing or 1 if the file was opened read-only.  The function returns
 ** SQLITE_OK.
 **
 ** On failure, the function returns SQLITE_CANTOPEN and leaves
-** *pResulst and *pReadonly unchanged.
+** *ppFile and *pReadonly unchanged.
 */
-int sqliteOsOpenReadWrite(
+static int nativeOpenReadWrite(
+  sqlite_vfs *pVfs,
   const char *zFilename,
-  OsFile *id,
+  void **ppFile,
   int *pReadonly
 ){
 #if OS_UNIX
+  NativeFile f, *id = &f;
   id->fd = open(zFilename, O_RDWR|O_CREAT, 0644);
   if( id->fd<0 ){
     id->fd = open(zFilename, O_RDONLY);
     if( id->fd<0 ){
-      return SQLITE_CANTOPEN; 
+      return SQLITE_CANTOPEN;
     }
     *pReadonly = 1;
   }else{
     *pReadonly = 0;
   }
-  sqliteOsEnterMutex();
   id->pLock = findLockInfo(id->fd);
-  sqliteOsLeaveMutex();
   if( id->pLock==0 ){
     close(id->fd);
     return SQLITE_NOMEM;
   }
-  id->locked = 0;
-  return SQLITE_OK;
+  id->locktype = SQLITE_LOCK_NONE;
+  return nativeSave(id, ppFile);
 #endif
 #if OS_WIN
+  NativeFile f, *id = &f;
   HANDLE h = CreateFile(zFilename,
      GENERIC_READ | GENERIC_WRITE,
      FILE_SHARE_READ | FILE_SHARE_WRITE,
@@ -278,8 +471,8 @@ int sqliteOsOpenReadWrite(
     *pReadonly = 0;
   }
   id->h = h;
-  id->locked = 0;
-  return SQLITE_OK;
+  id->locktype = SQLITE_LOCK_NONE;
+  return nativeSave(id, ppFile);
 #endif
 }
 
@@ -294,12 +487,18 @@ int sqliteOsOpenReadWrite(
 ** If delFlag is true, then make arrangements to automatically delete
 ** the file when it is closed.
 **
-** On success, write the file handle into *id and return SQLITE_OK.
+** On success, write the file handle into *ppFile and return SQLITE_OK.
 **
 ** On failure, return SQLITE_CANTOPEN.
 */
-int sqliteOsOpenExclusive(const char *zFilename, OsFile *id, int delFlag){
+static int nativeOpenExclusive(
+  sqlite_vfs *pVfs,
+  const char *zFilename,
+  void **ppFile,
+  int delFlag
+){
 #if OS_UNIX
+  NativeFile f, *id = &f;
   if( access(zFilename, 0)==0 ){
     return SQLITE_CANTOPEN;
   }
@@ -310,25 +509,24 @@ int sqliteOsOpenExclusive(const char *zFilename, OsFile *id, int delFlag){
   if( id->fd<0 ){
     return SQLITE_CANTOPEN;
   }
-  sqliteOsEnterMutex();
   id->pLock = findLockInfo(id->fd);
-  sqliteOsLeaveMutex();
   if( id->pLock==0 ){
     close(id->fd);
     unlink(zFilename);
     return SQLITE_NOMEM;
   }
-  id->locked = 0;
+  id->locktype = SQLITE_LOCK_NONE;
   if( delFlag ){
     unlink(zFilename);
   }
-  return SQLITE_OK;
+  return nativeSave(id, ppFile);
 #endif
 #if OS_WIN
+  NativeFile f, *id = &f;
   HANDLE h;
   int fileflags;
   if( delFlag ){
-    fileflags = FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_RANDOM_ACCESS 
+    fileflags = FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_RANDOM_ACCESS
                      | FILE_FLAG_DELETE_ON_CLOSE;
   }else{
     fileflags = FILE_FLAG_RANDOM_ACCESS;
@@ -345,35 +543,39 @@ int sqliteOsOpenExclusive(const char *zFilename, OsFile *id, int delFlag){
     return SQLITE_CANTOPEN;
   }
   id->h = h;
-  id->locked = 0;
-  return SQLITE_OK;
+  id->locktype = SQLITE_LOCK_NONE;
+  return nativeSave(id, ppFile);
 #endif
 }
 
 /*
 ** Attempt to open a new file for read-only access.
 **
-** On success, write the file handle into *id and return SQLITE_OK.
+** On success, write the file handle into *ppFile and return SQLITE_OK.
 **
 ** On failure, return SQLITE_CANTOPEN.
 */
-int sqliteOsOpenReadOnly(const char *zFilename, OsFile *id){
+static int nativeOpenReadOnly(
+  sqlite_vfs *pVfs,
+  const char *zFilename,
+  void **ppFile
+){
 #if OS_UNIX
+  NativeFile f, *id = &f;
   id->fd = open(zFilename, O_RDONLY);
   if( id->fd<0 ){
     return SQLITE_CANTOPEN;
   }
-  sqliteOsEnterMutex();
   id->pLock = findLockInfo(id->fd);
-  sqliteOsLeaveMutex();
   if( id->pLock==0 ){
     close(id->fd);
     return SQLITE_NOMEM;
   }
-  id->locked = 0;
-  return SQLITE_OK;
+  id->locktype = SQLITE_LOCK_NONE;
+  return nativeSave(id, ppFile);
 #endif
 #if OS_WIN
+  NativeFile f, *id = &f;
   HANDLE h = CreateFile(zFilename,
      GENERIC_READ,
      0,
@@ -386,8 +588,8 @@ int sqliteOsOpenReadOnly(const char *zFilename, OsFile *id){
     return SQLITE_CANTOPEN;
   }
   id->h = h;
-  id->locked = 0;
-  return SQLITE_OK;
+  id->locktype = SQLITE_LOCK_NONE;
+  return nativeSave(id, ppFile);
 #endif
 }
 
@@ -395,7 +597,7 @@ int sqliteOsOpenReadOnly(const char *zFilename, OsFile *id){
 ** Create a temporary file name in zBuf.  zBuf must be big enough to
 ** hold at least SQLITE_TEMPNAME_SIZE characters.
 */
-int sqliteOsTempFileName(char *zBuf){
+static int nativeTempFileName(sqlite_vfs *pVfs, char *zBuf){
 #if OS_UNIX
   static const char *azDirs[] = {
      ".",
@@ -445,47 +647,100 @@ int sqliteOsTempFileName(char *zBuf){
       zBuf[j++] = zChars[n];
     }
     zBuf[j] = 0;
-    if( !sqliteOsFileExists(zBuf) ) break;
+    if( !nativeFileExists(pVfs, zBuf) ) break;
   }
 #endif
-  return SQLITE_OK; 
+  return SQLITE_OK;
 }
 
 /*
-** Close a file
+** Make sure that the creation or deletion of the file named zFilename
+** is committed to disk, by syncing the directory that holds it.  Windows
+** keeps directory entries safe on its own, so this is a no-op there.
+** It is also a no-op if the directory cannot be opened.
 */
-int sqliteOsClose(OsFile *id){
+static int nativeSyncDirectory(sqlite_vfs *pVfs, const char *zFilename){
 #if OS_UNIX
-  close(id->fd);
-  sqliteOsEnterMutex();
-  releaseLockInfo(id->pLock);
-  sqliteOsLeaveMutex();
-  return SQLITE_OK;
+  char *zDir;
+  int i, fd, rc;
+  SimulateIOError(SQLITE_IOERR);
+  TRACE2("DIRSYNC %s\n", zFilename);
+  zDir = sqliteStrDup(zFilename);
+  if( zDir==0 ) return SQLITE_NOMEM;
+  for(i=strlen(zDir); i>0 && zDir[i-1]!='/'; i--){}
+  if( i>1 ){
+    zDir[i-1] = 0;
+  }else if( i==1 ){
+    zDir[1] = 0;
+  }else{
+    sqliteFree(zDir);
+    zDir = sqliteStrDup(".");
+    if( zDir==0 ) return SQLITE_NOMEM;
+  }
+  fd = open(zDir, O_RDONLY);
+  sqliteFree(zDir);
+  if( fd<0 ) return SQLITE_OK;
+  rc = fsync(fd)==0 ? SQLITE_OK : SQLITE_IOERR;
+  close(fd);
+  return rc;
 #endif
 #if OS_WIN
-  CloseHandle(id->h);
   return SQLITE_OK;
 #endif
 }
 
 /*
-** Read data from a file into a buffer.  Return SQLITE_OK if all
-** bytes were read successfully and SQLITE_IOERR if anything goes
-** wrong.
+** Close a file
+*/
+static int nativeClose(void *pFile){
+  NativeFile *id = (NativeFile*)pFile;
+  nativeRelease(id);
+  sqliteFree(id);
+  return SQLITE_OK;
+}
+
+/*
+** Use pwritev() to hand several buffers to the kernel at a given file
+** offset where the system has it.  Elsewhere nativeWritev() seeks and
+** then calls writev(), which costs one extra system call per call.
 */
-int sqliteOsRead(OsFile *id, void *pBuf, int amt){
+#if OS_UNIX && !defined(HAVE_PWRITEV)
+# if defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__) \
+     || defined(__OpenBSD__)
+#  define HAVE_PWRITEV 1
+# else
+#  define HAVE_PWRITEV 0
+# endif
+#endif
+
+/*
+** Read amt bytes from a file, beginning at byte offset "offset", into
+** a buffer.  Return SQLITE_OK if all bytes were read successfully and
+** SQLITE_IOERR if anything goes wrong.
+**
+** All reads and writes name the offset they work on.  The file position
+** of the file is never used, so a single file may be read from or
+** written to by more than one thread at a time.
+*/
+static int nativeRead(void *pFile, void *pBuf, int amt, off64 offset){
+  NativeFile *id = (NativeFile*)pFile;
 #if OS_UNIX
   int got;
+  SEEK(offset/1024 + 1);
   SimulateIOError(SQLITE_IOERR);
   TRACE2("READ %d\n", last_page);
-  got = read(id->fd, pBuf, amt);
+  got = pread(id->fd, pBuf, amt, offset);
   if( got<0 ) got = 0;
   return got==amt ? SQLITE_OK : SQLITE_IOERR;
 #endif
 #if OS_WIN
   DWORD got;
+  OVERLAPPED ov;
   SimulateIOError(SQLITE_IOERR);
-  if( !ReadFile(id->h, pBuf, amt, &got, 0) ){
+  memset(&ov, 0, sizeof(ov));
+  ov.Offset = (DWORD)offset;
+  ov.OffsetHigh = (DWORD)(offset>>32);
+  if( !ReadFile(id->h, pBuf, amt, &got, &ov) ){
     got = 0;
   }
   return got==amt ? SQLITE_OK : SQLITE_IOERR;
@@ -493,22 +748,29 @@ int sqliteOsRead(OsFile *id, void *pBuf, int amt){
 }
 
 /*
-** Write data from a buffer into a file.  Return SQLITE_OK on success
-** or some other error code on failure.
+** Write amt bytes from a buffer into a file beginning at byte offset
+** "offset".  Return SQLITE_OK on success or some other error code on
+** failure.
 */
-int sqliteOsWrite(OsFile *id, const void *pBuf, int amt){
+static int nativeWrite(void *pFile, const void *pBuf, int amt, off64 offset){
+  NativeFile *id = (NativeFile*)pFile;
 #if OS_UNIX
   int wrote;
+  SEEK(offset/1024 + 1);
   SimulateIOError(SQLITE_IOERR);
   TRACE2("WRITE %d\n", last_page);
-  wrote = write(id->fd, pBuf, amt);
+  wrote = pwrite(id->fd, pBuf, amt, offset);
   if( wrote<amt ) return SQLITE_FULL;
   return SQLITE_OK;
 #endif
 #if OS_WIN
   DWORD wrote;
+  OVERLAPPED ov;
   SimulateIOError(SQLITE_IOERR);
-  if( !WriteFile(id->h, pBuf, amt, &wrote, 0) || (int)wrote<amt ){
+  memset(&ov, 0, sizeof(ov));
+  ov.Offset = (DWORD)offset;
+  ov.OffsetHigh = (DWORD)(offset>>32);
+  if( !WriteFile(id->h, pBuf, amt, &wrote, &ov) || (int)wrote<amt ){
     return SQLITE_FULL;
   }
   return SQLITE_OK;
@@ -516,27 +778,79 @@ int sqliteOsWrite(OsFile *id, const void *pBuf, int amt){
 }
 
 /*
-** Move the read/write pointer in a file.
+** The largest number of buffers handed to a single writev() call.
+** POSIX guarantees that at least 16 are allowed.
 */
-int sqliteOsSeek(OsFile *id, int offset){
-  SEEK(offset/1024 + 1);
+#define MX_IOVEC 16
+
+/*
+** Write nBuf buffers of amt bytes each into a file, one after another,
+** starting at byte offset "offset".  This has the same effect as calling
+** nativeWrite() once for each buffer, but on Unix the buffers are
+** handed to the kernel together with pwritev() or writev().  Return
+** SQLITE_OK on success or some other error code on failure.
+*/
+static int nativeWritev(
+  void *pFile,            /* Write to this file */
+  void **apBuf,           /* The buffers to write */
+  int nBuf,               /* Number of buffers in apBuf[] */
+  int amt,                /* Number of bytes in each buffer */
+  off64 offset            /* Where in the file to write the first buffer */
+){
 #if OS_UNIX
-  lseek(id->fd, offset, SEEK_SET);
+  NativeFile *id = (NativeFile*)pFile;
+  struct iovec aIov[MX_IOVEC];
+  int i, n, wrote;
+  while( nBuf>0 ){
+    SimulateIOError(SQLITE_IOERR);
+    n = nBuf<MX_IOVEC ? nBuf : MX_IOVEC;
+    for(i=0; i<n; i++){
+      aIov[i].iov_base = apBuf[i];
+      aIov[i].iov_len = amt;
+    }
+    SEEK(offset/1024 + 1);
+    TRACE3("WRITEV %d %d\n", last_page, n);
+#if HAVE_PWRITEV
+    wrote = pwritev(id->fd, aIov, n, offset);
+#else
+    if( lseek(id->fd, offset, SEEK_SET)!=offset ) return SQLITE_IOERR;
+    wrote = writev(id->fd, aIov, n);
+#endif
+    if( wrote<n*amt ) return SQLITE_FULL;
+    apBuf += n;
+    nBuf -= n;
+    offset += (off64)n*amt;
+  }
   return SQLITE_OK;
 #endif
 #if OS_WIN
-  SetFilePointer(id->h, offset, 0, FILE_BEGIN);
+  int i, rc;
+  for(i=0; i<nBuf; i++){
+    rc = nativeWrite(pFile, apBuf[i], amt, offset + (off64)i*amt);
+    if( rc!=SQLITE_OK ) return rc;
+  }
   return SQLITE_OK;
 #endif
 }
 
 /*
 ** Make sure all writes to a particular file are committed to disk.
+**
+** If dataOnly is true, only the contents of the file and whatever
+** metadata is needed to read them back, such as the size of the file,
+** are flushed.  Other metadata, like the modification time, might not
+** be written.  On systems without fdatasync() both cases are the same.
 */
-int sqliteOsSync(OsFile *id){
+static int nativeSync(void *pFile, int dataOnly){
+  NativeFile *id = (NativeFile*)pFile;
   SimulateIOError(SQLITE_IOERR);
-  TRACE1("SYNC\n");
+  TRACE1(dataOnly ? "DATASYNC\n" : "SYNC\n");
 #if OS_UNIX
+# if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO>0
+  if( dataOnly ){
+    return fdatasync(id->fd)==0 ? SQLITE_OK : SQLITE_IOERR;
+  }
+# endif
   return fsync(id->fd)==0 ? SQLITE_OK : SQLITE_IOERR;
 #endif
 #if OS_WIN
@@ -547,14 +861,18 @@ int sqliteOsSync(OsFile *id){
 /*
 ** Truncate an open file to a specified size
 */
-int sqliteOsTruncate(OsFile *id, int nByte){
+static int nativeTruncate(void *pFile, off64 nByte){
+  NativeFile *id = (NativeFile*)pFile;
   SimulateIOError(SQLITE_IOERR);
 #if OS_UNIX
   return ftruncate(id->fd, nByte)==0 ? SQLITE_OK : SQLITE_IOERR;
 #endif
 #if OS_WIN
-  SetFilePointer(id->h, nByte, 0, FILE_BEGIN);
-  SetEndOfFile(id->h);
+  {
+    LONG upper = (LONG)(nByte>>32);
+    SetFilePointer(id->h, (LONG)nByte, &upper, FILE_BEGIN);
+    SetEndOfFile(id->h);
+  }
   return SQLITE_OK;
 #endif
 }
@@ -562,7 +880,8 @@ int sqliteOsTruncate(OsFile *id, int nByte){
 /*
 ** Determine the current size of a file in bytes
 */
-int sqliteOsFileSize(OsFile *id, int *pSize){
+static int nativeFileSize(void *pFile, off64 *pSize){
+  NativeFile *id = (NativeFile*)pFile;
 #if OS_UNIX
   struct stat buf;
   SimulateIOError(SQLITE_IOERR);
@@ -573,55 +892,119 @@ int sqliteOsFileSize(OsFile *id, int *pSize){
   return SQLITE_OK;
 #endif
 #if OS_WIN
+  DWORD upper, lower;
   SimulateIOError(SQLITE_IOERR);
-  *pSize = GetFileSize(id->h, 0);
+  lower = GetFileSize(id->h, &upper);
+  *pSize = (((off64)upper)<<32) + lower;
   return SQLITE_OK;
 #endif
 }
 
 
+#if OS_UNIX
 /*
-** Change the status of the lock on the file "id" to be a readlock.
-** If the file was write locked, then this reduces the lock to a read.
-** If the file was read locked, then this acquires a new read lock.
+** The locks are POSIX advisory locks on the following bytes of the
+** database file.  The bytes are far beyond the end of most databases,
+** and since the locks are only advisory they do not get in the way of
+** reading and writing a database that is bigger than that.
+**
+** A SHARED lock is a read lock on the SHARED_SIZE bytes starting at
+** SHARED_FIRST, and an EXCLUSIVE lock is a write lock on the same
+** bytes.  A RESERVED lock is a write lock on
+** RESERVED_BYTE and a PENDING lock is a write lock on PENDING_BYTE.
+** A read lock on PENDING_BYTE is held for a moment while a SHARED lock
+** is taken, so that no new SHARED lock is granted while a writer waits
+** for the readers to finish.
+*/
+#define PENDING_BYTE      0x40000000
+#define RESERVED_BYTE     (PENDING_BYTE+1)
+#define SHARED_FIRST      (PENDING_BYTE+2)
+#define SHARED_SIZE       510
+
+/*
+** Set a POSIX lock of the given type (F_RDLCK, F_WRLCK or F_UNLCK) on
+** nByte bytes of a file starting at iStart.  nByte==0 means to the end
+** of the file.  Return zero on success.
+*/
+static int lockRange(int fd, int type, off64 iStart, int nByte){
+  struct flock lock;
+  lock.l_type = type;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = iStart;
+  lock.l_len = nByte;
+  return fcntl(fd, F_SETLK, &lock);
+}
+#endif
+
+/*
+** Move the lock on the file "id" up to level eLock, which is SHARED,
+** RESERVED or EXCLUSIVE.  An EXCLUSIVE lock is taken by way of PENDING.
+** If the PENDING lock is obtained but the EXCLUSIVE lock is busy, the
+** file is left at PENDING so that the next attempt does not have to
+** compete with new readers.
 **
 ** Return SQLITE_OK on success and SQLITE_BUSY on failure.
 */
-int sqliteOsReadLock(OsFile *id){
+static int nativeLockUp(NativeFile *id, int eLock){
 #if OS_UNIX
-  int rc;
-  sqliteOsEnterMutex();
-  if( id->pLock->cnt>0 ){
-    if( !id->locked ){
-      id->pLock->cnt++;
-      id->locked = 1;
-    }
-    rc = SQLITE_OK;
-  }else if( id->locked || id->pLock->cnt==0 ){
-    struct flock lock;
-    lock.l_type = F_RDLCK;
-    lock.l_whence = SEEK_SET;
-    lock.l_start = lock.l_len = 0L;
-    if( fcntl(id->fd, F_SETLK, &lock)!=0 ){
+  struct lockInfo *pLock = id->pLock;
+  int rc = SQLITE_OK;
+  lockInfoEnter(pLock);
+  if( pLock->locktype!=id->locktype
+   && (pLock->locktype>=SQLITE_LOCK_PENDING || eLock>SQLITE_LOCK_SHARED) ){
+    /* Another NativeFile of this process holds a conflicting lock */
+    rc = SQLITE_BUSY;
+  }else if( eLock==SQLITE_LOCK_SHARED && pLock->cnt>0 ){
+    /* Join the SHARED lock that this process already holds */
+    pLock->cnt++;
+    id->locktype = SQLITE_LOCK_SHARED;
+  }else if( eLock==SQLITE_LOCK_SHARED ){
+    if( lockRange(id->fd, F_RDLCK, PENDING_BYTE, 1)!=0 ){
       rc = SQLITE_BUSY;
     }else{
-      rc = SQLITE_OK;
-      id->pLock->cnt = 1;
-      id->locked = 1;
+      if( lockRange(id->fd, F_RDLCK, SHARED_FIRST, SHARED_SIZE)!=0 ){
+        rc = SQLITE_BUSY;
+      }else{
+        pLock->cnt = 1;
+        pLock->locktype = id->locktype = SQLITE_LOCK_SHARED;
+      }
+      lockRange(id->fd, F_UNLCK, PENDING_BYTE, 1);
     }
   }else{
-    rc = SQLITE_BUSY;
+    assert( id->locktype>=SQLITE_LOCK_SHARED );
+    if( eLock==SQLITE_LOCK_EXCLUSIVE && id->locktype<SQLITE_LOCK_PENDING ){
+      if( lockRange(id->fd, F_WRLCK, PENDING_BYTE, 1)!=0 ){
+        rc = SQLITE_BUSY;
+      }else{
+        pLock->locktype = id->locktype = SQLITE_LOCK_PENDING;
+      }
+    }
+    if( rc==SQLITE_OK ){
+      if( eLock==SQLITE_LOCK_RESERVED ){
+        rc = lockRange(id->fd, F_WRLCK, RESERVED_BYTE, 1);
+      }else if( pLock->cnt>1 ){
+        rc = SQLITE_BUSY;
+      }else{
+        rc = lockRange(id->fd, F_WRLCK, SHARED_FIRST, SHARED_SIZE);
+      }
+      if( rc!=0 ){
+        rc = SQLITE_BUSY;
+      }else{
+        pLock->locktype = id->locktype = eLock;
+      }
+    }
   }
-  sqliteOsLeaveMutex();
+  lockInfoLeave(pLock);
   return rc;
 #endif
 #if OS_WIN
   int rc;
-  if( id->locked ){
+  if( id->locktype>SQLITE_LOCK_NONE ){
     rc = SQLITE_OK;
+    id->locktype = eLock;
   }else if( LockFile(id->h, 0, 0, 1024, 0) ){
     rc = SQLITE_OK;
-    id->locked = 1;
+    id->locktype = eLock;
   }else{
     rc = SQLITE_BUSY;
   }
@@ -630,38 +1013,43 @@ int sqliteOsReadLock(OsFile *id){
 }
 
 /*
-** Change the lock status to be an exclusive or write lock.  Return
-** SQLITE_OK on success and SQLITE_BUSY on a failure.
+** Move the lock on the file "id" down to level eLock, which is NONE or
+** SHARED.
 */
-int sqliteOsWriteLock(OsFile *id){
+static int nativeLockDown(NativeFile *id, int eLock){
 #if OS_UNIX
-  int rc;
-  sqliteOsEnterMutex();
-  if( id->pLock->cnt==0 || (id->pLock->cnt==1 && id->locked==1) ){
-    struct flock lock;
-    lock.l_type = F_WRLCK;
-    lock.l_whence = SEEK_SET;
-    lock.l_start = lock.l_len = 0L;
-    if( fcntl(id->fd, F_SETLK, &lock)!=0 ){
+  struct lockInfo *pLock = id->pLock;
+  int rc = SQLITE_OK;
+  lockInfoEnter(pLock);
+  assert( pLock->cnt!=0 );
+  lockReleased(pLock);
+  if( id->locktype>SQLITE_LOCK_SHARED ){
+    if( eLock==SQLITE_LOCK_SHARED
+     && lockRange(id->fd, F_RDLCK, SHARED_FIRST, SHARED_SIZE)!=0 ){
       rc = SQLITE_BUSY;
-    }else{
-      rc = SQLITE_OK;
-      id->pLock->cnt = -1;
-      id->locked = 1;
     }
-  }else{
-    rc = SQLITE_BUSY;
+    lockRange(id->fd, F_UNLCK, PENDING_BYTE, 2);
+    pLock->locktype = SQLITE_LOCK_SHARED;
   }
-  sqliteOsLeaveMutex();
+  if( eLock==SQLITE_LOCK_NONE ){
+    pLock->cnt--;
+    if( pLock->cnt==0 ){
+      if( lockRange(id->fd, F_UNLCK, 0, 0)!=0 ) rc = SQLITE_BUSY;
+      pLock->locktype = SQLITE_LOCK_NONE;
+    }
+  }
+  lockInfoLeave(pLock);
+  id->locktype = eLock;
   return rc;
 #endif
 #if OS_WIN
   int rc;
-  if( id->locked ){
+  if( eLock>SQLITE_LOCK_NONE ){
     rc = SQLITE_OK;
-  }else if( LockFile(id->h, 0, 0, 1024, 0) ){
+    id->locktype = eLock;
+  }else if( UnlockFile(id->h, 0, 0, 1024, 0) ){
     rc = SQLITE_OK;
-    id->locked = 1;
+    id->locktype = SQLITE_LOCK_NONE;
   }else{
     rc = SQLITE_BUSY;
   }
@@ -670,52 +1058,114 @@ int sqliteOsWriteLock(OsFile *id){
 }
 
 /*
-** Unlock the given file descriptor.  If the file descriptor was
-** not previously locked, then this routine is a no-op.
+** Change the lock held on a file to one of the SQLITE_LOCK_* levels.
+**
+** Windows has only the one lock, so every level other than NONE takes
+** it and a single connection at a time can use a database there.
 */
-int sqliteOsUnlock(OsFile *id){
+static int nativeLock(void *pFile, int eLock){
+  NativeFile *id = (NativeFile*)pFile;
+  if( eLock==id->locktype ) return SQLITE_OK;
+  if( eLock<id->locktype ) return nativeLockDown(id, eLock);
+  return nativeLockUp(id, eLock);
+}
+
 #if OS_UNIX
+/*
+** Return TRUE if some connection other than "id" holds a PENDING or
+** EXCLUSIVE lock on the file.
+*/
+static int writerPending(NativeFile *id){
+  struct lockInfo *pLock = id->pLock;
+  struct flock lock;
   int rc;
-  if( !id->locked ) return SQLITE_OK;
-  sqliteOsEnterMutex();
-  assert( id->pLock->cnt!=0 );
-  if( id->pLock->cnt>1 ){
-    id->pLock->cnt--;
-    rc = SQLITE_OK;
-  }else{
-    struct flock lock;
-    lock.l_type = F_UNLCK;
-    lock.l_whence = SEEK_SET;
-    lock.l_start = lock.l_len = 0L;
-    if( fcntl(id->fd, F_SETLK, &lock)!=0 ){
-      rc = SQLITE_BUSY;
-    }else{
-      rc = SQLITE_OK;
-      id->pLock->cnt = 0;
-    }
+  lockInfoEnter(pLock);
+  rc = pLock->locktype>=SQLITE_LOCK_PENDING
+          && id->locktype<SQLITE_LOCK_PENDING;
+  lockInfoLeave(pLock);
+  if( rc ) return 1;
+  lock.l_type = F_RDLCK;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = PENDING_BYTE;
+  lock.l_len = 1;
+  if( fcntl(id->fd, F_GETLK, &lock)!=0 ) return 0;
+  return lock.l_type!=F_UNLCK;
+}
+#endif
+
+/*
+** How often, in milliseconds, nativeLockWait() retries a lock that
+** might be held by another process.  The first retry comes after
+** LOCK_POLL_MIN_MS and the delay doubles after each one, up to
+** LOCK_POLL_MAX_MS.  So a lock that another process releases is taken
+** no more than LOCK_POLL_MAX_MS after it is released, plus however late
+** the operating system wakes the waiter.  The cost of the short cap is
+** one fcntl() call every few milliseconds while a long lock is held.
+*/
+#ifndef LOCK_POLL_MIN_MS
+# define LOCK_POLL_MIN_MS 1
+#endif
+#ifndef LOCK_POLL_MAX_MS
+# define LOCK_POLL_MAX_MS 4
+#endif
+
+/*
+** Change the lock held on a file like nativeLock().  But if the lock is
+** busy, keep trying for up to ms milliseconds before giving up.  A lock
+** held by another thread of this process is retried as soon as it is
+** released.  A lock held by another process is retried after a delay
+** that backs off from LOCK_POLL_MIN_MS to LOCK_POLL_MAX_MS, and never
+** runs past the end of the timeout.
+**
+** There is no waiting for a RESERVED lock while another connection holds
+** PENDING.  That connection is a writer waiting for this one to drop its
+** SHARED lock, and if both waited neither could go on until one of them
+** timed out.
+*/
+static int nativeLockWait(void *pFile, int eLock, int ms){
+#if OS_UNIX
+  NativeFile *id = (NativeFile*)pFile;
+  struct timeval start, now;
+  int rc, nRelease, elapsed;
+  int delay = LOCK_POLL_MIN_MS;
+  gettimeofday(&start, 0);
+  for(;;){
+    lockInfoEnter(id->pLock);
+    nRelease = id->pLock->nRelease;
+    lockInfoLeave(id->pLock);
+    rc = nativeLock(pFile, eLock);
+    if( rc!=SQLITE_BUSY ) return rc;
+    if( eLock==SQLITE_LOCK_RESERVED && writerPending(id) ) return rc;
+    gettimeofday(&now, 0);
+    elapsed = (now.tv_sec - start.tv_sec)*1000
+                 + (now.tv_usec - start.tv_usec)/1000;
+    if( elapsed>=ms ) return rc;
+    if( delay>ms-elapsed ) delay = ms-elapsed;
+    lockInfoWait(id->pLock, nRelease, delay);
+    delay *= 2;
+    if( delay>LOCK_POLL_MAX_MS ) delay = LOCK_POLL_MAX_MS;
   }
-  sqliteOsLeaveMutex();
-  id->locked = 0;
-  return rc;
 #endif
 #if OS_WIN
-  int rc;
-  if( !id->locked ){
-    rc = SQLITE_OK;
-  }else if( UnlockFile(id->h, 0, 0, 1024, 0) ){
-    rc = SQLITE_OK;
-    id->locked = 0;
-  }else{
-    rc = SQLITE_BUSY;
+  DWORD start = GetTickCount();
+  int rc, elapsed;
+  int delay = LOCK_POLL_MIN_MS;
+  for(;;){
+    rc = nativeLock(pFile, eLock);
+    elapsed = (int)(GetTickCount()-start);
+    if( rc!=SQLITE_BUSY || elapsed>=ms ) return rc;
+    if( delay>ms-elapsed ) delay = ms-elapsed;
+    Sleep(delay);
+    delay *= 2;
+    if( delay>LOCK_POLL_MAX_MS ) delay = LOCK_POLL_MAX_MS;
   }
-  return rc;
 #endif
 }
 
 /*
 ** Get information to seed the random number generator.
 */
-int sqliteOsRandomSeed(char *zBuf){
+static int nativeRandomSeed(sqlite_vfs *pVfs, char *zBuf){
   static int once = 1;
 #if OS_UNIX
   int pid;
@@ -738,7 +1188,7 @@ int sqliteOsRandomSeed(char *zBuf){
 /*
 ** Sleep for a little while.  Return the amount of time slept.
 */
-int sqliteOsSleep(int ms){
+static int nativeSleep(sqlite_vfs *pVfs, int ms){
 #if OS_UNIX
 #if defined(HAVE_USLEEP) && HAVE_USLEEP
   usleep(ms*1000);
@@ -755,29 +1205,236 @@ int sqliteOsSleep(int ms){
 }
 
 /*
-** Macros used to determine whether or not to use threads.  The
-** SQLITE_UNIX_THREADS macro is defined if we are synchronizing for
-** Posix threads and SQLITE_W32_THREADS is defined if we are
-** synchronizing using Win32 threads.
+** The built-in VFS.  It talks directly to the operating system.
 */
-#if OS_UNIX && defined(THREADSAFE) && THREADSAFE
-# include <pthread.h>
-# define SQLITE_UNIX_THREADS 1
+static sqlite_vfs nativeVfs = {
+#if OS_UNIX
+  "unix",
 #endif
-#if OS_WIN && defined(THREADSAFE) && THREADSAFE
-# define SQLITE_W32_THREADS 1
+#if OS_WIN
+  "win32",
 #endif
+  0,                     /* pAppData */
+  0,                     /* pNext */
+  nativeOpenReadWrite,
+  nativeOpenExclusive,
+  nativeOpenReadOnly,
+  nativeDelete,
+  nativeFileExists,
+  nativeTempFileName,
+  nativeSyncDirectory,
+  nativeClose,
+  nativeRead,
+  nativeWrite,
+  nativeWritev,
+  nativeSync,
+  nativeTruncate,
+  nativeFileSize,
+  nativeLock,
+  nativeRandomSeed,
+  nativeSleep,
+  nativeLockWait,
+};
 
 /*
-** Static variables used for thread synchronization
+** All registered VFSes.  The first entry on the list is the default.
 */
-static int inMutex = 0;
-#ifdef SQLITE_UNIX_THREADS
-  static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static sqlite_vfs *pVfsList = &nativeVfs;
+
+/*
+** Unlink pVfs from the list of registered VFSes, if it is there.  The
+** caller must hold the mutex.
+*/
+static void vfsUnlink(sqlite_vfs *pVfs){
+  sqlite_vfs **pp;
+  for(pp=&pVfsList; *pp; pp=&(*pp)->pNext){
+    if( *pp==pVfs ){
+      *pp = pVfs->pNext;
+      break;
+    }
+  }
+}
+
+/*
+** Register a new VFS.  If makeDefault is true, the new VFS becomes
+** the one used by sqlite_open().
+*/
+int sqlite_vfs_register(sqlite_vfs *pVfs, int makeDefault){
+  if( pVfs==0 || pVfs->zName==0 ) return SQLITE_MISUSE;
+  sqliteOsEnterMutex();
+  vfsUnlink(pVfs);
+  if( makeDefault || pVfsList==0 ){
+    pVfs->pNext = pVfsList;
+    pVfsList = pVfs;
+  }else{
+    pVfs->pNext = pVfsList->pNext;
+    pVfsList->pNext = pVfs;
+  }
+  sqliteOsLeaveMutex();
+  return SQLITE_OK;
+}
+
+/*
+** Remove a VFS from the list of registered VFSes.  If it was the
+** default, the next VFS on the list becomes the default.  The built-in
+** VFS always stays on the list.
+*/
+int sqlite_vfs_unregister(sqlite_vfs *pVfs){
+  if( pVfs==0 || pVfs==&nativeVfs ) return SQLITE_MISUSE;
+  sqliteOsEnterMutex();
+  vfsUnlink(pVfs);
+  sqliteOsLeaveMutex();
+  return SQLITE_OK;
+}
+
+/*
+** Locate the registered VFS named zName.  Return the default VFS if
+** zName is NULL and NULL if there is no VFS by that name.
+**
+** This routine does not take the mutex because the random number
+** generator calls it, with the mutex already held, to find the VFS
+** that seeds it.  VFSes are normally registered once when a program
+** starts, before any database is opened.
+*/
+sqlite_vfs *sqlite_vfs_find(const char *zName){
+  sqlite_vfs *pVfs;
+  for(pVfs=pVfsList; pVfs && zName; pVfs=pVfs->pNext){
+    if( strcmp(zName, pVfs->zName)==0 ) break;
+  }
+  return pVfs;
+}
+
+/*
+** The rest of SQLite does its I/O through the following routines.  Those
+** that open a file or work on a file name are given the VFS to use.  The
+** others pass the request on to the VFS that opened the file.
+*/
+int sqliteOsDelete(sqlite_vfs *pVfs, const char *zFilename){
+  return pVfs->xDelete(pVfs, zFilename);
+}
+int sqliteOsFileExists(sqlite_vfs *pVfs, const char *zFilename){
+  return pVfs->xFileExists(pVfs, zFilename);
+}
+int sqliteOsOpenReadWrite(
+  sqlite_vfs *pVfs,
+  const char *zFilename,
+  OsFile *id,
+  int *pReadonly
+){
+  id->pVfs = pVfs;
+  return pVfs->xOpenReadWrite(pVfs, zFilename, &id->pHandle, pReadonly);
+}
+int sqliteOsOpenExclusive(
+  sqlite_vfs *pVfs,
+  const char *zFilename,
+  OsFile *id,
+  int delFlag
+){
+  id->pVfs = pVfs;
+  return pVfs->xOpenExclusive(pVfs, zFilename, &id->pHandle, delFlag);
+}
+int sqliteOsOpenReadOnly(sqlite_vfs *pVfs, const char *zFilename, OsFile *id){
+  id->pVfs = pVfs;
+  return pVfs->xOpenReadOnly(pVfs, zFilename, &id->pHandle);
+}
+int sqliteOsTempFileName(sqlite_vfs *pVfs, char *zBuf){
+  return pVfs->xTempFileName(pVfs, zBuf);
+}
+int sqliteOsSyncDirectory(sqlite_vfs *pVfs, const char *zFilename){
+  return pVfs->xSyncDirectory(pVfs, zFilename);
+}
+int sqliteOsClose(OsFile *id){
+  return id->pVfs->xClose(id->pHandle);
+}
+int sqliteOsRead(OsFile *id, void *pBuf, int amt, off64 offset){
+  return id->pVfs->xRead(id->pHandle, pBuf, amt, offset);
+}
+int sqliteOsWrite(OsFile *id, const void *pBuf, int amt, off64 offset){
+  return id->pVfs->xWrite(id->pHandle, pBuf, amt, offset);
+}
+int sqliteOsWritev(OsFile *id, void **apBuf, int nBuf, int amt, off64 offset){
+  int i, rc;
+  if( id->pVfs->xWritev ){
+    return id->pVfs->xWritev(id->pHandle, apBuf, nBuf, amt, offset);
+  }
+  for(i=0; i<nBuf; i++){
+    rc = id->pVfs->xWrite(id->pHandle, apBuf[i], amt, offset+(off64)i*amt);
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  return SQLITE_OK;
+}
+int sqliteOsSync(OsFile *id){
+  return id->pVfs->xSync(id->pHandle, 0);
+}
+int sqliteOsDataSync(OsFile *id){
+  return id->pVfs->xSync(id->pHandle, 1);
+}
+int sqliteOsTruncate(OsFile *id, off64 nByte){
+  return id->pVfs->xTruncate(id->pHandle, nByte);
+}
+int sqliteOsFileSize(OsFile *id, off64 *pSize){
+  return id->pVfs->xFileSize(id->pHandle, pSize);
+}
+int sqliteOsReadLock(OsFile *id){
+  return id->pVfs->xLock(id->pHandle, SQLITE_LOCK_SHARED);
+}
+int sqliteOsWriteLock(OsFile *id){
+  return id->pVfs->xLock(id->pHandle, SQLITE_LOCK_EXCLUSIVE);
+}
+int sqliteOsUnlock(OsFile *id){
+  return id->pVfs->xLock(id->pHandle, SQLITE_LOCK_NONE);
+}
+int sqliteOsLockWait(OsFile *id, int eLock, int ms){
+  if( ms>0 && id->pVfs->xLockWait ){
+    return id->pVfs->xLockWait(id->pHandle, eLock, ms);
+  }
+  return id->pVfs->xLock(id->pHandle, eLock);
+}
+int sqliteOsRandomSeed(sqlite_vfs *pVfs, char *zBuf){
+  return pVfs->xRandomSeed(pVfs, zBuf);
+}
+int sqliteOsSleep(sqlite_vfs *pVfs, int ms){
+  return pVfs->xSleep(pVfs, ms);
+}
+
+/*
+** Fill in *pKey so that it identifies the file zFilename when it is
+** opened through pVfs.  Different names for the same file give equal
+** keys.  On Unix the key holds the device and inode numbers, the same
+** numbers that are used to find the lockInfo of an open file.  On
+** Windows it holds the volume serial number and the file index.
+**
+** Keys may be compared with memcmp().  SQLITE_NOTFOUND is returned if
+** the operating system does not know of a file with the given name.
+*/
+int sqliteOsFileKey(sqlite_vfs *pVfs, const char *zFilename, OsFileKey *pKey){
+#if OS_UNIX
+  struct stat statbuf;
+  memset(pKey, 0, sizeof(*pKey));
+  if( stat(zFilename, &statbuf)!=0 ) return SQLITE_NOTFOUND;
+  pKey->pVfs = pVfs;
+  pKey->dev = statbuf.st_dev;
+  pKey->ino = statbuf.st_ino;
+  return SQLITE_OK;
 #endif
-#ifdef SQLITE_W32_THREADS
-  static CRITICAL_SECTION cs;
+#if OS_WIN
+  HANDLE h;
+  BY_HANDLE_FILE_INFORMATION info;
+  int ok;
+  memset(pKey, 0, sizeof(*pKey));
+  h = CreateFile(zFilename, 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                 OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if( h==INVALID_HANDLE_VALUE ) return SQLITE_NOTFOUND;
+  ok = GetFileInformationByHandle(h, &info);
+  CloseHandle(h);
+  if( !ok ) return SQLITE_NOTFOUND;
+  pKey->pVfs = pVfs;
+  pKey->dev = info.dwVolumeSerialNumber;
+  pKey->ino = (((sqlite_int64)info.nFileIndexHigh)<<32) + info.nFileIndexLow;
+  return SQLITE_OK;
 #endif
+}
+
 
 /*
 ** The following pair of routine implement mutual exclusion for
@@ -817,3 +1474,59 @@ void sqliteOsLeaveMutex(){
   LeaveCriticalSection(&cs);
 #endif
 }
+
+/*
+** Mutexes for data that threads share for longer than the single mutex
+** above may be held, such as a page cache shared among connections.
+** The thread that holds one of these mutexes may enter it again.
+**
+** sqliteOsMutexAlloc() writes the new mutex into *ppMutex.  When SQLite
+** is built without THREADSAFE it writes NULL, and the other routines do
+** nothing when they are given NULL.
+*/
+int sqliteOsMutexAlloc(void **ppMutex){
+#ifdef SQLITE_UNIX_THREADS
+  pthread_mutexattr_t attr;
+  pthread_mutex_t *p = sqliteMalloc( sizeof(*p) );
+  *ppMutex = p;
+  if( p==0 ) return SQLITE_NOMEM;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(p, &attr);
+  pthread_mutexattr_destroy(&attr);
+#elif defined(SQLITE_W32_THREADS)
+  CRITICAL_SECTION *p = sqliteMalloc( sizeof(*p) );
+  *ppMutex = p;
+  if( p==0 ) return SQLITE_NOMEM;
+  InitializeCriticalSection(p);
+#else
+  *ppMutex = 0;
+#endif
+  return SQLITE_OK;
+}
+void sqliteOsMutexFree(void *pMutex){
+  if( pMutex==0 ) return;
+#ifdef SQLITE_UNIX_THREADS
+  pthread_mutex_destroy((pthread_mutex_t*)pMutex);
+#endif
+#ifdef SQLITE_W32_THREADS
+  DeleteCriticalSection((CRITICAL_SECTION*)pMutex);
+#endif
+  sqliteFree(pMutex);
+}
+void sqliteOsMutexEnter(void *pMutex){
+#ifdef SQLITE_UNIX_THREADS
+  pthread_mutex_lock((pthread_mutex_t*)pMutex);
+#endif
+#ifdef SQLITE_W32_THREADS
+  EnterCriticalSection((CRITICAL_SECTION*)pMutex);
+#endif
+}
+void sqliteOsMutexLeave(void *pMutex){
+#ifdef SQLITE_UNIX_THREADS
+  pthread_mutex_unlock((pthread_mutex_t*)pMutex);
+#endif
+#ifdef SQLITE_W32_THREADS
+  LeaveCriticalSection((CRITICAL_SECTION*)pMutex);
+#endif
+}
@@ -35,15 +35,34 @@
 #endif
 
 /*
-** A handle for an open file is stored in an OsFile object.
+** Offsets into files and the sizes of files.  See the definition of
+** sqlite_int64 in sqlite.h.
 */
+typedef sqlite_int64 off64;
+
+/*
+** A handle for an open file is stored in an OsFile object.  It records
+** the VFS that opened the file and the handle that VFS returned.  All
+** I/O on the file is passed through to the methods of that VFS.
+*/
+typedef struct OsFile OsFile;
+struct OsFile {
+  sqlite_vfs *pVfs;        /* The VFS that opened this file */
+  void *pHandle;           /* The file handle returned by pVfs */
+};
+
+/*
+** An OsFileKey identifies a file independently of the name by which
+** it was opened.  See sqliteOsFileKey().
+*/
+typedef struct OsFileKey OsFileKey;
+struct OsFileKey {
+  sqlite_vfs *pVfs;        /* The VFS the file is opened through */
+  sqlite_int64 dev;        /* Device or volume that holds the file */
+  sqlite_int64 ino;        /* The file's number on that device */
+};
+
 #if OS_UNIX
-  typedef struct OsFile OsFile;
-  struct OsFile {
-    struct lockInfo *pLock;  /* Information about locks on this inode */
-    int fd;                  /* The file descriptor */
-    int locked;              /* True if this user holds the lock */
-  };
 # define SQLITE_TEMPNAME_SIZE 200
 # if defined(HAVE_USLEEP) && HAVE_USLEEP
 #  define SQLITE_MIN_SLEEP_MS 1
@@ -55,35 +74,38 @@
 #if OS_WIN
 #include <windows.h>
 #include <winbase.h>
-  typedef struct OsFile OsFile;
-  struct OsFile {
-    HANDLE h;
-    int locked;
-  };
 # define SQLITE_TEMPNAME_SIZE (MAX_PATH+50)
 # define SQLITE_MIN_SLEEP_MS 1
 #endif
 
-int sqliteOsDelete(const char*);
-int sqliteOsFileExists(const char*);
-int sqliteOsOpenReadWrite(const char*, OsFile*, int*);
-int sqliteOsOpenExclusive(const char*, OsFile*, int);
-int sqliteOsOpenReadOnly(const char*, OsFile*);
-int sqliteOsTempFileName(char*);
+int sqliteOsDelete(sqlite_vfs*, const char*);
+int sqliteOsFileExists(sqlite_vfs*, const char*);
+int sqliteOsOpenReadWrite(sqlite_vfs*, const char*, OsFile*, int*);
+int sqliteOsOpenExclusive(sqlite_vfs*, const char*, OsFile*, int);
+int sqliteOsOpenReadOnly(sqlite_vfs*, const char*, OsFile*);
+int sqliteOsTempFileName(sqlite_vfs*, char*);
+int sqliteOsSyncDirectory(sqlite_vfs*, const char*);
 int sqliteOsClose(OsFile*);
-int sqliteOsRead(OsFile*, void*, int amt);
-int sqliteOsWrite(OsFile*, const void*, int amt);
-int sqliteOsSeek(OsFile*, int offset);
+int sqliteOsRead(OsFile*, void*, int amt, off64 offset);
+int sqliteOsWrite(OsFile*, const void*, int amt, off64 offset);
+int sqliteOsWritev(OsFile*, void**, int nBuf, int amt, off64 offset);
 int sqliteOsSync(OsFile*);
-int sqliteOsTruncate(OsFile*, int size);
-int sqliteOsFileSize(OsFile*, int *pSize);
+int sqliteOsDataSync(OsFile*);
+int sqliteOsTruncate(OsFile*, off64 size);
+int sqliteOsFileSize(OsFile*, off64 *pSize);
 int sqliteOsReadLock(OsFile*);
 int sqliteOsWriteLock(OsFile*);
 int sqliteOsUnlock(OsFile*);
-int sqliteOsRandomSeed(char*);
-int sqliteOsSleep(int ms);
+int sqliteOsLockWait(OsFile*, int eLock, int ms);
+int sqliteOsRandomSeed(sqlite_vfs*, char*);
+int sqliteOsSleep(sqlite_vfs*, int ms);
+int sqliteOsFileKey(sqlite_vfs*, const char*, OsFileKey*);
 void sqliteOsEnterMutex(void);
 void sqliteOsLeaveMutex(void);
+int sqliteOsMutexAlloc(void**);
+void sqliteOsMutexFree(void*);
+void sqliteOsMutexEnter(void*);
+void sqliteOsMutexLeave(void*);
 
 
 
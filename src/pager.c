@@ -41,9 +41,10 @@
 **                       file at the same time.
 **
 **   SQLITE_WRITELOCK    The page cache is writing the database.
-**                       Access is exclusive.  No other processes or
-**                       threads can be reading or writing while one
-**                       process is writing.
+**                       Only one process or thread can be writing
+**                       at a time.  Others can go on reading until
+**                       changes are written to the database file,
+**                       which normally happens only at commit.
 **
 ** The page cache comes up in SQLITE_UNLOCK.  The first time a
 ** sqlite_page_get() occurs, the state transitions to SQLITE_READLOCK.
@@ -55,6 +56,12 @@
 ** be in SQLITE_READLOCK before it transitions to SQLITE_WRITELOCK.)
 ** The sqlite_page_rollback() and sqlite_page_commit() functions 
 ** transition the state from SQLITE_WRITELOCK back to SQLITE_READLOCK.
+**
+** In SQLITE_WRITELOCK the pager holds a RESERVED lock on the database
+** file, which keeps out other writers but not readers.  The lock is
+** raised to EXCLUSIVE by pager_exclusive_lock() just before the first
+** change is written to the database file.  Pager.eLock records which
+** of the two is held.
 */
 #define SQLITE_UNLOCK      0
 #define SQLITE_READLOCK    1
@@ -77,6 +84,11 @@ struct PgHdr {
   char inJournal;                /* TRUE if has been written to journal */
   char inCkpt;                   /* TRUE if written to the checkpoint journal */
   char dirty;                    /* TRUE if we need to write back changes */
+  char isHot;                    /* TRUE if in the protected part of the cache */
+  char alwaysRollback;           /* Disable dont_rollback() for this page */
+  PgHdr *pDirty;                 /* Next page on a list of pages to write */
+  PgSnapshot *pSnap;             /* Snapshot this is a copy for, or NULL */
+  char isImage;                  /* Keep this copy until pSnap is freed */
   /* SQLITE_PAGE_SIZE bytes of page data follow this header */
   /* Pager.nExtra bytes of local data follow the page data */
 };
@@ -90,10 +102,94 @@ struct PgHdr {
 #define PGHDR_TO_EXTRA(P) ((void*)&((char*)(&(P)[1]))[SQLITE_PAGE_SIZE])
 
 /*
-** How big to make the hash table used for locating in-memory pages
-** by page number.  Knuth says this should be a prime number.
+** The byte offset of page PGNO in the database file.  The arithmetic is
+** done in 64 bits so that files larger than 2 GB work.
+*/
+#define PAGE_OFFSET(PGNO) ((off64)((PGNO)-1)*SQLITE_PAGE_SIZE)
+
+/*
+** A snapshot is a read-only view of the database as it was when the
+** snapshot was taken.  Snapshots let connections that share a page
+** cache read the last committed version of a table while another
+** connection is changing it.  See sqlitepager_snapshot_open().
+**
+** A snapshot holds copies of pages, which are PgHdr structures that are
+** not part of the cache.  Snapshots are kept on a list from oldest to
+** newest.  Only the newest snapshot can be open.  While a transaction
+** is in progress, the first change to each page copies the original
+** content of the page into the newest open snapshot as an "image".  So
+** when the transaction commits, that snapshot holds the version of
+** every page that was changed, and it is then closed.  A page that is
+** not in a snapshot is the same as in the next newer snapshot, or as
+** in the cache if there is none.  Hence a snapshot must be kept as long
+** as any older snapshot is in use.
+**
+** Copies that are not images are made when a page is read through a
+** snapshot and are freed as soon as they are released.  Images are only
+** freed along with their snapshot.
+*/
+struct PgSnapshot {
+  Pager *pPager;              /* The pager this is a snapshot of */
+  int nRef;                   /* Number of users plus referenced pages */
+  u8 isClosed;                /* A later transaction has committed */
+  Hash pages;                 /* Copies of pages, keyed by page number */
+  PgSnapshot *pNext;          /* The next newer snapshot */
+};
+
+/*
+** Memory for in-memory pages is not obtained from sqliteMalloc() one
+** page at a time.  Instead, the pager allocates slabs that each hold
+** many page slots and hands out slots from those.  Slots that are no
+** longer in use go onto a list in the Pager structure and are reused
+** the next time a page is needed.  The slabs themselves are only freed
+** when the pager is closed, so the cache does not have to be rebuilt
+** with a fresh round of malloc() calls for every transaction.
+**
+** Each slab is preceded by the following header.  The page slots
+** follow the header.  Every slot is Pager.szSlot bytes in size and
+** holds a PgHdr, the page data, and Pager.nExtra bytes of extra space.
+*/
+typedef struct PgSlab PgSlab;
+struct PgSlab {
+  PgSlab *pNext;                 /* Next slab belonging to the same pager */
+  int nSlot;                     /* Number of page slots in this slab */
+};
+
+/*
+** The smallest number of page slots that will be put in a single slab.
+** Larger slabs are used as the cache grows.  See pager_new_slab().
+*/
+#define N_SLAB_MIN 16
+
+/*
+** The hash table used for locating in-memory pages by page number
+** starts out with this many buckets.  The table doubles in size
+** whenever the number of pages in the cache exceeds the number of
+** buckets, so a large cache_size does not lead to long hash chains
+** and a small cache does not waste memory on empty buckets.  The
+** number of buckets is always a power of two.
+*/
+#define N_PG_HASH 64
+
+/*
+** The page cache is split into two segments so that a single large
+** scan cannot push every frequently used page out of the cache.  (This
+** is a simplified form of the "2Q" algorithm.)  A page that is read in
+** from disk starts out in the probationary segment.  If the page is
+** requested again after all references to it have been released, it
+** moves to the protected (or "hot") segment.  Pages that are fetched
+** once and never again, such as the leaves of a table during a full
+** scan, stay in the probationary segment, and that is where pages are
+** recycled from first.  Pages near the root of a B-tree are requested
+** over and over, so they end up protected.
+**
+** Unreferenced pages of each segment are kept on a separate LRU list:
+** Pager.pFirst for probationary pages and Pager.pFirstHot for protected
+** pages.  The protected segment is allowed to hold up to the following
+** number of pages.  When it grows larger, the least recently used
+** unreferenced protected page is moved back to the probationary list.
 */
-#define N_PG_HASH 2003
+#define PAGER_MX_HOT(P)  ((P)->mxPage - (P)->mxPage/4)
 
 /*
 ** A open page cache is an instance of the following structure.
@@ -101,32 +197,61 @@ struct PgHdr {
 struct Pager {
   char *zFilename;            /* Name of the database file */
   char *zJournal;             /* Name of the journal file */
+  sqlite_vfs *pVfs;           /* VFS used for all files of this pager */
   OsFile fd, jfd;             /* File descriptors for database and journal */
   OsFile cpfd;                /* File descriptor for the checkpoint journal */
   int dbSize;                 /* Number of pages in the file */
   int origDbSize;             /* dbSize before the current change */
-  int ckptSize, ckptJSize;    /* Size of database and journal at ckpt_begin() */
+  int ckptSize;               /* Size of database in pages at ckpt_begin() */
+  off64 ckptJSize;            /* Size of the journal at ckpt_begin() */
+  off64 ckptOffset;           /* Bytes written to the checkpoint journal */
   int nExtra;                 /* Add this many bytes to each in-memory page */
   void (*xDestructor)(void*); /* Call this routine when freeing pages */
   int nPage;                  /* Total number of in-memory pages */
   int nRef;                   /* Number of in-memory pages with PgHdr.nRef>0 */
   int mxPage;                 /* Maximum number of pages to hold in cache */
   int nHit, nMiss, nOvfl;     /* Cache hits, missing, and LRU overflows */
+  int lockTimeout;            /* Milliseconds to wait for a busy lock */
   u8 journalOpen;             /* True if journal file descriptors is valid */
   u8 ckptOpen;                /* True if the checkpoint journal is open */
   u8 ckptInUse;               /* True we are in a checkpoint */
   u8 noSync;                  /* Do not sync the journal if true */
+  u8 safetyLevel;             /* One of the PAGER_SYNC_* values */
   u8 state;                   /* SQLITE_UNLOCK, _READLOCK or _WRITELOCK */
+  u8 eLock;                   /* SQLITE_LOCK_* level held on the database */
   u8 errMask;                 /* One of several kinds of errors */
   u8 tempFile;                /* zFilename is a temporary file */
   u8 readOnly;                /* True for a read-only database */
   u8 needSync;                /* True if an fsync() is needed on the journal */
   u8 dirtyFile;               /* True if database file has changed in any way */
+  u8 journalMode;             /* One of the PAGER_JOURNALMODE_* values */
+  u8 memJournal;              /* True if the journal is aJBuf[], not jfd */
+  u8 exclusiveMode;           /* Keep locks and cache when nRef reaches 0 */
+  u8 memDb;                   /* True for an in-memory database.  No file */
+  u8 lazyTemp;                /* memDb that spills to a temp file when full */
+  u8 alwaysRollback;          /* Disable dont_rollback() for all pages */
   u8 *aInJournal;             /* One bit for each page in the database file */
   u8 *aInCkpt;                /* One bit for each page in the database */
-  PgHdr *pFirst, *pLast;      /* List of free pages */
+  PgHdr *pFirst, *pLast;      /* List of free probationary pages */
+  PgHdr *pFirstHot, *pLastHot;  /* List of free protected pages */
+  int nHot;                   /* Number of pages with PgHdr.isHot set */
   PgHdr *pAll;                /* List of all pages */
-  PgHdr *aHash[N_PG_HASH];    /* Hash table to map page number of PgHdr */
+  PgSlab *pSlab;              /* Slabs from which pages are allocated */
+  PgHdr *pFreeSlot;           /* Page slots not currently in use */
+  int nSlot;                  /* Total number of slots in all slabs */
+  int szSlot;                 /* Size of a single page slot in bytes */
+  u8 *aJBuf;                  /* Journal data not yet written to jfd */
+  int nJBuf;                  /* Number of bytes used in aJBuf[] */
+  int szJBuf;                 /* Number of bytes allocated for aJBuf[] */
+  off64 jOffset;              /* Journal size, including buffered data */
+  u8 *aCkpt;                  /* Checkpoint journal kept in memory */
+  int szCkpt;                 /* Number of bytes allocated for aCkpt[] */
+  int nHash;                  /* Number of buckets in aHash[] */
+  PgHdr **aHash;              /* Hash table to map page number of PgHdr */
+  PgSnapshot *pSnapFirst;     /* Oldest snapshot of the database */
+  PgSnapshot *pSnapLast;      /* Newest snapshot of the database */
+  int nSnapReader;            /* Clients that may read through snapshots */
+  u8 snapValid;               /* Changes of this transaction are captured */
 };
 
 /*
@@ -157,9 +282,43 @@ static const unsigned char aJournalMagic[] = {
 };
 
 /*
-** Hash a page number
+** In PAGER_JOURNALMODE_PERSIST the journal file is not deleted at the
+** end of a transaction, so it may still hold records of an earlier and
+** larger transaction beyond the records of the current one.  The number
+** of records can therefore not be computed from the size of the file.
+** Journals written in that mode start with the following magic string
+** instead, which is followed by the number of valid records and then by
+** the original size of the database.  The record count is brought up
+** to date before any page of the database file is overwritten.
+*/
+static const unsigned char aJournalMagic2[] = {
+  0xd9, 0xd5, 0x05, 0xf9, 0x20, 0xa1, 0x63, 0xd5,
+};
+
+/*
+** Records are not written into the transaction journal one at a time.
+** They are collected in the Pager.aJBuf[] buffer, which holds this many
+** bytes, and the buffer is written out when it fills up.  The buffer is
+** also flushed before the journal is synced, before any page is written
+** into the database file and before the journal is read back, so the
+** journal on disk always holds the original content of a page before
+** that page is overwritten in the database.
+*/
+#define JOURNAL_BUF_SIZE  (64*sizeof(PageRecord))
+
+/*
+** Size of the header at the start of a journal file.  The first form
+** applies when the header begins with aJournalMagic and the second when
+** it begins with aJournalMagic2.
+*/
+#define JOURNAL_HDR_SZ   (sizeof(aJournalMagic)+sizeof(Pgno))
+#define JOURNAL_HDR_SZ2  (sizeof(aJournalMagic2)+sizeof(int)+sizeof(Pgno))
+
+/*
+** Hash a page number.  Page numbers are mostly sequential so the low
+** order bits make a good hash.
 */
-#define pager_hash(PN)  ((PN)%N_PG_HASH)
+#define pager_hash(P,PN)  ((PN)&((P)->nHash-1))
 
 /*
 ** Enable reference count tracking here:
@@ -199,13 +358,376 @@ static int pager_errcode(Pager *pPager){
 ** a pointer to the page or NULL if not found.
 */
 static PgHdr *pager_lookup(Pager *pPager, Pgno pgno){
-  PgHdr *p = pPager->aHash[pgno % N_PG_HASH];
+  PgHdr *p = pPager->aHash[pager_hash(pPager, pgno)];
   while( p && p->pgno!=pgno ){
     p = p->pNextHash;
   }
   return p;
 }
 
+/*
+** Change the number of buckets in the page hash table to nNew and
+** rehash every page in the cache.  nNew must be a power of two.
+**
+** If the new table cannot be allocated, the old table is left in
+** place.  Lookups still work, the hash chains are just longer.
+*/
+static void pager_resize_hash(Pager *pPager, int nNew){
+  PgHdr **aNew;
+  PgHdr *pPg;
+  int h;
+
+  assert( nNew>0 && (nNew&(nNew-1))==0 );
+  aNew = sqliteMalloc( nNew*sizeof(aNew[0]) );
+  if( aNew==0 ) return;
+  sqliteFree(pPager->aHash);
+  pPager->aHash = aNew;
+  pPager->nHash = nNew;
+  for(pPg=pPager->pAll; pPg; pPg=pPg->pNextAll){
+    h = pager_hash(pPager, pPg->pgno);
+    pPg->pPrevHash = 0;
+    pPg->pNextHash = aNew[h];
+    if( aNew[h] ){
+      aNew[h]->pPrevHash = pPg;
+    }
+    aNew[h] = pPg;
+  }
+}
+
+/*
+** Allocate a new slab of page slots for the pager and put all of its
+** slots on the Pager.pFreeSlot list.  The new slab is as large as all
+** of the existing slabs together, so the number of slabs grows only
+** logarithmically with the size of the cache, but it is never allowed
+** to push the total number of slots past the configured cache size
+** unless the cache has already overflowed.
+**
+** Return SQLITE_NOMEM if the slab cannot be allocated.
+*/
+static int pager_new_slab(Pager *pPager){
+  PgSlab *pSlab;
+  char *pSlot;
+  int n, i;
+
+  n = pPager->nSlot;
+  if( n>pPager->mxPage - pPager->nSlot ){
+    n = pPager->mxPage - pPager->nSlot;
+  }
+  if( n<N_SLAB_MIN ) n = N_SLAB_MIN;
+  pSlab = sqliteMalloc( sizeof(*pSlab) + n*pPager->szSlot );
+  if( pSlab==0 ){
+    return SQLITE_NOMEM;
+  }
+  pSlab->nSlot = n;
+  pSlab->pNext = pPager->pSlab;
+  pPager->pSlab = pSlab;
+  pPager->nSlot += n;
+  pSlot = (char*)&pSlab[1];
+  for(i=0; i<n; i++, pSlot+=pPager->szSlot){
+    PgHdr *pPg = (PgHdr*)pSlot;
+    pPg->pNextFree = pPager->pFreeSlot;
+    pPager->pFreeSlot = pPg;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Take an unused page slot for a new in-memory page, allocating a new
+** slab if necessary.  The PgHdr of the returned slot is zeroed, as if
+** it had just come from sqliteMalloc().  Return NULL if out of memory.
+*/
+static PgHdr *pager_alloc_page(Pager *pPager){
+  PgHdr *pPg;
+  if( pPager->pFreeSlot==0 && pager_new_slab(pPager)!=SQLITE_OK ){
+    return 0;
+  }
+  pPg = pPager->pFreeSlot;
+  pPager->pFreeSlot = pPg->pNextFree;
+  memset(pPg, 0, sizeof(*pPg));
+  return pPg;
+}
+
+/*
+** Return a page slot to the list of unused slots.
+*/
+static void pager_free_page(Pager *pPager, PgHdr *pPg){
+  pPg->pNextFree = pPager->pFreeSlot;
+  pPager->pFreeSlot = pPg;
+}
+
+/*
+** Make a copy of page pgno, whose content is pData, for snapshot pSnap.
+** The copy has no references.  Return NULL if out of memory.
+*/
+static PgHdr *snapshot_add_page(PgSnapshot *pSnap, Pgno pgno,
+                                const void *pData){
+  Pager *pPager = pSnap->pPager;
+  PgHdr *pPg;
+  pPg = sqliteMalloc( sizeof(PgHdr) + SQLITE_PAGE_SIZE + pPager->nExtra );
+  if( pPg==0 ) return 0;
+  pPg->pPager = pPager;
+  pPg->pgno = pgno;
+  pPg->pSnap = pSnap;
+  memcpy(PGHDR_TO_DATA(pPg), pData, SQLITE_PAGE_SIZE);
+  sqliteHashInsert(&pSnap->pages, 0, pgno, pPg);
+  if( sqliteHashFind(&pSnap->pages, 0, pgno)!=pPg ){
+    sqliteFree(pPg);
+    return 0;
+  }
+  return pPg;
+}
+
+/*
+** Free a snapshot and all of its pages.  None of the pages may be
+** referenced.
+*/
+static void snapshot_free(PgSnapshot *pSnap){
+  HashElem *p;
+  for(p=sqliteHashFirst(&pSnap->pages); p; p=sqliteHashNext(p)){
+    PgHdr *pPg = (PgHdr*)sqliteHashData(p);
+    assert( pPg->nRef==0 );
+    sqliteFree(pPg);
+  }
+  sqliteHashClear(&pSnap->pages);
+  sqliteFree(pSnap);
+}
+
+/*
+** Free the closed snapshots at the old end of the list that are no
+** longer in use.  A snapshot in the middle of the list cannot be freed
+** while an older one is in use, since the older one may need its images.
+*/
+static void snapshot_free_unused(Pager *pPager){
+  PgSnapshot *pSnap;
+  while( (pSnap = pPager->pSnapFirst)!=0 && pSnap->isClosed
+         && pSnap->nRef==0 ){
+    pPager->pSnapFirst = pSnap->pNext;
+    if( pPager->pSnapFirst==0 ) pPager->pSnapLast = 0;
+    snapshot_free(pSnap);
+  }
+}
+
+/*
+** Return the newest snapshot if it is open.  Otherwise start a new one
+** and return it.  Return NULL if out of memory.
+*/
+static PgSnapshot *snapshot_newest(Pager *pPager){
+  PgSnapshot *pSnap = pPager->pSnapLast;
+  if( pSnap && !pSnap->isClosed ) return pSnap;
+  pSnap = sqliteMalloc( sizeof(*pSnap) );
+  if( pSnap==0 ) return 0;
+  pSnap->pPager = pPager;
+  sqliteHashInit(&pSnap->pages, SQLITE_HASH_INT, 0);
+  if( pPager->pSnapLast ){
+    pPager->pSnapLast->pNext = pSnap;
+  }else{
+    pPager->pSnapFirst = pSnap;
+  }
+  pPager->pSnapLast = pSnap;
+  return pSnap;
+}
+
+/*
+** Save the content of page pPg, which is about to be changed for the
+** first time in this transaction, as an image in the newest snapshot.
+** If a reader already has a copy of the page in that snapshot, the
+** copy holds the same content and simply becomes the image.
+*/
+static int snapshot_capture(PgHdr *pPg){
+  PgSnapshot *pSnap;
+  PgHdr *pImg;
+  pSnap = snapshot_newest(pPg->pPager);
+  if( pSnap==0 ) return SQLITE_NOMEM;
+  pImg = (PgHdr*)sqliteHashFind(&pSnap->pages, 0, pPg->pgno);
+  if( pImg==0 ){
+    pImg = snapshot_add_page(pSnap, pPg->pgno, PGHDR_TO_DATA(pPg));
+    if( pImg==0 ) return SQLITE_NOMEM;
+  }
+  pImg->isImage = 1;
+  return SQLITE_OK;
+}
+
+/*
+** Write any buffered journal data into the journal file.  This is a
+** no-op for an in-memory journal.
+*/
+static int pager_journal_flush(Pager *pPager){
+  int rc = SQLITE_OK;
+  if( pPager->nJBuf>0 && !pPager->memJournal ){
+    rc = sqliteOsWrite(&pPager->jfd, pPager->aJBuf, pPager->nJBuf,
+                       pPager->jOffset - pPager->nJBuf);
+    pPager->nJBuf = 0;
+  }
+  return rc;
+}
+
+/*
+** Append nByte bytes to the transaction journal.  The data goes into
+** the journal buffer if there is one.  If the buffer could not be
+** allocated, the data is written directly to the journal file.
+**
+** An in-memory journal is never flushed.  Its buffer is enlarged as
+** needed to hold the entire journal.
+*/
+static int pager_journal_write(Pager *pPager, const void *pBuf, int nByte){
+  int rc;
+  if( pPager->nJBuf+nByte>pPager->szJBuf ){
+    if( pPager->memJournal ){
+      int szNew = pPager->szJBuf>0 ? pPager->szJBuf*2 : JOURNAL_BUF_SIZE;
+      u8 *aNew = sqliteRealloc(pPager->aJBuf, szNew);
+      if( aNew==0 ) return SQLITE_NOMEM;
+      pPager->aJBuf = aNew;
+      pPager->szJBuf = szNew;
+    }else{
+      rc = pager_journal_flush(pPager);
+      if( rc!=SQLITE_OK ) return rc;
+    }
+  }
+  if( pPager->aJBuf==0 ){
+    rc = sqliteOsWrite(&pPager->jfd, pBuf, nByte, pPager->jOffset);
+    if( rc!=SQLITE_OK ) return rc;
+  }else{
+    memcpy(&pPager->aJBuf[pPager->nJBuf], pBuf, nByte);
+    pPager->nJBuf += nByte;
+  }
+  pPager->jOffset += nByte;
+  return SQLITE_OK;
+}
+
+/*
+** Read nByte bytes from the transaction journal beginning at byte
+** offset iOff.  Any buffered journal data must have been flushed first.
+*/
+static int pager_journal_read(
+  Pager *pPager,          /* Read from the journal of this pager */
+  off64 iOff,             /* Byte offset of the first byte to read */
+  void *pBuf,             /* Write the data here */
+  int nByte               /* Number of bytes to read */
+){
+  if( pPager->memJournal ){
+    if( iOff+nByte>pPager->nJBuf ) return SQLITE_IOERR;
+    memcpy(pBuf, &pPager->aJBuf[(int)iOff], nByte);
+    return SQLITE_OK;
+  }
+  return sqliteOsRead(&pPager->jfd, pBuf, nByte, iOff);
+}
+
+/*
+** Append the original content of page pgno to the checkpoint journal.
+** The checkpoint journal is kept in Pager.aCkpt[] when the transaction
+** journal is in memory, and in the temporary file cpfd otherwise.
+*/
+static int pager_ckpt_write(Pager *pPager, Pgno pgno, const void *pData){
+  int rc;
+  if( pPager->memJournal ){
+    if( pPager->ckptOffset+sizeof(PageRecord)>pPager->szCkpt ){
+      int szNew = pPager->szCkpt>0 ? pPager->szCkpt*2 : JOURNAL_BUF_SIZE;
+      u8 *aNew = sqliteRealloc(pPager->aCkpt, szNew);
+      if( aNew==0 ) return SQLITE_NOMEM;
+      pPager->aCkpt = aNew;
+      pPager->szCkpt = szNew;
+    }
+    memcpy(&pPager->aCkpt[(int)pPager->ckptOffset], &pgno, sizeof(Pgno));
+    memcpy(&pPager->aCkpt[(int)pPager->ckptOffset+sizeof(Pgno)], pData,
+           SQLITE_PAGE_SIZE);
+  }else{
+    rc = sqliteOsWrite(&pPager->cpfd, &pgno, sizeof(Pgno),
+                       pPager->ckptOffset);
+    if( rc==SQLITE_OK ){
+      rc = sqliteOsWrite(&pPager->cpfd, pData, SQLITE_PAGE_SIZE,
+                         pPager->ckptOffset + sizeof(Pgno));
+    }
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  pPager->ckptOffset += sizeof(PageRecord);
+  return SQLITE_OK;
+}
+
+/*
+** Read the i-th page record of the checkpoint journal into *pRec.
+*/
+static int pager_ckpt_read(Pager *pPager, int i, PageRecord *pRec){
+  off64 iOff = (off64)i*sizeof(PageRecord);
+  if( pPager->memJournal ){
+    if( iOff+sizeof(PageRecord)>pPager->ckptOffset ) return SQLITE_IOERR;
+    memcpy(pRec, &pPager->aCkpt[(int)iOff], sizeof(PageRecord));
+    return SQLITE_OK;
+  }
+  return sqliteOsRead(&pPager->cpfd, pRec, sizeof(PageRecord), iOff);
+}
+
+/*
+** Flush the file pFile to disk in the way called for by the safety
+** level of the pager.  PAGER_SYNC_DATA uses fdatasync(), which does not
+** wait for file metadata such as the modification time to be written.
+*/
+static int pager_sync(Pager *pPager, OsFile *pFile){
+  if( pPager->safetyLevel==PAGER_SYNC_DATA ){
+    return sqliteOsDataSync(pFile);
+  }
+  return sqliteOsSync(pFile);
+}
+
+/*
+** In PAGER_JOURNALMODE_PERSIST, write the number of page records in the
+** journal into the journal header.  This must be done, after the journal
+** buffer has been flushed, before any page of the database file is
+** overwritten.  It is a no-op in the other journal modes.
+**
+** At PAGER_SYNC_FULL the page records are synced before the count is
+** written, so that a power failure cannot leave a header on disk that
+** claims records that never made it there.  The caller syncs the
+** journal again once the count is written.
+*/
+static int pager_write_nrec(Pager *pPager){
+  int nRec;
+  int rc;
+  if( pPager->journalMode!=PAGER_JOURNALMODE_PERSIST || pPager->memJournal ){
+    return SQLITE_OK;
+  }
+  assert( pPager->nJBuf==0 );
+  if( pPager->needSync && pPager->safetyLevel==PAGER_SYNC_FULL ){
+    rc = pager_sync(pPager, &pPager->jfd);
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  nRec = (int)((pPager->jOffset - JOURNAL_HDR_SZ2)/sizeof(PageRecord));
+  return sqliteOsWrite(&pPager->jfd, &nRec, sizeof(nRec),
+                       sizeof(aJournalMagic2));
+}
+
+/*
+** Return TRUE if the journal file for pPager is a hot journal that must
+** be played back before the database can be read.  A journal that is
+** empty or whose header has been zeroed is left behind by a transaction
+** that committed in PAGER_JOURNALMODE_TRUNCATE or _PERSIST, and is not
+** hot.
+**
+** A writer holds a RESERVED lock for as long as its journal exists, so
+** the journal of a live writer is not hot either.  The pager must hold
+** a SHARED lock when this is called.  If TRUE is returned the pager has
+** been given the RESERVED lock, and nobody else can remove the journal.
+*/
+static int pager_hot_journal(Pager *pPager){
+  static const unsigned char aZero[sizeof(aJournalMagic)];
+  unsigned char aMagic[sizeof(aJournalMagic)];
+  OsFile jfd;
+  int rc;
+  if( !sqliteOsFileExists(pPager->pVfs, pPager->zJournal) ) return 0;
+  if( sqliteOsLockWait(&pPager->fd, SQLITE_LOCK_RESERVED, 0)!=SQLITE_OK ){
+    return 0;
+  }
+  rc = sqliteOsOpenReadOnly(pPager->pVfs, pPager->zJournal, &jfd);
+  if( rc==SQLITE_OK ){
+    rc = sqliteOsRead(&jfd, aMagic, sizeof(aMagic), 0);
+    sqliteOsClose(&jfd);
+    if( rc==SQLITE_OK && memcmp(aMagic, aZero, sizeof(aMagic))!=0 ) return 1;
+  }else if( sqliteOsFileExists(pPager->pVfs, pPager->zJournal) ){
+    return 1;
+  }
+  sqliteOsReadLock(&pPager->fd);
+  return 0;
+}
+
 /*
 ** Unlock the database and clear the in-memory cache.  This routine
 ** sets the state of the pager back to what it was when it was first
@@ -214,19 +736,30 @@ static PgHdr *pager_lookup(Pager *pPager, Pgno pgno){
 */
 static void pager_reset(Pager *pPager){
   PgHdr *pPg, *pNext;
+  PgSnapshot *pSnap;
   for(pPg=pPager->pAll; pPg; pPg=pNext){
     pNext = pPg->pNextAll;
-    sqliteFree(pPg);
+    pager_free_page(pPager, pPg);
   }
+  while( (pSnap = pPager->pSnapFirst)!=0 ){
+    assert( pSnap->nRef==0 );
+    pPager->pSnapFirst = pSnap->pNext;
+    snapshot_free(pSnap);
+  }
+  pPager->pSnapLast = 0;
   pPager->pFirst = 0;
   pPager->pLast = 0;
+  pPager->pFirstHot = 0;
+  pPager->pLastHot = 0;
+  pPager->nHot = 0;
   pPager->pAll = 0;
-  memset(pPager->aHash, 0, sizeof(pPager->aHash));
+  memset(pPager->aHash, 0, pPager->nHash*sizeof(pPager->aHash[0]));
   pPager->nPage = 0;
   if( pPager->state>=SQLITE_WRITELOCK ){
     sqlitepager_rollback(pPager);
   }
   sqliteOsUnlock(&pPager->fd);
+  pPager->eLock = SQLITE_LOCK_NONE;
   pPager->state = SQLITE_UNLOCK;
   pPager->dbSize = -1;
   pPager->nRef = 0;
@@ -237,10 +770,18 @@ static void pager_reset(Pager *pPager){
 ** When this routine is called, the pager has the journal file open and
 ** a write lock on the database.  This routine releases the database
 ** write lock and acquires a read lock in its place.  The journal file
-** is deleted and closed.
+** is closed and then deleted, zeroed or truncated as called for by the
+** journal mode.
+**
+** If the header of a persistent journal cannot be zeroed, or the journal
+** cannot be truncated, the journal is deleted instead.  Otherwise it
+** would still look like a hot journal, and the next connection to open
+** the database would roll back a transaction that has been committed.
+** If it cannot be deleted either, the error is returned.  The rest of
+** the work is still done, so the pager is left holding a read lock.
 */
 static int pager_unwritelock(Pager *pPager){
-  int rc;
+  int rc = SQLITE_OK;
   PgHdr *pPg;
   if( pPager->state<SQLITE_WRITELOCK ) return SQLITE_OK;
   sqlitepager_ckpt_commit(pPager);
@@ -248,48 +789,80 @@ static int pager_unwritelock(Pager *pPager){
     sqliteOsClose(&pPager->cpfd);
     pPager->ckptOpen = 0;
   }
-  sqliteOsClose(&pPager->jfd);
+  if( pPager->memJournal ){
+    pPager->memJournal = 0;
+    if( pPager->szJBuf>JOURNAL_BUF_SIZE ){
+      sqliteFree(pPager->aJBuf);
+      pPager->aJBuf = 0;
+      pPager->szJBuf = 0;
+    }
+    if( pPager->szCkpt>JOURNAL_BUF_SIZE ){
+      sqliteFree(pPager->aCkpt);
+      pPager->aCkpt = 0;
+      pPager->szCkpt = 0;
+    }
+  }else if( pPager->journalMode==PAGER_JOURNALMODE_PERSIST
+         || pPager->journalMode==PAGER_JOURNALMODE_TRUNCATE ){
+    if( pPager->journalMode==PAGER_JOURNALMODE_PERSIST ){
+      static const unsigned char aZero[JOURNAL_HDR_SZ2];
+      rc = sqliteOsWrite(&pPager->jfd, aZero, sizeof(aZero), 0);
+    }else{
+      rc = sqliteOsTruncate(&pPager->jfd, 0);
+    }
+    sqliteOsClose(&pPager->jfd);
+    if( rc!=SQLITE_OK
+     && sqliteOsDelete(pPager->pVfs, pPager->zJournal)==SQLITE_OK ){
+      rc = SQLITE_OK;
+    }
+  }else{
+    sqliteOsClose(&pPager->jfd);
+    sqliteOsDelete(pPager->pVfs, pPager->zJournal);
+  }
   pPager->journalOpen = 0;
-  sqliteOsDelete(pPager->zJournal);
-  rc = sqliteOsReadLock(&pPager->fd);
-  assert( rc==SQLITE_OK );
+  pPager->nJBuf = 0;
+  pPager->jOffset = 0;
+  if( !pPager->exclusiveMode ){
+    int rc2 = sqliteOsReadLock(&pPager->fd);
+    assert( rc2==SQLITE_OK );
+    if( rc==SQLITE_OK ) rc = rc2;
+    pPager->eLock = SQLITE_LOCK_SHARED;
+  }
   sqliteFree( pPager->aInJournal );
   pPager->aInJournal = 0;
   for(pPg=pPager->pAll; pPg; pPg=pPg->pNextAll){
     pPg->inJournal = 0;
     pPg->dirty = 0;
+    pPg->alwaysRollback = 0;
   }
+  pPager->alwaysRollback = 0;
   pPager->state = SQLITE_READLOCK;
+  pPager->snapValid = 0;
   return rc;
 }
 
 /*
-** Read a single page from the journal file opened on file descriptor
-** jfd.  Playback this one page.
+** Playback a single page record that has been read from a journal.
 */
-static int pager_playback_one_page(Pager *pPager, OsFile *jfd){
+static int pager_playback_one_page(Pager *pPager, PageRecord *pRec){
   int rc;
   PgHdr *pPg;              /* An existing page in the cache */
-  PageRecord pgRec;
-
-  rc = sqliteOsRead(jfd, &pgRec, sizeof(pgRec));
-  if( rc!=SQLITE_OK ) return rc;
 
   /* Sanity checking on the page */
-  if( pgRec.pgno>pPager->dbSize || pgRec.pgno==0 ) return SQLITE_CORRUPT;
+  if( pRec->pgno>pPager->dbSize || pRec->pgno==0 ) return SQLITE_CORRUPT;
 
   /* Playback the page.  Update the in-memory copy of the page
-  ** at the same time, if there is one.
+  ** at the same time, if there is one.  Without an EXCLUSIVE lock
+  ** nothing has been written to the database file yet, so only the
+  ** in-memory copy needs to be restored.
   */
-  pPg = pager_lookup(pPager, pgRec.pgno);
+  pPg = pager_lookup(pPager, pRec->pgno);
   if( pPg ){
-    memcpy(PGHDR_TO_DATA(pPg), pgRec.aData, SQLITE_PAGE_SIZE);
+    memcpy(PGHDR_TO_DATA(pPg), pRec->aData, SQLITE_PAGE_SIZE);
     memset(PGHDR_TO_EXTRA(pPg), 0, pPager->nExtra);
   }
-  rc = sqliteOsSeek(&pPager->fd, (pgRec.pgno-1)*SQLITE_PAGE_SIZE);
-  if( rc==SQLITE_OK ){
-    rc = sqliteOsWrite(&pPager->fd, pgRec.aData, SQLITE_PAGE_SIZE);
-  }
+  if( pPager->eLock<SQLITE_LOCK_EXCLUSIVE ) return SQLITE_OK;
+  rc = sqliteOsWrite(&pPager->fd, pRec->aData, SQLITE_PAGE_SIZE,
+                     PAGE_OFFSET(pRec->pgno));
   return rc;
 }
 
@@ -303,7 +876,15 @@ static int pager_playback_one_page(Pager *pPager, OsFile *jfd){
 ** changes were made.  The database is truncated to this size.
 ** Next come zero or more page records where each page record
 ** consists of a Pgno and SQLITE_PAGE_SIZE bytes of data.  See
-** the PageRecord structure for details.
+** the PageRecord structure for details.  Journals that begin with
+** aJournalMagic2 have an extra integer between the file-type string
+** and the database size which is the number of valid page records.
+**
+** If isHot is false, the journal is the one written by this pager in
+** the current transaction and the number of records is known from
+** Pager.jOffset.  If isHot is true, the journal was left behind by some
+** other process and the number of records is determined from the
+** journal itself.
 **
 ** If the file opened as the journal file is not a well-formed
 ** journal file (as determined by looking at the magic number
@@ -313,50 +894,114 @@ static int pager_playback_one_page(Pager *pPager, OsFile *jfd){
 ** pPager->errMask and SQLITE_CORRUPT is returned.  If it all
 ** works, then this routine returns SQLITE_OK.
 */
-static int pager_playback(Pager *pPager){
+static int pager_playback(Pager *pPager, int isHot){
+  off64 szJ;               /* Size of the journal in bytes */
   int nRec;                /* Number of Records */
+  int nHdrRec;             /* Number of records according to the header */
+  off64 iOff;              /* Offset of the first page record */
   int i;                   /* Loop counter */
   Pgno mxPg = 0;           /* Size of the original file in pages */
   unsigned char aMagic[sizeof(aJournalMagic)];
+  PageRecord pgRec;
+  PgHdr *pPg;
   int rc;
 
-  /* Figure out how many records are in the journal.  Abort early if
-  ** the journal is empty.
+  /* Figure out how big the journal is.  Abort early if the journal
+  ** is empty.
   */
   assert( pPager->journalOpen );
-  sqliteOsSeek(&pPager->jfd, 0);
-  rc = sqliteOsFileSize(&pPager->jfd, &nRec);
+  rc = pager_journal_flush(pPager);
   if( rc!=SQLITE_OK ){
     goto end_playback;
   }
-  nRec = (nRec - (sizeof(aMagic)+sizeof(Pgno))) / sizeof(PageRecord);
-  if( nRec<=0 ){
+  if( isHot ){
+    rc = sqliteOsFileSize(&pPager->jfd, &szJ);
+    if( rc!=SQLITE_OK ){
+      goto end_playback;
+    }
+  }else{
+    szJ = pPager->jOffset;
+  }
+  if( szJ<(off64)JOURNAL_HDR_SZ ){
     goto end_playback;
   }
 
   /* Read the beginning of the journal and truncate the
   ** database file back to its original size.
   */
-  rc = sqliteOsRead(&pPager->jfd, aMagic, sizeof(aMagic));
-  if( rc!=SQLITE_OK || memcmp(aMagic,aJournalMagic,sizeof(aMagic))!=0 ){
+  rc = pager_journal_read(pPager, 0, aMagic, sizeof(aMagic));
+  iOff = sizeof(aMagic);
+  if( rc==SQLITE_OK && memcmp(aMagic,aJournalMagic2,sizeof(aMagic))==0 ){
+    rc = pager_journal_read(pPager, iOff, &nHdrRec, sizeof(nHdrRec));
+    iOff += sizeof(nHdrRec);
+  }else if( rc!=SQLITE_OK || memcmp(aMagic,aJournalMagic,sizeof(aMagic))!=0 ){
     rc = SQLITE_PROTOCOL;
     goto end_playback;
+  }else{
+    nHdrRec = -1;
+  }
+  if( rc==SQLITE_OK ){
+    rc = pager_journal_read(pPager, iOff, &mxPg, sizeof(mxPg));
+    iOff += sizeof(mxPg);
   }
-  rc = sqliteOsRead(&pPager->jfd, &mxPg, sizeof(mxPg));
   if( rc!=SQLITE_OK ){
     goto end_playback;
   }
-  rc = sqliteOsTruncate(&pPager->fd, mxPg*SQLITE_PAGE_SIZE);
-  if( rc!=SQLITE_OK ){
+  nRec = (int)((szJ - iOff)/sizeof(PageRecord));
+  if( isHot && nHdrRec>=0 && nHdrRec<nRec ){
+    nRec = nHdrRec;
+  }
+  if( nRec<=0 ){
     goto end_playback;
   }
+  if( pPager->eLock==SQLITE_LOCK_EXCLUSIVE ){
+    rc = sqliteOsTruncate(&pPager->fd, (off64)mxPg*SQLITE_PAGE_SIZE);
+    if( rc!=SQLITE_OK ){
+      goto end_playback;
+    }
+  }
   pPager->dbSize = mxPg;
   
   /* Copy original pages out of the journal and back into the database file.
   */
-  for(i=nRec-1; i>=0; i--){
-    rc = pager_playback_one_page(pPager, &pPager->jfd);
+  for(i=0; i<nRec; i++){
+    rc = pager_journal_read(pPager, iOff, &pgRec, sizeof(pgRec));
     if( rc!=SQLITE_OK ) break;
+    iOff += sizeof(pgRec);
+    rc = pager_playback_one_page(pPager, &pgRec);
+    if( rc!=SQLITE_OK ) break;
+    pPg = pager_lookup(pPager, pgRec.pgno);
+    if( pPg ) pPg->dirty = 0;
+  }
+  if( rc!=SQLITE_OK ){
+    goto end_playback;
+  }
+
+  /* The cache can outlive the transaction, in exclusive locking mode or
+  ** when other users of a shared cache still hold pages.  Pages that the
+  ** transaction added to the end of the database are made to look as if
+  ** they were read from past the end of the file.  Pages that are still
+  ** dirty were changed without being journaled, such as pages reused
+  ** from the freelist (see sqlitepager_dont_rollback()), and are read
+  ** back from the database file.  An in-memory database journals every
+  ** page it changes, so it has no such pages.
+  */
+  for(pPg=pPager->pAll; pPg; pPg=pPg->pNextAll){
+    char zBuf[SQLITE_PAGE_SIZE];
+    if( pPg->pgno>mxPg ){
+      if( pPg->nRef==0 ){
+        memset(PGHDR_TO_DATA(pPg), 0, SQLITE_PAGE_SIZE);
+        memset(PGHDR_TO_EXTRA(pPg), 0, pPager->nExtra);
+      }
+    }else if( pPg->dirty && !pPager->memDb ){
+      rc = sqliteOsRead(&pPager->fd, zBuf, SQLITE_PAGE_SIZE,
+                        PAGE_OFFSET(pPg->pgno));
+      if( rc!=SQLITE_OK ) break;
+      if( memcmp(zBuf, PGHDR_TO_DATA(pPg), SQLITE_PAGE_SIZE)!=0 ){
+        memcpy(PGHDR_TO_DATA(pPg), zBuf, SQLITE_PAGE_SIZE);
+        memset(PGHDR_TO_EXTRA(pPg), 0, pPager->nExtra);
+      }
+    }
   }
 
 end_playback:
@@ -387,48 +1032,47 @@ end_playback:
 static int pager_ckpt_playback(Pager *pPager){
   int nRec;                /* Number of Records */
   int i;                   /* Loop counter */
+  off64 iOff;              /* Offset of a record in the transaction journal */
+  PageRecord pgRec;
   int rc;
 
   /* Truncate the database back to its original size.
   */
-  rc = sqliteOsTruncate(&pPager->fd, pPager->ckptSize*SQLITE_PAGE_SIZE);
+  if( pPager->eLock==SQLITE_LOCK_EXCLUSIVE ){
+    sqliteOsTruncate(&pPager->fd, (off64)pPager->ckptSize*SQLITE_PAGE_SIZE);
+  }
   pPager->dbSize = pPager->ckptSize;
 
   /* Figure out how many records are in the checkpoint journal.
   */
   assert( pPager->ckptInUse && pPager->journalOpen );
-  sqliteOsSeek(&pPager->cpfd, 0);
-  rc = sqliteOsFileSize(&pPager->cpfd, &nRec);
-  if( rc!=SQLITE_OK ){
-    goto end_ckpt_playback;
-  }
-  nRec /= sizeof(PageRecord);
+  nRec = (int)(pPager->ckptOffset/sizeof(PageRecord));
   
   /* Copy original pages out of the checkpoint journal and back into the
   ** database file.
   */
-  for(i=nRec-1; i>=0; i--){
-    rc = pager_playback_one_page(pPager, &pPager->cpfd);
+  for(i=0; i<nRec; i++){
+    rc = pager_ckpt_read(pPager, i, &pgRec);
+    if( rc!=SQLITE_OK ) goto end_ckpt_playback;
+    rc = pager_playback_one_page(pPager, &pgRec);
     if( rc!=SQLITE_OK ) goto end_ckpt_playback;
   }
 
-  /* Figure out how many pages need to be copied out of the transaction
-  ** journal.
+  /* Copy the pages that were added to the transaction journal since
+  ** the checkpoint was set.  The journal file might be longer than
+  ** Pager.jOffset in PAGER_JOURNALMODE_PERSIST, so the file size is
+  ** not used here.
   */
-  rc = sqliteOsSeek(&pPager->jfd, pPager->ckptJSize);
+  rc = pager_journal_flush(pPager);
   if( rc!=SQLITE_OK ){
     goto end_ckpt_playback;
   }
-  rc = sqliteOsFileSize(&pPager->jfd, &nRec);
-  if( rc!=SQLITE_OK ){
-    goto end_ckpt_playback;
-  }
-  nRec = (nRec - pPager->ckptJSize)/sizeof(PageRecord);
-  for(i=nRec-1; i>=0; i--){
-    rc = pager_playback_one_page(pPager, &pPager->jfd);
+  for(iOff=pPager->ckptJSize; iOff<pPager->jOffset; iOff+=sizeof(pgRec)){
+    rc = pager_journal_read(pPager, iOff, &pgRec, sizeof(pgRec));
+    if( rc!=SQLITE_OK ) goto end_ckpt_playback;
+    rc = pager_playback_one_page(pPager, &pgRec);
     if( rc!=SQLITE_OK ) goto end_ckpt_playback;
   }
-  
 
 end_ckpt_playback:
   if( rc!=SQLITE_OK ){
@@ -442,24 +1086,158 @@ end_ckpt_playback:
 ** Change the maximum number of in-memory pages that are allowed.
 **
 ** The maximum number is the absolute value of the mxPage parameter.
-** If mxPage is negative, the noSync flag is also set.  noSync bypasses
-** calls to sqliteOsSync().  The pager runs much faster with noSync on,
-** but if the operating system crashes or there is an abrupt power 
-** failure, the database file might be left in an inconsistent and
-** unrepairable state.  
+** If mxPage is negative, the safety level is also set to PAGER_SYNC_OFF.
+** A positive mxPage turns a level of PAGER_SYNC_OFF back into
+** PAGER_SYNC_NORMAL and leaves any other level alone.  See
+** sqlitepager_safety_level() for what each level guarantees.
 */
 void sqlitepager_set_cachesize(Pager *pPager, int mxPage){
   if( mxPage>=0 ){
-    pPager->noSync = pPager->tempFile;
+    if( pPager->safetyLevel==PAGER_SYNC_OFF ){
+      pPager->safetyLevel = PAGER_SYNC_NORMAL;
+    }
   }else{
-    pPager->noSync = 1;
+    pPager->safetyLevel = PAGER_SYNC_OFF;
     mxPage = -mxPage;
   }
+  pPager->noSync = pPager->tempFile || pPager->safetyLevel==PAGER_SYNC_OFF;
   if( mxPage>10 ){
     pPager->mxPage = mxPage;
   }
 }
 
+/*
+** Set the journal mode for this pager to eMode, which must be one of
+** the PAGER_JOURNALMODE_* values, and return the journal mode that is
+** now in effect.  If eMode is negative, the mode is not changed.  The
+** mode cannot be changed while a write transaction is in progress.
+**
+**    PAGER_JOURNALMODE_DELETE    The journal is created at the start of
+**                                each transaction and deleted at the end.
+**
+**    PAGER_JOURNALMODE_PERSIST   The journal file is kept between
+**                                transactions.  At the end of a
+**                                transaction its header is zeroed.
+**
+**    PAGER_JOURNALMODE_TRUNCATE  The journal file is kept between
+**                                transactions.  At the end of a
+**                                transaction it is truncated to zero
+**                                length.
+**
+**    PAGER_JOURNALMODE_MEMORY    The journal is kept in memory.  No
+**                                journal file is written, so a ROLLBACK
+**                                still works but a crash or power failure
+**                                in the middle of a COMMIT, or while the
+**                                cache spills changes to disk, can leave
+**                                the database corrupt.
+**
+** An in-memory database always uses PAGER_JOURNALMODE_MEMORY.
+*/
+int sqlitepager_journal_mode(Pager *pPager, int eMode){
+  if( eMode>=PAGER_JOURNALMODE_DELETE && eMode<=PAGER_JOURNALMODE_MEMORY
+       && pPager->state!=SQLITE_WRITELOCK && !pPager->memDb ){
+    pPager->journalMode = eMode;
+  }
+  return pPager->journalMode;
+}
+
+/*
+** Set the safety level of the pager to eLevel, which must be one of the
+** PAGER_SYNC_* values, and return the level that is now in effect.  If
+** eLevel is negative the level is not changed.  The safety level decides
+** when the journal and the database file are flushed to disk, and so
+** what survives an operating system crash or a power failure.  Every
+** level survives a crash of the application itself, because the data
+** written is already in the hands of the operating system.
+**
+**    PAGER_SYNC_OFF      Nothing is ever synced.  This is the fastest
+**                        level, but a power failure in the middle of a
+**                        COMMIT, or soon after it, can leave the
+**                        database corrupt.
+**
+**    PAGER_SYNC_NORMAL   The journal is synced before the first page of
+**                        the database file is overwritten and the
+**                        database file is synced before the journal is
+**                        deleted, zeroed or truncated.  A transaction is
+**                        either fully committed or fully rolled back
+**                        after a power failure, so long as the file
+**                        system keeps the new journal's directory entry.
+**                        This is the default.
+**
+**    PAGER_SYNC_FULL     As PAGER_SYNC_NORMAL, and in addition the
+**                        directory is synced after the journal is created
+**                        and after it is deleted, so that neither the
+**                        journal nor a committed transaction can be lost
+**                        to a power failure.  In PAGER_JOURNALMODE_PERSIST
+**                        the journal is synced once more so the record
+**                        count in its header never reaches the disk
+**                        before the records themselves.
+**
+**    PAGER_SYNC_DATA     The same sync points as PAGER_SYNC_NORMAL, but
+**                        using fdatasync() where the system has it.  The
+**                        contents of both files are as safe as with
+**                        PAGER_SYNC_NORMAL; only metadata that is not
+**                        needed to read the file back, such as the
+**                        modification time, may be lost.
+**
+** Temporary databases are never synced whatever the level.
+*/
+int sqlitepager_safety_level(Pager *pPager, int eLevel){
+  if( eLevel>=PAGER_SYNC_OFF && eLevel<=PAGER_SYNC_DATA ){
+    pPager->safetyLevel = eLevel;
+    pPager->noSync = pPager->tempFile || eLevel==PAGER_SYNC_OFF;
+  }
+  return pPager->safetyLevel;
+}
+
+/*
+** Set the number of milliseconds to wait for a lock on the database file
+** that some other connection holds before giving up with SQLITE_BUSY.
+** The wait ends as soon as the lock is released.  Zero, the default,
+** means do not wait.  A VFS that cannot wait for locks never waits.
+*/
+void sqlitepager_lock_timeout(Pager *pPager, int ms){
+  pPager->lockTimeout = ms>0 ? ms : 0;
+}
+
+/*
+** Set the locking mode of the pager to eMode, which must be one of the
+** PAGER_LOCKINGMODE_* values, and return the mode that is now in effect.
+** If eMode is negative the mode is not changed.
+**
+**    PAGER_LOCKINGMODE_NORMAL     The lock on the database file is dropped
+**                                 and the page cache is emptied whenever
+**                                 the last page is released, which is at
+**                                 the end of every statement outside of a
+**                                 transaction.
+**
+**    PAGER_LOCKINGMODE_EXCLUSIVE  Locks are only ever taken, never given
+**                                 up, until the pager is closed or the
+**                                 mode is set back to normal.  Since no
+**                                 other connection can change the file
+**                                 meanwhile, the page cache is kept from
+**                                 one statement to the next.  Once this
+**                                 pager has written to the database, no
+**                                 other connection can read it either.
+**
+** When the mode is set back to normal, the locks are dropped right away
+** if no page is in use, and otherwise when the last page is released.
+** An in-memory database, whose page cache is all there is of it, is
+** always in exclusive mode.
+*/
+int sqlitepager_locking_mode(Pager *pPager, int eMode){
+  if( (eMode==PAGER_LOCKINGMODE_NORMAL || eMode==PAGER_LOCKINGMODE_EXCLUSIVE)
+       && !pPager->memDb ){
+    pPager->exclusiveMode = eMode==PAGER_LOCKINGMODE_EXCLUSIVE;
+    if( !pPager->exclusiveMode && pPager->nRef==0
+     && pPager->state!=SQLITE_UNLOCK ){
+      pager_reset(pPager);
+    }
+  }
+  return pPager->exclusiveMode ?
+            PAGER_LOCKINGMODE_EXCLUSIVE : PAGER_LOCKINGMODE_NORMAL;
+}
+
 /*
 ** Open a temporary file.  Write the name of the file into zName
 ** (zName must be at least SQLITE_TEMPNAME_SIZE bytes long.)  Write
@@ -469,13 +1247,13 @@ void sqlitepager_set_cachesize(Pager *pPager, int mxPage){
 ** The OS will automatically delete the temporary file when it is
 ** closed.
 */
-static int sqlitepager_opentemp(char *zFile, OsFile *fd){
+static int sqlitepager_opentemp(sqlite_vfs *pVfs, char *zFile, OsFile *fd){
   int cnt = 8;
   int rc;
   do{
     cnt--;
-    sqliteOsTempFileName(zFile);
-    rc = sqliteOsOpenExclusive(zFile, fd, 1);
+    sqliteOsTempFileName(pVfs, zFile);
+    rc = sqliteOsOpenExclusive(pVfs, zFile, fd, 1);
   }while( cnt>0 && rc!=SQLITE_OK );
   return rc;
 }
@@ -486,50 +1264,70 @@ static int sqlitepager_opentemp(char *zFile, OsFile *fd){
 ** the first call to sqlitepager_get() and is only held open until the
 ** last page is released using sqlitepager_unref().
 **
-** If zFilename is NULL then a randomly-named temporary file is created
-** and used as the file to be cached.  The file will be deleted
-** automatically when it is closed.
+** If zFilename is ":memory:" then no file is opened at all.  The pages
+** of the database are kept in the cache, which is never flushed, and
+** vanish when the pager is closed.  The journal is kept in memory and
+** no locks are taken.
+**
+** If zFilename is NULL then a temporary database is opened.  It starts
+** out in memory, like a ":memory:" database.  Only when its cache is
+** full is a randomly-named temporary file created, and from then on the
+** pages that do not fit in the cache are written there.  The file will
+** be deleted automatically when it is closed.
 */
 int sqlitepager_open(
   Pager **ppPager,         /* Return the Pager structure here */
   const char *zFilename,   /* Name of the database file to open */
   int mxPage,              /* Max number of in-memory cache pages */
-  int nExtra               /* Extra bytes append to each in-memory page */
+  int nExtra,              /* Extra bytes append to each in-memory page */
+  sqlite_vfs *pVfs         /* Do all I/O through this VFS.  NULL for default */
 ){
   Pager *pPager;
   int nameLen;
   OsFile fd;
   int rc;
   int tempFile;
+  int memDb = 0;
   int readOnly = 0;
-  char zTemp[SQLITE_TEMPNAME_SIZE];
 
   *ppPager = 0;
   if( sqlite_malloc_failed ){
     return SQLITE_NOMEM;
   }
-  if( zFilename ){
-    rc = sqliteOsOpenReadWrite(zFilename, &fd, &readOnly);
-    tempFile = 0;
-  }else{
-    rc = sqlitepager_opentemp(zTemp, &fd);
-    zFilename = zTemp;
+  if( pVfs==0 ){
+    pVfs = sqlite_vfs_find(0);
+  }
+  if( zFilename==0 || strcmp(zFilename, ":memory:")==0 ){
+    memset(&fd, 0, sizeof(fd));
+    rc = SQLITE_OK;
     tempFile = 1;
+    memDb = 1;
+  }else{
+    rc = sqliteOsOpenReadWrite(pVfs, zFilename, &fd, &readOnly);
+    tempFile = 0;
   }
   if( rc!=SQLITE_OK ){
     return SQLITE_CANTOPEN;
   }
-  nameLen = strlen(zFilename);
+  nameLen = zFilename ? strlen(zFilename) : 0;
   pPager = sqliteMalloc( sizeof(*pPager) + nameLen*2 + 30 );
   if( pPager==0 ){
-    sqliteOsClose(&fd);
+    if( !memDb ) sqliteOsClose(&fd);
+    return SQLITE_NOMEM;
+  }
+  pPager->nHash = N_PG_HASH;
+  pPager->aHash = sqliteMalloc( N_PG_HASH*sizeof(pPager->aHash[0]) );
+  if( pPager->aHash==0 ){
+    sqliteFree(pPager);
+    if( !memDb ) sqliteOsClose(&fd);
     return SQLITE_NOMEM;
   }
   pPager->zFilename = (char*)&pPager[1];
   pPager->zJournal = &pPager->zFilename[nameLen+1];
-  strcpy(pPager->zFilename, zFilename);
-  strcpy(pPager->zJournal, zFilename);
+  strcpy(pPager->zFilename, zFilename ? zFilename : "");
+  strcpy(pPager->zJournal, pPager->zFilename);
   strcpy(&pPager->zJournal[nameLen], "-journal");
+  pPager->pVfs = pVfs;
   pPager->fd = fd;
   pPager->journalOpen = 0;
   pPager->ckptOpen = 0;
@@ -538,6 +1336,7 @@ int sqlitepager_open(
   pPager->dbSize = -1;
   pPager->ckptSize = 0;
   pPager->ckptJSize = 0;
+  pPager->ckptOffset = 0;
   pPager->nPage = 0;
   pPager->mxPage = mxPage>5 ? mxPage : 10;
   pPager->state = SQLITE_UNLOCK;
@@ -546,10 +1345,34 @@ int sqlitepager_open(
   pPager->readOnly = readOnly;
   pPager->needSync = 0;
   pPager->noSync = pPager->tempFile;
+  pPager->safetyLevel = PAGER_SYNC_NORMAL;
   pPager->pFirst = 0;
   pPager->pLast = 0;
+  pPager->pFirstHot = 0;
+  pPager->pLastHot = 0;
+  pPager->nHot = 0;
   pPager->nExtra = nExtra;
-  memset(pPager->aHash, 0, sizeof(pPager->aHash));
+  pPager->pSlab = 0;
+  pPager->pFreeSlot = 0;
+  pPager->nSlot = 0;
+  pPager->szSlot = sizeof(PgHdr) + SQLITE_PAGE_SIZE + nExtra;
+  pPager->szSlot = (pPager->szSlot + 7) & ~7;
+  pPager->aJBuf = 0;
+  pPager->nJBuf = 0;
+  pPager->szJBuf = 0;
+  pPager->jOffset = 0;
+  pPager->journalMode = PAGER_JOURNALMODE_DELETE;
+  pPager->memJournal = 0;
+  pPager->memDb = memDb;
+  pPager->lazyTemp = zFilename==0;
+  if( memDb ){
+    /* There is nobody to share an in-memory database with, so it is
+    ** read-locked from the start and never gives up its cache. */
+    pPager->dbSize = 0;
+    pPager->state = SQLITE_READLOCK;
+    pPager->exclusiveMode = 1;
+    pPager->journalMode = PAGER_JOURNALMODE_MEMORY;
+  }
   *ppPager = pPager;
   return SQLITE_OK;
 }
@@ -571,7 +1394,7 @@ void sqlitepager_set_destructor(Pager *pPager, void (*xDesc)(void*)){
 ** pPager.
 */
 int sqlitepager_pagecount(Pager *pPager){
-  int n;
+  off64 n;
   assert( pPager!=0 );
   if( pPager->dbSize>=0 ){
     return pPager->dbSize;
@@ -582,9 +1405,9 @@ int sqlitepager_pagecount(Pager *pPager){
   }
   n /= SQLITE_PAGE_SIZE;
   if( pPager->state!=SQLITE_UNLOCK ){
-    pPager->dbSize = n;
+    pPager->dbSize = (int)n;
   }
-  return n;
+  return (int)n;
 }
 
 /*
@@ -597,16 +1420,18 @@ int sqlitepager_pagecount(Pager *pPager){
 ** result in a coredump.
 */
 int sqlitepager_close(Pager *pPager){
-  PgHdr *pPg, *pNext;
+  PgSlab *pSlab, *pNext;
+  PgSnapshot *pSnap;
   switch( pPager->state ){
     case SQLITE_WRITELOCK: {
       sqlitepager_rollback(pPager);
-      sqliteOsUnlock(&pPager->fd);
+      if( !pPager->memDb ) sqliteOsUnlock(&pPager->fd);
+      pPager->eLock = SQLITE_LOCK_NONE;
       assert( pPager->journalOpen==0 );
       break;
     }
     case SQLITE_READLOCK: {
-      sqliteOsUnlock(&pPager->fd);
+      if( !pPager->memDb ) sqliteOsUnlock(&pPager->fd);
       break;
     }
     default: {
@@ -614,17 +1439,24 @@ int sqlitepager_close(Pager *pPager){
       break;
     }
   }
-  for(pPg=pPager->pAll; pPg; pPg=pNext){
-    pNext = pPg->pNextAll;
-    sqliteFree(pPg);
+  for(pSlab=pPager->pSlab; pSlab; pSlab=pNext){
+    pNext = pSlab->pNext;
+    sqliteFree(pSlab);
   }
-  sqliteOsClose(&pPager->fd);
+  while( (pSnap = pPager->pSnapFirst)!=0 ){
+    pPager->pSnapFirst = pSnap->pNext;
+    snapshot_free(pSnap);
+  }
+  if( !pPager->memDb ) sqliteOsClose(&pPager->fd);
   assert( pPager->journalOpen==0 );
   /* Temp files are automatically deleted by the OS
   ** if( pPager->tempFile ){
   **   sqliteOsDelete(pPager->zFilename);
   ** }
   */
+  sqliteFree(pPager->aHash);
+  sqliteFree(pPager->aJBuf);
+  sqliteFree(pPager->aCkpt);
   sqliteFree(pPager);
   return SQLITE_OK;
 }
@@ -637,6 +1469,77 @@ Pgno sqlitepager_pagenumber(void *pData){
   return p->pgno;
 }
 
+/*
+** Remove a page from the freelist that it is on.  Protected pages
+** are on the pFirstHot list and probationary pages are on pFirst.
+*/
+static void page_unlink_free(PgHdr *pPg){
+  Pager *pPager = pPg->pPager;
+  if( pPg->pPrevFree ){
+    pPg->pPrevFree->pNextFree = pPg->pNextFree;
+  }else if( pPg->isHot ){
+    assert( pPager->pFirstHot==pPg );
+    pPager->pFirstHot = pPg->pNextFree;
+  }else{
+    assert( pPager->pFirst==pPg );
+    pPager->pFirst = pPg->pNextFree;
+  }
+  if( pPg->pNextFree ){
+    pPg->pNextFree->pPrevFree = pPg->pPrevFree;
+  }else if( pPg->isHot ){
+    assert( pPager->pLastHot==pPg );
+    pPager->pLastHot = pPg->pPrevFree;
+  }else{
+    assert( pPager->pLast==pPg );
+    pPager->pLast = pPg->pPrevFree;
+  }
+  pPg->pNextFree = pPg->pPrevFree = 0;
+}
+
+/*
+** Add a page to the most recently used end of the freelist for
+** its segment of the cache.
+*/
+static void page_link_free(PgHdr *pPg){
+  Pager *pPager = pPg->pPager;
+  PgHdr **ppFirst, **ppLast;
+  if( pPg->isHot ){
+    ppFirst = &pPager->pFirstHot;
+    ppLast = &pPager->pLastHot;
+  }else{
+    ppFirst = &pPager->pFirst;
+    ppLast = &pPager->pLast;
+  }
+  pPg->pNextFree = 0;
+  pPg->pPrevFree = *ppLast;
+  *ppLast = pPg;
+  if( pPg->pPrevFree ){
+    pPg->pPrevFree->pNextFree = pPg;
+  }else{
+    *ppFirst = pPg;
+  }
+}
+
+/*
+** Move a probationary page into the protected segment of the cache.
+** The page must not be on a freelist.  If this makes the protected
+** segment too big, the least recently used free protected page is
+** moved back to the probationary list.
+*/
+static void page_make_hot(PgHdr *pPg){
+  Pager *pPager = pPg->pPager;
+  assert( pPg->nRef>0 && !pPg->isHot );
+  pPg->isHot = 1;
+  pPager->nHot++;
+  if( pPager->nHot>PAGER_MX_HOT(pPager) && pPager->pFirstHot ){
+    PgHdr *pOld = pPager->pFirstHot;
+    page_unlink_free(pOld);
+    pOld->isHot = 0;
+    pPager->nHot--;
+    page_link_free(pOld);
+  }
+}
+
 /*
 ** Increment the reference count for a page.  If the page is
 ** currently on the freelist (the reference count is zero) then
@@ -644,16 +1547,12 @@ Pgno sqlitepager_pagenumber(void *pData){
 */
 static void page_ref(PgHdr *pPg){
   if( pPg->nRef==0 ){
-    /* The page is currently on the freelist.  Remove it. */
-    if( pPg->pPrevFree ){
-      pPg->pPrevFree->pNextFree = pPg->pNextFree;
-    }else{
-      pPg->pPager->pFirst = pPg->pNextFree;
-    }
-    if( pPg->pNextFree ){
-      pPg->pNextFree->pPrevFree = pPg->pPrevFree;
+    if( pPg->pSnap ){
+      /* A snapshot copy is never on the freelist. */
+      pPg->pSnap->nRef++;
     }else{
-      pPg->pPager->pLast = pPg->pPrevFree;
+      /* The page is currently on the freelist.  Remove it. */
+      page_unlink_free(pPg);
     }
     pPg->pPager->nRef++;
   }
@@ -671,6 +1570,124 @@ int sqlitepager_ref(void *pData){
   return SQLITE_OK;
 }
 
+/*
+** Merge two lists of pages that are connected by PgHdr.pDirty and
+** that are each in ascending order by page number.
+*/
+static PgHdr *merge_pagelist(PgHdr *pA, PgHdr *pB){
+  PgHdr result, *pTail;
+  pTail = &result;
+  while( pA && pB ){
+    if( pA->pgno<pB->pgno ){
+      pTail->pDirty = pA;
+      pTail = pA;
+      pA = pA->pDirty;
+    }else{
+      pTail->pDirty = pB;
+      pTail = pB;
+      pB = pB->pDirty;
+    }
+  }
+  pTail->pDirty = pA ? pA : pB;
+  return result.pDirty;
+}
+
+/*
+** Sort a list of pages connected by PgHdr.pDirty into ascending order
+** by page number and return the head of the sorted list.  This is a
+** bottom-up merge sort.  Entry i of a[] holds a sorted list of 2**i
+** pages, or is empty.  The last entry can hold any number of pages.
+*/
+#define N_SORT_BUCKET 25
+static PgHdr *sort_pagelist(PgHdr *pIn){
+  PgHdr *a[N_SORT_BUCKET], *p;
+  int i;
+  memset(a, 0, sizeof(a));
+  while( pIn ){
+    p = pIn;
+    pIn = p->pDirty;
+    p->pDirty = 0;
+    for(i=0; i<N_SORT_BUCKET-1; i++){
+      if( a[i]==0 ){
+        a[i] = p;
+        break;
+      }
+      p = merge_pagelist(a[i], p);
+      a[i] = 0;
+    }
+    if( i==N_SORT_BUCKET-1 ){
+      a[i] = merge_pagelist(a[i], p);
+    }
+  }
+  p = a[0];
+  for(i=1; i<N_SORT_BUCKET; i++){
+    p = merge_pagelist(p, a[i]);
+  }
+  return p;
+}
+
+/*
+** The largest number of pages that pager_write_pagelist() will hand
+** to the OS layer in a single write.
+*/
+#define N_WRITE_RUN 32
+
+/*
+** Write every page on the list pList back to the database file and
+** clear the dirty flag of each page that was written.  The pages are
+** connected by PgHdr.pDirty.
+**
+** The pages are first sorted by page number so that the file is written
+** from front to back.  Each run of consecutive page numbers (up to
+** N_WRITE_RUN pages) is passed to the OS layer in a single vectored
+** write.  A bulk load or index build that dirties
+** thousands of pages is thus written with a small number of large,
+** sequential writes instead of one small write per page in whatever
+** order the pages happened to enter the cache.
+*/
+static int pager_write_pagelist(Pager *pPager, PgHdr *pList){
+  void *apData[N_WRITE_RUN];
+  PgHdr *p;
+  int n, rc;
+
+  pList = sort_pagelist(pList);
+  while( pList ){
+    n = 0;
+    p = pList;
+    do{
+      apData[n++] = PGHDR_TO_DATA(p);
+      p = p->pDirty;
+    }while( p && p->pgno==pList->pgno+n && n<N_WRITE_RUN );
+    rc = sqliteOsWritev(&pPager->fd, apData, n, SQLITE_PAGE_SIZE,
+                        PAGE_OFFSET(pList->pgno));
+    if( rc!=SQLITE_OK ) return rc;
+    while( pList!=p ){
+      pList->dirty = 0;
+      pList = pList->pDirty;
+    }
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Raise the RESERVED lock of a write transaction to EXCLUSIVE so that
+** changes can be written to the database file.  Readers that still
+** hold SHARED locks are waited for, for up to the lock timeout, and no
+** new readers are let in meanwhile.  This is a no-op if the EXCLUSIVE
+** lock is already held.
+*/
+static int pager_exclusive_lock(Pager *pPager){
+  int rc;
+  if( pPager->eLock==SQLITE_LOCK_EXCLUSIVE ) return SQLITE_OK;
+  assert( pPager->state==SQLITE_WRITELOCK );
+  rc = sqliteOsLockWait(&pPager->fd, SQLITE_LOCK_EXCLUSIVE,
+                        pPager->lockTimeout);
+  if( rc==SQLITE_OK ){
+    pPager->eLock = SQLITE_LOCK_EXCLUSIVE;
+  }
+  return rc;
+}
+
 /*
 ** Sync the journal and then write all free dirty pages to the database
 ** file.
@@ -690,23 +1707,74 @@ int sqlitepager_ref(void *pData){
 */
 static int syncAllPages(Pager *pPager){
   PgHdr *pPg;
-  int rc = SQLITE_OK;
+  PgHdr *pList = 0;
+  int i;
+  int rc;
+  rc = pager_journal_flush(pPager);
+  if( rc==SQLITE_OK ) rc = pager_write_nrec(pPager);
+  if( rc!=SQLITE_OK ) return rc;
   if( pPager->needSync ){
     if( !pPager->tempFile ){
-      rc = sqliteOsSync(&pPager->jfd);
+      rc = pager_sync(pPager, &pPager->jfd);
       if( rc!=0 ) return rc;
     }
     pPager->needSync = 0;
   }
-  for(pPg=pPager->pFirst; pPg; pPg=pPg->pNextFree){
-    if( pPg->dirty ){
-      sqliteOsSeek(&pPager->fd, (pPg->pgno-1)*SQLITE_PAGE_SIZE);
-      rc = sqliteOsWrite(&pPager->fd, PGHDR_TO_DATA(pPg), SQLITE_PAGE_SIZE);
-      if( rc!=SQLITE_OK ) break;
-      pPg->dirty = 0;
+  rc = pager_exclusive_lock(pPager);
+  if( rc!=SQLITE_OK ) return rc;
+  for(i=0; i<2; i++){
+    pPg = i==0 ? pPager->pFirst : pPager->pFirstHot;
+    for(; pPg; pPg=pPg->pNextFree){
+      if( pPg->dirty ){
+        pPg->pDirty = pList;
+        pList = pPg;
+      }
     }
   }
-  return rc;
+  return pager_write_pagelist(pPager, pList);
+}
+
+/*
+** Move a temporary database that has been kept in memory out to a
+** temporary file, because its cache is full.  Every page that holds
+** data not yet in the file is written there, except for pages that are
+** both dirty and in use, which are written like any other dirty page
+** later on.  From then on pages are recycled as for any other database.
+**
+** If the file cannot be created or written, the database is left in
+** memory for good and its cache simply keeps growing.
+*/
+static int pager_spill(Pager *pPager){
+  char zTemp[SQLITE_TEMPNAME_SIZE];
+  PgHdr *pPg, *pList = 0;
+  int rc;
+  assert( pPager->memDb && pPager->lazyTemp );
+  rc = sqlitepager_opentemp(pPager->pVfs, zTemp, &pPager->fd);
+  if( rc!=SQLITE_OK ) return rc;
+  rc = sqliteOsLockWait(&pPager->fd, SQLITE_LOCK_SHARED, 0);
+  if( rc==SQLITE_OK ){
+    rc = sqliteOsLockWait(&pPager->fd, SQLITE_LOCK_EXCLUSIVE, 0);
+  }
+  if( rc==SQLITE_OK ){
+    for(pPg=pPager->pAll; pPg; pPg=pPg->pNextAll){
+      if( (int)pPg->pgno>pPager->dbSize ) continue;
+      if( pPg->dirty && pPg->nRef>0 ) continue;
+      pPg->pDirty = pList;
+      pList = pPg;
+    }
+    rc = pager_write_pagelist(pPager, pList);
+  }
+  if( rc!=SQLITE_OK ){
+    /* Pages that were written are no longer marked dirty.  That does
+    ** not matter while the database is in memory. */
+    sqliteOsClose(&pPager->fd);
+    memset(&pPager->fd, 0, sizeof(pPager->fd));
+    pPager->lazyTemp = 0;
+    return rc;
+  }
+  pPager->eLock = SQLITE_LOCK_EXCLUSIVE;
+  pPager->memDb = 0;
+  return SQLITE_OK;
 }
 
 /*
@@ -734,6 +1802,7 @@ static int syncAllPages(Pager *pPager){
 */
 int sqlitepager_get(Pager *pPager, Pgno pgno, void **ppPage){
   PgHdr *pPg;
+  int rc;
 
   /* Make sure we have not hit any critical errors.
   */ 
@@ -745,29 +1814,38 @@ int sqlitepager_get(Pager *pPager, Pgno pgno, void **ppPage){
   }
 
   /* If this is the first page accessed, then get a read lock
-  ** on the database file.
+  ** on the database file.  In exclusive locking mode the lock may
+  ** still be held from an earlier statement, along with the cache.
   */
-  if( pPager->nRef==0 ){
-    if( sqliteOsReadLock(&pPager->fd)!=SQLITE_OK ){
+  if( pPager->nRef==0
+   && (pPager->state==SQLITE_UNLOCK || !pPager->exclusiveMode) ){
+    rc = sqliteOsLockWait(&pPager->fd, SQLITE_LOCK_SHARED,
+                          pPager->lockTimeout);
+    if( rc!=SQLITE_OK ){
       *ppPage = 0;
       return SQLITE_BUSY;
     }
+    pPager->eLock = SQLITE_LOCK_SHARED;
     pPager->state = SQLITE_READLOCK;
 
     /* If a journal file exists, try to play it back.
     */
-    if( sqliteOsFileExists(pPager->zJournal) ){
-       int rc, dummy;
+    if( pager_hot_journal(pPager) ){
+       int dummy;
 
        /* Get a write lock on the database
        */
-       rc = sqliteOsWriteLock(&pPager->fd);
+       rc = sqliteOsLockWait(&pPager->fd, SQLITE_LOCK_EXCLUSIVE,
+                             pPager->lockTimeout);
        if( rc!=SQLITE_OK ){
          rc = sqliteOsUnlock(&pPager->fd);
          assert( rc==SQLITE_OK );
+         pPager->eLock = SQLITE_LOCK_NONE;
+         pPager->state = SQLITE_UNLOCK;
          *ppPage = 0;
          return SQLITE_BUSY;
        }
+       pPager->eLock = SQLITE_LOCK_EXCLUSIVE;
        pPager->state = SQLITE_WRITELOCK;
 
        /* Open the journal for exclusive access.  Return SQLITE_BUSY if
@@ -777,7 +1855,8 @@ int sqlitepager_get(Pager *pPager, Pgno pgno, void **ppPage){
        ** we have to open the journal for writing in order to obtain an
        ** exclusive access lock.
        */
-       rc = sqliteOsOpenReadWrite(pPager->zJournal, &pPager->jfd, &dummy);
+       rc = sqliteOsOpenReadWrite(pPager->pVfs, pPager->zJournal, &pPager->jfd,
+                                  &dummy);
        if( rc!=SQLITE_OK ){
          rc = sqliteOsUnlock(&pPager->fd);
          assert( rc==SQLITE_OK );
@@ -789,7 +1868,7 @@ int sqlitepager_get(Pager *pPager, Pgno pgno, void **ppPage){
        /* Playback and delete the journal.  Drop the database write
        ** lock and reacquire the read lock.
        */
-       rc = pager_playback(pPager);
+       rc = pager_playback(pPager, 1);
        if( rc!=SQLITE_OK ){
          return rc;
        }
@@ -803,9 +1882,18 @@ int sqlitepager_get(Pager *pPager, Pgno pgno, void **ppPage){
     /* The requested page is not in the page cache. */
     int h;
     pPager->nMiss++;
-    if( pPager->nPage<pPager->mxPage || pPager->pFirst==0 ){
-      /* Create a new page */
-      pPg = sqliteMalloc( sizeof(*pPg) + SQLITE_PAGE_SIZE + pPager->nExtra );
+    if( pPager->nPage>=pPager->mxPage && pPager->lazyTemp && pPager->memDb ){
+      pager_spill(pPager);
+    }
+    if( pPager->nPage<pPager->mxPage || pPager->memDb
+          || (pPager->pFirst==0 && pPager->pFirstHot==0) ){
+      /* Create a new page.  Grow the hash table first if the cache
+      ** is about to hold more pages than there are hash buckets.  The
+      ** pages of an in-memory database are never recycled. */
+      if( pPager->nPage>=pPager->nHash ){
+        pager_resize_hash(pPager, pPager->nHash*2);
+      }
+      pPg = pager_alloc_page(pPager);
       if( pPg==0 ){
         *ppPage = 0;
         pager_unwritelock(pPager);
@@ -823,11 +1911,18 @@ int sqlitepager_get(Pager *pPager, Pgno pgno, void **ppPage){
     }else{
       /* Recycle an older page.  First locate the page to be recycled.
       ** Try to find one that is not dirty and is near the head of
-      ** of the free list */
+      ** of the probationary free list.  Only take a protected page if
+      ** there are no clean probationary pages. */
       pPg = pPager->pFirst;
       while( pPg && pPg->dirty ){
         pPg = pPg->pNextFree;
       }
+      if( pPg==0 ){
+        pPg = pPager->pFirstHot;
+        while( pPg && pPg->dirty ){
+          pPg = pPg->pNextFree;
+        }
+      }
 
       /* If we could not find a page that has not been used recently
       ** and which is not dirty, then sync the journal and write all
@@ -846,35 +1941,36 @@ int sqlitepager_get(Pager *pPager, Pgno pgno, void **ppPage){
         if( rc!=0 ){
           sqlitepager_rollback(pPager);
           *ppPage = 0;
-          return SQLITE_IOERR;
+          return rc==SQLITE_BUSY ? SQLITE_BUSY : SQLITE_IOERR;
         }
-        pPg = pPager->pFirst;
+        pPg = pPager->pFirst ? pPager->pFirst : pPager->pFirstHot;
       }
       assert( pPg->nRef==0 );
       assert( pPg->dirty==0 );
 
-      /* Unlink the old page from the free list and the hash table
+      /* The page being recycled may have been freed in this transaction.
+      ** See sqlitepager_dont_write().  Since it is no longer possible to
+      ** tell whether a page that is loaded again was one of them, no page
+      ** may skip the journal for the rest of the transaction.
       */
-      if( pPg->pPrevFree ){
-        pPg->pPrevFree->pNextFree = pPg->pNextFree;
-      }else{
-        assert( pPager->pFirst==pPg );
-        pPager->pFirst = pPg->pNextFree;
+      if( pPg->alwaysRollback ){
+        pPager->alwaysRollback = 1;
       }
-      if( pPg->pNextFree ){
-        pPg->pNextFree->pPrevFree = pPg->pPrevFree;
-      }else{
-        assert( pPager->pLast==pPg );
-        pPager->pLast = pPg->pPrevFree;
+
+      /* Unlink the old page from the free list and the hash table
+      */
+      page_unlink_free(pPg);
+      if( pPg->isHot ){
+        pPg->isHot = 0;
+        pPager->nHot--;
       }
-      pPg->pNextFree = pPg->pPrevFree = 0;
       if( pPg->pNextHash ){
         pPg->pNextHash->pPrevHash = pPg->pPrevHash;
       }
       if( pPg->pPrevHash ){
         pPg->pPrevHash->pNextHash = pPg->pNextHash;
       }else{
-        h = pager_hash(pPg->pgno);
+        h = pager_hash(pPager, pPg->pgno);
         assert( pPager->aHash[h]==pPg );
         pPager->aHash[h] = pPg->pNextHash;
       }
@@ -893,10 +1989,11 @@ int sqlitepager_get(Pager *pPager, Pgno pgno, void **ppPage){
       pPg->inCkpt = 0;
     }
     pPg->dirty = 0;
+    pPg->alwaysRollback = 0;
     pPg->nRef = 1;
     REFINFO(pPg);
     pPager->nRef++;
-    h = pager_hash(pgno);
+    h = pager_hash(pPager, pgno);
     pPg->pNextHash = pPager->aHash[h];
     pPager->aHash[h] = pPg;
     if( pPg->pNextHash ){
@@ -904,12 +2001,12 @@ int sqlitepager_get(Pager *pPager, Pgno pgno, void **ppPage){
       pPg->pNextHash->pPrevHash = pPg;
     }
     if( pPager->dbSize<0 ) sqlitepager_pagecount(pPager);
-    if( pPager->dbSize<(int)pgno ){
+    if( pPager->dbSize<(int)pgno || pPager->memDb ){
       memset(PGHDR_TO_DATA(pPg), 0, SQLITE_PAGE_SIZE);
     }else{
       int rc;
-      sqliteOsSeek(&pPager->fd, (pgno-1)*SQLITE_PAGE_SIZE);
-      rc = sqliteOsRead(&pPager->fd, PGHDR_TO_DATA(pPg), SQLITE_PAGE_SIZE);
+      rc = sqliteOsRead(&pPager->fd, PGHDR_TO_DATA(pPg), SQLITE_PAGE_SIZE,
+                        PAGE_OFFSET(pgno));
       if( rc!=SQLITE_OK ){
         return rc;
       }
@@ -918,9 +2015,17 @@ int sqlitepager_get(Pager *pPager, Pgno pgno, void **ppPage){
       memset(PGHDR_TO_EXTRA(pPg), 0, pPager->nExtra);
     }
   }else{
-    /* The requested page is in the page cache. */
+    /* The requested page is in the page cache.  If all earlier
+    ** references to a probationary page had already been released,
+    ** then this is a genuine reuse of the page, so promote it to the
+    ** protected segment.  Requests for a page that is still in use
+    ** do not count. */
+    int isReuse = pPg->nRef==0;
     pPager->nHit++;
     page_ref(pPg);
+    if( isReuse && !pPg->isHot ){
+      page_make_hot(pPg);
+    }
   }
   *ppPage = PGHDR_TO_DATA(pPg);
   return SQLITE_OK;
@@ -957,6 +2062,104 @@ void *sqlitepager_lookup(Pager *pPager, Pgno pgno){
   return PGHDR_TO_DATA(pPg);
 }
 
+/*
+** Change by nDelta the number of clients that may read through
+** snapshots.  While there are any, every transaction saves the original
+** content of the pages it changes so that snapshots can be taken at
+** any time.  That costs one page copy for each page a transaction
+** changes.
+*/
+void sqlitepager_snapshot_readers(Pager *pPager, int nDelta){
+  pPager->nSnapReader += nDelta;
+  assert( pPager->nSnapReader>=0 );
+}
+
+/*
+** Take a snapshot of the database as of the last commit and write it
+** into *ppSnap.  The snapshot stays valid until it is released with
+** sqlitepager_snapshot_close(), however many transactions commit in
+** the meantime.  The caller must hold a reference to some page of the
+** pager, so that the read lock is held while the snapshot is in use.
+**
+** SQLITE_LOCKED is returned if a transaction is in progress that began
+** when no client could read through snapshots, since the original
+** content of the pages it changed has not been saved.  The caller has
+** to read the database normally then.
+*/
+int sqlitepager_snapshot_open(Pager *pPager, PgSnapshot **ppSnap){
+  PgSnapshot *pSnap;
+  assert( pPager->nRef>0 );
+  *ppSnap = 0;
+  if( pPager->state==SQLITE_WRITELOCK && !pPager->snapValid ){
+    return SQLITE_LOCKED;
+  }
+  pSnap = snapshot_newest(pPager);
+  if( pSnap==0 ) return SQLITE_NOMEM;
+  pSnap->nRef++;
+  *ppSnap = pSnap;
+  return SQLITE_OK;
+}
+
+/*
+** Release a snapshot taken by sqlitepager_snapshot_open().  Pages that
+** were obtained through the snapshot must be released separately, and
+** the last of them should be released after the snapshot itself.
+*/
+void sqlitepager_snapshot_close(PgSnapshot *pSnap){
+  assert( pSnap->nRef>0 );
+  pSnap->nRef--;
+  snapshot_free_unused(pSnap->pPager);
+}
+
+/*
+** Get a page as it was when snapshot pSnap was taken.  This works like
+** sqlitepager_get(), except that the page is a private copy that must
+** not be written.  The copy is released with sqlitepager_unref().
+*/
+int sqlitepager_snapshot_get(PgSnapshot *pSnap, Pgno pgno, void **ppPage){
+  Pager *pPager = pSnap->pPager;
+  PgSnapshot *p;
+  PgHdr *pPg, *pSrc;
+  void *pData;
+  int rc;
+
+  *ppPage = 0;
+  if( pgno==0 ){
+    return SQLITE_ERROR;
+  }
+  if( pPager->errMask & ~(PAGER_ERR_FULL) ){
+    return pager_errcode(pPager);
+  }
+  pPg = (PgHdr*)sqliteHashFind(&pSnap->pages, 0, pgno);
+  if( pPg==0 ){
+    /* The first newer snapshot that holds the page has the content this
+    ** snapshot should see.  If there is none, the page has not changed
+    ** since the snapshot was taken and is copied from the cache.
+    */
+    pSrc = 0;
+    for(p=pSnap->pNext; p && pSrc==0; p=p->pNext){
+      pSrc = (PgHdr*)sqliteHashFind(&p->pages, 0, pgno);
+    }
+    if( pSrc ){
+      pPg = snapshot_add_page(pSnap, pgno, PGHDR_TO_DATA(pSrc));
+      if( pPg==0 ) return SQLITE_NOMEM;
+      page_ref(pPg);
+    }else{
+      /* The copy is referenced before the cached page is released so
+      ** that the read lock is not dropped in between. */
+      rc = sqlitepager_get(pPager, pgno, &pData);
+      if( rc!=SQLITE_OK ) return rc;
+      pPg = snapshot_add_page(pSnap, pgno, pData);
+      if( pPg ) page_ref(pPg);
+      sqlitepager_unref(pData);
+      if( pPg==0 ) return SQLITE_NOMEM;
+    }
+  }else{
+    page_ref(pPg);
+  }
+  *ppPage = PGHDR_TO_DATA(pPg);
+  return SQLITE_OK;
+}
 /*
 ** Release a page.
 **
@@ -981,24 +2184,32 @@ int sqlitepager_unref(void *pData){
   if( pPg->nRef==0 ){
     Pager *pPager;
     pPager = pPg->pPager;
-    pPg->pNextFree = 0;
-    pPg->pPrevFree = pPager->pLast;
-    pPager->pLast = pPg;
-    if( pPg->pPrevFree ){
-      pPg->pPrevFree->pNextFree = pPg;
-    }else{
-      pPager->pFirst = pPg;
+    if( pPg->pSnap==0 ){
+      page_link_free(pPg);
     }
     if( pPager->xDestructor ){
       pPager->xDestructor(pData);
     }
+
+    /* A snapshot copy that is not an image is no longer needed.
+    */
+    if( pPg->pSnap ){
+      PgSnapshot *pSnap = pPg->pSnap;
+      if( !pPg->isImage ){
+        sqliteHashInsert(&pSnap->pages, 0, pPg->pgno, 0);
+        sqliteFree(pPg);
+      }
+      pSnap->nRef--;
+      snapshot_free_unused(pPager);
+    }
   
     /* When all pages reach the freelist, drop the read lock from
-    ** the database file.
+    ** the database file.  In exclusive locking mode the lock and the
+    ** pages are kept for the next statement.
     */
     pPager->nRef--;
     assert( pPager->nRef>=0 );
-    if( pPager->nRef==0 ){
+    if( pPager->nRef==0 && !pPager->exclusiveMode ){
       pager_reset(pPager);
     }
   }
@@ -1006,7 +2217,68 @@ int sqlitepager_unref(void *pData){
 }
 
 /*
-** Acquire a write-lock on the database.  The lock is removed when
+** Open the transaction journal for pPager in the way called for by the
+** journal mode.
+**
+** In PAGER_JOURNALMODE_DELETE the journal is created with exclusive
+** access and must not exist already.  A journal that is still there
+** at this point holds no transaction (the database write lock is held
+** and any hot journal was played back when the read lock was taken),
+** so it is left over from one of the other modes and is removed.  In
+** _PERSIST and _TRUNCATE the existing journal file is reused.  A
+** leftover journal is truncated in _TRUNCATE, while in _PERSIST the
+** record count in the header says which records are valid.  In _MEMORY
+** no file is opened; the journal is kept in Pager.aJBuf[].
+*/
+static int pager_open_journal(Pager *pPager){
+  int rc;
+  int readOnly = 0;
+  switch( pPager->journalMode ){
+    case PAGER_JOURNALMODE_MEMORY: {
+      pPager->memJournal = 1;
+      rc = SQLITE_OK;
+      break;
+    }
+    case PAGER_JOURNALMODE_PERSIST:
+    case PAGER_JOURNALMODE_TRUNCATE: {
+      rc = sqliteOsOpenReadWrite(pPager->pVfs, pPager->zJournal, &pPager->jfd,
+                                 &readOnly);
+      if( rc==SQLITE_OK && readOnly ){
+        sqliteOsClose(&pPager->jfd);
+        rc = SQLITE_CANTOPEN;
+      }
+      if( rc==SQLITE_OK && pPager->journalMode==PAGER_JOURNALMODE_TRUNCATE ){
+        rc = sqliteOsTruncate(&pPager->jfd, 0);
+        if( rc!=SQLITE_OK ) sqliteOsClose(&pPager->jfd);
+      }
+      break;
+    }
+    default: {
+      rc = sqliteOsOpenExclusive(pPager->pVfs, pPager->zJournal,
+                                 &pPager->jfd, 0);
+      if( rc!=SQLITE_OK && sqliteOsFileExists(pPager->pVfs, pPager->zJournal) ){
+        sqliteOsDelete(pPager->pVfs, pPager->zJournal);
+        rc = sqliteOsOpenExclusive(pPager->pVfs, pPager->zJournal,
+                                   &pPager->jfd, 0);
+      }
+      if( rc==SQLITE_OK && pPager->safetyLevel==PAGER_SYNC_FULL
+       && !pPager->noSync ){
+        rc = sqliteOsSyncDirectory(pPager->pVfs, pPager->zJournal);
+        if( rc!=SQLITE_OK ){
+          sqliteOsClose(&pPager->jfd);
+          sqliteOsDelete(pPager->pVfs, pPager->zJournal);
+        }
+      }
+      break;
+    }
+  }
+  return rc;
+}
+
+/*
+** Acquire a write-lock on the database.  This is a RESERVED lock, so
+** other connections can still read the database until the changes are
+** written to the database file.  The lock is removed when
 ** the any of the following happen:
 **
 **   *  sqlitepager_commit() is called.
@@ -1029,31 +2301,56 @@ int sqlitepager_begin(void *pData){
   assert( pPager->state!=SQLITE_UNLOCK );
   if( pPager->state==SQLITE_READLOCK ){
     assert( pPager->aInJournal==0 );
-    rc = sqliteOsWriteLock(&pPager->fd);
-    if( rc!=SQLITE_OK ){
-      return rc;
+    if( pPager->eLock<SQLITE_LOCK_RESERVED && !pPager->memDb ){
+      rc = sqliteOsLockWait(&pPager->fd, SQLITE_LOCK_RESERVED,
+                            pPager->lockTimeout);
+      if( rc!=SQLITE_OK ){
+        return rc;
+      }
+      pPager->eLock = SQLITE_LOCK_RESERVED;
     }
+    /* The size may not be known if the last transaction ended while
+    ** another handle on a shared cache kept its pages in use. */
+    sqlitepager_pagecount(pPager);
     pPager->aInJournal = sqliteMalloc( pPager->dbSize/8 + 1 );
     if( pPager->aInJournal==0 ){
-      sqliteOsReadLock(&pPager->fd);
+      if( !pPager->memDb ){
+        sqliteOsReadLock(&pPager->fd);
+        pPager->eLock = SQLITE_LOCK_SHARED;
+      }
       return SQLITE_NOMEM;
     }
-    rc = sqliteOsOpenExclusive(pPager->zJournal, &pPager->jfd, 0);
+    rc = pager_open_journal(pPager);
     if( rc!=SQLITE_OK ){
       sqliteFree(pPager->aInJournal);
       pPager->aInJournal = 0;
       sqliteOsReadLock(&pPager->fd);
+      pPager->eLock = SQLITE_LOCK_SHARED;
       return SQLITE_CANTOPEN;
     }
     pPager->journalOpen = 1;
     pPager->needSync = 0;
     pPager->dirtyFile = 0;
     pPager->state = SQLITE_WRITELOCK;
-    sqlitepager_pagecount(pPager);
+    pPager->snapValid = pPager->nSnapReader>0 || pPager->pSnapFirst!=0;
+    if( pPager->aJBuf==0 ){
+      pPager->aJBuf = sqliteMalloc( JOURNAL_BUF_SIZE );
+      pPager->szJBuf = pPager->aJBuf ? JOURNAL_BUF_SIZE : 0;
+    }
+    pPager->nJBuf = 0;
+    pPager->jOffset = 0;
     pPager->origDbSize = pPager->dbSize;
-    rc = sqliteOsWrite(&pPager->jfd, aJournalMagic, sizeof(aJournalMagic));
+    if( pPager->journalMode==PAGER_JOURNALMODE_PERSIST && !pPager->memJournal ){
+      int nRec = 0;
+      rc = pager_journal_write(pPager, aJournalMagic2, sizeof(aJournalMagic2));
+      if( rc==SQLITE_OK ){
+        rc = pager_journal_write(pPager, &nRec, sizeof(nRec));
+      }
+    }else{
+      rc = pager_journal_write(pPager, aJournalMagic, sizeof(aJournalMagic));
+    }
     if( rc==SQLITE_OK ){
-      rc = sqliteOsWrite(&pPager->jfd, &pPager->dbSize, sizeof(Pgno));
+      rc = pager_journal_write(pPager, &pPager->dbSize, sizeof(Pgno));
     }
     if( rc!=SQLITE_OK ){
       rc = pager_unwritelock(pPager);
@@ -1085,6 +2382,8 @@ int sqlitepager_write(void *pData){
   Pager *pPager = pPg->pPager;
   int rc = SQLITE_OK;
 
+  assert( pPg->pSnap==0 );
+
   /* Check for errors
   */
   if( pPager->errMask ){ 
@@ -1122,9 +2421,13 @@ int sqlitepager_write(void *pData){
   ** journal if it is not there already.
   */
   if( !pPg->inJournal && (int)pPg->pgno <= pPager->origDbSize ){
-    rc = sqliteOsWrite(&pPager->jfd, &pPg->pgno, sizeof(Pgno));
+    if( pPager->snapValid ){
+      rc = snapshot_capture(pPg);
+      if( rc!=SQLITE_OK ) return rc;
+    }
+    rc = pager_journal_write(pPager, &pPg->pgno, sizeof(Pgno));
     if( rc==SQLITE_OK ){
-      rc = sqliteOsWrite(&pPager->jfd, pData, SQLITE_PAGE_SIZE);
+      rc = pager_journal_write(pPager, pData, SQLITE_PAGE_SIZE);
     }
     if( rc!=SQLITE_OK ){
       sqlitepager_rollback(pPager);
@@ -1133,7 +2436,7 @@ int sqlitepager_write(void *pData){
     }
     assert( pPager->aInJournal!=0 );
     pPager->aInJournal[pPg->pgno/8] |= 1<<(pPg->pgno&7);
-    pPager->needSync = !pPager->noSync;
+    pPager->needSync = !pPager->noSync && !pPager->memJournal;
     pPg->inJournal = 1;
     if( pPager->ckptInUse ){
       pPager->aInCkpt[pPg->pgno/8] |= 1<<(pPg->pgno&7);
@@ -1146,10 +2449,7 @@ int sqlitepager_write(void *pData){
   */
   if( pPager->ckptInUse && !pPg->inCkpt && (int)pPg->pgno<=pPager->ckptSize ){
     assert( pPg->inJournal || (int)pPg->pgno>pPager->origDbSize );
-    rc = sqliteOsWrite(&pPager->cpfd, &pPg->pgno, sizeof(Pgno));
-    if( rc==SQLITE_OK ){
-      rc = sqliteOsWrite(&pPager->cpfd, pData, SQLITE_PAGE_SIZE);
-    }
+    rc = pager_ckpt_write(pPager, pPg->pgno, pData);
     if( rc!=SQLITE_OK ){
       sqlitepager_rollback(pPager);
       pPager->errMask |= PAGER_ERR_FULL;
@@ -1178,6 +2478,77 @@ int sqlitepager_iswriteable(void *pData){
   return pPg->dirty;
 }
 
+/*
+** Shrink the database to nPage pages as part of the current write
+** transaction.  The pages that are cut off are first written to the
+** journal, if they are not there already, so that a rollback brings
+** them back.  The file itself is truncated when the transaction
+** commits.  Pages beyond the new end that are in the cache are no
+** longer written back and those that are not in use are zeroed.
+*/
+int sqlitepager_truncate(Pager *pPager, Pgno nPage){
+  PgHdr *pPg;
+  void *pData;
+  Pgno pgno;
+  int rc;
+
+  if( pPager->errMask ){
+    return pager_errcode(pPager);
+  }
+  if( pPager->state!=SQLITE_WRITELOCK ){
+    return SQLITE_ERROR;
+  }
+  if( (int)nPage>=sqlitepager_pagecount(pPager) ){
+    return SQLITE_OK;
+  }
+  for(pgno=nPage+1; (int)pgno<=pPager->origDbSize; pgno++){
+    if( pPager->aInJournal[pgno/8] & (1<<(pgno&7)) ) continue;
+    rc = sqlitepager_get(pPager, pgno, &pData);
+    if( rc!=SQLITE_OK ) return rc;
+    rc = sqlitepager_write(pData);
+    sqlitepager_unref(pData);
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  for(pPg=pPager->pAll; pPg; pPg=pPg->pNextAll){
+    if( pPg->pgno<=nPage ) continue;
+    pPg->dirty = 0;
+    if( pPg->nRef==0 ){
+      memset(PGHDR_TO_DATA(pPg), 0, SQLITE_PAGE_SIZE);
+    }
+  }
+  pPager->dbSize = nPage;
+  pPager->dirtyFile = 1;
+  return SQLITE_OK;
+}
+
+/*
+** Invoke xPage(pArg, pgno) for each page numbered below mxPgno that
+** the current write transaction has changed: every page that has been
+** written to the journal and every page past the original end of the
+** database.  Pages that were marked by sqlitepager_dont_rollback() are
+** reported too, although they need not have changed.
+*/
+void sqlitepager_changed_pages(
+  Pager *pPager,                 /* The pager of the write transaction */
+  Pgno mxPgno,                   /* Report only pages below this one */
+  void (*xPage)(void*,Pgno),     /* Called once for each changed page */
+  void *pArg                     /* First argument to xPage */
+){
+  Pgno pgno;
+  if( pPager->state!=SQLITE_WRITELOCK ) return;
+  for(pgno=1; pgno<mxPgno && (int)pgno<=pPager->origDbSize; pgno++){
+    if( pPager->aInJournal[pgno/8]==0 ){
+      pgno |= 7;
+    }else if( pPager->aInJournal[pgno/8] & (1<<(pgno&7)) ){
+      xPage(pArg, pgno);
+    }
+  }
+  for(pgno=pPager->origDbSize+1; pgno<mxPgno && (int)pgno<=pPager->dbSize;
+      pgno++){
+    xPage(pArg, pgno);
+  }
+}
+
 /*
 ** A call to this routine tells the pager that it is not necessary to
 ** write the information on page "pgno" back to the disk, even though
@@ -1190,11 +2561,22 @@ int sqlitepager_iswriteable(void *pData){
 ** Tests show that this optimization, together with the
 ** sqlitepager_dont_rollback() below, more than double the speed
 ** of large INSERT operations and quadruple the speed of large DELETEs.
+**
+** A page that is freed may have held live data when the transaction
+** started.  If it is reused later in the same transaction, its
+** original content must still go into the journal, so the page is
+** excluded from sqlitepager_dont_rollback().  When the page is not in
+** the cache that is done for every page until the transaction ends.
 */
 void sqlitepager_dont_write(Pager *pPager, Pgno pgno){
   PgHdr *pPg;
   pPg = pager_lookup(pPager, pgno);
-  if( pPg && pPg->dirty ){
+  if( pPg==0 ){
+    pPager->alwaysRollback = 1;
+    return;
+  }
+  pPg->alwaysRollback = 1;
+  if( pPg->dirty ){
     pPg->dirty = 0;
   }
 }
@@ -1204,13 +2586,22 @@ void sqlitepager_dont_write(Pager *pPager, Pgno pgno){
 ** it is not necessary to restore the data on the given page.  This
 ** means that the pager does not have to record the given page in the
 ** rollback journal.
+**
+** An in-memory database has no file to reread such a page from after
+** a rollback, so its pages are always journaled.
 */
 void sqlitepager_dont_rollback(void *pData){
   PgHdr *pPg = DATA_TO_PGHDR(pData);
   Pager *pPager = pPg->pPager;
 
   if( pPager->state!=SQLITE_WRITELOCK || pPager->journalOpen==0 ) return;
+  if( pPager->memDb ) return;
+  if( pPg->alwaysRollback || pPager->alwaysRollback ) return;
   if( !pPg->inJournal && (int)pPg->pgno <= pPager->origDbSize ){
+    if( pPager->snapValid && snapshot_capture(pPg)!=SQLITE_OK ){
+      /* Journal the page normally instead when it cannot be captured */
+      return;
+    }
     assert( pPager->aInJournal!=0 );
     pPager->aInJournal[pPg->pgno/8] |= 1<<(pPg->pgno&7);
     pPg->inJournal = 1;
@@ -1233,10 +2624,16 @@ void sqlitepager_dont_rollback(void *pData){
 ** If the commit fails for any reason, a rollback attempt is made
 ** and an error code is returned.  If the commit worked, SQLITE_OK
 ** is returned.
+**
+** The exception is SQLITE_BUSY, which is returned if readers still
+** hold the database when the lock timeout runs out.  Nothing has been
+** written to the database file at that point, so the transaction is
+** left open, with its journal, its changes and its lock, and the
+** commit can be tried again later.
 */
 int sqlitepager_commit(Pager *pPager){
   int rc;
-  PgHdr *pPg;
+  PgHdr *pPg, *pList;
 
   if( pPager->errMask==PAGER_ERR_FULL ){
     rc = sqlitepager_rollback(pPager);
@@ -1255,23 +2652,58 @@ int sqlitepager_commit(Pager *pPager){
     /* Exit early (without doing the time-consuming sqliteOsSync() calls)
     ** if there have been no changes to the database file. */
     rc = pager_unwritelock(pPager);
-    pPager->dbSize = -1;
+    if( !pPager->memDb ) pPager->dbSize = -1;
+    return rc;
+  }
+  if( pPager->memDb ){
+    /* The changes to an in-memory database are already in the only
+    ** place they need to be.  Just forget the journal. */
+    if( pPager->snapValid && pPager->pSnapLast ){
+      pPager->pSnapLast->isClosed = 1;
+    }
+    rc = pager_unwritelock(pPager);
+    snapshot_free_unused(pPager);
     return rc;
   }
-  if( pPager->needSync && sqliteOsSync(&pPager->jfd)!=SQLITE_OK ){
+  rc = pager_exclusive_lock(pPager);
+  if( rc==SQLITE_BUSY ){
+    return rc;
+  }
+  if( rc!=SQLITE_OK ) goto commit_abort;
+  if( pager_journal_flush(pPager)!=SQLITE_OK
+   || pager_write_nrec(pPager)!=SQLITE_OK ){
+    goto commit_abort;
+  }
+  if( pPager->needSync && pager_sync(pPager, &pPager->jfd)!=SQLITE_OK ){
     goto commit_abort;
   }
+  pList = 0;
   for(pPg=pPager->pAll; pPg; pPg=pPg->pNextAll){
     if( pPg->dirty==0 ) continue;
-    rc = sqliteOsSeek(&pPager->fd, (pPg->pgno-1)*SQLITE_PAGE_SIZE);
-    if( rc!=SQLITE_OK ) goto commit_abort;
-    rc = sqliteOsWrite(&pPager->fd, PGHDR_TO_DATA(pPg), SQLITE_PAGE_SIZE);
+    pPg->pDirty = pList;
+    pList = pPg;
+  }
+  rc = pager_write_pagelist(pPager, pList);
+  if( rc!=SQLITE_OK ) goto commit_abort;
+  if( pPager->dbSize>=0 && pPager->dbSize<pPager->origDbSize ){
+    /* See sqlitepager_truncate() */
+    rc = sqliteOsTruncate(&pPager->fd, (off64)pPager->dbSize*SQLITE_PAGE_SIZE);
     if( rc!=SQLITE_OK ) goto commit_abort;
   }
-  if( !pPager->noSync && sqliteOsSync(&pPager->fd)!=SQLITE_OK ){
+  if( !pPager->noSync && pager_sync(pPager, &pPager->fd)!=SQLITE_OK ){
     goto commit_abort;
   }
+  if( pPager->snapValid && pPager->pSnapLast ){
+    pPager->pSnapLast->isClosed = 1;
+  }
   rc = pager_unwritelock(pPager);
+  snapshot_free_unused(pPager);
+  if( pPager->safetyLevel==PAGER_SYNC_FULL && !pPager->noSync
+   && pPager->journalMode==PAGER_JOURNALMODE_DELETE ){
+    /* The transaction is committed once the journal is gone, so there is
+    ** nothing to undo if this fails.  It only makes the commit durable. */
+    sqliteOsSyncDirectory(pPager->pVfs, pPager->zJournal);
+  }
   pPager->dbSize = -1;
   return rc;
 
@@ -1301,19 +2733,19 @@ int sqlitepager_rollback(Pager *pPager){
   int rc;
   if( pPager->errMask!=0 && pPager->errMask!=PAGER_ERR_FULL ){
     if( pPager->state>=SQLITE_WRITELOCK ){
-      pager_playback(pPager);
+      pager_playback(pPager, 0);
     }
     return pager_errcode(pPager);
   }
   if( pPager->state!=SQLITE_WRITELOCK ){
     return SQLITE_OK;
   }
-  rc = pager_playback(pPager);
+  rc = pager_playback(pPager, 0);
   if( rc!=SQLITE_OK ){
     rc = SQLITE_CORRUPT;
     pPager->errMask |= PAGER_ERR_CORRUPT;
   }
-  pPager->dbSize = -1;
+  if( !pPager->memDb ) pPager->dbSize = -1;
   return rc;
 }
 
@@ -1325,6 +2757,25 @@ int sqlitepager_isreadonly(Pager *pPager){
   return pPager->readOnly;
 }
 
+/*
+** Return TRUE if the current write transaction has changed the
+** database.
+*/
+int sqlitepager_isdirty(Pager *pPager){
+  return pPager->state==SQLITE_WRITELOCK && pPager->dirtyFile;
+}
+
+/*
+** Write into *pnHit and *pnMiss the number of page requests that were
+** found in the cache and that had to be read from the file.  Unlike
+** sqlitepager_stats(), this uses no static storage, so it can be called
+** on different pagers from different threads at once.
+*/
+void sqlitepager_hitmiss(Pager *pPager, int *pnHit, int *pnMiss){
+  *pnHit = pPager->nHit;
+  *pnMiss = pPager->nMiss;
+}
+
 /*
 ** This routine is used for testing and analysis only.
 */
@@ -1356,14 +2807,17 @@ int sqlitepager_ckpt_begin(Pager *pPager){
   assert( !pPager->ckptInUse );
   pPager->aInCkpt = sqliteMalloc( pPager->dbSize/8 + 1 );
   if( pPager->aInCkpt==0 ){
-    sqliteOsReadLock(&pPager->fd);
+    if( !pPager->memDb ){
+      sqliteOsReadLock(&pPager->fd);
+      pPager->eLock = SQLITE_LOCK_SHARED;
+    }
     return SQLITE_NOMEM;
   }
-  rc = sqliteOsFileSize(&pPager->jfd, &pPager->ckptJSize);
-  if( rc ) goto ckpt_begin_failed;
+  pPager->ckptJSize = pPager->jOffset;
   pPager->ckptSize = pPager->dbSize;
-  if( !pPager->ckptOpen ){
-    rc = sqlitepager_opentemp(zTemp, &pPager->cpfd);
+  pPager->ckptOffset = 0;
+  if( !pPager->ckptOpen && !pPager->memJournal ){
+    rc = sqlitepager_opentemp(pPager->pVfs, zTemp, &pPager->cpfd);
     if( rc ) goto ckpt_begin_failed;
     pPager->ckptOpen = 1;
   }
@@ -1384,7 +2838,10 @@ ckpt_begin_failed:
 int sqlitepager_ckpt_commit(Pager *pPager){
   if( pPager->ckptInUse ){
     PgHdr *pPg;
-    sqliteOsTruncate(&pPager->cpfd, 0);
+    if( pPager->ckptOpen ){
+      sqliteOsTruncate(&pPager->cpfd, 0);
+    }
+    pPager->ckptOffset = 0;
     pPager->ckptInUse = 0;
     sqliteFree( pPager->aInCkpt );
     pPager->aInCkpt = 0;
@@ -1421,4 +2878,11 @@ void sqlitepager_refdump(Pager *pPager){
        pPg->pgno, (int)PGHDR_TO_DATA(pPg), pPg->nRef);
   }
 }
+
+/*
+** Return the number of page slots in all of the slabs of the pager.
+*/
+int sqlitepager_slotcount(Pager *pPager){
+  return pPager->nSlot;
+}
 #endif
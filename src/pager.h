@@ -38,39 +38,80 @@
 */
 typedef unsigned int Pgno;
 
+/*
+** Allowed values for the journal mode.  See sqlitepager_journal_mode().
+*/
+#define PAGER_JOURNALMODE_DELETE    0   /* Delete the journal after commit */
+#define PAGER_JOURNALMODE_PERSIST   1   /* Zero the journal header */
+#define PAGER_JOURNALMODE_TRUNCATE  2   /* Truncate the journal */
+#define PAGER_JOURNALMODE_MEMORY    3   /* Keep the journal in memory */
+
+/*
+** Allowed values for the locking mode.  See sqlitepager_locking_mode().
+*/
+#define PAGER_LOCKINGMODE_NORMAL    0   /* Unlock after every statement */
+#define PAGER_LOCKINGMODE_EXCLUSIVE 1   /* Keep locks until closed */
+
+/*
+** Allowed values for the safety level.  See sqlitepager_safety_level().
+*/
+#define PAGER_SYNC_OFF              0   /* Never sync */
+#define PAGER_SYNC_NORMAL           1   /* Sync at the critical points */
+#define PAGER_SYNC_FULL             2   /* Also sync the directory */
+#define PAGER_SYNC_DATA             3   /* Like NORMAL, using fdatasync() */
+
 /*
 ** Each open file is managed by a separate instance of the "Pager" structure.
 */
 typedef struct Pager Pager;
 
+/*
+** A read-only view of the database as of some commit.
+*/
+typedef struct PgSnapshot PgSnapshot;
+
 /*
 ** See source code comments for a detailed description of the following
 ** routines:
 */
-int sqlitepager_open(Pager **ppPager,const char *zFilename,int nPage,int nEx);
+int sqlitepager_open(Pager**, const char *zFilename, int nPage, int nEx,
+                     sqlite_vfs*);
 void sqlitepager_set_destructor(Pager*, void(*)(void*));
 void sqlitepager_set_cachesize(Pager*, int);
+int sqlitepager_journal_mode(Pager*, int);
+int sqlitepager_safety_level(Pager*, int);
+void sqlitepager_lock_timeout(Pager*, int);
+int sqlitepager_locking_mode(Pager*, int);
 int sqlitepager_close(Pager *pPager);
 int sqlitepager_get(Pager *pPager, Pgno pgno, void **ppPage);
 void *sqlitepager_lookup(Pager *pPager, Pgno pgno);
 int sqlitepager_ref(void*);
 int sqlitepager_unref(void*);
+void sqlitepager_snapshot_readers(Pager*, int);
+int sqlitepager_snapshot_open(Pager*, PgSnapshot**);
+void sqlitepager_snapshot_close(PgSnapshot*);
+int sqlitepager_snapshot_get(PgSnapshot*, Pgno, void**);
 Pgno sqlitepager_pagenumber(void*);
 int sqlitepager_write(void*);
 int sqlitepager_iswriteable(void*);
+int sqlitepager_truncate(Pager*, Pgno);
+void sqlitepager_changed_pages(Pager*, Pgno, void(*)(void*,Pgno), void*);
 int sqlitepager_pagecount(Pager*);
 int sqlitepager_begin(void*);
 int sqlitepager_commit(Pager*);
 int sqlitepager_rollback(Pager*);
 int sqlitepager_isreadonly(Pager*);
+int sqlitepager_isdirty(Pager*);
 int sqlitepager_ckpt_begin(Pager*);
 int sqlitepager_ckpt_commit(Pager*);
 int sqlitepager_ckpt_rollback(Pager*);
 void sqlitepager_dont_rollback(void*);
 void sqlitepager_dont_write(Pager*, Pgno);
+void sqlitepager_hitmiss(Pager*, int*, int*);
 int *sqlitepager_stats(Pager*);
 
 #ifdef SQLITE_TEST
 void sqlitepager_refdump(Pager*);
+int sqlitepager_slotcount(Pager*);
 int pager_refinfo_enable;
 #endif
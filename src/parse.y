@@ -55,7 +55,7 @@ struct TrigEvent { int a; IdList * b; };
 // add them to the parse.h output file.
 //
 %nonassoc END_OF_FILE ILLEGAL SPACE UNCLOSED_STRING COMMENT FUNCTION
-          COLUMN AGG_FUNCTION.
+          COLUMN AGG_FUNCTION REGISTER.
 
 // Input is zero or more commands.
 input ::= cmdlist.
@@ -68,6 +68,7 @@ ecmd ::= explain cmd SEMI.  {sqliteExec(pParse);}
 ecmd ::= cmd SEMI.          {sqliteExec(pParse);}
 ecmd ::= SEMI.
 explain ::= EXPLAIN.    {pParse->explain = 1;}
+explain ::= EXPLAIN ANALYZE.  {pParse->explainAnalyze = 1;}
 
 ///////////////////// Begin and end transactions. ////////////////////////////
 //
@@ -117,7 +118,7 @@ id(A) ::= ID(X).         {A = X;}
 // This obviates the need for the "id" nonterminal.
 //
 %fallback ID 
-  ABORT AFTER ASC BEFORE BEGIN CASCADE CLUSTER COLLATE CONFLICT
+  ABORT AFTER ANALYZE ASC BEFORE BEGIN CASCADE CLUSTER COLLATE CONFLICT
   COPY DEFERRED DELIMITERS DESC EACH END EXPLAIN FAIL FOR
   FULL IGNORE IMMEDIATE INITIALLY INSTEAD MATCH JOIN KEY
   OF OFFSET PARTIAL PRAGMA RAISE REPLACE RESTRICT ROW STATEMENT
@@ -60,7 +60,7 @@ static int randomByte(){
     char k[256];
     prng.j = 0;
     prng.i = 0;
-    sqliteOsRandomSeed(k);
+    sqliteOsRandomSeed(sqlite_vfs_find(0), k);
     for(i=0; i<256; i++){
       prng.s[i] = i;
     }
@@ -51,6 +51,8 @@ Select *sqliteSelectNew(
     pNew->op = TK_SELECT;
     pNew->nLimit = nLimit;
     pNew->nOffset = nOffset;
+    pNew->iLimit = -1;
+    pNew->iOffset = -1;
   }
   return pNew;
 }
@@ -284,6 +286,64 @@ static void sqliteAggregateInfoReset(Parse *pParse){
   pParse->useAgg = 0;
 }
 
+/*
+** Allocate memory cells to hold the LIMIT and OFFSET counters of the
+** SELECT statement p and generate code to initialize them.  Each counter
+** is loaded with the negative of its value and is stepped by OP_MemIncr
+** once for every candidate output row.  The counter becomes positive
+** as soon as the offset has been passed or the limit has been exceeded.
+**
+** The memory cell numbers are recorded in p->iLimit and p->iOffset.
+** Each is set to -1 if the corresponding counter is not needed.  A
+** LIMIT of zero or less means there is no limit, and in that case the
+** OFFSET is ignored too.
+**
+** The counters belong to this one SELECT, so a subquery or each side
+** of a compound select can have a LIMIT of its own.
+*/
+static void computeLimitRegisters(Parse *pParse, Select *p){
+  Vdbe *v = pParse->pVdbe;
+  p->iLimit = -1;
+  p->iOffset = -1;
+  if( v==0 || p->nLimit<=0 ) return;
+  p->iLimit = pParse->nMem++;
+  sqliteVdbeAddOp(v, OP_Integer, -p->nLimit, 0);
+  sqliteVdbeAddOp(v, OP_MemStore, p->iLimit, 1);
+  if( p->nOffset>0 ){
+    p->iOffset = pParse->nMem++;
+    sqliteVdbeAddOp(v, OP_Integer, -p->nOffset, 0);
+    sqliteVdbeAddOp(v, OP_MemStore, p->iOffset, 1);
+  }
+}
+
+/*
+** Generate code that checks the LIMIT and OFFSET counters set up by
+** computeLimitRegisters() for the row about to be output.  While the
+** OFFSET has not yet been reached, nPop elements are popped from the
+** stack and control jumps to iContinue so that the row is skipped.
+** Once the LIMIT has been exceeded, control jumps to iBreak.
+*/
+static void codeLimiter(
+  Vdbe *v,          /* Generate code into this VM */
+  Select *p,        /* The SELECT statement being coded */
+  int iContinue,    /* Jump here to skip the current row */
+  int iBreak,       /* Jump here to end the loop */
+  int nPop          /* Number of stack entries to pop when skipping a row */
+){
+  if( p->iOffset>=0 ){
+    int addr = sqliteVdbeCurrentAddr(v) + 2;
+    if( nPop>0 ) addr++;
+    sqliteVdbeAddOp(v, OP_MemIncr, p->iOffset, addr);
+    if( nPop>0 ){
+      sqliteVdbeAddOp(v, OP_Pop, nPop, 0);
+    }
+    sqliteVdbeAddOp(v, OP_Goto, 0, iContinue);
+  }
+  if( p->iLimit>=0 ){
+    sqliteVdbeAddOp(v, OP_MemIncr, p->iLimit, iBreak);
+  }
+}
+
 /*
 ** This routine generates the code for the inside of the inner loop
 ** of a SELECT.
@@ -313,12 +373,7 @@ static int selectInnerLoop(
   ** to see if this row should be output.
   */
   if( pOrderBy==0 ){
-    if( p->nOffset>0 ){
-      sqliteVdbeAddOp(v, OP_LimitCk, 1, iContinue);
-    }
-    if( p->nLimit>0 ){
-      sqliteVdbeAddOp(v, OP_LimitCk, 0, iBreak);
-    }
+    codeLimiter(v, p, iContinue, iBreak, 0);
   }
 
   /* Pull the requested columns.
@@ -446,17 +501,17 @@ static int selectInnerLoop(
 */
 static void generateSortTail(Select *p, Vdbe *v, int nColumn){
   int end = sqliteVdbeMakeLabel(v);
+  int brk = sqliteVdbeMakeLabel(v);
   int addr;
   sqliteVdbeAddOp(v, OP_Sort, 0, 0);
   addr = sqliteVdbeAddOp(v, OP_SortNext, 0, end);
-  if( p->nOffset>0 ){
-    sqliteVdbeAddOp(v, OP_LimitCk, 1, addr);
-  }
-  if( p->nLimit>0 ){
-    sqliteVdbeAddOp(v, OP_LimitCk, 0, end);
-  }
+  codeLimiter(v, p, addr, brk, 1);
   sqliteVdbeAddOp(v, OP_SortCallback, nColumn, 0);
   sqliteVdbeAddOp(v, OP_Goto, 0, addr);
+  if( p->iLimit>=0 ){
+    sqliteVdbeResolveLabel(v, brk);
+    sqliteVdbeAddOp(v, OP_Pop, 1, 0);
+  }
   sqliteVdbeResolveLabel(v, end);
   sqliteVdbeAddOp(v, OP_SortReset, 0, 0);
 }
@@ -904,6 +959,8 @@ static int multiSelect(Parse *pParse, Select *p, int eDest, int iParm){
   Select *pPrior;     /* Another SELECT immediately to our left */
   Vdbe *v;            /* Generate code to this VDBE */
   int base;           /* Baseline value for pParse->nTab */
+  int nLimit;         /* Saved LIMIT value of the right-most SELECT */
+  int nOffset;        /* Saved OFFSET value of the right-most SELECT */
 
   /* Make sure there is no ORDER BY clause on prior SELECTs.  Only the
   ** last SELECT in the series may have an ORDER BY.
@@ -978,8 +1035,21 @@ static int multiSelect(Parse *pParse, Select *p, int eDest, int iParm){
          case TK_ALL:     op = SRT_Table;    break;
       }
       p->pPrior = 0;
+      if( eDest!=priorOp ){
+        /* The LIMIT and OFFSET of the right-most SELECT apply to the
+        ** result of the whole compound, so do not apply them here.
+        */
+        nLimit = p->nLimit;
+        nOffset = p->nOffset;
+        p->nLimit = -1;
+        p->nOffset = 0;
+      }
       rc = sqliteSelect(pParse, p, op, unionTab, 0, 0, 0);
       p->pPrior = pPrior;
+      if( eDest!=priorOp ){
+        p->nLimit = nLimit;
+        p->nOffset = nOffset;
+      }
       if( rc ) return rc;
 
       /* Convert the data in the temporary table into whatever form
@@ -993,6 +1063,7 @@ static int multiSelect(Parse *pParse, Select *p, int eDest, int iParm){
         }
         iBreak = sqliteVdbeMakeLabel(v);
         iCont = sqliteVdbeMakeLabel(v);
+        computeLimitRegisters(pParse, p);
         sqliteVdbeAddOp(v, OP_Rewind, unionTab, iBreak);
         iStart = sqliteVdbeCurrentAddr(v);
         rc = selectInnerLoop(pParse, p, 0, unionTab, p->pEList->nExpr,
@@ -1035,8 +1106,14 @@ static int multiSelect(Parse *pParse, Select *p, int eDest, int iParm){
       sqliteVdbeAddOp(v, OP_OpenTemp, tab2, 1);
       sqliteVdbeAddOp(v, OP_KeyAsData, tab2, 1);
       p->pPrior = 0;
+      nLimit = p->nLimit;
+      nOffset = p->nOffset;
+      p->nLimit = -1;
+      p->nOffset = 0;
       rc = sqliteSelect(pParse, p, SRT_Union, tab2, 0, 0, 0);
       p->pPrior = pPrior;
+      p->nLimit = nLimit;
+      p->nOffset = nOffset;
       if( rc ) return rc;
 
       /* Generate code to take the intersection of the two temporary
@@ -1048,6 +1125,7 @@ static int multiSelect(Parse *pParse, Select *p, int eDest, int iParm){
       }
       iBreak = sqliteVdbeMakeLabel(v);
       iCont = sqliteVdbeMakeLabel(v);
+      computeLimitRegisters(pParse, p);
       sqliteVdbeAddOp(v, OP_Rewind, tab1, iBreak);
       iStart = sqliteVdbeAddOp(v, OP_FullKey, tab1, 0);
       sqliteVdbeAddOp(v, OP_NotFound, tab2, iCont);
@@ -1204,6 +1282,9 @@ substExprList(ExprList *pList, int iTable, ExprList *pEList, int iSub){
 **  (10)  The subquery does not use aggregates or the outer query does not
 **        use LIMIT.
 **
+**  (11)  The subquery does not use LIMIT or the outer query does not
+**        use OFFSET.
+**
 ** In this routine, the "p" parameter is a pointer to the outer query.
 ** The subquery is p->pSrc->a[iFrom].  isAgg is true if the outer query
 ** uses aggregates and subqueryIsAgg is true if the subquery uses aggregates.
@@ -1239,6 +1320,7 @@ int flattenSubquery(Select *p, int iFrom, int isAgg, int subqueryIsAgg){
      return 0;
   }
   if( (p->isDistinct || p->nLimit) && subqueryIsAgg ) return 0;
+  if( pSub->nLimit>0 && p->nOffset>0 ) return 0;
 
   /* If we reach this point, it means flattening is permitted for the
   ** i-th entry of the FROM clause in the outer query.
@@ -1296,14 +1378,12 @@ int flattenSubquery(Select *p, int iFrom, int isAgg, int subqueryIsAgg){
     }
   }
   p->isDistinct = p->isDistinct || pSub->isDistinct;
-  if( pSub->nLimit>=0 ){
-    if( p->nLimit<0 ){
+  if( pSub->nLimit>0 ){
+    if( p->nLimit<=0 || p->nLimit>pSub->nLimit ){
       p->nLimit = pSub->nLimit;
-    }else if( p->nLimit+p->nOffset > pSub->nLimit+pSub->nOffset ){
-      p->nLimit = pSub->nLimit + pSub->nOffset - p->nOffset;
     }
+    if( pSub->nOffset>0 ) p->nOffset += pSub->nOffset;
   }
-  p->nOffset += pSub->nOffset;
   if( pSrc->a[iFrom].pTab && pSrc->a[iFrom].pTab->isTransient ){
     sqliteDeleteTable(0, pSrc->a[iFrom].pTab);
   }
@@ -1423,6 +1503,7 @@ static int simpleMinMaxQuery(Parse *pParse, Select *p, int eDest, int iParm){
   eList.a = &eListItem;
   eList.a[0].pExpr = pExpr;
   cont = sqliteVdbeMakeLabel(v);
+  computeLimitRegisters(pParse, p);
   selectInnerLoop(pParse, p, &eList, base, 1, 0, -1, eDest, iParm, cont, cont);
   sqliteVdbeResolveLabel(v, cont);
   sqliteVdbeAddOp(v, OP_Close, base, 0);
@@ -1646,15 +1727,6 @@ int sqliteSelect(
     generateColumnNames(pParse, p->base, pTabList, pEList);
   }
 
-  /* Set the limiter
-  */
-  if( p->nLimit<=0 ){
-    p->nOffset = 0;
-  }else{
-    if( p->nOffset<0 ) p->nOffset = 0;
-    sqliteVdbeAddOp(v, OP_Limit, p->nLimit, p->nOffset);
-  }
-
   /* Generate code for all sub-queries in the FROM clause
   */
   for(i=0; i<pTabList->nSrc; i++){
@@ -1680,6 +1752,12 @@ int sqliteSelect(
     return rc;
   }
 
+  /* Set the limiter.  This is done after the subqueries in the FROM
+  ** clause have been coded, since flattening a subquery into this
+  ** SELECT can change its LIMIT and OFFSET.
+  */
+  computeLimitRegisters(pParse, p);
+
   /* If the output is destined for a temporary table, open that table.
   */
   if( eDest==SRT_TempTable ){
@@ -1748,6 +1826,15 @@ int sqliteSelect(
     distinct = -1;
   }
 
+  /* Compute subexpressions that do not depend on the current row
+  ** before the loop begins.
+  */
+  for(i=0; i<pEList->nExpr; i++){
+    sqliteExprHoistConstants(pParse, pEList->a[i].pExpr);
+  }
+  sqliteExprHoistConstants(pParse, pWhere);
+  sqliteExprHoistConstants(pParse, pHaving);
+
   /* Begin the database scan
   */
   pWInfo = sqliteWhereBegin(pParse, p->base, pTabList, pWhere, 0);
@@ -529,6 +529,7 @@ static int dump_callback(void *pArg, int nArg, char **azArg, char **azCol){
 
 // 목적: 사용자에게 제공되는 도움말 메시지로, 지원되는 셸 명령어들을 설명합니다.
 // 내용:
+// .backup: 데이터베이스를 파일로 백업합니다.
 // .dump: 데이터베이스를 텍스트 형식으로 덤프합니다.
 // .echo: 명령어 에코를 켜거나 끕니다.
 // .exit / .quit: 프로그램을 종료합니다.
@@ -549,6 +550,7 @@ static int dump_callback(void *pArg, int nArg, char **azArg, char **azCol){
 // .timeout: 테이블 잠금 시도 시간을 설정합니다.
 // .width: column 모드에서의 열 너비를 설정합니다.
 static char zHelp[] =
+  ".backup FILENAME       Copy the database into FILENAME\n"
   ".dump ?TABLE? ...      Dump the database in an text format\n"
   ".echo ON|OFF           Turn command echo on or off\n"
   ".exit                  Exit this program\n"
@@ -636,6 +638,24 @@ static int do_meta_command(char *zLine, sqlite *db, struct callback_data *p){
   if( nArg==0 ) return rc;
   n = strlen(azArg[0]);
   c = azArg[0][0];
+  if( c=='b' && strncmp(azArg[0], "backup", n)==0 && nArg==2 ){
+    sqlite_backup *pBackup;
+    char *zErrMsg = 0;
+    int rc;
+    pBackup = sqlite_backup_init(db, azArg[1], &zErrMsg);
+    if( pBackup==0 ){
+      fprintf(stderr,"Error: %s\n", zErrMsg);
+      free(zErrMsg);
+    }else{
+      rc = sqlite_backup_step(pBackup, -1);
+      if( rc==SQLITE_DONE ) rc = SQLITE_OK;
+      sqlite_backup_finish(pBackup);
+      if( rc!=SQLITE_OK ){
+        fprintf(stderr,"Error: %s\n", sqlite_error_string(rc));
+      }
+    }
+  }else
+
   if( c=='d' && strncmp(azArg[0], "dump", n)==0 ){
     char *zErrMsg = 0;
     fprintf(p->out, "BEGIN TRANSACTION;\n");
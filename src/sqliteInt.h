@@ -61,7 +61,10 @@
 ** where the sizes very.  Preprocessor macros are available so that the
 ** types can be conveniently redefined at compile-type.  Like this:
 **
-**         cc '-DUINTPTR_TYPE=long long int' ...
+**         cc '-DINTPTR_TYPE=long long int' ...
+**
+** INTPTR_TYPE must be as wide as a pointer.  A long is wide enough
+** everywhere except 64-bit Windows, where it is only 32 bits.
 */
 #ifndef UINT32_TYPE
 # define UINT32_TYPE unsigned int
@@ -73,7 +76,11 @@
 # define UINT8_TYPE unsigned char
 #endif
 #ifndef INTPTR_TYPE
-# define INTPTR_TYPE int
+# ifdef _WIN64
+#   define INTPTR_TYPE long long int
+# else
+#   define INTPTR_TYPE long int
+# endif
 #endif
 typedef UINT32_TYPE u32;           /* 4-byte unsigned integer */
 typedef UINT16_TYPE u16;           /* 2-byte unsigned integer */
@@ -179,6 +186,7 @@ typedef struct TriggerStack TriggerStack;
 ** Each database is an instance of the following structure
 */
 struct sqlite {
+  sqlite_vfs *pVfs;             /* All I/O goes through this VFS */
   Btree *pBe;                   /* The B*Tree backend */
   Btree *pBeTemp;               /* Backend for session temporary tables */
   int flags;                    /* Miscellanous flags. See below */
@@ -189,6 +197,7 @@ struct sqlite {
   int nTable;                   /* Number of tables in the database */
   void *pBusyArg;               /* 1st Argument to the busy callback */
   int (*xBusyCallback)(void *,const char*,int);  /* The busy callback */
+  int busyTimeout;              /* Timeout used by the default busy callback */
   Hash tblHash;                 /* All tables indexed by name */
   Hash idxHash;                 /* All (named) indices indexed by name */
   Hash tblDrop;                 /* Uncommitted DROP TABLEs */
@@ -244,6 +253,7 @@ struct FuncDef {
   void (*xStep)(sqlite_func*,int,const char**);  /* Aggregate function step */
   void (*xFinalize)(sqlite_func*);           /* Aggregate function finializer */
   int nArg;                                  /* Number of arguments */
+  int isDeterministic;                       /* Result depends only on args */
   void *pUserData;                           /* User data parameter */
   FuncDef *pNext;                            /* Next function with same name */
 };
@@ -422,6 +432,11 @@ struct Token {
 ** be the right operand of an IN operator.  Or, if a scalar SELECT appears
 ** in an expression the opcode is TK_SELECT and Expr.pSelect is the only
 ** operand.
+**
+** A subexpression whose value is the same for every row of a query is
+** computed once, before the loop, by sqliteExprHoistConstants().  The
+** node is then changed to TK_REGISTER and Expr.iColumn is the memory
+** cell that holds the value.  The subnodes are left in place.
 */
 struct Expr {
   u16 op;                /* Operation performed by this node */
@@ -570,6 +585,7 @@ struct Select {
   int op;                /* One of: TK_UNION TK_ALL TK_INTERSECT TK_EXCEPT */
   Select *pPrior;        /* Prior select in a compound select statement */
   int nLimit, nOffset;   /* LIMIT and OFFSET values.  -1 means not used */
+  int iLimit, iOffset;   /* Memory cells holding LIMIT and OFFSET counters */
   char *zSelect;         /* Complete text of the SELECT command */
   int base;              /* Index of VDBE cursor for left-most FROM table */
 };
@@ -630,6 +646,7 @@ struct Parse {
   Vdbe *pVdbe;         /* An engine for executing database bytecode */
   int colNamesSet;     /* TRUE after OP_ColumnCount has been issued to pVdbe */
   int explain;         /* True if the EXPLAIN flag is found on the query */
+  int explainAnalyze;  /* True for EXPLAIN ANALYZE */
   int initFlag;        /* True if reparsing CREATE TABLEs */
   int nameClash;       /* A permanent table name clashes with temp table name */
   int newTnum;         /* Table number to use when reparsing CREATE TABLEs */
@@ -867,6 +884,7 @@ void sqliteWhereEnd(WhereInfo*);
 void sqliteExprCode(Parse*, Expr*);
 void sqliteExprIfTrue(Parse*, Expr*, int, int);
 void sqliteExprIfFalse(Parse*, Expr*, int, int);
+void sqliteExprHoistConstants(Parse*, Expr*);
 Table *sqliteFindTable(sqlite*,const char*);
 Index *sqliteFindIndex(sqlite*,const char*);
 void sqliteUnlinkAndDeleteIndex(sqlite*,Index*);
@@ -895,9 +913,9 @@ void sqliteGenerateConstraintChecks(Parse*,Table*,int,char*,int,int,int,int);
 void sqliteCompleteInsertion(Parse*, Table*, int, char*, int, int);
 void sqliteBeginWriteOperation(Parse*, int);
 void sqliteEndWriteOperation(Parse*);
-void sqliteExprMoveStrings(Expr*, int);
-void sqliteExprListMoveStrings(ExprList*, int);
-void sqliteSelectMoveStrings(Select*, int);
+void sqliteExprMoveStrings(Expr*, ptr);
+void sqliteExprListMoveStrings(ExprList*, ptr);
+void sqliteSelectMoveStrings(Select*, ptr);
 Expr *sqliteExprDup(Expr*);
 ExprList *sqliteExprListDup(ExprList*);
 SrcList *sqliteSrcListDup(SrcList*);
@@ -149,7 +149,7 @@ int sqlite_get_table(
   res.azResult[0] = 0;
   rc = sqlite_exec(db, zSql, sqlite_get_table_cb, &res, pzErrMsg);
   if( res.azResult ){
-    res.azResult[0] = (char*)res.nData;
+    res.azResult[0] = (char*)(uptr)res.nData;
   }
   if( rc==SQLITE_ABORT ){
     sqlite_free_table(&res.azResult[1]);
@@ -193,7 +193,7 @@ void sqlite_free_table(
   if( azResult ){
     int i, n;
     azResult--;
-    n = (int)azResult[0];
+    n = (int)Addr(azResult[0]);
     for(i=1; i<n; i++){ if( azResult[i] ) free(azResult[i]); }
     free(azResult);
   }
@@ -268,12 +268,12 @@ static int DbObjCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
   SqliteDb *pDb = (SqliteDb*)cd;
   int choice;
   static char *DB_optStrs[] = {
-     "busy",  "changes",            "close",    "complete", 
-     "eval",  "last_insert_rowid",  "timeout",  0
+     "backup", "busy",  "changes",            "close",    "complete", 
+     "eval",   "last_insert_rowid",  "timeout",  0
   };
   enum DB_opts {
-     DB_BUSY, DB_CHANGES,           DB_CLOSE,   DB_COMPLETE,
-     DB_EVAL, DB_LAST_INSERT_ROWID, DB_TIMEOUT
+     DB_BACKUP, DB_BUSY, DB_CHANGES,           DB_CLOSE,   DB_COMPLETE,
+     DB_EVAL,   DB_LAST_INSERT_ROWID, DB_TIMEOUT
   };
 
   if( objc<2 ){
@@ -286,6 +286,78 @@ static int DbObjCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
 
   switch( (enum DB_opts)choice ){
 
+  /*    $db backup FILENAME ?PAGES? ?SCRIPT?
+  **
+  ** Copy the database into the file FILENAME with the online backup
+  ** interface, PAGES pages at a time, or all at once if PAGES is omitted
+  ** or negative.  After each step that leaves pages to copy, or that
+  ** finds a file locked, SCRIPT is run with the number of pages still to
+  ** copy and the number of pages in the database appended.  If SCRIPT
+  ** returns "break" the backup is abandoned.  Without a SCRIPT a locked
+  ** file is an error.  Return the number of steps taken.
+  */
+  case DB_BACKUP: {
+    sqlite_backup *p;
+    char *zErrMsg;
+    char *zScript = 0;
+    int nPage = -1;
+    int nStep = 0;
+    int rc, rc2;
+
+    if( objc<3 || objc>5 ){
+      Tcl_WrongNumArgs(interp, 2, objv, "FILENAME ?PAGES? ?SCRIPT?");
+      return TCL_ERROR;
+    }
+    if( objc>=4 && Tcl_GetIntFromObj(interp, objv[3], &nPage) ){
+      return TCL_ERROR;
+    }
+    if( objc==5 ){
+      zScript = Tcl_GetStringFromObj(objv[4], 0);
+    }
+    p = sqlite_backup_init(pDb->db, Tcl_GetStringFromObj(objv[2], 0),
+                           &zErrMsg);
+    if( p==0 ){
+      Tcl_AppendResult(interp, zErrMsg, 0);
+      sqlite_freemem(zErrMsg);
+      return TCL_ERROR;
+    }
+    rc = TCL_OK;
+    while( 1 ){
+      char zVal[60];
+      Tcl_DString cmd;
+
+      rc2 = sqlite_backup_step(p, nPage);
+      nStep++;
+      if( rc2==SQLITE_DONE ) break;
+      if( rc2!=SQLITE_OK && (rc2!=SQLITE_BUSY || zScript==0) ){
+        Tcl_AppendResult(interp, sqlite_error_string(rc2), 0);
+        rc = TCL_ERROR;
+        break;
+      }
+      if( zScript==0 ) continue;
+      Tcl_DStringInit(&cmd);
+      Tcl_DStringAppend(&cmd, zScript, -1);
+      sprintf(zVal, " %d %d", sqlite_backup_remaining(p),
+              sqlite_backup_pagecount(p));
+      Tcl_DStringAppend(&cmd, zVal, -1);
+      rc = Tcl_Eval(interp, Tcl_DStringValue(&cmd));
+      Tcl_DStringFree(&cmd);
+      if( rc!=TCL_OK ){
+        if( rc==TCL_BREAK ) rc = TCL_OK;
+        break;
+      }
+    }
+    rc2 = sqlite_backup_finish(p);
+    if( rc==TCL_OK && rc2!=SQLITE_OK ){
+      Tcl_AppendResult(interp, sqlite_error_string(rc2), 0);
+      rc = TCL_ERROR;
+    }
+    if( rc==TCL_OK ){
+      Tcl_SetObjResult(interp, Tcl_NewIntObj(nStep));
+    }
+    return rc;
+  }
+
   /*    $db busy ?CALLBACK?
   **
   ** Invoke the given callback if an SQL statement attempts to open
@@ -483,7 +555,7 @@ static int DbObjCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
 }
 
 /*
-**   sqlite DBNAME FILENAME ?MODE?
+**   sqlite DBNAME FILENAME ?MODE? ?VFS?
 **
 ** This is the main Tcl command.  When the "sqlite" Tcl command is
 ** invoked, this routine runs to process that command.
@@ -496,6 +568,10 @@ static int DbObjCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
 ** The second argument is the name of the directory that contains
 ** the sqlite database that is to be accessed.
 **
+** The optional VFS argument names a registered VFS through which all
+** I/O for the database is done.  The default VFS is used if it is
+** omitted.
+**
 ** For testing purposes, we also support the following:
 **
 **  sqlite -encoding
@@ -527,9 +603,9 @@ static int DbMain(void *cd, Tcl_Interp *interp, int argc, char **argv){
       return TCL_OK;
     }
   }
-  if( argc!=3 && argc!=4 ){
+  if( argc<3 || argc>5 ){
     Tcl_AppendResult(interp,"wrong # args: should be \"", argv[0],
-       " HANDLE FILENAME ?MODE?\"", 0);
+       " HANDLE FILENAME ?MODE? ?VFS?\"", 0);
     return TCL_ERROR;
   }
   if( argc==3 ){
@@ -544,7 +620,7 @@ static int DbMain(void *cd, Tcl_Interp *interp, int argc, char **argv){
     return TCL_ERROR;
   }
   memset(p, 0, sizeof(*p));
-  p->db = sqlite_open(argv[2], mode, &zErrMsg);
+  p->db = sqlite_open_vfs(argv[2], mode, argc==5 ? argv[4] : 0, &zErrMsg);
   if( p->db==0 ){
     Tcl_SetResult(interp, zErrMsg, TCL_VOLATILE);
     Tcl_Free((char*)p);
@@ -562,7 +638,7 @@ static int DbMain(void *cd, Tcl_Interp *interp, int argc, char **argv){
     char zBuf[40];
     extern void Md5_Register(sqlite*);
     Md5_Register(p->db);
-    sprintf(zBuf, "%d", (int)p->db);
+    sprintf(zBuf, "%p", (void*)p->db);
     Tcl_AppendResult(interp, zBuf, 0);
   }
 #endif  
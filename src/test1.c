@@ -20,6 +20,17 @@
 #include <stdlib.h>
 #include <string.h>
 
+/*
+** The test commands hand pointers to the TCL scripts as text made by
+** sprintf("%p").  This routine turns such text back into a pointer.
+** A TCL integer would not do, as a pointer can be wider than an int.
+*/
+void *sqliteTextToPtr(const char *z){
+  void *p = 0;
+  sscanf(z, "%p", &p);
+  return p;
+}
+
 /*
 ** Usage:   sqlite_open filename
 **
@@ -45,7 +56,7 @@ static int sqlite_test_open(
     free(zErr);
     return TCL_ERROR;
   }
-  sprintf(zBuf,"%d",(int)db);
+  sprintf(zBuf,"%p",(void*)db);
   Tcl_AppendResult(interp, zBuf, 0);
   return TCL_OK;
 }
@@ -91,7 +102,7 @@ static int test_exec_printf(
        " DB FORMAT STRING", 0);
     return TCL_ERROR;
   }
-  db = (sqlite*)atoi(argv[1]);
+  db = (sqlite*)sqliteTextToPtr(argv[1]);
   Tcl_DStringInit(&str);
   rc = sqlite_exec_printf(db, argv[2], exec_printf_cb, &str, &zErr, argv[3]);
   sprintf(zBuf, "%d", rc);
@@ -128,7 +139,7 @@ static int test_get_table_printf(
        " DB FORMAT STRING", 0);
     return TCL_ERROR;
   }
-  db = (sqlite*)atoi(argv[1]);
+  db = (sqlite*)sqliteTextToPtr(argv[1]);
   Tcl_DStringInit(&str);
   rc = sqlite_get_table_printf(db, argv[2], &aResult, &nRow, &nCol, 
                &zErr, argv[3]);
@@ -169,7 +180,7 @@ static int test_last_rowid(
     Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0], " DB\"", 0);
     return TCL_ERROR;
   }
-  db = (sqlite*)atoi(argv[1]);
+  db = (sqlite*)sqliteTextToPtr(argv[1]);
   sprintf(zBuf, "%d", sqlite_last_insert_rowid(db));
   Tcl_AppendResult(interp, zBuf, 0);
   return SQLITE_OK;
@@ -192,7 +203,7 @@ static int sqlite_test_close(
        " FILENAME\"", 0);
     return TCL_ERROR;
   }
-  db = (sqlite*)atoi(argv[1]);
+  db = (sqlite*)sqliteTextToPtr(argv[1]);
   sqlite_close(db);
   return TCL_OK;
 }
@@ -251,7 +262,7 @@ static int sqlite_test_create_function(
        " FILENAME\"", 0);
     return TCL_ERROR;
   }
-  db = (sqlite*)atoi(argv[1]);
+  db = (sqlite*)sqliteTextToPtr(argv[1]);
   sqlite_create_function(db, "x_coalesce", -1, ifnullFunc, 0);
   sqlite_create_function(db, "x_sqlite_exec", 1, sqliteExecFunc, db);
   return TCL_OK;
@@ -300,7 +311,7 @@ static int sqlite_test_create_aggregate(
        " FILENAME\"", 0);
     return TCL_ERROR;
   }
-  db = (sqlite*)atoi(argv[1]);
+  db = (sqlite*)sqliteTextToPtr(argv[1]);
   sqlite_create_aggregate(db, "x_count", 0, countStep, countFinalize, 0);
   sqlite_create_aggregate(db, "x_count", 1, countStep, countFinalize, 0);
   return TCL_OK;
@@ -435,6 +446,28 @@ static int sqlite_malloc_stat(
 }
 #endif
 
+/*
+** Usage:  sqlite_enable_shared_cache BOOLEAN
+**
+** Turn the shared page cache on or off for databases opened afterwards.
+*/
+static int test_enable_shared_cache(
+  void *NotUsed,
+  Tcl_Interp *interp,    /* The TCL interpreter that invoked this command */
+  int argc,              /* Number of arguments */
+  char **argv            /* Text of each argument */
+){
+  int enable;
+  if( argc!=2 ){
+    Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+       " BOOLEAN\"", 0);
+    return TCL_ERROR;
+  }
+  if( Tcl_GetBoolean(interp, argv[1], &enable) ) return TCL_ERROR;
+  sqlite_enable_shared_cache(enable);
+  return TCL_OK;
+}
+
 /*
 ** Usage:  sqlite_abort
 **
@@ -452,6 +485,230 @@ static int sqlite_abort(
   return TCL_OK;
 }
 
+/*
+** The "counter" VFS passes every call through to the VFS that was the
+** default when it was registered and counts the calls as it goes.  File
+** handles are those of the underlying VFS, so the per-file methods need
+** only forward their arguments.
+**
+** The VFS also keeps a log of the offset and size of every call to
+** xWrite and xWritev, together with the tail of the name of the file
+** written, so that tests can check how writes were ordered and merged.
+*/
+#define N_CNT_NAME    60     /* Bytes of file name kept for each file */
+#define N_CNT_FILE    20     /* Number of open files that are tracked */
+#define N_CNT_WRITE   500    /* Number of writes that are logged */
+static struct {
+  int nOpen;             /* Files opened */
+  int nRead;             /* Calls to xRead */
+  int nWrite;            /* Calls to xWrite and xWritev */
+  int nSync;             /* Calls to xSync */
+  int nLock;             /* Calls to xLock and xLockWait */
+  struct {
+    void *pFile;                /* Handle of an open file, or NULL */
+    char zName[N_CNT_NAME];     /* Tail of the name of that file */
+  } aFile[N_CNT_FILE];
+  int nLog;              /* Number of entries used in aLog[] */
+  struct {
+    char zName[N_CNT_NAME];     /* Tail of the name of the file written */
+    sqlite_int64 offset;        /* Offset of the first byte written */
+    int nByte;                  /* Number of bytes written */
+  } aLog[N_CNT_WRITE];
+} vfsCount;
+static sqlite_vfs counterVfs;
+#define REAL_VFS ((sqlite_vfs*)counterVfs.pAppData)
+
+/*
+** Remember the name of a file that has just been opened.  Files opened
+** when the table is full are simply not named in the write log.
+*/
+static int cntOpened(const char *zName, void *pFile){
+  int i, n;
+  vfsCount.nOpen++;
+  for(i=0; i<N_CNT_FILE && vfsCount.aFile[i].pFile; i++){}
+  if( i<N_CNT_FILE ){
+    n = strlen(zName);
+    if( n>=N_CNT_NAME ) zName += n - (N_CNT_NAME-1);
+    vfsCount.aFile[i].pFile = pFile;
+    strcpy(vfsCount.aFile[i].zName, zName);
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Add a write of nByte bytes at offset to file pFile to the write log.
+*/
+static void cntLogWrite(void *pFile, sqlite_int64 offset, int nByte){
+  int i;
+  if( vfsCount.nLog>=N_CNT_WRITE ) return;
+  for(i=0; i<N_CNT_FILE && vfsCount.aFile[i].pFile!=pFile; i++){}
+  strcpy(vfsCount.aLog[vfsCount.nLog].zName,
+         i<N_CNT_FILE ? vfsCount.aFile[i].zName : "");
+  vfsCount.aLog[vfsCount.nLog].offset = offset;
+  vfsCount.aLog[vfsCount.nLog].nByte = nByte;
+  vfsCount.nLog++;
+}
+
+static int cntOpenReadWrite(sqlite_vfs *p, const char *z, void **pp, int *pR){
+  int rc = REAL_VFS->xOpenReadWrite(REAL_VFS, z, pp, pR);
+  return rc==SQLITE_OK ? cntOpened(z, *pp) : rc;
+}
+static int cntOpenExclusive(sqlite_vfs *p, const char *z, void **pp, int d){
+  int rc = REAL_VFS->xOpenExclusive(REAL_VFS, z, pp, d);
+  return rc==SQLITE_OK ? cntOpened(z, *pp) : rc;
+}
+static int cntOpenReadOnly(sqlite_vfs *p, const char *z, void **pp){
+  int rc = REAL_VFS->xOpenReadOnly(REAL_VFS, z, pp);
+  return rc==SQLITE_OK ? cntOpened(z, *pp) : rc;
+}
+static int cntDelete(sqlite_vfs *p, const char *z){
+  return REAL_VFS->xDelete(REAL_VFS, z);
+}
+static int cntFileExists(sqlite_vfs *p, const char *z){
+  return REAL_VFS->xFileExists(REAL_VFS, z);
+}
+static int cntTempFileName(sqlite_vfs *p, char *z){
+  return REAL_VFS->xTempFileName(REAL_VFS, z);
+}
+static int cntSyncDirectory(sqlite_vfs *p, const char *z){
+  return REAL_VFS->xSyncDirectory(REAL_VFS, z);
+}
+static int cntClose(void *pFile){
+  int i;
+  for(i=0; i<N_CNT_FILE; i++){
+    if( vfsCount.aFile[i].pFile==pFile ) vfsCount.aFile[i].pFile = 0;
+  }
+  return REAL_VFS->xClose(pFile);
+}
+static int cntRead(void *pFile, void *pBuf, int amt, sqlite_int64 offset){
+  vfsCount.nRead++;
+  return REAL_VFS->xRead(pFile, pBuf, amt, offset);
+}
+static int cntWrite(void *pFile, const void *pBuf, int amt,
+                    sqlite_int64 offset){
+  vfsCount.nWrite++;
+  cntLogWrite(pFile, offset, amt);
+  return REAL_VFS->xWrite(pFile, pBuf, amt, offset);
+}
+static int cntWritev(void *pFile, void **apBuf, int nBuf, int amt,
+                     sqlite_int64 offset){
+  int i, rc;
+  vfsCount.nWrite++;
+  cntLogWrite(pFile, offset, nBuf*amt);
+  if( REAL_VFS->xWritev ){
+    return REAL_VFS->xWritev(pFile, apBuf, nBuf, amt, offset);
+  }
+  for(i=0; i<nBuf; i++){
+    rc = REAL_VFS->xWrite(pFile, apBuf[i], amt, offset+(sqlite_int64)i*amt);
+    if( rc!=SQLITE_OK ) return rc;
+  }
+  return SQLITE_OK;
+}
+static int cntSync(void *pFile, int dataOnly){
+  vfsCount.nSync++;
+  return REAL_VFS->xSync(pFile, dataOnly);
+}
+static int cntTruncate(void *pFile, sqlite_int64 size){
+  return REAL_VFS->xTruncate(pFile, size);
+}
+static int cntFileSize(void *pFile, sqlite_int64 *pSize){
+  return REAL_VFS->xFileSize(pFile, pSize);
+}
+static int cntLock(void *pFile, int eLock){
+  vfsCount.nLock++;
+  return REAL_VFS->xLock(pFile, eLock);
+}
+static int cntLockWait(void *pFile, int eLock, int ms){
+  vfsCount.nLock++;
+  return REAL_VFS->xLockWait(pFile, eLock, ms);
+}
+static int cntRandomSeed(sqlite_vfs *p, char *zBuf){
+  return REAL_VFS->xRandomSeed(REAL_VFS, zBuf);
+}
+static int cntSleep(sqlite_vfs *p, int ms){
+  return REAL_VFS->xSleep(REAL_VFS, ms);
+}
+static sqlite_vfs counterVfs = {
+  "counter", 0, 0,
+  cntOpenReadWrite, cntOpenExclusive, cntOpenReadOnly,
+  cntDelete, cntFileExists, cntTempFileName, cntSyncDirectory,
+  cntClose, cntRead, cntWrite, cntWritev, cntSync, cntTruncate,
+  cntFileSize, cntLock, cntRandomSeed, cntSleep, cntLockWait,
+};
+
+/*
+** Usage:  sqlite_vfs_counter register ?MAKEDEFAULT?
+**         sqlite_vfs_counter unregister
+**         sqlite_vfs_counter reset
+**         sqlite_vfs_counter get
+**         sqlite_vfs_counter writes NAME
+**
+** Register or unregister the "counter" VFS, zero its counters and its
+** write log, or return the counters as a list of names and values.  The
+** "writes" option returns the offset and size of each logged write to
+** a file whose name ends with NAME, in the order they were made.
+*/
+static int sqlite_vfs_counter(
+  void *NotUsed,
+  Tcl_Interp *interp,    /* The TCL interpreter that invoked this command */
+  int argc,              /* Number of arguments */
+  char **argv            /* Text of each argument */
+){
+  if( argc<2 ){
+    Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+       " register|unregister|reset|get|writes ?ARG?\"", 0);
+    return TCL_ERROR;
+  }
+  if( strcmp(argv[1],"register")==0 ){
+    int makeDefault = 0;
+    if( argc==3 && Tcl_GetBoolean(interp, argv[2], &makeDefault) ){
+      return TCL_ERROR;
+    }
+    if( sqlite_vfs_find("counter")==0 ){
+      counterVfs.pAppData = sqlite_vfs_find(0);
+    }
+    sqlite_vfs_register(&counterVfs, makeDefault);
+  }else if( strcmp(argv[1],"unregister")==0 ){
+    sqlite_vfs_unregister(&counterVfs);
+  }else if( strcmp(argv[1],"reset")==0 ){
+    vfsCount.nOpen = 0;
+    vfsCount.nRead = 0;
+    vfsCount.nWrite = 0;
+    vfsCount.nSync = 0;
+    vfsCount.nLock = 0;
+    vfsCount.nLog = 0;
+  }else if( strcmp(argv[1],"writes")==0 ){
+    int i, n, nName;
+    char zBuf[100];
+    if( argc!=3 ){
+      Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+         " writes NAME\"", 0);
+      return TCL_ERROR;
+    }
+    nName = strlen(argv[2]);
+    for(i=0; i<vfsCount.nLog; i++){
+      n = strlen(vfsCount.aLog[i].zName);
+      if( n<nName || strcmp(&vfsCount.aLog[i].zName[n-nName], argv[2]) ){
+        continue;
+      }
+      sprintf(zBuf, "%.0f", (double)vfsCount.aLog[i].offset);
+      Tcl_AppendElement(interp, zBuf);
+      sprintf(zBuf, "%d", vfsCount.aLog[i].nByte);
+      Tcl_AppendElement(interp, zBuf);
+    }
+  }else if( strcmp(argv[1],"get")==0 ){
+    char zBuf[200];
+    sprintf(zBuf, "open %d read %d write %d sync %d lock %d",
+       vfsCount.nOpen, vfsCount.nRead, vfsCount.nWrite, vfsCount.nSync,
+       vfsCount.nLock);
+    Tcl_AppendResult(interp, zBuf, 0);
+  }else{
+    Tcl_AppendResult(interp, "unknown option: ", argv[1], 0);
+    return TCL_ERROR;
+  }
+  return TCL_OK;
+}
+
 /*
 ** Register commands with the TCL interpreter.
 */
@@ -477,5 +734,8 @@ int Sqlitetest1_Init(Tcl_Interp *interp){
   Tcl_CreateCommand(interp, "sqlite_malloc_stat", sqlite_malloc_stat, 0, 0);
 #endif
   Tcl_CreateCommand(interp, "sqlite_abort", sqlite_abort, 0, 0);
+  Tcl_CreateCommand(interp, "sqlite_enable_shared_cache",
+       test_enable_shared_cache, 0, 0);
+  Tcl_CreateCommand(interp, "sqlite_vfs_counter", sqlite_vfs_counter, 0, 0);
   return TCL_OK;
 }
@@ -17,10 +17,13 @@
 */
 #include "sqliteInt.h"
 #include "pager.h"
+#include "os.h"
 #include "tcl.h"
 #include <stdlib.h>
 #include <string.h>
 
+extern void *sqliteTextToPtr(const char*);
+
 /*
 ** Interpret an SQLite error number
 */
@@ -48,6 +51,7 @@ static char *errorName(int rc){
     case SQLITE_CONSTRAINT: zName = "SQLITE_CONSTRAINT";  break;
     case SQLITE_MISMATCH:   zName = "SQLITE_MISMATCH";    break;
     case SQLITE_MISUSE:     zName = "SQLITE_MISUSE";      break;
+    case SQLITE_CHANGED:    zName = "SQLITE_CHANGED";     break;
     default:                zName = "SQLITE_Unknown";     break;
   }
   return zName;
@@ -74,12 +78,12 @@ static int pager_open(
     return TCL_ERROR;
   }
   if( Tcl_GetInt(interp, argv[2], &nPage) ) return TCL_ERROR;
-  rc = sqlitepager_open(&pPager, argv[1], nPage, 0);
+  rc = sqlitepager_open(&pPager, argv[1], nPage, 0, 0);
   if( rc!=SQLITE_OK ){
     Tcl_AppendResult(interp, errorName(rc), 0);
     return TCL_ERROR;
   }
-  sprintf(zBuf,"0x%x",(int)pPager);
+  sprintf(zBuf,"%p",(void*)pPager);
   Tcl_AppendResult(interp, zBuf, 0);
   return TCL_OK;
 }
@@ -102,7 +106,7 @@ static int pager_close(
        " ID\"", 0);
     return TCL_ERROR;
   }
-  if( Tcl_GetInt(interp, argv[1], (int*)&pPager) ) return TCL_ERROR;
+  pPager = sqliteTextToPtr(argv[1]);
   rc = sqlitepager_close(pPager);
   if( rc!=SQLITE_OK ){
     Tcl_AppendResult(interp, errorName(rc), 0);
@@ -129,7 +133,7 @@ static int pager_rollback(
        " ID\"", 0);
     return TCL_ERROR;
   }
-  if( Tcl_GetInt(interp, argv[1], (int*)&pPager) ) return TCL_ERROR;
+  pPager = sqliteTextToPtr(argv[1]);
   rc = sqlitepager_rollback(pPager);
   if( rc!=SQLITE_OK ){
     Tcl_AppendResult(interp, errorName(rc), 0);
@@ -156,7 +160,7 @@ static int pager_commit(
        " ID\"", 0);
     return TCL_ERROR;
   }
-  if( Tcl_GetInt(interp, argv[1], (int*)&pPager) ) return TCL_ERROR;
+  pPager = sqliteTextToPtr(argv[1]);
   rc = sqlitepager_commit(pPager);
   if( rc!=SQLITE_OK ){
     Tcl_AppendResult(interp, errorName(rc), 0);
@@ -183,7 +187,7 @@ static int pager_ckpt_begin(
        " ID\"", 0);
     return TCL_ERROR;
   }
-  if( Tcl_GetInt(interp, argv[1], (int*)&pPager) ) return TCL_ERROR;
+  pPager = sqliteTextToPtr(argv[1]);
   rc = sqlitepager_ckpt_begin(pPager);
   if( rc!=SQLITE_OK ){
     Tcl_AppendResult(interp, errorName(rc), 0);
@@ -210,7 +214,7 @@ static int pager_ckpt_rollback(
        " ID\"", 0);
     return TCL_ERROR;
   }
-  if( Tcl_GetInt(interp, argv[1], (int*)&pPager) ) return TCL_ERROR;
+  pPager = sqliteTextToPtr(argv[1]);
   rc = sqlitepager_ckpt_rollback(pPager);
   if( rc!=SQLITE_OK ){
     Tcl_AppendResult(interp, errorName(rc), 0);
@@ -237,7 +241,7 @@ static int pager_ckpt_commit(
        " ID\"", 0);
     return TCL_ERROR;
   }
-  if( Tcl_GetInt(interp, argv[1], (int*)&pPager) ) return TCL_ERROR;
+  pPager = sqliteTextToPtr(argv[1]);
   rc = sqlitepager_ckpt_commit(pPager);
   if( rc!=SQLITE_OK ){
     Tcl_AppendResult(interp, errorName(rc), 0);
@@ -264,7 +268,7 @@ static int pager_stats(
        " ID\"", 0);
     return TCL_ERROR;
   }
-  if( Tcl_GetInt(interp, argv[1], (int*)&pPager) ) return TCL_ERROR;
+  pPager = sqliteTextToPtr(argv[1]);
   a = sqlitepager_stats(pPager);
   for(i=0; i<9; i++){
     static char *zName[] = {
@@ -297,12 +301,60 @@ static int pager_pagecount(
        " ID\"", 0);
     return TCL_ERROR;
   }
-  if( Tcl_GetInt(interp, argv[1], (int*)&pPager) ) return TCL_ERROR;
+  pPager = sqliteTextToPtr(argv[1]);
   sprintf(zBuf,"%d",sqlitepager_pagecount(pPager));
   Tcl_AppendResult(interp, zBuf, 0);
   return TCL_OK;
 }
 
+/*
+** Usage:   pager_set_cachesize ID N
+**
+** Set the maximum number of pages in the cache of a pager.
+*/
+static int pager_set_cachesize(
+  void *NotUsed,
+  Tcl_Interp *interp,    /* The TCL interpreter that invoked this command */
+  int argc,              /* Number of arguments */
+  char **argv            /* Text of each argument */
+){
+  Pager *pPager;
+  int n;
+  if( argc!=3 ){
+    Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+       " ID N\"", 0);
+    return TCL_ERROR;
+  }
+  pPager = sqliteTextToPtr(argv[1]);
+  if( Tcl_GetInt(interp, argv[2], &n) ) return TCL_ERROR;
+  sqlitepager_set_cachesize(pPager, n);
+  return TCL_OK;
+}
+
+/*
+** Usage:   pager_slots ID
+**
+** Return the number of page slots the pager has allocated.
+*/
+static int pager_slots(
+  void *NotUsed,
+  Tcl_Interp *interp,    /* The TCL interpreter that invoked this command */
+  int argc,              /* Number of arguments */
+  char **argv            /* Text of each argument */
+){
+  Pager *pPager;
+  char zBuf[100];
+  if( argc!=2 ){
+    Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+       " ID\"", 0);
+    return TCL_ERROR;
+  }
+  pPager = sqliteTextToPtr(argv[1]);
+  sprintf(zBuf,"%d",sqlitepager_slotcount(pPager));
+  Tcl_AppendResult(interp, zBuf, 0);
+  return TCL_OK;
+}
+
 /*
 ** Usage:   page_get ID PGNO
 **
@@ -324,14 +376,14 @@ static int page_get(
        " ID PGNO\"", 0);
     return TCL_ERROR;
   }
-  if( Tcl_GetInt(interp, argv[1], (int*)&pPager) ) return TCL_ERROR;
+  pPager = sqliteTextToPtr(argv[1]);
   if( Tcl_GetInt(interp, argv[2], &pgno) ) return TCL_ERROR;
   rc = sqlitepager_get(pPager, pgno, &pPage);
   if( rc!=SQLITE_OK ){
     Tcl_AppendResult(interp, errorName(rc), 0);
     return TCL_ERROR;
   }
-  sprintf(zBuf,"0x%x",(int)pPage);
+  sprintf(zBuf,"%p",(void*)pPage);
   Tcl_AppendResult(interp, zBuf, 0);
   return TCL_OK;
 }
@@ -357,11 +409,11 @@ static int page_lookup(
        " ID PGNO\"", 0);
     return TCL_ERROR;
   }
-  if( Tcl_GetInt(interp, argv[1], (int*)&pPager) ) return TCL_ERROR;
+  pPager = sqliteTextToPtr(argv[1]);
   if( Tcl_GetInt(interp, argv[2], &pgno) ) return TCL_ERROR;
   pPage = sqlitepager_lookup(pPager, pgno);
   if( pPage ){
-    sprintf(zBuf,"0x%x",(int)pPage);
+    sprintf(zBuf,"%p",(void*)pPage);
     Tcl_AppendResult(interp, zBuf, 0);
   }
   return TCL_OK;
@@ -385,7 +437,7 @@ static int page_unref(
        " PAGE\"", 0);
     return TCL_ERROR;
   }
-  if( Tcl_GetInt(interp, argv[1], (int*)&pPage) ) return TCL_ERROR;
+  pPage = sqliteTextToPtr(argv[1]);
   rc = sqlitepager_unref(pPage);
   if( rc!=SQLITE_OK ){
     Tcl_AppendResult(interp, errorName(rc), 0);
@@ -412,7 +464,7 @@ static int page_read(
        " PAGE\"", 0);
     return TCL_ERROR;
   }
-  if( Tcl_GetInt(interp, argv[1], (int*)&pPage) ) return TCL_ERROR;
+  pPage = sqliteTextToPtr(argv[1]);
   memcpy(zBuf, pPage, sizeof(zBuf));
   Tcl_AppendResult(interp, zBuf, 0);
   return TCL_OK;
@@ -436,7 +488,7 @@ static int page_number(
        " PAGE\"", 0);
     return TCL_ERROR;
   }
-  if( Tcl_GetInt(interp, argv[1], (int*)&pPage) ) return TCL_ERROR;
+  pPage = sqliteTextToPtr(argv[1]);
   sprintf(zBuf, "%d", sqlitepager_pagenumber(pPage));
   Tcl_AppendResult(interp, zBuf, 0);
   return TCL_OK;
@@ -460,7 +512,7 @@ static int page_write(
        " PAGE DATA\"", 0);
     return TCL_ERROR;
   }
-  if( Tcl_GetInt(interp, argv[1], (int*)&pPage) ) return TCL_ERROR;
+  pPage = sqliteTextToPtr(argv[1]);
   rc = sqlitepager_write(pPage);
   if( rc!=SQLITE_OK ){
     Tcl_AppendResult(interp, errorName(rc), 0);
@@ -471,6 +523,45 @@ static int page_write(
   return TCL_OK;
 }
 
+/*
+** Usage:   fake_big_file  N  FILENAME
+**
+** Write a few bytes at the N megabyte point of FILENAME.  This will
+** create a large file.  If the file was a valid SQLite database, then
+** the next time the database is opened, SQLite will begin allocating
+** new pages after N megabytes.  On systems with sparse files the space
+** in between is never actually written to disk.
+*/
+static int fake_big_file(
+  void *NotUsed,
+  Tcl_Interp *interp,    /* The TCL interpreter that invoked this command */
+  int argc,              /* Number of arguments */
+  char **argv            /* Text of each argument */
+){
+  int rc;
+  int n;
+  int readOnly = 0;
+  OsFile fd;
+  if( argc!=3 ){
+    Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0],
+       " N-MEGABYTES FILE\"", 0);
+    return TCL_ERROR;
+  }
+  if( Tcl_GetInt(interp, argv[1], &n) ) return TCL_ERROR;
+  rc = sqliteOsOpenReadWrite(sqlite_vfs_find(0), argv[2], &fd, &readOnly);
+  if( rc!=SQLITE_OK ){
+    Tcl_AppendResult(interp, "open failed: ", errorName(rc), 0);
+    return TCL_ERROR;
+  }
+  rc = sqliteOsWrite(&fd, "Hello, World!", 14, (off64)n*1048576);
+  sqliteOsClose(&fd);
+  if( rc!=SQLITE_OK ){
+    Tcl_AppendResult(interp, "write failed: ", errorName(rc), 0);
+    return TCL_ERROR;
+  }
+  return TCL_OK;
+}
+
 /*
 ** Register commands with the TCL interpreter.
 */
@@ -485,12 +576,15 @@ int Sqlitetest2_Init(Tcl_Interp *interp){
   Tcl_CreateCommand(interp, "pager_ckpt_rollback", pager_ckpt_rollback, 0, 0);
   Tcl_CreateCommand(interp, "pager_stats", pager_stats, 0, 0);
   Tcl_CreateCommand(interp, "pager_pagecount", pager_pagecount, 0, 0);
+  Tcl_CreateCommand(interp, "pager_set_cachesize", pager_set_cachesize, 0, 0);
+  Tcl_CreateCommand(interp, "pager_slots", pager_slots, 0, 0);
   Tcl_CreateCommand(interp, "page_get", page_get, 0, 0);
   Tcl_CreateCommand(interp, "page_lookup", page_lookup, 0, 0);
   Tcl_CreateCommand(interp, "page_unref", page_unref, 0, 0);
   Tcl_CreateCommand(interp, "page_read", page_read, 0, 0);
   Tcl_CreateCommand(interp, "page_write", page_write, 0, 0);
   Tcl_CreateCommand(interp, "page_number", page_number, 0, 0);
+  Tcl_CreateCommand(interp, "fake_big_file", fake_big_file, 0, 0);
   Tcl_LinkVar(interp, "sqlite_io_error_pending",
      (char*)&sqlite_io_error_pending, TCL_LINK_INT);
   return TCL_OK;
@@ -17,6 +17,34 @@
 ** places execute for very short periods of time.  So even if the library
 ** is compiled with its mutexes disabled, it is likely to work correctly
 ** in a multi-threaded program most of the time.  
+**
+** Usage:   threadtest ?-same? ?-shared? ?-snapshot? ?-group N? ?-scale?
+**                     ?NTHREAD? ?NPASS?
+**
+** NTHREAD threads (default 10) each make NPASS passes (default 10) over
+** a workload that fills a table, checks its contents and empties it
+** again, all inside one transaction.  Normally every thread uses a
+** database file of its own.  With -same all threads use the one file,
+** each with a table of its own, so that they compete for its locks and
+** must retry when they find it busy.  -shared turns on the shared
+** cache, so that with -same the connections of all threads share one
+** page cache and retry when they find a table locked.  With -scale the
+** workload is run with 1, 2, 4 and so on up to NTHREAD threads, and the
+** time taken and the number of passes per second are printed for each.
+** Independent connections should not wait for one another, so on a
+** machine with enough processors the rate grows with the number of
+** threads unless -same is also given.
+**
+** -group N runs a workload of single INSERT statements instead, NPASS*10
+** of them in each thread, with all threads on one shared cache and
+** "PRAGMA group_commit=N".  Each thread checks its table at the end.
+** Comparing the rate with -group 1 shows what group commit saves.
+**
+** -snapshot runs a different workload.  One thread makes NPASS*10
+** commits to a table while NTHREAD threads read it over and over with
+** "PRAGMA read_snapshot=ON", all on one shared cache.  The readers check
+** that every read sees a consistent table, and fail if they are ever
+** made to wait for the writer.
 */
 #include "sqlite.h"
 #include <pthread.h>
@@ -24,8 +52,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/time.h>
 
-#define sqliteFree(X)  sqliteFree_(X,__FILE__,__LINE__)
+#ifdef MEMORY_DEBUG
+# define sqliteFree(X)  sqliteFree_(X,__FILE__,__LINE__)
+extern void sqliteFree_(void*,char*,int);
+#else
+extern void sqliteFree(void*);
+#endif
 
 /*
 ** Come here to die.
@@ -109,9 +143,10 @@ char **db_query(sqlite *db, const char *zFile, const char *zFormat, ...){
 }
 
 /*
-** Execute an SQL statement.
+** Execute an SQL statement.  SQLITE_BUSY is returned if the database
+** or one of its tables is locked.  Any other error is fatal.
 */
-void db_execute(sqlite *db, const char *zFile, const char *zFormat, ...){
+int db_execute(sqlite *db, const char *zFile, const char *zFormat, ...){
   char *zSql;
   int rc;
   char *zErrMsg = 0;
@@ -120,6 +155,11 @@ void db_execute(sqlite *db, const char *zFile, const char *zFormat, ...){
   zSql = sqlite_vmprintf(zFormat, ap);
   va_end(ap);
   rc = sqlite_exec(db, zSql, 0, 0, &zErrMsg);
+  if( rc==SQLITE_BUSY || rc==SQLITE_LOCKED ){
+    free(zErrMsg);
+    sqliteFree(zSql);
+    return SQLITE_BUSY;
+  }
   if( zErrMsg ){
     fprintf(stderr,"%s: command failed: %s - %s\n", zFile, zSql, zErrMsg);
     free(zErrMsg);
@@ -127,6 +167,7 @@ void db_execute(sqlite *db, const char *zFile, const char *zFormat, ...){
     Exit(1);
   }
   sqliteFree(zSql);
+  return rc;
 }
 
 /*
@@ -160,77 +201,352 @@ void db_check(const char *zFile, const char *zMsg, char **az, ...){
   db_query_free(az);
 }
 
-pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t sig = PTHREAD_COND_INITIALIZER;
-int thread_cnt = 0;
+/*
+** Settings from the command line.
+*/
+static int sameFile = 0;      /* All threads use the same database file */
+static int sharedCache = 0;   /* Connections share their page cache */
+static int groupSize = 0;     /* group_commit setting, or 0 for one_pass() */
+static int nPass = 10;        /* Passes over the workload by each thread */
 
-static void *worker_bee(void *pArg){
-  const char *zFilename = (char*)pArg;
-  char *azErr;
-  int i, cnt;
+/*
+** Make one pass over the workload, using table zTab of database db.
+** Return SQLITE_BUSY if the database was locked, in which case the
+** transaction has been rolled back and the pass should be made again.
+*/
+static int one_pass(sqlite *db, const char *zFile, const char *zTab){
   char **az;
+  int i;
+  if( db_execute(db, zFile, "BEGIN")!=SQLITE_OK ) return SQLITE_BUSY;
+  if( db_execute(db, zFile, "DELETE FROM %s", zTab)!=SQLITE_OK ){
+    db_execute(db, zFile, "ROLLBACK");
+    return SQLITE_BUSY;
+  }
+  for(i=1; i<=100; i++){
+    if( db_execute(db, zFile, "INSERT INTO %s VALUES(%d,%d,%d);",
+           zTab, i, i*2, i*i)!=SQLITE_OK ){
+      db_execute(db, zFile, "ROLLBACK");
+      return SQLITE_BUSY;
+    }
+  }
+  az = db_query(db, zFile, "SELECT count(*) FROM %s", zTab);
+  db_check(zFile, "table size", az, "100", 0);  
+  az = db_query(db, zFile, "SELECT avg(b) FROM %s", zTab);
+  db_check(zFile, "table avg", az, "101", 0);  
+  if( db_execute(db, zFile, "DELETE FROM %s WHERE a>50", zTab)!=SQLITE_OK ){
+    db_execute(db, zFile, "ROLLBACK");
+    return SQLITE_BUSY;
+  }
+  az = db_query(db, zFile, "SELECT avg(b) FROM %s", zTab);
+  db_check(zFile, "table avg2", az, "51", 0);
+  for(i=1; i<=50; i++){
+    char z1[30], z2[30];
+    az = db_query(db, zFile, "SELECT b, c FROM %s WHERE a=%d", zTab, i);
+    sprintf(z1, "%d", i*2);
+    sprintf(z2, "%d", i*i);
+    db_check(zFile, "readback", az, z1, z2, 0);
+  }
+  if( db_execute(db, zFile, "COMMIT")!=SQLITE_OK ){
+    db_execute(db, zFile, "ROLLBACK");
+    return SQLITE_BUSY;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** The argument to each thread.
+*/
+struct WorkerArg {
+  char *zFile;     /* Name of the database file */
+  char *zTab;      /* Name of the table to use */
+  int nRetry;      /* Number of passes that had to be made again */
+};
+
+static void *worker_bee(void *pArg){
+  struct WorkerArg *p = (struct WorkerArg*)pArg;
+  char *zErr;
+  int cnt;
   sqlite *db;
 
-  pthread_mutex_lock(&lock);
-  thread_cnt++;
-  pthread_mutex_unlock(&lock);
-  printf("%s: START\n", zFilename);
-  fflush(stdout);
-  for(cnt=0; cnt<10; cnt++){
-    db = sqlite_open(zFilename, 0, &azErr);
+  for(cnt=0; cnt<nPass; cnt++){
+    db = sqlite_open(p->zFile, 0, &zErr);
     if( db==0 ){
-      fprintf(stderr,"%s: can't open\n", zFilename);
+      fprintf(stderr,"%s: can't open\n", p->zFile);
       Exit(1);
     }
-    db_execute(db, zFilename, "BEGIN; CREATE TABLE t1(a,b,c);");
-    for(i=1; i<=100; i++){
-      db_execute(db, zFilename, "INSERT INTO t1 VALUES(%d,%d,%d);",
-         i, i*2, i*i);
+    sqlite_busy_timeout(db, 10000);
+    while( one_pass(db, p->zFile, p->zTab)==SQLITE_BUSY ){
+      p->nRetry++;
+      if( sharedCache ) usleep(1000);
     }
-    az = db_query(db, zFilename, "SELECT count(*) FROM t1");
-    db_check(zFilename, "t1 size", az, "100", 0);  
-    az = db_query(db, zFilename, "SELECT avg(b) FROM t1");
-    db_check(zFilename, "t1 avg", az, "101", 0);  
-    db_execute(db, zFilename, "DELETE FROM t1 WHERE a>50");
-    az = db_query(db, zFilename, "SELECT avg(b) FROM t1");
-    db_check(zFilename, "t1 avg2", az, "51", 0);
-    for(i=1; i<=50; i++){
-      char z1[30], z2[30];
-      az = db_query(db, zFilename, "SELECT b, c FROM t1 WHERE a=%d", i);
-      sprintf(z1, "%d", i*2);
-      sprintf(z2, "%d", i*i);
-      db_check(zFilename, "readback", az, z1, z2, 0);
+    sqlite_close(db);
+  }
+  return 0;
+}
+
+/*
+** The thread of a -group run.  It inserts rows into its own table one
+** autocommit statement at a time, and then checks that they are all
+** there.
+*/
+static void *inserter_bee(void *pArg){
+  struct WorkerArg *p = (struct WorkerArg*)pArg;
+  char *zErr;
+  char **az;
+  char zCnt[30];
+  sqlite *db;
+  int i;
+
+  db = sqlite_open(p->zFile, 0, &zErr);
+  if( db==0 ){
+    fprintf(stderr,"%s: can't open\n", p->zFile);
+    Exit(1);
+  }
+  sqlite_busy_timeout(db, 10000);
+  db_execute(db, p->zFile, "PRAGMA group_commit=%d", groupSize);
+  for(i=1; i<=nPass*10; i++){
+    while( db_execute(db, p->zFile, "INSERT INTO %s VALUES(%d,%d,%d)",
+              p->zTab, i, i*2, i*i)!=SQLITE_OK ){
+      p->nRetry++;
+      usleep(1000);
     }
-    db_execute(db, zFilename, "COMMIT; DROP TABLE t1;");
+  }
+  az = db_query(db, p->zFile, "SELECT count(*) FROM %s", p->zTab);
+  sprintf(zCnt, "%d", nPass*10);
+  db_check(p->zFile, "row count", az, zCnt, 0);
+  sqlite_close(db);
+  return 0;
+}
+
+/*
+** Run nThread threads at once and wait for them all to finish.  Return
+** the number of seconds this took.
+*/
+static double run_threads(int nThread){
+  pthread_t *aId;
+  struct WorkerArg *aArg;
+  struct timeval start, end;
+  sqlite *db;
+  char *zErr;
+  int i, nRetry;
+
+  aId = malloc( nThread*sizeof(aId[0]) );
+  aArg = malloc( nThread*sizeof(aArg[0]) );
+  if( aId==0 || aArg==0 ){
+    fprintf(stderr, "malloc failed\n");
+    Exit(1);
+  }
+  for(i=0; i<nThread; i++){
+    aArg[i].zFile = sameFile ? sqlite_mprintf("testdb-shared")
+                             : sqlite_mprintf("testdb-%d", i+1);
+    aArg[i].zTab = sqlite_mprintf("t%d", i+1);
+    aArg[i].nRetry = 0;
+    if( i==0 || !sameFile ) unlink(aArg[i].zFile);
+    db = sqlite_open(aArg[i].zFile, 0, &zErr);
+    if( db==0 ){
+      fprintf(stderr,"%s: can't open\n", aArg[i].zFile);
+      Exit(1);
+    }
+    db_execute(db, aArg[i].zFile, "CREATE TABLE %s(a,b,c)", aArg[i].zTab);
     sqlite_close(db);
   }
-  printf("%s: END\n", zFilename);
-  unlink(zFilename);
-  fflush(stdout);
-  pthread_mutex_lock(&lock);
-  thread_cnt--;
-  if( thread_cnt<=0 ){
-    pthread_cond_signal(&sig);
+  gettimeofday(&start, 0);
+  for(i=0; i<nThread; i++){
+    pthread_create(&aId[i], 0, groupSize ? inserter_bee : worker_bee,
+                   (void*)&aArg[i]);
+  }
+  nRetry = 0;
+  for(i=0; i<nThread; i++){
+    pthread_join(aId[i], 0);
+    nRetry += aArg[i].nRetry;
+  }
+  gettimeofday(&end, 0);
+  for(i=0; i<nThread; i++){
+    unlink(aArg[i].zFile);
+    sqliteFree(aArg[i].zFile);
+    sqliteFree(aArg[i].zTab);
   }
-  pthread_mutex_unlock(&lock);
+  free(aId);
+  free(aArg);
+  if( nRetry>0 ){
+    printf("%d threads: %d passes retried\n", nThread, nRetry);
+  }
+  return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec)*1e-6;
+}
+
+/*
+** State shared by the threads of run_snapshot().
+*/
+static pthread_mutex_t snapMutex = PTHREAD_MUTEX_INITIALIZER;
+static int writerDone;        /* True once the writer has finished */
+static int nSnapRead;         /* Number of queries made by the readers */
+
+/*
+** The writer of run_snapshot().  Each transaction moves one unit of b
+** from one row of t1 to another, so count(*) and sum(b) never change
+** from one commit to the next.  Return the number of commits made.
+*/
+static void *writer_bee(void *pArg){
+  const char *zFile = (const char*)pArg;
+  char *zErr;
+  sqlite *db;
+  int i, nCommit;
+
+  db = sqlite_open(zFile, 0, &zErr);
+  if( db==0 ){
+    fprintf(stderr,"%s: can't open\n", zFile);
+    Exit(1);
+  }
+  nCommit = 0;
+  for(i=0; i<nPass*10; i++){
+    if( db_execute(db, zFile, "BEGIN")!=SQLITE_OK
+     || db_execute(db, zFile, "UPDATE t1 SET b=b-1 WHERE a=%d", i%100+1)
+     || db_execute(db, zFile, "UPDATE t1 SET b=b+1 WHERE a=%d", (i+37)%100+1)
+     || db_execute(db, zFile, "COMMIT")!=SQLITE_OK
+    ){
+      fprintf(stderr,"%s: the writer was locked out\n", zFile);
+      Exit(1);
+    }
+    nCommit++;
+  }
+  sqlite_close(db);
+  pthread_mutex_lock(&snapMutex);
+  writerDone = 1;
+  pthread_mutex_unlock(&snapMutex);
+  return (void*)(long)nCommit;
+}
+
+/*
+** A reader of run_snapshot().  It keeps checking that t1 is consistent
+** until the writer is done.  Any error, SQLITE_LOCKED included, is fatal,
+** since snapshot readers are never supposed to wait on the writer.
+*/
+static void *reader_bee(void *pArg){
+  const char *zFile = (const char*)pArg;
+  char *zErr;
+  char **az;
+  sqlite *db;
+  int done, n;
+
+  db = sqlite_open(zFile, 0, &zErr);
+  if( db==0 ){
+    fprintf(stderr,"%s: can't open\n", zFile);
+    Exit(1);
+  }
+  db_execute(db, zFile, "PRAGMA read_snapshot=ON");
+  n = 0;
+  do{
+    pthread_mutex_lock(&snapMutex);
+    done = writerDone;
+    pthread_mutex_unlock(&snapMutex);
+    az = db_query(db, zFile, "SELECT count(*), sum(b) FROM t1");
+    db_check(zFile, "snapshot", az, "100", "5050", 0);
+    n++;
+  }while( !done );
+  sqlite_close(db);
+  pthread_mutex_lock(&snapMutex);
+  nSnapRead += n;
+  pthread_mutex_unlock(&snapMutex);
   return 0;
 }
 
+/*
+** Run one writer and nThread readers at once on a shared cache, the
+** readers with "PRAGMA read_snapshot=ON".  Return the number of seconds
+** this took.
+*/
+static double run_snapshot(int nThread){
+  const char *zFile = "testdb-snapshot";
+  pthread_t *aId;
+  struct timeval start, end;
+  sqlite *db;
+  char *zErr;
+  void *pCommit;
+  int i;
+
+  aId = malloc( (nThread+1)*sizeof(aId[0]) );
+  if( aId==0 ){
+    fprintf(stderr, "malloc failed\n");
+    Exit(1);
+  }
+  unlink(zFile);
+  db = sqlite_open(zFile, 0, &zErr);
+  if( db==0 ){
+    fprintf(stderr,"%s: can't open\n", zFile);
+    Exit(1);
+  }
+  db_execute(db, zFile, "BEGIN; CREATE TABLE t1(a INTEGER PRIMARY KEY, b)");
+  for(i=1; i<=100; i++){
+    db_execute(db, zFile, "INSERT INTO t1 VALUES(%d,%d)", i, i);
+  }
+  db_execute(db, zFile, "COMMIT");
+  writerDone = 0;
+  nSnapRead = 0;
+  gettimeofday(&start, 0);
+  for(i=1; i<=nThread; i++){
+    pthread_create(&aId[i], 0, reader_bee, (void*)zFile);
+  }
+  pthread_create(&aId[0], 0, writer_bee, (void*)zFile);
+  pthread_join(aId[0], &pCommit);
+  for(i=1; i<=nThread; i++){
+    pthread_join(aId[i], 0);
+  }
+  gettimeofday(&end, 0);
+  sqlite_close(db);
+  unlink(zFile);
+  free(aId);
+  printf("%d readers: %d consistent reads during %d commits\n",
+     nThread, nSnapRead, (int)(long)pCommit);
+  return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec)*1e-6;
+}
+
 int main(int argc, char **argv){
-  char *zFile;
-  int i, n;
-  pthread_t id;
-  if( argc<2 || (n=atoi(argv[1]))<1 ) n = 10;
-  for(i=0; i<n; i++){
-    zFile = sqlite_mprintf("testdb-%d", i+1);
-    unlink(zFile);
-    pthread_create(&id, 0, worker_bee, (void*)zFile);
-    pthread_detach(id);
-  }
-  pthread_mutex_lock(&lock);
-  while( thread_cnt>0 ){
-    pthread_cond_wait(&sig, &lock);
-  }
-  pthread_mutex_unlock(&lock);
+  int i, n, scale, snapshot;
+  double t;
+  scale = 0;
+  snapshot = 0;
+  n = 10;
+  for(i=1; i<argc && argv[i][0]=='-'; i++){
+    if( strcmp(argv[i],"-same")==0 ){
+      sameFile = 1;
+    }else if( strcmp(argv[i],"-shared")==0 ){
+      sharedCache = 1;
+    }else if( strcmp(argv[i],"-group")==0 && i+1<argc ){
+      groupSize = atoi(argv[++i]);
+      if( groupSize<1 ) groupSize = 1;
+      sameFile = 1;
+      sharedCache = 1;
+    }else if( strcmp(argv[i],"-snapshot")==0 ){
+      snapshot = 1;
+      sharedCache = 1;
+    }else if( strcmp(argv[i],"-scale")==0 ){
+      scale = 1;
+    }else{
+      fprintf(stderr,
+         "Usage: %s ?-same? ?-shared? ?-snapshot? ?-group N? ?-scale?"
+         " ?NTHREAD? ?NPASS?\n", argv[0]);
+      return 1;
+    }
+  }
+  sqlite_enable_shared_cache(sharedCache);
+  if( i<argc && atoi(argv[i])>0 ) n = atoi(argv[i]);
+  if( i+1<argc && atoi(argv[i+1])>0 ) nPass = atoi(argv[i+1]);
+  for(i=scale ? 1 : n; i<=n; i = i<n && i*2>n ? n : i*2){
+    if( snapshot ){
+      t = run_snapshot(i);
+      printf("%d readers: %.3f seconds, %.1f commits per second\n",
+         i, t, nPass*10/t);
+    }else if( groupSize ){
+      t = run_threads(i);
+      printf("%d threads: %.3f seconds, %.1f commits per second\n",
+         i, t, i*nPass*10/t);
+    }else{
+      t = run_threads(i);
+      printf("%d threads: %.3f seconds, %.1f passes per second\n",
+         i, t, i*nPass/t);
+    }
+    fflush(stdout);
+    if( i==n ) break;
+  }
   return 0;
 }
@@ -41,6 +41,7 @@ static Keyword aKeywordTable[] = {
   { "ABORT",             0, TK_ABORT,            0 },
   { "AFTER",             0, TK_AFTER,            0 },
   { "ALL",               0, TK_ALL,              0 },
+  { "ANALYZE",           0, TK_ANALYZE,          0 },
   { "AND",               0, TK_AND,              0 },
   { "AS",                0, TK_AS,               0 },
   { "ASC",               0, TK_ASC,              0 },
@@ -153,8 +154,10 @@ int sqliteKeywordCode(const char *z, int n){
     if( aKeywordTable[0].len==0 ){
       int i;
       int n;
+      /* Entry 0 is done last since other threads read its length,
+      ** without the mutex, to see if the table is ready. */
       n = sizeof(aKeywordTable)/sizeof(aKeywordTable[0]);
-      for(i=0; i<n; i++){
+      for(i=n-1; i>=0; i--){
         aKeywordTable[i].len = strlen(aKeywordTable[i].zName);
         h = sqliteHashNoCase(aKeywordTable[i].zName, aKeywordTable[i].len);
         h %= KEY_HASH_SIZE;
@@ -32,7 +32,7 @@ void sqliteCreateTrigger(
 ){
   Trigger *nt;
   Table   *tab;
-  int offset;
+  ptr offset;
   TriggerStep *ss;
 
   /* Check that: 
@@ -101,7 +101,7 @@ void sqliteCreateTrigger(
   nt->foreach = foreach;
   nt->step_list = pStepList;
   nt->isCommit = 0;
-  offset = (int)(nt->strings - zData);
+  offset = Addr(nt->strings) - Addr(zData);
   sqliteExprMoveStrings(nt->pWhen, offset);
 
   ss = nt->step_list;
@@ -665,6 +665,8 @@ void sqliteViewTriggers(
   theSelect.pPrior = 0;
   theSelect.nLimit = -1;
   theSelect.nOffset = -1;
+  theSelect.iLimit = -1;
+  theSelect.iOffset = -1;
   theSelect.zSelect = 0;
   theSelect.base = 0;
 
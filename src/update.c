@@ -179,6 +179,14 @@ void sqliteUpdate(
   if( v==0 ) goto update_cleanup;
   sqliteBeginWriteOperation(pParse, 1);
 
+  /* Compute subexpressions that are the same for every row before
+  ** the loops begin.
+  */
+  sqliteExprHoistConstants(pParse, pWhere);
+  for(i=0; i<pChanges->nExpr; i++){
+    sqliteExprHoistConstants(pParse, pChanges->a[i].pExpr);
+  }
+
   /* Begin the database scan
   */
   pWInfo = sqliteWhereBegin(pParse, base, pTabList, pWhere, 1);
@@ -34,14 +34,18 @@
 */
 #include "sqliteInt.h"
 #include <ctype.h>
+#include <time.h>
 
 /*
 ** The following global variable is incremented every time a cursor
 ** moves, either by the OP_MoveTo or the OP_Next opcode.  The test
 ** procedures use this information to make sure that indices are
-** working correctly.
+** working correctly.  It is shared by every connection, so it only
+** exists in the test build, where vdbe.c is compiled with SQLITE_TEST.
 */
+#ifdef SQLITE_TEST
 int sqlite_search_count = 0;
+#endif
 
 /*
 ** SQL is translated into a sequence of instructions to be
@@ -215,6 +219,18 @@ struct Keylist {
   int aKey[1];      /* One or more keys.  Extra space allocated as needed */
 };
 
+/*
+** When a program is run by EXPLAIN ANALYZE, the following statistics
+** are gathered for each instruction.
+*/
+typedef struct OpProfile OpProfile;
+struct OpProfile {
+  int nExec;          /* Number of times the instruction was executed */
+  double nTicks;      /* Total time spent in the instruction */
+  int nFetch;         /* Number of database pages requested */
+  int nMiss;          /* Number of pages that were not in the cache */
+};
+
 /*
 ** An instance of the virtual machine
 */
@@ -248,10 +264,11 @@ struct Vdbe {
   int nSet;           /* Number of sets allocated */
   Set *aSet;          /* An array of sets */
   int nCallback;      /* Number of callbacks invoked so far */
-  int iLimit;         /* Limit on the number of callbacks remaining */
-  int iOffset;        /* Offset before beginning to do callbacks */
   int keylistStackDepth;  /* The size of the "keylist" stack */
   Keylist **keylistStack; /* The stack used by opcodes ListPush & ListPop */
+  OpProfile *aProfile;    /* Per-instruction statistics.  EXPLAIN ANALYZE */
+  int nClosedFetch;       /* Page requests by temp tables already closed */
+  int nClosedMiss;        /* Cache misses by temp tables already closed */
 };
 
 /*
@@ -525,6 +542,198 @@ void sqliteVdbeCompressSpace(Vdbe *p, int addr){
   z[j] = 0;
 }
 
+/*
+** Return TRUE if the P2 operand of the given opcode is the address of
+** another instruction.  Every opcode that sets the program counter from
+** its P2 operand must be listed here, or else sqliteVdbeOptimize() will
+** fail to relocate its jump.
+*/
+static int isJumpOp(int op){
+  switch( op ){
+    case OP_Goto:         case OP_If:           case OP_IfNot:
+    case OP_MustBeInt:    case OP_IsNull:       case OP_NotNull:
+    case OP_Eq:           case OP_Ne:           case OP_Lt:
+    case OP_Le:           case OP_Gt:           case OP_Ge:
+    case OP_EqImm:        case OP_NeImm:        case OP_LtImm:
+    case OP_LeImm:        case OP_GtImm:        case OP_GeImm:
+    case OP_MakeIdxKey:   case OP_MoveTo:       case OP_Distinct:
+    case OP_Found:        case OP_NotFound:     case OP_IsUnique:
+    case OP_NotExists:    case OP_Last:         case OP_Rewind:
+    case OP_Next:         case OP_IdxGT:        case OP_IdxGE:
+    case OP_ListRead:     case OP_SortNext:     case OP_FileRead:
+    case OP_MemIncr:      case OP_AggFocus:     case OP_AggNext:
+    case OP_SetFound:     case OP_SetNotFound:  case OP_SetFirst:
+    case OP_SetNext:
+      return 1;
+  }
+  return 0;
+}
+
+/*
+** If op is one of the comparison opcodes OP_Eq through OP_Ge, return
+** the corresponding compare-with-immediate opcode.  If bSwap is true,
+** the operands of the comparison are exchanged, so OP_Lt becomes
+** OP_GtImm and so forth.  Return 0 if op is not a comparison.
+*/
+static int immediateCompareOp(int op, int bSwap){
+  switch( op ){
+    case OP_Eq:  return OP_EqImm;
+    case OP_Ne:  return OP_NeImm;
+    case OP_Lt:  return bSwap ? OP_GtImm : OP_LtImm;
+    case OP_Le:  return bSwap ? OP_GeImm : OP_LeImm;
+    case OP_Gt:  return bSwap ? OP_LtImm : OP_GtImm;
+    case OP_Ge:  return bSwap ? OP_LeImm : OP_GeImm;
+  }
+  return 0;
+}
+
+/*
+** Run a peephole optimization pass over the program in the VDBE.  This
+** routine is called once, after all code has been generated and all
+** labels resolved, and before the program is run or listed.  It does
+** the following:
+**
+**   (1)  A jump whose destination is an OP_Goto is redirected to the
+**        final destination of the OP_Goto.
+**
+**   (2)  An OP_Integer followed by a comparison that jumps on NULL is
+**        fused into a single compare-with-immediate instruction such as
+**        OP_LtImm.  The same is done when an OP_Column, OP_Recno or
+**        OP_MemLoad comes between the two, with the sense of the
+**        comparison reversed.  This covers "column op constant" terms
+**        of a WHERE clause.
+**
+**   (3)  Instructions that can never be reached, OP_Noop instructions,
+**        and OP_Goto instructions that jump to the next surviving
+**        instruction are removed and the remaining jumps relocated.
+**
+** None of this changes what the program does; it only cuts the number
+** of instructions dispatched.  If a memory allocation fails, the
+** program is left unchanged.
+*/
+void sqliteVdbeOptimize(Vdbe *p){
+  Op *aOp = p->aOp;
+  int nOp = p->nOp;
+  char *aTarget;      /* aTarget[i] is true if some jump lands on i */
+  char *aLive;        /* aLive[i] is true if instruction i is reachable */
+  int *aMap;          /* Work stack, then map from old to new addresses */
+  int i, j, n;
+
+  if( aOp==0 || nOp==0 ) return;
+  aTarget = sqliteMalloc( 2*(nOp+1)*sizeof(aTarget[0]) );
+  aMap = sqliteMalloc( (nOp+1)*sizeof(aMap[0]) );
+  if( aTarget==0 || aMap==0 ) goto optimize_end;
+  aLive = &aTarget[nOp+1];
+
+  /* Thread jumps through OP_Goto instructions.  A P2 of zero means "do
+  ** not jump" for many opcodes so it is left alone.  The hop count
+  ** bounds the loop in case the OP_Gotos form a cycle.
+  */
+  for(i=0; i<nOp; i++){
+    if( !isJumpOp(aOp[i].opcode) ) continue;
+    for(n=0; n<nOp; n++){
+      j = aOp[i].p2;
+      if( j<=0 || j>=nOp || j==i || aOp[j].opcode!=OP_Goto ) break;
+      aOp[i].p2 = aOp[j].p2;
+    }
+  }
+
+  /* Fuse an integer constant into the comparison that consumes it.
+  ** Only comparisons that jump when an operand is NULL are fused, since
+  ** the constant itself is never NULL.  Nothing may jump into the middle
+  ** of the sequence.
+  */
+  for(i=0; i<nOp; i++){
+    j = aOp[i].p2;
+    if( isJumpOp(aOp[i].opcode) && j>=0 && j<nOp ) aTarget[j] = 1;
+  }
+  for(i=0; i+1<nOp; i++){
+    Op *pInt = &aOp[i];
+    Op *pCmp;
+    int bSwap;
+    if( pInt->opcode!=OP_Integer ) continue;
+    if( pInt->p3 ){
+      char zBuf[30];
+      sprintf(zBuf, "%d", pInt->p1);
+      if( strcmp(pInt->p3, zBuf)!=0 ) continue;
+    }
+    pCmp = &aOp[i+1];
+    bSwap = 0;
+    if( (pCmp->opcode==OP_Column || pCmp->opcode==OP_Recno
+          || pCmp->opcode==OP_MemLoad) && i+2<nOp && !aTarget[i+1] ){
+      pCmp = &aOp[i+2];
+      bSwap = 1;
+    }
+    if( aTarget[pCmp - aOp] ) continue;
+    if( immediateCompareOp(pCmp->opcode, bSwap)==0 ) continue;
+    if( pCmp->p1==0 || pCmp->p2<=0 ) continue;
+    pCmp->opcode = immediateCompareOp(pCmp->opcode, bSwap);
+    pCmp->p1 = pInt->p1;
+    pInt->opcode = OP_Noop;
+  }
+
+  /* Find the instructions that can be reached from the start of the
+  ** program.  aMap[] is used as the work stack.  Each instruction is
+  ** pushed at most once so the stack cannot overflow.
+  */
+  n = 0;
+  aMap[n++] = 0;
+  aLive[0] = 1;
+  while( n>0 ){
+    int op;
+    i = aMap[--n];
+    op = aOp[i].opcode;
+    j = aOp[i].p2;
+    if( isJumpOp(op) && j>=0 && j<nOp && !aLive[j] ){
+      aLive[j] = 1;
+      aMap[n++] = j;
+    }
+    if( op!=OP_Goto && op!=OP_Halt && i+1<nOp && !aLive[i+1] ){
+      aLive[i+1] = 1;
+      aMap[n++] = i+1;
+    }
+  }
+
+  /* An OP_Goto that jumps forward over nothing but instructions that
+  ** are about to be removed does no work.  Turn it into an OP_Noop.
+  ** Work backwards so that a run of such jumps collapses completely.
+  */
+  for(i=nOp-1; i>=0; i--){
+    if( aOp[i].opcode!=OP_Goto || !aLive[i] ) continue;
+    j = aOp[i].p2;
+    if( j<=i || j>nOp ) continue;
+    for(n=i+1; n<j && (!aLive[n] || aOp[n].opcode==OP_Noop); n++){}
+    if( n==j ) aOp[i].opcode = OP_Noop;
+  }
+
+  /* Squeeze out the dead instructions and relocate the jumps.
+  */
+  for(i=j=0; i<nOp; i++){
+    aMap[i] = j;
+    if( !aLive[i] || aOp[i].opcode==OP_Noop ){
+      if( aOp[i].p3type==P3_DYNAMIC ) sqliteFree(aOp[i].p3);
+      continue;
+    }
+    if( i!=j ) aOp[j] = aOp[i];
+    j++;
+  }
+  aMap[nOp] = j;
+  for(i=j; i<nOp; i++){
+    memset(&aOp[i], 0, sizeof(aOp[i]));
+  }
+  p->nOp = j;
+  for(i=0; i<p->nOp; i++){
+    n = aOp[i].p2;
+    if( isJumpOp(aOp[i].opcode) && n>=0 && n<=nOp ){
+      aOp[i].p2 = aMap[n];
+    }
+  }
+
+optimize_end:
+  sqliteFree(aTarget);
+  sqliteFree(aMap);
+}
+
 /*
 ** The following group or routines are employed by installable functions
 ** to return their results.
@@ -920,11 +1129,19 @@ static void KeylistFree(Keylist *p){
 ** Close a cursor and release all the resources that cursor happens
 ** to hold.
 */
-static void cleanupCursor(Cursor *pCx){
+static void cleanupCursor(Vdbe *p, Cursor *pCx){
   if( pCx->pCursor ){
     sqliteBtreeCloseCursor(pCx->pCursor);
   }
   if( pCx->pBt ){
+    if( p->aProfile ){
+      /* Remember the page counts of a temporary table that is going
+      ** away so that they are still charged to the right instruction. */
+      int nFetch, nMiss;
+      sqliteBtreePageCounts(pCx->pBt, &nFetch, &nMiss);
+      p->nClosedFetch += nFetch;
+      p->nClosedMiss += nMiss;
+    }
     sqliteBtreeClose(pCx->pBt);
   }
   memset(pCx, 0, sizeof(Cursor));
@@ -936,7 +1153,7 @@ static void cleanupCursor(Cursor *pCx){
 static void closeAllCursors(Vdbe *p){
   int i;
   for(i=0; i<p->nCursor; i++){
-    cleanupCursor(&p->aCsr[i]);
+    cleanupCursor(p, &p->aCsr[i]);
   }
   sqliteFree(p->aCsr);
   p->aCsr = 0;
@@ -1037,6 +1254,7 @@ void sqliteVdbeDelete(Vdbe *p){
   sqliteFree(p->aLabel);
   sqliteFree(p->aStack);
   sqliteFree(p->zStack);
+  sqliteFree(p->aProfile);
   sqliteFree(p);
 }
 
@@ -1060,27 +1278,28 @@ static char *zOpName[] = { 0,
   "Last",              "Rewind",            "Next",              "Destroy",
   "Clear",             "CreateIndex",       "CreateTable",       "IntegrityCk",
   "IdxPut",            "IdxDelete",         "IdxRecno",          "IdxGT",
-  "IdxGE",             "MemLoad",           "MemStore",          "ListWrite",
-  "ListRewind",        "ListRead",          "ListReset",         "ListPush",
-  "ListPop",           "SortPut",           "SortMakeRec",       "SortMakeKey",
-  "Sort",              "SortNext",          "SortCallback",      "SortReset",
-  "FileOpen",          "FileRead",          "FileColumn",        "AggReset",
-  "AggFocus",          "AggNext",           "AggSet",            "AggGet",
-  "AggFunc",           "AggInit",           "AggPush",           "AggPop",
-  "SetInsert",         "SetFound",          "SetNotFound",       "SetFirst",
-  "SetNext",           "MakeRecord",        "MakeKey",           "MakeIdxKey",
-  "IncrKey",           "Goto",              "If",                "IfNot",
-  "Halt",              "ColumnCount",       "ColumnName",        "Callback",
-  "NullCallback",      "Integer",           "String",            "Pop",
-  "Dup",               "Pull",              "Push",              "MustBeInt",
-  "Add",               "AddImm",            "Subtract",          "Multiply",
-  "Divide",            "Remainder",         "BitAnd",            "BitOr",
-  "BitNot",            "ShiftLeft",         "ShiftRight",        "AbsValue",
-  "Eq",                "Ne",                "Lt",                "Le",
-  "Gt",                "Ge",                "IsNull",            "NotNull",
-  "Negative",          "And",               "Or",                "Not",
-  "Concat",            "Noop",              "Function",          "Limit",
-  "LimitCk",
+  "IdxGE",             "MemLoad",           "MemStore",          "MemIncr",
+  "ListWrite",         "ListRewind",        "ListRead",          "ListReset",
+  "ListPush",          "ListPop",           "SortPut",           "SortMakeRec",
+  "SortMakeKey",       "Sort",              "SortNext",          "SortCallback",
+  "SortReset",         "FileOpen",          "FileRead",          "FileColumn",
+  "AggReset",          "AggFocus",          "AggNext",           "AggSet",
+  "AggGet",            "AggFunc",           "AggInit",           "AggPush",
+  "AggPop",            "SetInsert",         "SetFound",          "SetNotFound",
+  "SetFirst",          "SetNext",           "MakeRecord",        "MakeKey",
+  "MakeIdxKey",        "IncrKey",           "Goto",              "If",
+  "IfNot",             "Halt",              "ColumnCount",       "ColumnName",
+  "Callback",          "NullCallback",      "Integer",           "String",
+  "Pop",               "Dup",               "Pull",              "Push",
+  "MustBeInt",         "Add",               "AddImm",            "Subtract",
+  "Multiply",          "Divide",            "Remainder",         "BitAnd",
+  "BitOr",             "BitNot",            "ShiftLeft",         "ShiftRight",
+  "AbsValue",          "Eq",                "Ne",                "Lt",
+  "Le",                "Gt",                "Ge",                "EqImm",
+  "NeImm",             "LtImm",             "LeImm",             "GtImm",
+  "GeImm",             "IsNull",            "NotNull",           "Negative",
+  "And",               "Or",                "Not",               "Concat",
+  "Noop",              "Function",        
 };
 
 /*
@@ -1112,20 +1331,30 @@ int sqliteVdbeList(
 ){
   sqlite *db = p->db;
   int i, rc;
-  char *azValue[6];
+  int nColumn;
+  char *azValue[10];
   char zAddr[20];
   char zP1[20];
   char zP2[20];
   char zP3[40];
+  char zExec[20];
+  char zTicks[40];
+  char zFetch[20];
+  char zMiss[20];
   static char *azColumnNames[] = {
-     "addr", "opcode", "p1", "p2", "p3", 0
+     "addr", "opcode", "p1", "p2", "p3", "count", "ticks", "fetch", "miss", 0
   };
 
   if( xCallback==0 ) return 0;
+  nColumn = p->aProfile ? 9 : 5;
   azValue[0] = zAddr;
   azValue[2] = zP1;
   azValue[3] = zP2;
-  azValue[5] = 0;
+  azValue[5] = zExec;
+  azValue[6] = zTicks;
+  azValue[7] = zFetch;
+  azValue[8] = zMiss;
+  azValue[nColumn] = 0;
   rc = SQLITE_OK;
   for(i=0; rc==SQLITE_OK && i<p->nOp; i++){
     if( db->flags & SQLITE_Interrupt ){
@@ -1142,17 +1371,24 @@ int sqliteVdbeList(
     sprintf(zP1,"%d", p->aOp[i].p1);
     sprintf(zP2,"%d", p->aOp[i].p2);
     if( p->aOp[i].p3type==P3_POINTER ){
-      sprintf(zP3, "ptr(%#x)", (int)p->aOp[i].p3);
+      sprintf(zP3, "ptr(%p)", (void*)p->aOp[i].p3);
       azValue[4] = zP3;
     }else{
       azValue[4] = p->aOp[i].p3;
     }
     azValue[1] = zOpName[p->aOp[i].opcode];
+    if( p->aProfile ){
+      OpProfile *pProf = &p->aProfile[i];
+      sprintf(zExec, "%d", pProf->nExec);
+      sprintf(zTicks, "%.0f", pProf->nTicks);
+      sprintf(zFetch, "%d", pProf->nFetch);
+      sprintf(zMiss, "%d", pProf->nMiss);
+    }
     if( sqliteSafetyOff(db) ){
       rc = SQLITE_MISUSE;
       break;
     }
-    if( xCallback(pArg, 5, azValue, azColumnNames) ){
+    if( xCallback(pArg, nColumn, azValue, azColumnNames) ){
       rc = SQLITE_ABORT;
     }
     if( sqliteSafetyOn(db) ){
@@ -1162,6 +1398,38 @@ int sqliteVdbeList(
   return rc;
 }
 
+/*
+** Run the program with per-instruction profiling turned on, then give
+** a listing of the program just like sqliteVdbeList() with the number
+** of times each instruction ran, the time spent in it, and the number
+** of page requests and cache misses it caused added as extra columns.
+** This is how EXPLAIN ANALYZE is implemented.
+**
+** The statement really is executed, but any result rows it produces
+** are discarded.  If the statement fails, the error is returned and no
+** listing is produced.
+*/
+int sqliteVdbeAnalyze(
+  Vdbe *p,                   /* The VDBE */
+  sqlite_callback xCallback, /* The callback */
+  void *pArg,                /* 1st argument to callback */
+  char **pzErrMsg,           /* Error msg written here */
+  void *pBusyArg,            /* 1st argument to the busy callback */
+  int (*xBusy)(void*,const char*,int)  /* Called when a file is busy */
+){
+  int rc;
+  sqliteFree(p->aProfile);
+  p->aProfile = sqliteMalloc( p->nOp*sizeof(p->aProfile[0]) );
+  if( p->aProfile==0 ) return SQLITE_NOMEM;
+  p->nClosedFetch = 0;
+  p->nClosedMiss = 0;
+  rc = sqliteVdbeExec(p, 0, 0, pzErrMsg, pBusyArg, xBusy);
+  if( rc==SQLITE_OK ){
+    rc = sqliteVdbeList(p, xCallback, pArg, pzErrMsg);
+  }
+  return rc;
+}
+
 /*
 ** The parameters are pointers to the head of two sorted lists
 ** of Sorter structures.  Merge these two lists together and return
@@ -1241,6 +1509,89 @@ static int byteSwap(int x){
 # define VERIFY(X) X
 #endif
 
+/*
+** The profileTime() routine returns a timestamp used to measure how
+** long each instruction takes under EXPLAIN ANALYZE.  Where it is
+** available, the processor's cycle counter is used.  Otherwise we fall
+** back to clock(), which is much coarser.
+*/
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+typedef unsigned long long ProfileTime;
+static ProfileTime profileTime(void){
+  unsigned int lo, hi;
+  __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((ProfileTime)hi << 32) | lo;
+}
+#else
+typedef clock_t ProfileTime;
+# define profileTime() clock()
+#endif
+
+/*
+** Write into *pnFetch and *pnMiss the total number of page requests
+** and cache misses so far for every BTree that the VDBE might touch:
+** the main and temporary databases, and the private BTree behind
+** every open temporary table.  Temporary tables that have already
+** been closed are included too.
+*/
+static void profilePageCounts(Vdbe *p, int *pnFetch, int *pnMiss){
+  sqlite *db = p->db;
+  int nFetch, nMiss;
+  int i;
+  *pnFetch = p->nClosedFetch;
+  *pnMiss = p->nClosedMiss;
+  if( db->pBe ){
+    sqliteBtreePageCounts(db->pBe, &nFetch, &nMiss);
+    *pnFetch += nFetch;
+    *pnMiss += nMiss;
+  }
+  if( db->pBeTemp ){
+    sqliteBtreePageCounts(db->pBeTemp, &nFetch, &nMiss);
+    *pnFetch += nFetch;
+    *pnMiss += nMiss;
+  }
+  for(i=0; i<p->nCursor; i++){
+    if( p->aCsr[i].pBt==0 ) continue;
+    sqliteBtreePageCounts(p->aCsr[i].pBt, &nFetch, &nMiss);
+    *pnFetch += nFetch;
+    *pnMiss += nMiss;
+  }
+}
+
+/*
+** When VDBE_THREADED_DISPATCH is defined, the main loop of sqliteVdbeExec()
+** uses the "labels as values" extension of GCC.  Every case of the big
+** switch statement is also given a label, and an instruction that runs to
+** completion jumps straight to the label for the next instruction through
+** a table indexed by opcode.  That puts a separate indirect jump at the end
+** of every instruction, which the CPU can predict much better than the
+** single shared jump of the switch.  The switch statement is still used
+** whenever anything unusual happens (an error, an interrupt, tracing,
+** profiling for EXPLAIN ANALYZE or the end of the program), and it
+** remains the only dispatch method when VDBE_THREADED_DISPATCH is not
+** defined, which is the default.  An opcode outside of aDispatch[] is
+** never looked up there.  It goes to the switch, whose default case
+** reports it, just as it would without threaded dispatch.
+**
+** CASE(X) introduces the implementation of opcode X and
+** NEXT_INSTRUCTION ends it.
+*/
+#ifdef VDBE_THREADED_DISPATCH
+# define CASE(X)  case X: L_##X:
+# define NEXT_INSTRUCTION \
+    if( pc+1<p->nOp VERIFY(&& pc>=-1) && rc==SQLITE_OK \
+        && !sqlite_malloc_failed && (db->flags & SQLITE_Interrupt)==0 \
+        && p->aProfile==0 VERIFY(&& p->trace==0) \
+        && (unsigned)p->aOp[pc+1].opcode<=OP_MAX ){ \
+      pOp = &p->aOp[++pc]; \
+      goto *aDispatch[pOp->opcode]; \
+    } \
+    break
+#else
+# define CASE(X)  case X:
+# define NEXT_INSTRUCTION  break
+#endif
+
 /*
 ** Execute the program in the VDBE.
 **
@@ -1286,7 +1637,142 @@ int sqliteVdbeExec(
   int errorAction = OE_Abort; /* Recovery action to do in case of an error */
   int undoTransOnError = 0;   /* If error, either ROLLBACK or COMMIT */
   char zBuf[100];             /* Space to sprintf() an integer */
-
+  int pcStart = 0;            /* Instruction being profiled */
+  ProfileTime tStart = 0;     /* Time at which instruction pcStart began */
+  int nFetchStart = 0;        /* Page requests before pcStart began */
+  int nMissStart = 0;         /* Cache misses before pcStart began */
+#ifdef VDBE_THREADED_DISPATCH
+  /* The address of the code for each opcode.  Opcodes that are not
+  ** listed here go to the "unknown opcode" error.
+  */
+  static void *aDispatch[OP_MAX+1] = {
+    [0 ... OP_MAX] = &&L_default,
+    [OP_Transaction] = &&L_OP_Transaction,
+    [OP_Checkpoint] = &&L_OP_Checkpoint,
+    [OP_Commit] = &&L_OP_Commit,
+    [OP_Rollback] = &&L_OP_Rollback,
+    [OP_ReadCookie] = &&L_OP_ReadCookie,
+    [OP_SetCookie] = &&L_OP_SetCookie,
+    [OP_VerifyCookie] = &&L_OP_VerifyCookie,
+    [OP_Open] = &&L_OP_Open,
+    [OP_OpenTemp] = &&L_OP_OpenTemp,
+    [OP_OpenWrite] = &&L_OP_OpenWrite,
+    [OP_OpenAux] = &&L_OP_OpenAux,
+    [OP_OpenWrAux] = &&L_OP_OpenWrAux,
+    [OP_Close] = &&L_OP_Close,
+    [OP_MoveTo] = &&L_OP_MoveTo,
+    [OP_NewRecno] = &&L_OP_NewRecno,
+    [OP_PutIntKey] = &&L_OP_PutIntKey,
+    [OP_PutStrKey] = &&L_OP_PutStrKey,
+    [OP_Distinct] = &&L_OP_Distinct,
+    [OP_Found] = &&L_OP_Found,
+    [OP_NotFound] = &&L_OP_NotFound,
+    [OP_IsUnique] = &&L_OP_IsUnique,
+    [OP_NotExists] = &&L_OP_NotExists,
+    [OP_Delete] = &&L_OP_Delete,
+    [OP_Column] = &&L_OP_Column,
+    [OP_KeyAsData] = &&L_OP_KeyAsData,
+    [OP_Recno] = &&L_OP_Recno,
+    [OP_FullKey] = &&L_OP_FullKey,
+    [OP_NullRow] = &&L_OP_NullRow,
+    [OP_Last] = &&L_OP_Last,
+    [OP_Rewind] = &&L_OP_Rewind,
+    [OP_Next] = &&L_OP_Next,
+    [OP_Destroy] = &&L_OP_Destroy,
+    [OP_Clear] = &&L_OP_Clear,
+    [OP_CreateIndex] = &&L_OP_CreateIndex,
+    [OP_CreateTable] = &&L_OP_CreateTable,
+    [OP_IntegrityCk] = &&L_OP_IntegrityCk,
+    [OP_IdxPut] = &&L_OP_IdxPut,
+    [OP_IdxDelete] = &&L_OP_IdxDelete,
+    [OP_IdxRecno] = &&L_OP_IdxRecno,
+    [OP_IdxGT] = &&L_OP_IdxGT,
+    [OP_IdxGE] = &&L_OP_IdxGE,
+    [OP_MemLoad] = &&L_OP_MemLoad,
+    [OP_MemStore] = &&L_OP_MemStore,
+    [OP_MemIncr] = &&L_OP_MemIncr,
+    [OP_ListWrite] = &&L_OP_ListWrite,
+    [OP_ListRewind] = &&L_OP_ListRewind,
+    [OP_ListRead] = &&L_OP_ListRead,
+    [OP_ListReset] = &&L_OP_ListReset,
+    [OP_ListPush] = &&L_OP_ListPush,
+    [OP_ListPop] = &&L_OP_ListPop,
+    [OP_SortPut] = &&L_OP_SortPut,
+    [OP_SortMakeRec] = &&L_OP_SortMakeRec,
+    [OP_SortMakeKey] = &&L_OP_SortMakeKey,
+    [OP_Sort] = &&L_OP_Sort,
+    [OP_SortNext] = &&L_OP_SortNext,
+    [OP_SortCallback] = &&L_OP_SortCallback,
+    [OP_SortReset] = &&L_OP_SortReset,
+    [OP_FileOpen] = &&L_OP_FileOpen,
+    [OP_FileRead] = &&L_OP_FileRead,
+    [OP_FileColumn] = &&L_OP_FileColumn,
+    [OP_AggReset] = &&L_OP_AggReset,
+    [OP_AggFocus] = &&L_OP_AggFocus,
+    [OP_AggNext] = &&L_OP_AggNext,
+    [OP_AggSet] = &&L_OP_AggSet,
+    [OP_AggGet] = &&L_OP_AggGet,
+    [OP_AggFunc] = &&L_OP_AggFunc,
+    [OP_AggInit] = &&L_OP_AggInit,
+    [OP_SetInsert] = &&L_OP_SetInsert,
+    [OP_SetFound] = &&L_OP_SetFound,
+    [OP_SetNotFound] = &&L_OP_SetNotFound,
+    [OP_SetFirst] = &&L_OP_SetFirst,
+    [OP_SetNext] = &&L_OP_SetNext,
+    [OP_MakeRecord] = &&L_OP_MakeRecord,
+    [OP_MakeKey] = &&L_OP_MakeKey,
+    [OP_MakeIdxKey] = &&L_OP_MakeIdxKey,
+    [OP_IncrKey] = &&L_OP_IncrKey,
+    [OP_Goto] = &&L_OP_Goto,
+    [OP_If] = &&L_OP_If,
+    [OP_IfNot] = &&L_OP_IfNot,
+    [OP_Halt] = &&L_OP_Halt,
+    [OP_ColumnCount] = &&L_OP_ColumnCount,
+    [OP_ColumnName] = &&L_OP_ColumnName,
+    [OP_Callback] = &&L_OP_Callback,
+    [OP_NullCallback] = &&L_OP_NullCallback,
+    [OP_Integer] = &&L_OP_Integer,
+    [OP_String] = &&L_OP_String,
+    [OP_Pop] = &&L_OP_Pop,
+    [OP_Dup] = &&L_OP_Dup,
+    [OP_Pull] = &&L_OP_Pull,
+    [OP_Push] = &&L_OP_Push,
+    [OP_MustBeInt] = &&L_OP_MustBeInt,
+    [OP_Add] = &&L_OP_Add,
+    [OP_AddImm] = &&L_OP_AddImm,
+    [OP_Subtract] = &&L_OP_Subtract,
+    [OP_Multiply] = &&L_OP_Multiply,
+    [OP_Divide] = &&L_OP_Divide,
+    [OP_Remainder] = &&L_OP_Remainder,
+    [OP_BitAnd] = &&L_OP_BitAnd,
+    [OP_BitOr] = &&L_OP_BitOr,
+    [OP_BitNot] = &&L_OP_BitNot,
+    [OP_ShiftLeft] = &&L_OP_ShiftLeft,
+    [OP_ShiftRight] = &&L_OP_ShiftRight,
+    [OP_AbsValue] = &&L_OP_AbsValue,
+    [OP_Eq] = &&L_OP_Eq,
+    [OP_Ne] = &&L_OP_Ne,
+    [OP_Lt] = &&L_OP_Lt,
+    [OP_Le] = &&L_OP_Le,
+    [OP_Gt] = &&L_OP_Gt,
+    [OP_Ge] = &&L_OP_Ge,
+    [OP_EqImm] = &&L_OP_EqImm,
+    [OP_NeImm] = &&L_OP_NeImm,
+    [OP_LtImm] = &&L_OP_LtImm,
+    [OP_LeImm] = &&L_OP_LeImm,
+    [OP_GtImm] = &&L_OP_GtImm,
+    [OP_GeImm] = &&L_OP_GeImm,
+    [OP_IsNull] = &&L_OP_IsNull,
+    [OP_NotNull] = &&L_OP_NotNull,
+    [OP_Negative] = &&L_OP_Negative,
+    [OP_And] = &&L_OP_And,
+    [OP_Or] = &&L_OP_Or,
+    [OP_Not] = &&L_OP_Not,
+    [OP_Concat] = &&L_OP_Concat,
+    [OP_Noop] = &&L_OP_Noop,
+    [OP_Function] = &&L_OP_Function,
+  };
+#endif
 
   /* No instruction ever pushes more than a single element onto the
   ** stack.  And the stack never grows on successive executions of the
@@ -1299,8 +1785,6 @@ int sqliteVdbeExec(
   zStack = p->zStack;
   aStack = p->aStack;
   p->tos = -1;
-  p->iLimit = 0;
-  p->iOffset = 0;
 
   /* Initialize the aggregrate hash table.
   */
@@ -1331,6 +1815,15 @@ int sqliteVdbeExec(
       break;
     }
 
+    /* Take note of where the instruction starts if EXPLAIN ANALYZE
+    ** is profiling this program.
+    */
+    if( p->aProfile ){
+      pcStart = pc;
+      profilePageCounts(p, &nFetchStart, &nMissStart);
+      tStart = profileTime();
+    }
+
     /* Only allow tracing if NDEBUG is not defined.
     */
 #ifndef NDEBUG
@@ -1338,7 +1831,7 @@ int sqliteVdbeExec(
       char *zP3;
       char zPtr[40];
       if( pOp->p3type==P3_POINTER ){
-        sprintf(zPtr, "ptr(%#x)", (int)pOp->p3);
+        sprintf(zPtr, "ptr(%p)", (void*)pOp->p3);
         zP3 = zPtr;
       }else{
         zP3 = pOp->p3;
@@ -1349,6 +1842,9 @@ int sqliteVdbeExec(
     }
 #endif
 
+#ifdef VDBE_THREADED_DISPATCH
+    if( (unsigned)pOp->opcode<=OP_MAX ) goto *aDispatch[pOp->opcode];
+#endif
     switch( pOp->opcode ){
 
 /*****************************************************************************
@@ -1368,9 +1864,9 @@ int sqliteVdbeExec(
 ** the one at index P2 from the beginning of
 ** the program.
 */
-case OP_Goto: {
+CASE(OP_Goto) {
   pc = pOp->p2 - 1;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode:  Halt P1 P2 *
@@ -1392,7 +1888,7 @@ case OP_Goto: {
 ** every program.  So a jump past the last instruction of the program
 ** is the same as executing Halt.
 */
-case OP_Halt: {
+CASE(OP_Halt) {
   if( pOp->p1!=SQLITE_OK ){
     rc = pOp->p1;
     errorAction = pOp->p2;
@@ -1404,7 +1900,7 @@ case OP_Halt: {
   }else{
     pc = p->nOp-1;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Integer P1 * P3
@@ -1412,7 +1908,7 @@ case OP_Halt: {
 ** The integer value P1 is pushed onto the stack.  If P3 is not zero
 ** then it is assumed to be a string representation of the same integer.
 */
-case OP_Integer: {
+CASE(OP_Integer) {
   int i = ++p->tos;
   VERIFY( if( NeedStack(p, p->tos) ) goto no_mem; )
   aStack[i].i = pOp->p1;
@@ -1422,7 +1918,7 @@ case OP_Integer: {
     aStack[i].flags |= STK_Str | STK_Static;
     aStack[i].n = strlen(pOp->p3)+1;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: String * * P3
@@ -1430,7 +1926,7 @@ case OP_Integer: {
 ** The string value P3 is pushed onto the stack.  If P3==0 then a
 ** NULL is pushed onto the stack.
 */
-case OP_String: {
+CASE(OP_String) {
   int i = ++p->tos;
   char *z;
   VERIFY( if( NeedStack(p, p->tos) ) goto no_mem; )
@@ -1444,17 +1940,17 @@ case OP_String: {
     aStack[i].n = strlen(z) + 1;
     aStack[i].flags = STK_Str | STK_Static;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Pop P1 * *
 **
 ** P1 elements are popped off of the top of stack and discarded.
 */
-case OP_Pop: {
+CASE(OP_Pop) {
   assert( p->tos+1>=pOp->p1 );
   PopStack(p, pOp->p1);
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Dup P1 P2 *
@@ -1472,7 +1968,7 @@ case OP_Pop: {
 **
 ** Also see the Pull instruction.
 */
-case OP_Dup: {
+CASE(OP_Dup) {
   int i = p->tos - pOp->p1;
   int j = ++p->tos;
   VERIFY( if( i<0 ) goto not_enough_stack; )
@@ -1493,7 +1989,7 @@ case OP_Dup: {
       aStack[j].flags &= ~STK_Static;
     }
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Pull P1 * *
@@ -1506,7 +2002,7 @@ case OP_Dup: {
 **
 ** See also the Dup instruction.
 */
-case OP_Pull: {
+CASE(OP_Pull) {
   int from = p->tos - pOp->p1;
   int to = p->tos;
   int i;
@@ -1529,7 +2025,7 @@ case OP_Pull: {
   }else{
     zStack[to] = aStack[to].z;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Push P1 * *
@@ -1538,7 +2034,7 @@ case OP_Pull: {
 ** stack (P1==0 is the top of the stack) with the value
 ** of the top of the stack.  The pop the top of the stack.
 */
-case OP_Push: {
+CASE(OP_Push) {
   int from = p->tos;
   int to = p->tos - pOp->p1;
 
@@ -1554,7 +2050,7 @@ case OP_Push: {
   }
   aStack[from].flags &= ~STK_Dyn;
   p->tos--;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: ColumnCount P1 * *
@@ -1563,13 +2059,13 @@ case OP_Push: {
 ** array passed as the 4th parameter to the callback.  No checking
 ** is done.  If this value is wrong, a coredump can result.
 */
-case OP_ColumnCount: {
+CASE(OP_ColumnCount) {
   char **az = sqliteRealloc(p->azColName, (pOp->p1+1)*sizeof(char*));
   if( az==0 ){ goto no_mem; }
   p->azColName = az;
   p->azColName[pOp->p1] = 0;
   p->nCallback = 0;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: ColumnName P1 * P3
@@ -1580,10 +2076,10 @@ case OP_ColumnCount: {
 ** hold the column names.  Failure to do this will likely result in
 ** a coredump.
 */
-case OP_ColumnName: {
+CASE(OP_ColumnName) {
   p->azColName[pOp->p1] = pOp->p3 ? pOp->p3 : "";
   p->nCallback = 0;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Callback P1 * *
@@ -1592,7 +2088,7 @@ case OP_ColumnName: {
 ** invoke the callback function using the newly formed array as the
 ** 3rd parameter.
 */
-case OP_Callback: {
+CASE(OP_Callback) {
   int i = p->tos - pOp->p1 + 1;
   int j;
   VERIFY( if( i<0 ) goto not_enough_stack; )
@@ -1615,7 +2111,7 @@ case OP_Callback: {
   }
   PopStack(p, pOp->p1);
   if( sqlite_malloc_failed ) goto no_mem;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: NullCallback P1 * *
@@ -1634,7 +2130,7 @@ case OP_Callback: {
 ** This opcode is used to report the number and names of columns
 ** in cases where the result set is empty.
 */
-case OP_NullCallback: {
+CASE(OP_NullCallback) {
   if( xCallback!=0 && p->nCallback==0 ){
     if( sqliteSafetyOff(db) ) goto abort_due_to_misuse; 
     if( xCallback(pArg, pOp->p1, 0, p->azColName)!=0 ){
@@ -1644,7 +2140,7 @@ case OP_NullCallback: {
     p->nCallback++;
   }
   if( sqlite_malloc_failed ) goto no_mem;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Concat P1 P2 P3
@@ -1658,7 +2154,7 @@ case OP_NullCallback: {
 ** makes a copy of the top stack element into memory obtained
 ** from sqliteMalloc().
 */
-case OP_Concat: {
+CASE(OP_Concat) {
   char *zNew;
   int nByte;
   int nField;
@@ -1700,7 +2196,7 @@ case OP_Concat: {
   aStack[p->tos].n = nByte;
   aStack[p->tos].flags = STK_Str|STK_Dyn;
   zStack[p->tos] = zNew;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Add * * *
@@ -1749,11 +2245,11 @@ case OP_Concat: {
 ** function before the division.  Division by zero returns NULL.
 ** If either operand is NULL, the result is NULL.
 */
-case OP_Add:
-case OP_Subtract:
-case OP_Multiply:
-case OP_Divide:
-case OP_Remainder: {
+CASE(OP_Add)
+CASE(OP_Subtract)
+CASE(OP_Multiply)
+CASE(OP_Divide)
+CASE(OP_Remainder) {
   int tos = p->tos;
   int nos = tos - 1;
   VERIFY( if( nos<0 ) goto not_enough_stack; )
@@ -1818,7 +2314,7 @@ divide_by_zero:
   PopStack(p, 2);
   p->tos = nos;
   aStack[nos].flags = STK_Null;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Function P1 * P3
@@ -1829,7 +2325,7 @@ divide_by_zero:
 **
 ** See also: AggFunc
 */
-case OP_Function: {
+CASE(OP_Function) {
   int n, i;
   sqlite_func ctx;
 
@@ -1865,7 +2361,7 @@ case OP_Function: {
        zStack[p->tos] ? zStack[p->tos] : "user function error", 0);
     rc = SQLITE_ERROR;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: BitAnd * * *
@@ -1896,10 +2392,10 @@ case OP_Function: {
 ** right by N bits where N is the second element on the stack.
 ** If either operand is NULL, the result is NULL.
 */
-case OP_BitAnd:
-case OP_BitOr:
-case OP_ShiftLeft:
-case OP_ShiftRight: {
+CASE(OP_BitAnd)
+CASE(OP_BitOr)
+CASE(OP_ShiftLeft)
+CASE(OP_ShiftRight) {
   int tos = p->tos;
   int nos = tos - 1;
   int a, b;
@@ -1925,7 +2421,7 @@ case OP_ShiftRight: {
   Release(p, nos);
   aStack[nos].i = a;
   aStack[nos].flags = STK_Int;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: AddImm  P1 * *
@@ -1935,12 +2431,12 @@ case OP_ShiftRight: {
 **
 ** To force the top of the stack to be an integer, just add 0.
 */
-case OP_AddImm: {
+CASE(OP_AddImm) {
   int tos = p->tos;
   VERIFY( if( tos<0 ) goto not_enough_stack; )
   Integerify(p, tos);
   aStack[tos].i += pOp->p1;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: MustBeInt  * P2 *
@@ -1950,7 +2446,7 @@ case OP_AddImm: {
 ** with out data loss, then jump immediately to P2, or if P2==0
 ** raise an SQLITE_MISMATCH exception.
 */
-case OP_MustBeInt: {
+CASE(OP_MustBeInt) {
   int tos = p->tos;
   VERIFY( if( tos<0 ) goto not_enough_stack; )
   if( aStack[tos].flags & STK_Int ){
@@ -1981,7 +2477,7 @@ mismatch:
   }else{
     pc = pOp->p2 - 1;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Eq P1 P2 *
@@ -2061,12 +2557,12 @@ mismatch:
 ** stack if the jump would have been taken, or a 0 if not.  Push a
 ** NULL if either operand was NULL.
 */
-case OP_Eq:
-case OP_Ne:
-case OP_Lt:
-case OP_Le:
-case OP_Gt:
-case OP_Ge: {
+CASE(OP_Eq)
+CASE(OP_Ne)
+CASE(OP_Lt)
+CASE(OP_Le)
+CASE(OP_Gt)
+CASE(OP_Ge) {
   int tos = p->tos;
   int nos = tos - 1;
   int c;
@@ -2113,7 +2609,83 @@ case OP_Ge: {
     aStack[nos].flags = STK_Int;
     aStack[nos].i = c;
   }
-  break;
+  NEXT_INSTRUCTION;
+}
+
+/* Opcode: EqImm P1 P2 *
+**
+** Pop the top of the stack and compare it against the integer P1.
+** If they are equal, or if the top of the stack is NULL, jump to P2.
+**
+** The code generators never emit this opcode.  It is substituted for
+** an OP_Integer followed by an OP_Eq by sqliteVdbeOptimize().
+*/
+/* Opcode: NeImm P1 P2 *
+**
+** Pop the top of the stack and compare it against the integer P1.
+** If they are not equal, or if the top of the stack is NULL, jump
+** to P2.
+*/
+/* Opcode: LtImm P1 P2 *
+**
+** Pop the top of the stack and compare it against the integer P1.
+** If the top of the stack is less than P1, or if it is NULL, jump
+** to P2.
+*/
+/* Opcode: LeImm P1 P2 *
+**
+** Pop the top of the stack and compare it against the integer P1.
+** If the top of the stack is less than or equal to P1, or if it is
+** NULL, jump to P2.
+*/
+/* Opcode: GtImm P1 P2 *
+**
+** Pop the top of the stack and compare it against the integer P1.
+** If the top of the stack is greater than P1, or if it is NULL, jump
+** to P2.
+*/
+/* Opcode: GeImm P1 P2 *
+**
+** Pop the top of the stack and compare it against the integer P1.
+** If the top of the stack is greater than or equal to P1, or if it is
+** NULL, jump to P2.
+*/
+CASE(OP_EqImm)
+CASE(OP_NeImm)
+CASE(OP_LtImm)
+CASE(OP_LeImm)
+CASE(OP_GtImm)
+CASE(OP_GeImm) {
+  int tos = p->tos;
+  int c;
+  int ft;
+  VERIFY( if( tos<0 ) goto not_enough_stack; )
+  ft = aStack[tos].flags;
+  if( ft & STK_Null ){
+    POPSTACK;
+    pc = pOp->p2-1;
+    break;
+  }else if( (ft & STK_Int)!=0
+         || ((ft & STK_Str)!=0 && isInteger(zStack[tos])) ){
+    Integerify(p, tos);
+    c = aStack[tos].i<pOp->p1 ? -1 : aStack[tos].i>pOp->p1;
+  }else{
+    char zBuf[30];
+    if( Stringify(p, tos) ) goto no_mem;
+    sprintf(zBuf, "%d", pOp->p1);
+    c = sqliteCompare(zStack[tos], zBuf);
+  }
+  switch( pOp->opcode ){
+    case OP_EqImm:    c = c==0;     break;
+    case OP_NeImm:    c = c!=0;     break;
+    case OP_LtImm:    c = c<0;      break;
+    case OP_LeImm:    c = c<=0;     break;
+    case OP_GtImm:    c = c>0;      break;
+    default:          c = c>=0;     break;
+  }
+  POPSTACK;
+  if( c ) pc = pOp->p2-1;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: And * * *
@@ -2128,8 +2700,8 @@ case OP_Ge: {
 ** two values and push the resulting boolean value back onto the
 ** stack. 
 */
-case OP_And:
-case OP_Or: {
+CASE(OP_And)
+CASE(OP_Or) {
   int tos = p->tos;
   int nos = tos - 1;
   int v1, v2;    /* 0==TRUE, 1==FALSE, 2==UNKNOWN or NULL */
@@ -2162,7 +2734,7 @@ case OP_Or: {
     aStack[nos].i = v1==0;
     aStack[nos].flags = STK_Int;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Negative * * *
@@ -2177,8 +2749,8 @@ case OP_Or: {
 ** with its absolute value. If the top of the stack is NULL
 ** its value is unchanged.
 */
-case OP_Negative:
-case OP_AbsValue: {
+CASE(OP_Negative)
+CASE(OP_AbsValue) {
   int tos = p->tos;
   VERIFY( if( tos<0 ) goto not_enough_stack; )
   if( aStack[tos].flags & STK_Real ){
@@ -2203,7 +2775,7 @@ case OP_AbsValue: {
     }
     aStack[tos].flags = STK_Real;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Not * * *
@@ -2212,7 +2784,7 @@ case OP_AbsValue: {
 ** with its complement.  If the top of the stack is NULL its value
 ** is unchanged.
 */
-case OP_Not: {
+CASE(OP_Not) {
   int tos = p->tos;
   VERIFY( if( p->tos<0 ) goto not_enough_stack; )
   if( aStack[tos].flags & STK_Null ) break;  /* Do nothing to NULLs */
@@ -2220,7 +2792,7 @@ case OP_Not: {
   Release(p, tos);
   aStack[tos].i = !aStack[tos].i;
   aStack[tos].flags = STK_Int;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: BitNot * * *
@@ -2229,7 +2801,7 @@ case OP_Not: {
 ** with its ones-complement.  If the top of the stack is NULL its
 ** value is unchanged.
 */
-case OP_BitNot: {
+CASE(OP_BitNot) {
   int tos = p->tos;
   VERIFY( if( p->tos<0 ) goto not_enough_stack; )
   if( aStack[tos].flags & STK_Null ) break;  /* Do nothing to NULLs */
@@ -2237,7 +2809,7 @@ case OP_BitNot: {
   Release(p, tos);
   aStack[tos].i = ~aStack[tos].i;
   aStack[tos].flags = STK_Int;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Noop * * *
@@ -2245,8 +2817,8 @@ case OP_BitNot: {
 ** Do nothing.  This instruction is often useful as a jump
 ** destination.
 */
-case OP_Noop: {
-  break;
+CASE(OP_Noop) {
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: If P1 P2 *
@@ -2269,8 +2841,8 @@ case OP_Noop: {
 ** If the value popped of the stack is NULL, then take the jump if P1
 ** is true and fall through if P1 is false.
 */
-case OP_If:
-case OP_IfNot: {
+CASE(OP_If)
+CASE(OP_IfNot) {
   int c;
   VERIFY( if( p->tos<0 ) goto not_enough_stack; )
   if( aStack[p->tos].flags & STK_Null ){
@@ -2282,7 +2854,7 @@ case OP_IfNot: {
   }
   POPSTACK;
   if( c ) pc = pOp->p2-1;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: IsNull P1 P2 *
@@ -2291,7 +2863,7 @@ case OP_IfNot: {
 ** to P2.  The stack is popped P1 times if P1>0.  If P1<0 then all values
 ** are left unchanged on the stack.
 */
-case OP_IsNull: {
+CASE(OP_IsNull) {
   int i, cnt;
   cnt = pOp->p1;
   if( cnt<0 ) cnt = -cnt;
@@ -2303,7 +2875,7 @@ case OP_IsNull: {
     }
   }
   if( pOp->p1>0 ) PopStack(p, cnt);
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: NotNull P1 P2 *
@@ -2312,11 +2884,11 @@ case OP_IsNull: {
 ** stack if P1 is greater than zero.  If P1 is less than or equal to
 ** zero then leave the value on the stack.
 */
-case OP_NotNull: {
+CASE(OP_NotNull) {
   VERIFY( if( p->tos<0 ) goto not_enough_stack; )
   if( (aStack[p->tos].flags & STK_Null)==0 ) pc = pOp->p2-1;
   if( pOp->p1>0 ){ POPSTACK; }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: MakeRecord P1 P2 *
@@ -2340,7 +2912,7 @@ case OP_NotNull: {
 ** for the UNION operator.  But I have since discovered that NULLs
 ** are indistinct for UNION.  So this option is never used.
 */
-case OP_MakeRecord: {
+CASE(OP_MakeRecord) {
   char *zNewRecord;
   int nByte;
   int nField;
@@ -2432,7 +3004,7 @@ case OP_MakeRecord: {
   aStack[p->tos].n = nByte;
   aStack[p->tos].flags = STK_Str | STK_Dyn;
   zStack[p->tos] = zNewRecord;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: MakeKey P1 P2 *
@@ -2475,8 +3047,8 @@ case OP_MakeRecord: {
 **
 ** See also:  MakeKey, SortMakeKey
 */
-case OP_MakeIdxKey:
-case OP_MakeKey: {
+CASE(OP_MakeIdxKey)
+CASE(OP_MakeKey) {
   char *zNewKey;
   int nByte;
   int nField;
@@ -2564,7 +3136,7 @@ case OP_MakeKey: {
   aStack[p->tos].n = nByte;
   aStack[p->tos].flags = STK_Str|STK_Dyn;
   zStack[p->tos] = zNewKey;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: IncrKey * * *
@@ -2575,7 +3147,7 @@ case OP_MakeKey: {
 ** will move to the first entry greater than the key rather than to
 ** the key itself.
 */
-case OP_IncrKey: {
+CASE(OP_IncrKey) {
   int tos = p->tos;
 
   VERIFY( if( tos<0 ) goto bad_instruction );
@@ -2587,7 +3159,7 @@ case OP_IncrKey: {
     aStack[tos].flags = STK_Str | STK_Dyn;
   }
   zStack[tos][aStack[tos].n-1]++;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Checkpoint * * *
@@ -2597,12 +3169,12 @@ case OP_IncrKey: {
 ** itself without effecting the containing transaction.  A checkpoint will
 ** be automatically committed or rollback when the VDBE halts.
 */
-case OP_Checkpoint: {
+CASE(OP_Checkpoint) {
   rc = sqliteBtreeBeginCkpt(pBt);
   if( rc==SQLITE_OK && db->pBeTemp ){
      rc = sqliteBtreeBeginCkpt(db->pBeTemp);
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Transaction * * *
@@ -2612,12 +3184,17 @@ case OP_Checkpoint: {
 ** transaction might also be rolled back if an error is encountered.
 **
 ** A write lock is obtained on the database file when a transaction is
-** started.  No other process can read or write the file while the
-** transaction is underway.  Starting a transaction also creates a
+** started.  No other process can write the file while the transaction
+** is underway.  Other processes can go on reading until the changes
+** are written to the file at commit, or earlier if they do not all fit
+** in the page cache.  Starting a transaction also creates a
 ** rollback journal.  A transaction must be started before any changes
 ** can be made to the database.
+**
+** Outside of a BEGIN...COMMIT block the transaction may join a group
+** commit on a shared cache.  See sqliteBtreeBeginGroup().
 */
-case OP_Transaction: {
+CASE(OP_Transaction) {
   int busy = 0;
   if( db->pBeTemp ){
     rc = sqliteBtreeBeginTrans(db->pBeTemp);
@@ -2626,7 +3203,11 @@ case OP_Transaction: {
     }
   }
   do{
-    rc = sqliteBtreeBeginTrans(pBt);
+    if( db->flags & SQLITE_InTrans ){
+      rc = sqliteBtreeBeginTrans(pBt);
+    }else{
+      rc = sqliteBtreeBeginGroup(pBt);
+    }
     switch( rc ){
       case SQLITE_BUSY: {
         if( xBusy==0 || (*xBusy)(pBusyArg, "", ++busy)==0 ){
@@ -2645,27 +3226,52 @@ case OP_Transaction: {
     }
   }while( busy );
   undoTransOnError = 1;
-  break;
+  NEXT_INSTRUCTION;
 }
 
-/* Opcode: Commit * * *
+/* Opcode: Commit P1 P2 *
 **
 ** Cause all modifications to the database that have been made since the
 ** last Transaction to actually take effect.  No additional modifications
 ** are allowed until another transaction is started.  The Commit instruction
 ** deletes the journal file and releases the write lock on the database.
 ** A read lock continues to be held if there are still cursors open.
+**
+** The commit cannot go ahead while other connections are reading the
+** database.  The busy callback is invoked while that is so, and if it
+** gives up the Commit fails with SQLITE_BUSY.  The transaction is then
+** still open.  If P1 is 1, this is the COMMIT of a BEGIN...COMMIT block
+** and the connection goes back into that block, with P2 as its default
+** conflict resolution algorithm, so that the COMMIT can be tried again.
+** Otherwise the error causes the transaction to be rolled back.
+**
+** The Commit of a statement that joined a group commit returns only once
+** the whole group has been synced.
 */
-case OP_Commit: {
-  if( db->pBeTemp==0 || (rc = sqliteBtreeCommit(db->pBeTemp))==SQLITE_OK ){
+CASE(OP_Commit) {
+  int busy = 0;
+  /* The main database is committed first since it is the only one that
+  ** can be busy.  The temporary database is then still open too. */
+  do{
     rc = sqliteBtreeCommit(pBt);
+  }while( rc==SQLITE_BUSY && xBusy && (*xBusy)(pBusyArg, "", ++busy)!=0 );
+  if( rc==SQLITE_BUSY ){
+    sqliteSetString(pzErrMsg, sqlite_error_string(rc), 0);
+    if( pOp->p1 ){
+      db->flags |= SQLITE_InTrans;
+      db->onError = pOp->p2;
+    }
+    NEXT_INSTRUCTION;
+  }
+  if( rc==SQLITE_OK && db->pBeTemp ){
+    rc = sqliteBtreeCommit(db->pBeTemp);
   }
   if( rc==SQLITE_OK ){
     sqliteCommitInternalChanges(db);
   }else{
     sqliteRollbackInternalChanges(db);
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Rollback * * *
@@ -2678,13 +3284,13 @@ case OP_Commit: {
 ** This instruction automatically closes all cursors and releases both
 ** the read and write locks on the database.
 */
-case OP_Rollback: {
+CASE(OP_Rollback) {
   if( db->pBeTemp ){
     sqliteBtreeRollback(db->pBeTemp);
   }
   rc = sqliteBtreeRollback(pBt);
   sqliteRollbackInternalChanges(db);
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: ReadCookie * P2 *
@@ -2706,7 +3312,7 @@ case OP_Rollback: {
 ** must be started or there must be an open cursor) before
 ** executing this instruction.
 */
-case OP_ReadCookie: {
+CASE(OP_ReadCookie) {
   int i = ++p->tos;
   int aMeta[SQLITE_N_BTREE_META];
   assert( pOp->p2<SQLITE_N_BTREE_META );
@@ -2714,7 +3320,7 @@ case OP_ReadCookie: {
   rc = sqliteBtreeGetMeta(pBt, aMeta);
   aStack[i].i = aMeta[1+pOp->p2];
   aStack[i].flags = STK_Int;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: SetCookie * P2 *
@@ -2732,7 +3338,7 @@ case OP_ReadCookie: {
 **
 ** A transaction must be started before executing this opcode.
 */
-case OP_SetCookie: {
+CASE(OP_SetCookie) {
   int aMeta[SQLITE_N_BTREE_META];
   assert( pOp->p2<SQLITE_N_BTREE_META );
   VERIFY( if( p->tos<0 ) goto not_enough_stack; )
@@ -2743,7 +3349,7 @@ case OP_SetCookie: {
     rc = sqliteBtreeUpdateMeta(pBt, aMeta);
   }
   POPSTACK;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: VerifyCookie P1 P2 *
@@ -2761,7 +3367,7 @@ case OP_SetCookie: {
 ** to be executed (to establish a read lock) before this opcode is
 ** invoked.
 */
-case OP_VerifyCookie: {
+CASE(OP_VerifyCookie) {
   int aMeta[SQLITE_N_BTREE_META];
   assert( pOp->p2<SQLITE_N_BTREE_META );
   rc = sqliteBtreeGetMeta(pBt, aMeta);
@@ -2769,7 +3375,7 @@ case OP_VerifyCookie: {
     sqliteSetString(pzErrMsg, "database schema has changed", 0);
     rc = SQLITE_SCHEMA;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Open P1 P2 P3
@@ -2823,10 +3429,10 @@ case OP_VerifyCookie: {
 ** to store tables created using CREATE TEMPORARY TABLE) is used in place
 ** of the main database file.
 */
-case OP_OpenAux:
-case OP_OpenWrAux:
-case OP_OpenWrite:
-case OP_Open: {
+CASE(OP_OpenAux)
+CASE(OP_OpenWrAux)
+CASE(OP_OpenWrite)
+CASE(OP_Open) {
   int busy = 0;
   int i = pOp->p1;
   int tos = p->tos;
@@ -2862,7 +3468,7 @@ case OP_Open: {
     }
     p->nCursor = i+1;
   }
-  cleanupCursor(&p->aCsr[i]);
+  cleanupCursor(p, &p->aCsr[i]);
   memset(&p->aCsr[i], 0, sizeof(Cursor));
   p->aCsr[i].nullRow = 1;
   do{
@@ -2884,7 +3490,7 @@ case OP_Open: {
       }
     }
   }while( busy );
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: OpenTemp P1 P2 *
@@ -2905,7 +3511,7 @@ case OP_Open: {
 ** whereas "Temporary" in the context of CREATE TABLE means for the duration
 ** of the connection to the database.  Same word; different meanings.
 */
-case OP_OpenTemp: {
+CASE(OP_OpenTemp) {
   int i = pOp->p1;
   Cursor *pCx;
   VERIFY( if( i<0 ) goto bad_instruction; )
@@ -2920,10 +3526,10 @@ case OP_OpenTemp: {
     p->nCursor = i+1;
   }
   pCx = &p->aCsr[i];
-  cleanupCursor(pCx);
+  cleanupCursor(p, pCx);
   memset(pCx, 0, sizeof(*pCx));
   pCx->nullRow = 1;
-  rc = sqliteBtreeOpen(0, 0, TEMP_PAGES, &pCx->pBt);
+  rc = sqliteBtreeOpen(0, 0, TEMP_PAGES, db->pVfs, &pCx->pBt);
   if( rc==SQLITE_OK ){
     rc = sqliteBtreeBeginTrans(pCx->pBt);
   }
@@ -2938,7 +3544,7 @@ case OP_OpenTemp: {
       rc = sqliteBtreeCursor(pCx->pBt, 2, 1, &pCx->pCursor);
     }
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Close P1 * *
@@ -2946,12 +3552,12 @@ case OP_OpenTemp: {
 ** Close a cursor previously opened as P1.  If P1 is not
 ** currently open, this instruction is a no-op.
 */
-case OP_Close: {
+CASE(OP_Close) {
   int i = pOp->p1;
   if( i>=0 && i<p->nCursor && p->aCsr[i].pCursor ){
-    cleanupCursor(&p->aCsr[i]);
+    cleanupCursor(p, &p->aCsr[i]);
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: MoveTo P1 P2 *
@@ -2965,7 +3571,7 @@ case OP_Close: {
 **
 ** See also: Found, NotFound, Distinct
 */
-case OP_MoveTo: {
+CASE(OP_MoveTo) {
   int i = pOp->p1;
   int tos = p->tos;
   Cursor *pC;
@@ -2984,7 +3590,9 @@ case OP_MoveTo: {
       pC->recnoIsValid = 0;
     }
     pC->nullRow = 0;
+#ifdef SQLITE_TEST
     sqlite_search_count++;
+#endif
     if( res<0 ){
       sqliteBtreeNext(pC->pCursor, &res);
       pC->recnoIsValid = 0;
@@ -2994,7 +3602,7 @@ case OP_MoveTo: {
     }
   }
   POPSTACK;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Distinct P1 P2 *
@@ -3030,9 +3638,9 @@ case OP_MoveTo: {
 **
 ** See also: Distinct, Found, MoveTo, NotExists, IsUnique
 */
-case OP_Distinct:
-case OP_NotFound:
-case OP_Found: {
+CASE(OP_Distinct)
+CASE(OP_NotFound)
+CASE(OP_Found) {
   int i = pOp->p1;
   int tos = p->tos;
   int alreadyExists = 0;
@@ -3052,7 +3660,7 @@ case OP_Found: {
   if( pOp->opcode!=OP_Distinct ){
     POPSTACK;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: IsUnique P1 P2 *
@@ -3075,7 +3683,7 @@ case OP_Found: {
 **
 ** See also: Distinct, NotFound, NotExists, Found
 */
-case OP_IsUnique: {
+CASE(OP_IsUnique) {
   int i = pOp->p1;
   int tos = p->tos;
   int nos = tos-1;
@@ -3142,7 +3750,7 @@ case OP_IsUnique: {
     aStack[tos].i = v;
     aStack[tos].flags = STK_Int;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: NotExists P1 P2 *
@@ -3158,7 +3766,7 @@ case OP_IsUnique: {
 **
 ** See also: Distinct, Found, MoveTo, NotFound, IsUnique
 */
-case OP_NotExists: {
+CASE(OP_NotExists) {
   int i = pOp->p1;
   int tos = p->tos;
   BtCursor *pCrsr;
@@ -3177,7 +3785,7 @@ case OP_NotExists: {
     }
   }
   POPSTACK;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: NewRecno P1 * *
@@ -3187,7 +3795,7 @@ case OP_NotExists: {
 ** table that cursor P1 points to.  The new record number is pushed 
 ** onto the stack.
 */
-case OP_NewRecno: {
+CASE(OP_NewRecno) {
   int i = pOp->p1;
   int v = 0;
   Cursor *pC;
@@ -3268,7 +3876,7 @@ case OP_NewRecno: {
   p->tos++;
   aStack[p->tos].i = v;
   aStack[p->tos].flags = STK_Int;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: PutIntKey P1 P2 *
@@ -3290,8 +3898,8 @@ case OP_NewRecno: {
 ** stack.  The key is the next value down on the stack.  The key must
 ** be a string.  The stack is popped twice by this instruction.
 */
-case OP_PutIntKey:
-case OP_PutStrKey: {
+CASE(OP_PutIntKey)
+CASE(OP_PutStrKey) {
   int tos = p->tos;
   int nos = p->tos-1;
   int i = pOp->p1;
@@ -3317,7 +3925,7 @@ case OP_PutStrKey: {
   }
   POPSTACK;
   POPSTACK;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Delete P1 P2 *
@@ -3332,13 +3940,13 @@ case OP_PutStrKey: {
 ** The row change counter is incremented if P2==1 and is unmodified
 ** if P2==0.
 */
-case OP_Delete: {
+CASE(OP_Delete) {
   int i = pOp->p1;
   if( VERIFY( i>=0 && i<p->nCursor && ) p->aCsr[i].pCursor!=0 ){
     rc = sqliteBtreeDelete(p->aCsr[i].pCursor);
   }
   if( pOp->p2 ) db->nChange++;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: KeyAsData P1 P2 *
@@ -3348,12 +3956,12 @@ case OP_Delete: {
 ** data off of the key rather than the data.  This is useful for
 ** processing compound selects.
 */
-case OP_KeyAsData: {
+CASE(OP_KeyAsData) {
   int i = pOp->p1;
   if( VERIFY( i>=0 && i<p->nCursor && ) p->aCsr[i].pCursor!=0 ){
     p->aCsr[i].keyAsData = pOp->p2;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Column P1 P2 *
@@ -3369,7 +3977,7 @@ case OP_KeyAsData: {
 ** then the field might be extracted from the key rather than the
 ** data.
 */
-case OP_Column: {
+CASE(OP_Column) {
   int amt, offset, end, payloadSize;
   int i = pOp->p1;
   int p2 = pOp->p2;
@@ -3455,7 +4063,7 @@ case OP_Column: {
     }
     p->tos = tos;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Recno P1 * *
@@ -3465,7 +4073,7 @@ case OP_Column: {
 ** file P1.  The sequential scan should have been started using the 
 ** Next opcode.
 */
-case OP_Recno: {
+CASE(OP_Recno) {
   int i = pOp->p1;
   int tos = ++p->tos;
   BtCursor *pCrsr;
@@ -3485,7 +4093,7 @@ case OP_Recno: {
     aStack[tos].i = v;
     aStack[tos].flags = STK_Int;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: FullKey P1 * *
@@ -3497,7 +4105,7 @@ case OP_Recno: {
 ** 4 bytes of the key and pushes those bytes onto the stack as an
 ** integer.  This instruction pushes the entire key as a string.
 */
-case OP_FullKey: {
+CASE(OP_FullKey) {
   int i = pOp->p1;
   int tos = ++p->tos;
   BtCursor *pCrsr;
@@ -3524,7 +4132,7 @@ case OP_FullKey: {
     zStack[tos] = z;
     aStack[tos].n = amt;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: NullRow P1 * *
@@ -3533,14 +4141,14 @@ case OP_FullKey: {
 ** that occur while the cursor is on the null row will always push 
 ** a NULL onto the stack.
 */
-case OP_NullRow: {
+CASE(OP_NullRow) {
   int i = pOp->p1;
   BtCursor *pCrsr;
 
   if( VERIFY( i>=0 && i<p->nCursor && ) (pCrsr = p->aCsr[i].pCursor)!=0 ){
     p->aCsr[i].nullRow = 1;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Last P1 P2 *
@@ -3551,7 +4159,7 @@ case OP_NullRow: {
 ** If P2 is 0 or if the table or index is not empty, fall through
 ** to the following instruction.
 */
-case OP_Last: {
+CASE(OP_Last) {
   int i = pOp->p1;
   BtCursor *pCrsr;
 
@@ -3563,7 +4171,7 @@ case OP_Last: {
       pc = pOp->p2 - 1;
     }
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Rewind P1 P2 *
@@ -3574,7 +4182,7 @@ case OP_Last: {
 ** If P2 is 0 or if the table or index is not empty, fall through
 ** to the following instruction.
 */
-case OP_Rewind: {
+CASE(OP_Rewind) {
   int i = pOp->p1;
   BtCursor *pCrsr;
 
@@ -3587,7 +4195,7 @@ case OP_Rewind: {
       pc = pOp->p2 - 1;
     }
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Next P1 P2 *
@@ -3597,7 +4205,7 @@ case OP_Rewind: {
 ** to the following instruction.  But if the cursor advance was successful,
 ** jump immediately to P2.
 */
-case OP_Next: {
+CASE(OP_Next) {
   int i = pOp->p1;
   BtCursor *pCrsr;
 
@@ -3611,11 +4219,13 @@ case OP_Next: {
     }
     if( res==0 ){
       pc = pOp->p2 - 1;
+#ifdef SQLITE_TEST
       sqlite_search_count++;
+#endif
     }
     p->aCsr[i].recnoIsValid = 0;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: IdxPut P1 P2 P3
@@ -3629,7 +4239,7 @@ case OP_Next: {
 ** is rolled back.  If P3 is not null, then it because part of the
 ** error message returned with the SQLITE_CONSTRAINT.
 */
-case OP_IdxPut: {
+CASE(OP_IdxPut) {
   int i = pOp->p1;
   int tos = p->tos;
   BtCursor *pCrsr;
@@ -3666,7 +4276,7 @@ case OP_IdxPut: {
     rc = sqliteBtreeInsert(pCrsr, zKey, nKey, "", 0);
   }
   POPSTACK;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: IdxDelete P1 * *
@@ -3674,7 +4284,7 @@ case OP_IdxPut: {
 ** The top of the stack is an index key built using the MakeIdxKey opcode.
 ** This opcode removes that entry from the index.
 */
-case OP_IdxDelete: {
+CASE(OP_IdxDelete) {
   int i = pOp->p1;
   int tos = p->tos;
   BtCursor *pCrsr;
@@ -3687,7 +4297,7 @@ case OP_IdxDelete: {
     }
   }
   POPSTACK;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: IdxRecno P1 * *
@@ -3699,7 +4309,7 @@ case OP_IdxDelete: {
 **
 ** See also: Recno, MakeIdxKey.
 */
-case OP_IdxRecno: {
+CASE(OP_IdxRecno) {
   int i = pOp->p1;
   int tos = ++p->tos;
   BtCursor *pCrsr;
@@ -3714,7 +4324,7 @@ case OP_IdxRecno: {
     aStack[tos].i = v;
     aStack[tos].flags = STK_Int;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: IdxGT P1 P2 *
@@ -3734,8 +4344,8 @@ case OP_IdxRecno: {
 ** then jump to P2.  Otherwise fall through to the next instruction.
 ** In either case, the stack is popped once.
 */
-case OP_IdxGT:
-case OP_IdxGE: {
+CASE(OP_IdxGT)
+CASE(OP_IdxGE) {
   int i= pOp->p1;
   int tos = p->tos;
   BtCursor *pCrsr;
@@ -3756,7 +4366,7 @@ case OP_IdxGE: {
     }
   }
   POPSTACK;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Destroy P1 P2 *
@@ -3770,9 +4380,9 @@ case OP_IdxGE: {
 **
 ** See also: Clear
 */
-case OP_Destroy: {
+CASE(OP_Destroy) {
   sqliteBtreeDropTable(pOp->p2 ? db->pBeTemp : pBt, pOp->p1);
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Clear P1 P2 *
@@ -3787,9 +4397,9 @@ case OP_Destroy: {
 **
 ** See also: Destroy
 */
-case OP_Clear: {
+CASE(OP_Clear) {
   sqliteBtreeClearTable(pOp->p2 ? db->pBeTemp : pBt, pOp->p1);
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: CreateTable * P2 P3
@@ -3817,8 +4427,8 @@ case OP_Clear: {
 **
 ** See documentation on OP_CreateTable for additional information.
 */
-case OP_CreateIndex:
-case OP_CreateTable: {
+CASE(OP_CreateIndex)
+CASE(OP_CreateTable) {
   int i = ++p->tos;
   int pgno;
   VERIFY( if( NeedStack(p, p->tos) ) goto no_mem; )
@@ -3834,7 +4444,7 @@ case OP_CreateTable: {
     *(u32*)pOp->p3 = pgno;
     pOp->p3 = 0;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: IntegrityCk P1 * *
@@ -3848,7 +4458,7 @@ case OP_CreateTable: {
 **
 ** This opcode is used for testing purposes only.
 */
-case OP_IntegrityCk: {
+CASE(OP_IntegrityCk) {
   int nRoot;
   int *aRoot;
   int tos = ++p->tos;
@@ -3879,63 +4489,15 @@ case OP_IntegrityCk: {
     aStack[tos].flags = STK_Str | STK_Dyn;
   }
   sqliteFree(aRoot);
-  break;
-}
-
-/* Opcode:  Limit P1 P2 *
-**
-** Set a limit and offset on callbacks.  P1 is the limit and P2 is
-** the offset.  If the offset counter is positive, no callbacks are
-** invoked but instead the counter is decremented.  Once the offset
-** counter reaches zero, callbacks are invoked and the limit
-** counter is decremented.  When the limit counter reaches zero,
-** the OP_Callback or OP_SortCallback instruction executes a jump
-** that should end the query.
-**
-** This opcode is used to implement the "LIMIT x OFFSET y" clause
-** of a SELECT statement.
-*/
-case OP_Limit: {
-  p->iLimit = pOp->p1;
-  p->iOffset = pOp->p2;
-  break;
-}
-
-/* Opcode: LimitCk P1 P2 *
-**
-** If P1 is 1, then check to see if the offset counter (set by the
-** P2 argument of OP_Limit) is positive.  If the offset counter is
-** positive then decrement the counter and jump immediately to P2.
-** Otherwise fall straight through.
-**
-** If P1 is 0, then check the value of the limit counter (set by the
-** P1 argument of OP_Limit).  If the limit counter is negative or
-** zero then jump immedately to P2.  Otherwise decrement the limit
-** counter and fall through.
-*/
-case OP_LimitCk: {
-  if( pOp->p1 ){
-    if( p->iOffset ){
-      p->iOffset--;
-      pc = pOp->p2 - 1;
-    }
-  }else{
-    if( p->iLimit>0 ){
-      p->iLimit--;
-    }else{
-      pc = pOp->p2 - 1;
-    }
-  }
-  break;
+  NEXT_INSTRUCTION;
 }
 
-
 /* Opcode: ListWrite * * *
 **
 ** Write the integer on the top of the stack
 ** into the temporary storage list.
 */
-case OP_ListWrite: {
+CASE(OP_ListWrite) {
   Keylist *pKeylist;
   VERIFY( if( p->tos<0 ) goto not_enough_stack; )
   pKeylist = p->pList;
@@ -3951,16 +4513,16 @@ case OP_ListWrite: {
   Integerify(p, p->tos);
   pKeylist->aKey[pKeylist->nUsed++] = aStack[p->tos].i;
   POPSTACK;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: ListRewind * * *
 **
 ** Rewind the temporary buffer back to the beginning.
 */
-case OP_ListRewind: {
+CASE(OP_ListRewind) {
   /* This is now a no-op */
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: ListRead * P2 *
@@ -3969,7 +4531,7 @@ case OP_ListRewind: {
 ** and push it onto the stack.  If the storage buffer is empty, 
 ** push nothing but instead jump to P2.
 */
-case OP_ListRead: {
+CASE(OP_ListRead) {
   Keylist *pKeylist;
   pKeylist = p->pList;
   if( pKeylist!=0 ){
@@ -3990,19 +4552,19 @@ case OP_ListRead: {
   }else{
     pc = pOp->p2 - 1;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: ListReset * * *
 **
 ** Reset the temporary storage buffer so that it holds nothing.
 */
-case OP_ListReset: {
+CASE(OP_ListReset) {
   if( p->pList ){
     KeylistFree(p->pList);
     p->pList = 0;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: ListPush * * * 
@@ -4010,14 +4572,14 @@ case OP_ListReset: {
 ** Save the current Vdbe list such that it can be restored by a ListPop
 ** opcode. The list is empty after this is executed.
 */
-case OP_ListPush: {
+CASE(OP_ListPush) {
   p->keylistStackDepth++;
   assert(p->keylistStackDepth > 0);
   p->keylistStack = sqliteRealloc(p->keylistStack, 
           sizeof(Keylist *) * p->keylistStackDepth);
   p->keylistStack[p->keylistStackDepth - 1] = p->pList;
   p->pList = 0;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: ListPop * * * 
@@ -4025,7 +4587,7 @@ case OP_ListPush: {
 ** Restore the Vdbe list to the state it was in when ListPush was last
 ** executed.
 */
-case OP_ListPop: {
+CASE(OP_ListPop) {
   assert(p->keylistStackDepth > 0);
   p->keylistStackDepth--;
   KeylistFree(p->pList);
@@ -4035,7 +4597,7 @@ case OP_ListPop: {
     sqliteFree(p->keylistStack);
     p->keylistStack = 0;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: SortPut * * *
@@ -4044,7 +4606,7 @@ case OP_ListPop: {
 ** and put them on the sorter.  The key and data should have been
 ** made using SortMakeKey and SortMakeRec, respectively.
 */
-case OP_SortPut: {
+CASE(OP_SortPut) {
   int tos = p->tos;
   int nos = tos - 1;
   Sorter *pSorter;
@@ -4065,7 +4627,7 @@ case OP_SortPut: {
   zStack[tos] = 0;
   zStack[nos] = 0;
   p->tos -= 2;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: SortMakeRec P1 * *
@@ -4074,7 +4636,7 @@ case OP_SortPut: {
 ** elements into a single data entry that can be stored on a sorter
 ** using SortPut and later fed to a callback using SortCallback.
 */
-case OP_SortMakeRec: {
+CASE(OP_SortMakeRec) {
   char *z;
   char **azArg;
   int nByte;
@@ -4109,7 +4671,7 @@ case OP_SortMakeRec: {
   aStack[p->tos].n = nByte;
   zStack[p->tos] = (char*)azArg;
   aStack[p->tos].flags = STK_Str|STK_Dyn;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: SortMakeKey * * P3
@@ -4125,7 +4687,7 @@ case OP_SortMakeRec: {
 **
 ** See also the MakeKey and MakeIdxKey opcodes.
 */
-case OP_SortMakeKey: {
+CASE(OP_SortMakeKey) {
   char *zNewKey;
   int nByte;
   int nField;
@@ -4156,7 +4718,7 @@ case OP_SortMakeKey: {
   aStack[p->tos].n = nByte;
   aStack[p->tos].flags = STK_Str|STK_Dyn;
   zStack[p->tos] = zNewKey;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: Sort * * *
@@ -4164,7 +4726,7 @@ case OP_SortMakeKey: {
 ** Sort all elements on the sorter.  The algorithm is a
 ** mergesort.
 */
-case OP_Sort: {
+CASE(OP_Sort) {
   int i;
   Sorter *pElem;
   Sorter *apSorter[NSORT];
@@ -4193,7 +4755,7 @@ case OP_Sort: {
     pElem = Merge(apSorter[i], pElem);
   }
   p->pSort = pElem;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: SortNext * P2 *
@@ -4203,7 +4765,7 @@ case OP_Sort: {
 ** is empty, push nothing on the stack and instead jump immediately 
 ** to instruction P2.
 */
-case OP_SortNext: {
+CASE(OP_SortNext) {
   Sorter *pSorter = p->pSort;
   if( pSorter!=0 ){
     p->pSort = pSorter->pNext;
@@ -4217,7 +4779,7 @@ case OP_SortNext: {
   }else{
     pc = pOp->p2 - 1;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: SortCallback P1 * *
@@ -4227,7 +4789,7 @@ case OP_SortNext: {
 ** instruction.  Pop this record from the stack and invoke the
 ** callback on it.
 */
-case OP_SortCallback: {
+CASE(OP_SortCallback) {
   int i = p->tos;
   VERIFY( if( i<0 ) goto not_enough_stack; )
   if( xCallback!=0 ){
@@ -4240,16 +4802,16 @@ case OP_SortCallback: {
   }
   POPSTACK;
   if( sqlite_malloc_failed ) goto no_mem;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: SortReset * * *
 **
 ** Remove any elements that remain on the sorter.
 */
-case OP_SortReset: {
+CASE(OP_SortReset) {
   SorterReset(p);
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: FileOpen * * P3
@@ -4257,7 +4819,7 @@ case OP_SortReset: {
 ** Open the file named by P3 for reading using the FileRead opcode.
 ** If P3 is "stdin" then open standard input for reading.
 */
-case OP_FileOpen: {
+CASE(OP_FileOpen) {
   VERIFY( if( pOp->p3==0 ) goto bad_instruction; )
   if( p->pFile ){
     if( p->pFile!=stdin ) fclose(p->pFile);
@@ -4273,7 +4835,7 @@ case OP_FileOpen: {
     rc = SQLITE_ERROR;
     goto cleanup;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: FileRead P1 P2 P3
@@ -4289,7 +4851,7 @@ case OP_FileOpen: {
 ** "\N" is a null field.  The backslash \ character can be used be used
 ** to escape newlines or the delimiter.
 */
-case OP_FileRead: {
+CASE(OP_FileRead) {
   int n, eol, nField, i, c, nDelim;
   char *zDelim, *z;
   if( p->pFile==0 ) goto fileread_jump;
@@ -4382,7 +4944,7 @@ case OP_FileRead: {
   ** This code will cause a jump to P2 */
 fileread_jump:
   pc = pOp->p2 - 1;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: FileColumn P1 * *
@@ -4390,7 +4952,7 @@ fileread_jump:
 ** Push onto the stack the P1-th column of the most recently read line
 ** from the input file.
 */
-case OP_FileColumn: {
+CASE(OP_FileColumn) {
   int i = pOp->p1;
   char *z;
   VERIFY( if( NeedStack(p, p->tos+1) ) goto no_mem; )
@@ -4409,7 +4971,7 @@ case OP_FileColumn: {
     zStack[p->tos] = 0;
     aStack[p->tos].flags = STK_Null;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: MemStore P1 P2 *
@@ -4422,7 +4984,7 @@ case OP_FileColumn: {
 ** stack is popped once if P2 is 1.  If P2 is zero, then
 ** the original data remains on the stack.
 */
-case OP_MemStore: {
+CASE(OP_MemStore) {
   int i = pOp->p1;
   int tos = p->tos;
   char *zOld;
@@ -4463,7 +5025,7 @@ case OP_MemStore: {
     aStack[tos].flags = 0;
     POPSTACK;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: MemLoad P1 * *
@@ -4475,7 +5037,7 @@ case OP_MemStore: {
 ** location is subsequently changed (using OP_MemStore) then the
 ** value pushed onto the stack will change too.
 */
-case OP_MemLoad: {
+CASE(OP_MemLoad) {
   int tos = ++p->tos;
   int i = pOp->p1;
   VERIFY( if( NeedStack(p, tos) ) goto no_mem; )
@@ -4486,7 +5048,36 @@ case OP_MemLoad: {
     aStack[tos].flags |= STK_Static;
     aStack[tos].flags &= ~STK_Dyn;
   }
-  break;
+  NEXT_INSTRUCTION;
+}
+
+/* Opcode: MemIncr P1 P2 *
+**
+** Increment the integer valued memory location P1 by 1.  If P2 is
+** not zero and the result after the increment is greater than zero,
+** then jump to P2.
+**
+** This instruction works on the memory location directly and never
+** touches the stack, so a counter can be stepped and tested in a
+** single instruction where a MemLoad, AddImm, MemStore sequence would
+** otherwise be required.  It is used to implement the LIMIT and
+** OFFSET counters of a SELECT and the match flags of a LEFT OUTER
+** JOIN.  The memory location must have previously been loaded with
+** an integer using OP_MemStore.
+*/
+CASE(OP_MemIncr) {
+  int i = pOp->p1;
+  Mem *pMem;
+  VERIFY( if( i<0 || i>=p->nMem ) goto bad_instruction; )
+  pMem = &p->aMem[i];
+  VERIFY( if( (pMem->s.flags & STK_Int)==0 ) goto bad_instruction; )
+  pMem->s.i++;
+  if( pMem->s.flags & STK_Dyn ) sqliteFree(pMem->z);
+  pMem->s.flags = STK_Int;
+  if( pOp->p2>0 && pMem->s.i>0 ){
+     pc = pOp->p2 - 1;
+  }
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: AggReset * P2 *
@@ -4494,11 +5085,11 @@ case OP_MemLoad: {
 ** Reset the aggregator so that it no longer contains any data.
 ** Future aggregator elements will contain P2 values each.
 */
-case OP_AggReset: {
+CASE(OP_AggReset) {
   AggReset(&p->agg);
   p->agg.nMem = pOp->p2;
   p->agg.apFunc = sqliteMalloc( p->agg.nMem*sizeof(p->agg.apFunc[0]) );
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: AggInit * P2 P3
@@ -4507,11 +5098,11 @@ case OP_AggReset: {
 ** The aggregate will operate out of aggregate column P2.
 ** P3 is a pointer to the FuncDef structure for the function.
 */
-case OP_AggInit: {
+CASE(OP_AggInit) {
   int i = pOp->p2;
   VERIFY( if( i<0 || i>=p->agg.nMem ) goto bad_instruction; )
   p->agg.apFunc[i] = (FuncDef*)pOp->p3;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: AggFunc * P2 P3
@@ -4525,7 +5116,7 @@ case OP_AggInit: {
 ** Ideally, this index would be another parameter, but there are
 ** no free parameters left.  The integer is popped from the stack.
 */
-case OP_AggFunc: {
+CASE(OP_AggFunc) {
   int n = pOp->p2;
   int i;
   Mem *pMem;
@@ -4557,7 +5148,7 @@ case OP_AggFunc: {
   if( ctx.isError ){
     rc = SQLITE_ERROR;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: AggFocus * P2 *
@@ -4574,7 +5165,7 @@ case OP_AggFunc: {
 ** zero or more AggNext operations.  You must not execute an AggFocus
 ** in between an AggNext and an AggReset.
 */
-case OP_AggFocus: {
+CASE(OP_AggFocus) {
   int tos = p->tos;
   AggElem *pElem;
   char *zKey;
@@ -4593,7 +5184,7 @@ case OP_AggFocus: {
     if( sqlite_malloc_failed ) goto no_mem;
   }
   POPSTACK;
-  break; 
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: AggSet * P2 *
@@ -4601,7 +5192,7 @@ case OP_AggFocus: {
 ** Move the top of the stack into the P2-th field of the current
 ** aggregate.  String values are duplicated into new memory.
 */
-case OP_AggSet: {
+CASE(OP_AggSet) {
   AggElem *pFocus = AggInFocus(p->agg);
   int i = pOp->p2;
   int tos = p->tos;
@@ -4628,7 +5219,7 @@ case OP_AggSet: {
     if( zOld ) sqliteFree(zOld);
   }
   POPSTACK;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: AggGet * P2 *
@@ -4637,7 +5228,7 @@ case OP_AggSet: {
 ** of the current aggregate.  Strings are not duplicated so
 ** string values will be ephemeral.
 */
-case OP_AggGet: {
+CASE(OP_AggGet) {
   AggElem *pFocus = AggInFocus(p->agg);
   int i = pOp->p2;
   int tos = ++p->tos;
@@ -4649,7 +5240,7 @@ case OP_AggGet: {
     zStack[tos] = pMem->z;
     aStack[tos].flags &= ~STK_Dyn;
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: AggNext * P2 *
@@ -4664,7 +5255,7 @@ case OP_AggGet: {
 ** zero or more AggNext operations.  You must not execute an AggFocus
 ** in between an AggNext and an AggReset.
 */
-case OP_AggNext: {
+CASE(OP_AggNext) {
   if( p->agg.pSearch==0 ){
     p->agg.pSearch = sqliteHashFirst(&p->agg.hash);
   }else{
@@ -4703,7 +5294,7 @@ case OP_AggNext: {
       nErr += ctx.isError;
     }
   }
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: SetInsert P1 * P3
@@ -4712,7 +5303,7 @@ case OP_AggNext: {
 ** P3 into that set.  If P3 is NULL, then insert the top of the
 ** stack into the set.
 */
-case OP_SetInsert: {
+CASE(OP_SetInsert) {
   int i = pOp->p1;
   if( p->nSet<=i ){
     int k;
@@ -4734,7 +5325,7 @@ case OP_SetInsert: {
     POPSTACK;
   }
   if( sqlite_malloc_failed ) goto no_mem;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: SetFound P1 P2 *
@@ -4743,7 +5334,7 @@ case OP_SetInsert: {
 ** contents of set P1.  If the element popped exists in set P1,
 ** then jump to P2.  Otherwise fall through.
 */
-case OP_SetFound: {
+CASE(OP_SetFound) {
   int i = pOp->p1;
   int tos = p->tos;
   VERIFY( if( tos<0 ) goto not_enough_stack; )
@@ -4753,7 +5344,7 @@ case OP_SetFound: {
     pc = pOp->p2 - 1;
   }
   POPSTACK;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: SetNotFound P1 P2 *
@@ -4762,7 +5353,7 @@ case OP_SetFound: {
 ** contents of set P1.  If the element popped does not exists in 
 ** set P1, then jump to P2.  Otherwise fall through.
 */
-case OP_SetNotFound: {
+CASE(OP_SetNotFound) {
   int i = pOp->p1;
   int tos = p->tos;
   VERIFY( if( tos<0 ) goto not_enough_stack; )
@@ -4772,7 +5363,7 @@ case OP_SetNotFound: {
     pc = pOp->p2 - 1;
   }
   POPSTACK;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* Opcode: SetFirst P1 P2 *
@@ -4787,8 +5378,8 @@ case OP_SetNotFound: {
 ** are no more elements in the set, do not do the push and fall through.
 ** Otherwise, jump to P2 after pushing the next set element.
 */
-case OP_SetFirst: 
-case OP_SetNext: {
+CASE(OP_SetFirst) 
+CASE(OP_SetNext) {
   Set *pSet;
   int tos;
   VERIFY( if( pOp->p1<0 || pOp->p1>=p->nSet ) goto bad_instruction; )
@@ -4813,11 +5404,14 @@ case OP_SetNext: {
   zStack[tos] = sqliteHashKey(pSet->prev);
   aStack[tos].n = sqliteHashKeysize(pSet->prev);
   aStack[tos].flags = STK_Str | STK_Static;
-  break;
+  NEXT_INSTRUCTION;
 }
 
 /* An other opcode is illegal...
 */
+#ifdef VDBE_THREADED_DISPATCH
+L_default:
+#endif
 default: {
   sprintf(zBuf,"%d",pOp->opcode);
   sqliteSetString(pzErrMsg, "unknown opcode ", zBuf, 0);
@@ -4833,6 +5427,19 @@ default: {
 *****************************************************************************/
     }
 
+    /* Charge the time and the page requests used by the instruction
+    ** that just finished to that instruction.
+    */
+    if( p->aProfile ){
+      OpProfile *pProf = &p->aProfile[pcStart];
+      int nFetch, nMiss;
+      pProf->nTicks += (double)(profileTime() - tStart);
+      profilePageCounts(p, &nFetch, &nMiss);
+      pProf->nExec++;
+      pProf->nFetch += nFetch - nFetchStart;
+      pProf->nMiss += nMiss - nMissStart;
+    }
+
     /* The following code adds nothing to the actual functionality
     ** of the program.  It is only here for testing and debugging.
     ** On the other hand, it does burn CPU cycles every time through
@@ -4910,7 +5517,9 @@ cleanup:
       }
       default: {
         if( undoTransOnError ){
-          sqliteBtreeCommit(pBt);
+          if( sqliteBtreeCommit(pBt)==SQLITE_BUSY ){
+            sqliteBtreeRollback(pBt);
+          }
           if( db->pBeTemp ) sqliteBtreeCommit(db->pBeTemp);
           db->flags &= ~SQLITE_InTrans;
           db->onError = OE_Default;
@@ -528,13 +528,13 @@ WhereInfo *sqliteWhereBegin(
     WhereLevel *pLevel = &pWInfo->a[i];
 
     /* If this is the right table of a LEFT OUTER JOIN, allocate and
-    ** initialize a memory cell that record if this table matches any
-    ** row of the left table of the join.
+    ** initialize a memory cell that counts the rows of this table that
+    ** match the current row of the left table of the join.
     */
     if( i>0 && (pTabList->a[i-1].jointype & JT_LEFT)!=0 ){
       if( !pParse->nMem ) pParse->nMem++;
       pLevel->iLeftJoin = pParse->nMem++;
-      sqliteVdbeAddOp(v, OP_String, 0, 0);
+      sqliteVdbeAddOp(v, OP_Integer, 0, 0);
       sqliteVdbeAddOp(v, OP_MemStore, pLevel->iLeftJoin, 1);
     }
 
@@ -904,9 +904,7 @@ WhereInfo *sqliteWhereBegin(
     ** at least one row of the right table has matched the left table.  
     */
     if( pLevel->iLeftJoin ){
-      pLevel->top = sqliteVdbeCurrentAddr(v);
-      sqliteVdbeAddOp(v, OP_Integer, 1, 0);
-      sqliteVdbeAddOp(v, OP_MemStore, pLevel->iLeftJoin, 1);
+      pLevel->top = sqliteVdbeAddOp(v, OP_MemIncr, pLevel->iLeftJoin, 0);
     }
   }
   pWInfo->iContinue = cont;
@@ -941,7 +939,7 @@ void sqliteWhereEnd(WhereInfo *pWInfo){
     if( pLevel->iLeftJoin ){
       int addr;
       addr = sqliteVdbeAddOp(v, OP_MemLoad, pLevel->iLeftJoin, 0);
-      sqliteVdbeAddOp(v, OP_NotNull, 0, addr+4);
+      sqliteVdbeAddOp(v, OP_If, 0, addr+4);
       sqliteVdbeAddOp(v, OP_NullRow, base+i, 0);
       sqliteVdbeAddOp(v, OP_Goto, 0, pLevel->top);
     }
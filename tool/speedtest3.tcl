@@ -0,0 +1,128 @@
+#!/usr/bin/tclsh
+#
+# Run this script using TCLSH to compare the speed of the virtual machine
+# when it uses switch dispatch and when it uses computed-goto (threaded)
+# dispatch.  Build the "sqlite" shell twice, once configured normally and
+# once with --enable-threaded-dispatch, and give both to this script:
+#
+#      tclsh speedtest3.tcl ./sqlite-switch ./sqlite-threaded
+#
+# The workloads are chosen so that most of the time is spent in the
+# virtual machine rather than in the disk I/O:  inserts in a single
+# transaction and full table scans with and without a WHERE clause.
+# Each test is run several times with each shell and the best time
+# is reported.
+#
+if {[llength $argv]!=2} {
+  puts stderr "Usage: $argv0 SWITCH-SHELL THREADED-SHELL"
+  exit 1
+}
+set shell(switch) [lindex $argv 0]
+set shell(threaded) [lindex $argv 1]
+set nrep 3
+
+# Run a test.  Print the best of $nrep times for each shell and the
+# speedup of threaded dispatch over switch dispatch.
+#
+set cnt 1
+proc runtest {title {setup {}}} {
+  global cnt shell nrep
+  set sqlfile test$cnt.sql
+  incr cnt
+  foreach mode {switch threaded} {
+    set best {}
+    for {set i 0} {$i<$nrep} {incr i} {
+      if {$setup!=""} {
+        catch {exec /bin/sh -c {rm -f sd.db sd.db-journal}}
+        exec $shell($mode) sd.db <$setup
+      }
+      set t [time "exec $shell($mode) sd.db <$sqlfile" 1]
+      set t [expr {[lindex $t 0]/1000000.0}]
+      if {$best=="" || $t<$best} {set best $t}
+    }
+    set tm($mode) $best
+  }
+  if {$tm(threaded)>0} {
+    set ratio [expr {$tm(switch)/$tm(threaded)}]
+  } else {
+    set ratio 0
+  }
+  puts [format {%-40s %8.3f %8.3f %6.2fx} $title \
+           $tm(switch) $tm(threaded) $ratio]
+}
+
+# Initialize the environment
+#
+expr srand(1)
+catch {exec /bin/sh -c {rm -f sd.db sd.db-journal}}
+puts [format {%-40s %8s %8s %7s} Test switch threaded speedup]
+
+# Scripts used to set up a fresh database before a test.
+#
+set fd [open clear.sql w]
+puts $fd "PRAGMA default_synchronous=off;"
+close $fd
+set fd [open init.sql w]
+puts $fd "PRAGMA default_synchronous=off;"
+puts $fd "BEGIN;"
+puts $fd "CREATE TABLE t1(a INTEGER, b INTEGER, c VARCHAR(100));"
+for {set i 1} {$i<=50000} {incr i} {
+  set r [expr {int(rand()*500000)}]
+  puts $fd "INSERT INTO t1 VALUES($i,$r,'row $r of t1');"
+}
+puts $fd "COMMIT;"
+close $fd
+
+set fd [open test$cnt.sql w]
+puts $fd "PRAGMA default_synchronous=off;"
+puts $fd "BEGIN;"
+puts $fd "CREATE TABLE t2(a INTEGER, b INTEGER, c VARCHAR(100));"
+for {set i 1} {$i<=25000} {incr i} {
+  set r [expr {int(rand()*500000)}]
+  puts $fd "INSERT INTO t2 VALUES($i,$r,'row $r of t2');"
+}
+puts $fd "COMMIT;"
+close $fd
+runtest {25000 INSERTs in a transaction} clear.sql
+
+set fd [open test$cnt.sql w]
+puts $fd "BEGIN;"
+puts $fd "INSERT INTO t1 SELECT a+50000, b, c FROM t1;"
+puts $fd "COMMIT;"
+close $fd
+runtest {INSERT INTO ... SELECT of 50000 rows} init.sql
+
+catch {exec /bin/sh -c {rm -f sd.db sd.db-journal}}
+exec $shell(switch) sd.db <init.sql
+
+set fd [open test$cnt.sql w]
+for {set i 0} {$i<20} {incr i} {
+  puts $fd "SELECT count(*) FROM t1;"
+}
+close $fd
+runtest {20 full scans with count(*)}
+
+set fd [open test$cnt.sql w]
+for {set i 0} {$i<20} {incr i} {
+  set lwr [expr {$i*10000}]
+  set upr [expr {($i+10)*10000}]
+  puts $fd "SELECT count(*), avg(b) FROM t1 WHERE b>=$lwr AND b<$upr;"
+}
+close $fd
+runtest {20 scans with a range WHERE clause}
+
+set fd [open test$cnt.sql w]
+for {set i 0} {$i<20} {incr i} {
+  puts $fd "SELECT sum(a+b), max(b-a) FROM t1 WHERE a%7=$i%7;"
+}
+close $fd
+runtest {20 scans with arithmetic}
+
+set fd [open test$cnt.sql w]
+for {set i 0} {$i<10} {incr i} {
+  puts $fd "SELECT c FROM t1 WHERE b<1000 ORDER BY b;"
+}
+close $fd
+runtest {10 scans with ORDER BY}
+
+catch {exec /bin/sh -c {rm -f sd.db sd.db-journal}}
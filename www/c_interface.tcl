@@ -74,6 +74,20 @@ additional temporary files may be created during the execution of
 an SQL command in order to store the database rollback journal or
 temporary and intermediate results of a query.</p>
 
+<p>Temporary tables and the intermediate results of a query are held in
+memory at first.  A temporary file is only created for them when they
+grow larger than their page cache, so small sorts, unions and temporary
+tables never touch the disk.</p>
+
+<p>If the database name is <b>":memory:"</b>, no file is opened.  The
+database is created empty and held entirely in memory.  Its pages are
+never written anywhere, however large it grows, and transactions are
+rolled back from copies of the original pages that are also kept in
+memory.  Each call to <b>sqlite_open(":memory:",...)</b> creates a new,
+separate database, which is destroyed when it is closed.  The journal
+mode of such a database is always <b>memory</b> and its locking mode is
+always <b>exclusive</b>.</p>
+
 <p>The return value of the <b>sqlite_open()</b> function is a
 pointer to an opaque <b>sqlite</b> structure.  This pointer will
 be the first argument to all subsequent SQLite function calls that
@@ -187,6 +201,7 @@ the type of error.  Here is a complete list of the return codes:
 #define SQLITE_CONSTRAINT  19   /* Abort due to contraint violation */
 #define SQLITE_MISMATCH    20   /* Data type mismatch */
 #define SQLITE_MISUSE      21   /* Library used incorrectly */
+#define SQLITE_CHANGED     22   /* Database changed too often to back up */
 </pre></blockquote>
 
 <p>
@@ -220,8 +235,15 @@ file are such that the file cannot be opened.
 <dd><p>This return code indicates that another program or thread has
 the database locked.  SQLite allows two or more threads to read the
 database at the same time, but only one thread can have the database
-open for writing at the same time.  Locking in SQLite is on the
-entire database.</p>
+open for writing at the same time.  Readers can go on reading while a
+write transaction is underway, until the writer is ready to change the
+database file, normally when it commits.  The commit then waits for
+the readers to finish, calling the busy handler.  If a COMMIT still
+finds readers when the busy handler gives up, it returns SQLITE_BUSY
+and the transaction stays open, so the COMMIT can be tried again
+later.  A statement outside of a BEGIN...COMMIT block that cannot
+commit is rolled back instead.  Locking in SQLite is on the entire
+database.</p>
 </p></dd>
 <dt>SQLITE_LOCKED</dt>
 <dd><p>This return code is similar to SQLITE_BUSY in that it indicates
@@ -302,6 +324,10 @@ is used incorrectly.  Examples of incorrect usage include calling
 <b>sqlite_close()</b> or calling <b>sqlite_exec()</b> with the same
 database pointer simultaneously from two separate threads.
 </p></dd>
+<dt>SQLITE_CHANGED</dt>
+<dd><p>An online backup started over too many times because the
+database it was copying kept being changed by other processes.
+</p></dd>
 </dl>
 </blockquote>
 
@@ -378,6 +404,28 @@ int sqlite_get_table_vprintf(
   va_list
 );
 
+sqlite *sqlite_open_vfs(const char *dbname, int mode,
+                        const char *zVfs, char **errmsg);
+
+int sqlite_vfs_register(sqlite_vfs*, int makeDefault);
+
+int sqlite_vfs_unregister(sqlite_vfs*);
+
+sqlite_vfs *sqlite_vfs_find(const char *zName);
+
+int sqlite_enable_shared_cache(int enable);
+
+sqlite_backup *sqlite_backup_init(sqlite*, const char *zFilename,
+                                  char **errmsg);
+
+int sqlite_backup_step(sqlite_backup*, int nPage);
+
+int sqlite_backup_remaining(sqlite_backup*);
+
+int sqlite_backup_pagecount(sqlite_backup*);
+
+int sqlite_backup_finish(sqlite_backup*);
+
 </pre></blockquote>
 
 <p>All of the above definitions are included in the "sqlite.h"
@@ -587,7 +635,16 @@ an open SQLite database and the second argument is a number of milliseconds.
 After <b>sqlite_busy_timeout()</b> has been executed, the SQLite library
 will wait for the lock to clear for at least the number of milliseconds 
 specified before it returns SQLITE_BUSY.  Specifying zero milliseconds for
-the timeout restores the default behavior.</p>
+the timeout restores the default behavior.  Rather than sleeping on a
+fixed schedule, SQLite waits on the lock itself and goes ahead as soon as
+it is released.  A lock held by another thread of the same process is
+noticed at once.  A lock held by another process is checked for after
+1, 2 and 4 milliseconds and then every 4 milliseconds, so it is taken
+within about 4 milliseconds of being released, plus whatever delay the
+operating system adds in waking the thread.  On Windows a sleep lasts
+at least one tick of the system timer, which is often 15.6
+milliseconds, and that is then the bound.  (Calling <b>sqlite_busy_handler()</b> turns these lock
+waits off again.)</p>
 
 <h2>Using the <tt>_printf()</tt> wrapper functions</h2>
 
@@ -770,6 +827,129 @@ new SQL functions, review the SQLite source code in the file
 <b>func.c</b>.
 </p>
 
+<h2>Replacing the file I/O layer</h2>
+
+<p>SQLite does all of its file I/O, file locking, sleeping and random
+number seeding through a table of function pointers called a
+<b>VFS</b> (for "virtual file system").  The library comes with a
+single VFS, named "unix" or "win32", that calls the operating system
+directly.  A program can supply its own VFS to, for example, keep
+databases in memory, count or delay I/O operations for benchmarking,
+or store databases somewhere other than in ordinary files.</p>
+
+<p>A VFS is an instance of the <b>sqlite_vfs</b> structure defined in
+"sqlite.h".  The comments in that header describe what each method
+must do.  The methods that open a file return an opaque handle of the
+implementation's own choosing, and SQLite hands that handle back to
+the per-file methods.  Register the VFS with
+<b>sqlite_vfs_register()</b>.  If the second argument is true, the new
+VFS becomes the default and is used by <b>sqlite_open()</b>.  Otherwise
+it is only used by databases opened with <b>sqlite_open_vfs()</b> and
+the name of the VFS as the third argument.  The rollback journal and
+all temporary files of such a database go through the same VFS.</p>
+
+<p><b>sqlite_vfs_find()</b> returns the registered VFS of a given
+name, or the default VFS if the name is NULL.  A VFS that wraps
+another one, such as one that counts calls, can use it to locate the
+VFS it passes calls on to.  <b>sqlite_vfs_unregister()</b> removes a
+VFS from the list.  A VFS must not be unregistered while a database
+is using it.  VFSes should be registered and unregistered before other
+threads start using SQLite.</p>
+
+<h2>Sharing the page cache between connections</h2>
+
+<p>Each connection normally keeps its own cache of database pages, so a
+program that opens the same database many times caches the same pages
+many times over.  After a call to
+<b>sqlite_enable_shared_cache(1)</b>, a database that is opened while
+another connection in the same process has the same file open (through
+the same VFS) shares that connection's page cache.  Files are matched by
+device and inode number, so two different names for one file still
+share.  Connections that were opened before the call are not affected,
+and <b>sqlite_enable_shared_cache(0)</b> turns sharing off again for
+databases opened later.</p>
+
+<p>Connections that share a cache lock tables rather than the whole
+file.  Only one of them may have a transaction open at a time.  The
+others can keep reading while it is open, but any table the writer has
+changed cannot be read until the writer commits or rolls back.  A
+request that needs a table lock that is not available fails with
+SQLITE_LOCKED, not SQLITE_BUSY, and the busy handler is not called.
+When the library is built with THREADSAFE=1, connections that share a
+cache may be used by different threads.  Each connection must still be
+used by only one thread at a time.</p>
+
+<p>Some settings belong to the shared cache and not to the connection:
+the cache size, the synchronous setting, the journal mode, the locking
+mode, the group commit size and the busy timeout.  Changing one of these
+through any connection that shares the cache changes it for every
+connection sharing it, and the last change made is the one that holds.  A connection that needs
+settings of its own should be opened while sharing is turned off.</p>
+
+<p>A connection that runs "PRAGMA read_snapshot=ON" is not held up by
+the writer.  Before the writer changes a page for the first time in a
+transaction, a copy of the committed page is kept for such readers.
+Their queries read those copies and so see each table as it was at the
+last commit, and the writer may change tables that they are reading.
+The copies are freed when the last query that can use them finishes.</p>
+
+<p>A program that wants many threads to read one database while another
+thread writes it gives each thread a connection of its own, opened with
+the shared cache turned on, and turns on read_snapshot in the reading
+connections.  The threads then share one copy of the pages, and none of
+the readers waits for the writer's locks.  Each connection still parses
+the schema for itself, and one connection still cannot be used by two
+threads at the same time.  The connections take turns inside the B-tree
+layer, so readers do not run in parallel on several processors.  The
+"threadtest -snapshot" program in the source tree runs this setup.</p>
+
+<h2>Copying a database while it is in use</h2>
+
+<p>The backup routines make a copy of a database in another file
+without keeping other users of the database waiting for the whole copy.
+<b>sqlite_backup_init()</b> opens the file that will hold the copy.
+Each call to <b>sqlite_backup_step()</b> then copies the given number of
+pages, or all of them if the number is negative, and releases the lock
+on the database before it returns.  It returns SQLITE_OK while there is
+more to copy and SQLITE_DONE when the copy is complete.  It returns
+SQLITE_BUSY, without copying anything, when either file is locked or
+the connection is in the middle of a transaction.  The step can be
+tried again later.
+<b>sqlite_backup_remaining()</b> and <b>sqlite_backup_pagecount()</b>
+report how far the copy has got, and <b>sqlite_backup_finish()</b>
+frees the backup.  An in-memory database can be saved to a file
+this way.</p>
+
+<p>Pages that the connection changes after they have been copied, or
+that another connection sharing its cache changes, are copied again by
+a later step.  If some other process changes the database between two
+steps, the copy starts again from the first page.  Either way what
+ends up in the file is the database as it was at the last step.  A
+database that is changed faster than it can be copied would keep the
+copy starting over, so after 100 restarts the backup ends with the
+error SQLITE_CHANGED.</p>
+
+<p>The copy is written in one write transaction that begins at the
+first step and commits at the last.  Until then the old contents of the
+file are left alone, and they are kept if the backup is finished early.
+No other connection can write the file while the backup is under way.
+The journal holds every page of the old contents that is overwritten,
+so it can grow to the size of the file as it was before the backup.
+If a reader of the file keeps the final commit from going through, the
+step returns SQLITE_BUSY with the copy intact and the next step only
+tries the commit again.</p>
+
+<blockquote><pre>
+sqlite_backup *p = sqlite_backup_init(db, "backup.db", &amp;zErrMsg);
+if( p ){
+  do{
+    rc = sqlite_backup_step(p, 100);
+    if( rc==SQLITE_OK || rc==SQLITE_BUSY ) sleep(1);
+  }while( rc==SQLITE_OK || rc==SQLITE_BUSY );
+  sqlite_backup_finish(p);
+}
+</pre></blockquote>
+
 <h2>Usage Examples</h2>
 
 <p>For examples of how the SQLite C/C++ interface can be used,
@@ -226,6 +226,19 @@ faq {
   to use the same <b>sqlite</b> structure pointer simultaneously in two
   or more threads.</p>
 
+  <p>In a threadsafe build, connections do not wait for one another
+  unless they are using the same database file.  Locks on a database
+  file are tracked per file, so threads working on different files
+  never wait on a common lock.  The one process-wide mutex is only held
+  briefly when a database is opened or closed, a VFS is registered or
+  random numbers are made.  Threads that use the same file wait only
+  for the file lock itself.  A connection may be passed from one thread
+  to another between calls, but connections that share a page cache
+  (see <b>sqlite_enable_shared_cache()</b>) must all be used from the
+  same thread.  The <b>threadtest</b> program in the source tree
+  checks all of this under load and measures how throughput grows
+  with the number of threads.</p>
+
   <p>Note that if two or more threads have the same database open and one
   thread creates a new table or index, the other threads might
   not be able to see the new table right away.  You might have to
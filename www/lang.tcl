@@ -145,6 +145,13 @@ clause for additional information about the ROLLBACK
 conflict resolution algorithm.
 </p>
 
+<p>
+A COMMIT has to wait until other connections have stopped reading
+the database.  If they are still reading when the busy handler gives
+up, the COMMIT fails with SQLITE_BUSY but the transaction stays in
+effect, and the COMMIT can be run again later.
+</p>
+
 <p>
 The optional ON CONFLICT clause at the end of a BEGIN statement
 can be used to changed the default conflict resolution algorithm.
@@ -306,8 +313,9 @@ PRIMARY KEY.</p>
 and "TABLE" then the table that is created is only visible to the
 process that opened the database and is automatically deleted when
 the database is closed.  Any indices created on a temporary table
-are also temporary.  Temporary tables and indices are stored in a
-separate file distinct from the main database file.</p>
+are also temporary.  Temporary tables and indices are stored
+separately from the main database file, in memory until they grow too
+large and then in a temporary file.</p>
 
 <p>The optional conflict-clause following each constraint
 allows the specification of an alternative default
@@ -578,7 +586,7 @@ But no actual data is modified.</p>}
 Section EXPLAIN explain
 
 Syntax {sql-statement} {
-EXPLAIN <sql-statement>
+EXPLAIN [ANALYZE] <sql-statement>
 }
 
 puts {
@@ -593,6 +601,17 @@ used to execute the command had the EXPLAIN keyword not been present.
 For additional information about virtual machine instructions see
 the <a href="arch.html">architecture description</a> or the documentation
 on <a href="opcode.html">available opcodes</a> for the virtual machine.</p>
+
+<p>EXPLAIN ANALYZE is different:  the command really is executed, though
+any rows it returns are discarded.  Then the virtual machine instructions
+are listed as for EXPLAIN, with four extra columns added.  The "count"
+column is the number of times the instruction ran.  "ticks" is the total
+time spent in the instruction, in CPU cycles where the processor has a
+cycle counter or in clock() units otherwise.  "fetch" is the number of
+database pages the instruction requested and "miss" is how many of those
+pages were not already in the page cache and had to be read from disk.
+These numbers make it easy to find the part of a slow query where the
+time is going.</p>
 }
 
 Section expression expr
@@ -1044,6 +1063,10 @@ with caution.</p>
     the mode stays as set even if the database is closed and reopened.  The
     <b>synchronous</b> pragma does the same thing but only applies the setting
     to the current session.</p>
+    <p>Only on or off is remembered in the database file.  The levels
+    NORMAL, FULL and DATA described under the <b>synchronous</b> pragma
+    may also be given here.  They apply to the current session and are
+    remembered as ON, which is the same as NORMAL.</p>
 
 <li><p><b>PRAGMA empty_result_callbacks = ON;
        <br>PRAGMA empty_result_callbacks = OFF;</b></p>
@@ -1062,6 +1085,29 @@ with caution.</p>
     is used.  But when full_column_names is turned on, column names are
     always reported as "TABLE.COLUMN" even for simple queries.</p></li>
 
+<li><p><b>PRAGMA group_commit;
+       <br>PRAGMA group_commit = </b><i>Number-of-statements</i><b>;</b></p>
+    <p>Query or change the largest number of statements that are synced
+    to disk together.  This only has an effect on connections that share
+    their page cache (see <b>sqlite_enable_shared_cache()</b>), and it is
+    set for all of the connections that share it.  When it is more than
+    1, statements that these connections run outside of a BEGIN...COMMIT
+    block, from different threads, make up one transaction on disk, so the
+    journal and database files are synced once for the whole group.  A
+    statement that fails only undoes its own changes.</p>
+    <p>A statement does not return until its group has been synced, so
+    a statement that has returned is never lost in a crash.  The group is
+    synced as soon as it is full, or as large as the group before it,
+    with no other statement waiting to join it, and after at most 10
+    milliseconds otherwise.  A connection used on its own never waits.
+    The default, 0, turns group commit off.  This setting is not stored
+    in the database file.</p>
+    <p>Group commit across processes is not done.  Connections in
+    different processes, and connections in the same process that do not
+    share the cache, each commit alone and pay for their own syncs, as
+    before.  Only one of them can hold the write lock on the file at a
+    time, so there is nothing for them to share a transaction with.</p></li>
+
 <li><p><b>PRAGMA index_info(</b><i>index-name</i><b>);</b></p>
     <p>For each column that the named index references, invoke the 
     callback function
@@ -1074,6 +1120,66 @@ with caution.</p>
     index name and a flag to indicate whether or not the index must be
     unique.</p>
 
+<li><p><b>PRAGMA journal_mode;
+       <br>PRAGMA journal_mode = 'delete';
+       <br>PRAGMA journal_mode = PERSIST;
+       <br>PRAGMA journal_mode = TRUNCATE;
+       <br>PRAGMA journal_mode = MEMORY;</b></p>
+    <p>Query or change the way the rollback journal of the main database
+    is managed for the current database connection.  In the default
+    <b>delete</b> mode, a new journal file is created at the start of each
+    transaction and deleted when the transaction ends.  (DELETE is a
+    keyword, so the name must be quoted.)  In <b>persist</b> mode the journal
+    file is kept and its header is overwritten with zeros at the end of
+    a transaction.  In <b>truncate</b> mode the journal file is kept and
+    truncated to zero length.  Both avoid creating and deleting a file
+    for every transaction.  In <b>memory</b> mode the journal is held in
+    memory and no journal file is written at all.  ROLLBACK still works,
+    but if the program or the operating system crashes in the middle of
+    a COMMIT, or while a large transaction is spilling changes to the
+    database file, the database can be left corrupt.</p>
+    <p>The journal mode cannot be changed in the middle of a transaction.
+    It reverts to <b>delete</b> when the database is closed and
+    reopened.  It applies to the main database only.  The database that
+    holds TEMP tables is not affected.  Its journal is kept in memory
+    until it gets too big for the cache, and since the whole database
+    goes away when the connection is closed, a crash cannot leave it
+    corrupt.</p></li>
+
+<li><p><b>PRAGMA locking_mode;
+       <br>PRAGMA locking_mode = NORMAL;
+       <br>PRAGMA locking_mode = EXCLUSIVE;</b></p>
+    <p>Query or change how long the current database connection keeps
+    its lock on the main database file.  In <b>normal</b> mode, the
+    default, the lock is taken at the start of each statement and
+    released at its end, unless a transaction is open, and the pages
+    cached during the statement are discarded.  In <b>exclusive</b> mode
+    a lock, once taken, is held until the database is closed.  The
+    connection then skips the locking calls of each statement and keeps
+    its page cache from one statement to the next.  Other connections
+    can read the database until this connection first changes it, but
+    they can never change it themselves.  This suits a program that is
+    the only user of its database.</p>
+    <p>Setting the mode back to <b>normal</b> releases the lock once no
+    statement is using the database.  The locking mode reverts to
+    <b>normal</b> when the database is closed and reopened.</p></li>
+
+<li><p><b>PRAGMA read_snapshot;
+       <br>PRAGMA read_snapshot = ON;
+       <br>PRAGMA read_snapshot = OFF;</b></p>
+    <p>Query or change whether queries on the main database read the
+    last committed version of each table.  This only matters when the
+    page cache is shared with other connections (see
+    <b>sqlite_enable_shared_cache()</b> in the C interface).  Normally a
+    connection cannot read a table that another connection sharing the
+    cache has changed in its open transaction, and the other connection
+    cannot change a table that this one is reading.  With
+    <b>read_snapshot</b> on, neither waits for the other.  Each query
+    sees the tables as they were when it started, and changes that are
+    committed while it runs are not seen until the next query.  The
+    setting reverts to <b>off</b> when the database is closed and
+    reopened.</p></li>
+
 <li><p><b>PRAGMA parser_trace = ON;<br>PRAGMA parser_trace = OFF;</b></p>
     <p>Turn tracing of the SQL parser inside of the
     SQLite library on and off.  This is used for debugging.
@@ -1088,13 +1194,37 @@ with caution.</p>
     returned.</p>
 
 <li><p><b>PRAGMA synchronous;
-       <br>PRAGMA synchronous = ON;
-       <br>PRAGMA synchronous = OFF;</b></p>
+       <br>PRAGMA synchronous = OFF; <i>(0)</i>
+       <br>PRAGMA synchronous = NORMAL; <i>(1)</i>
+       <br>PRAGMA synchronous = FULL; <i>(2)</i>
+       <br>PRAGMA synchronous = DATA; <i>(3)</i></b></p>
     <p>Query or change the setting of the "synchronous" flag in
     the database for the duration of the current database connect.
     The synchronous flag reverts to its default value when the database
     is closed and reopened.  For additional information on the synchronous
     flag, see the description of the <b>default_synchronous</b> pragma.</p>
+    <p>The flag is reported as the number of one of the following levels.
+    Every level keeps the database safe if the application crashes.  They
+    differ in what survives an operating system crash or a power failure.
+    ON is the same as NORMAL.</p>
+    <ul>
+    <li><b>OFF</b> never waits for the disk.  A power failure during a
+    COMMIT, or shortly after one, can corrupt the database.</li>
+    <li><b>NORMAL</b>, the default, syncs the rollback journal before the
+    database file is changed and syncs the database file before the
+    journal is removed.  After a power failure each transaction is either
+    fully committed or fully rolled back, provided the file system does
+    not lose the newly created journal file itself.</li>
+    <li><b>FULL</b> does everything NORMAL does and also syncs the
+    directory after the journal is created and after it is deleted, so
+    that a transaction is durable once COMMIT returns.  With
+    <b>journal_mode</b> PERSIST, the journal is synced once more so that
+    its header never claims records that are not yet on disk.</li>
+    <li><b>DATA</b> syncs at the same points as NORMAL but uses
+    <b>fdatasync()</b> where the operating system has it.  The contents
+    of the files are as safe as with NORMAL; only details such as the
+    modification time of the files might be lost.</li>
+    </ul>
     </li>
 
 <li><p><b>PRAGMA table_info(</b><i>table-name</i><b>);</b></p>
@@ -135,6 +135,7 @@ at any time.  For example:
 
 Code {
 sqlite> (((.help)))
+.backup FILENAME       Copy the database into FILENAME
 .dump                  Dump database in a text format
 .exit                  Exit this program
 .explain               Set output mode suitable for EXPLAIN
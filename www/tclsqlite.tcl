@@ -48,13 +48,21 @@ The name of the database is just the name of a disk file in which
 the database is stored.
 </p>
 
+<p>
+Two more arguments may follow the database name.  The first is the
+file mode, which is currently ignored.  The second is the name of a
+registered VFS through which all I/O for the database is done.  See
+the description of sqlite_open_vfs() in the C interface documentation.
+</p>
+
 <p>
 Once an SQLite database is open, it can be controlled using 
-methods of the <i>dbcmd</i>.  There are currently 7 methods
+methods of the <i>dbcmd</i>.  There are currently 8 methods
 defined:</p>
 
 <p>
 <ul>
+<li> backup
 <li> busy
 <li> changes
 <li> close
@@ -255,6 +263,26 @@ of the most recently inserted database row.</p>
 in the database that were inserted, deleted, and/or modified by the most
 recent "eval" method.</p>
 
+<h2>The "backup" method</h2>
+
+<p>The "backup" method copies the database into another file while it
+stays open for use.  It takes the name of that file and, optionally, the
+number of pages to copy in each step and a script:</p>
+
+<blockquote>
+<b>db1 backup backup.db 100 {progress}</b>
+</blockquote>
+
+<p>If the number of pages is left out, or is negative, everything is
+copied in one step.  After each step that leaves pages to copy, and
+whenever a step finds a file locked, the script is run with two
+arguments appended: the number of pages still to copy and the number of
+pages in the database.  The script can do other work, or change the
+database, before the next step.  If it returns with "break" the backup
+is abandoned and the file keeps its old contents.  Without a script a
+locked file is an error.  The method returns the number of steps
+taken.</p>
+
 }
 
 puts {